@@ -0,0 +1,162 @@
+/* converts magiclantern.sym ("address name" per line) into the binary
+ * symbol table loaded by module.c (see src/module_symbols.h), so the camera
+ * doesn't have to parse the text and hash every symbol at startup.
+ *
+ * usage: sym2bin magiclantern.sym 5D3_123.syb
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "module_symbols.h"
+#include "crc32.h"
+
+/* must match elf_hash in tcc/tccelf.c */
+static unsigned long elf_hash(const unsigned char *name)
+{
+    unsigned long h = 0, g;
+
+    while (*name) {
+        h = (h << 4) + *name++;
+        g = h & 0xf0000000;
+        if (g)
+            h ^= g >> 24;
+        h &= ~g;
+    }
+    return h;
+}
+
+static int find_symbol(module_symbol_t *syms, int *hash, const char *strtab, const char *name)
+{
+    uint32_t nbuckets = hash[0];
+    int index = hash[2 + elf_hash((const unsigned char *)name) % nbuckets];
+
+    while(index)
+    {
+        if(!strcmp(strtab + syms[index].name, name))
+        {
+            return index;
+        }
+        index = hash[2 + nbuckets + index];
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc != 3)
+    {
+        printf("Usage: %s magiclantern.sym output.syb\n", argv[0]);
+        return -1;
+    }
+
+    FILE *f = fopen(argv[1], "rb");
+    if(!f)
+    {
+        printf("Failed to open '%s'\n", argv[1]);
+        return -1;
+    }
+
+    fseek(f, 0, SEEK_END);
+    uint32_t text_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    char *text = malloc(text_size + 1);
+    if(fread(text, 1, text_size, f) != text_size)
+    {
+        printf("Failed to read '%s'\n", argv[1]);
+        return -1;
+    }
+    text[text_size] = '\000';
+    fclose(f);
+
+    crc32_init();
+    uint32_t text_crc = crc32(text, text_size, CRC32_DEFAULT_SEED);
+
+    /* upper bound for the number of symbols and the string table size */
+    uint32_t max_syms = 2;
+    for(uint32_t pos = 0; pos < text_size; pos++)
+    {
+        if(text[pos] == '\n')
+        {
+            max_syms++;
+        }
+    }
+
+    module_symbol_t *syms = calloc(max_syms, sizeof(module_symbol_t));
+    char *strtab = calloc(text_size + 4, 1);
+    uint32_t nbuckets = max_syms | 1;
+    int *hash = calloc(2 + nbuckets + max_syms, sizeof(int));
+    uint32_t sym_count = 1;
+    uint32_t strtab_size = 1;
+
+    hash[0] = nbuckets;
+
+    /* same parsing as module_load_symbols */
+    char name[MODULE_SYMBOLS_NAME_MAX + 1];
+    uint32_t address = 0;
+    uint32_t pos = 0;
+    int ret;
+
+    while((ret = module_symbols_parse_line(text, text_size, &pos, &address, name)) >= 0)
+    {
+        /* like tcc_add_symbol: the first definition of a weak symbol wins */
+        if(ret && !find_symbol(syms, hash, strtab, name))
+        {
+            module_symbol_t *sym = &syms[sym_count];
+            uint32_t h = elf_hash((const unsigned char *)name) % nbuckets;
+
+            sym->name = strtab_size;
+            sym->value = address;
+            sym->info = MODULE_SYMBOLS_INFO;
+            sym->shndx = MODULE_SYMBOLS_SHNDX;
+
+            strcpy(&strtab[strtab_size], name);
+            strtab_size += strlen(name) + 1;
+
+            hash[2 + nbuckets + sym_count] = hash[2 + h];
+            hash[2 + h] = sym_count;
+            sym_count++;
+        }
+    }
+
+    hash[1] = sym_count;
+    strtab_size = (strtab_size + 3) & ~3;
+
+    module_symbols_hdr_t hdr;
+    memset(&hdr, 0x00, sizeof(hdr));
+    memcpy(hdr.magic, MODULE_SYMBOLS_MAGIC, sizeof(hdr.magic));
+    hdr.version = MODULE_SYMBOLS_VERSION;
+    hdr.text_size = text_size;
+    hdr.sym_count = sym_count;
+    hdr.hash_words = 2 + nbuckets + sym_count;
+    hdr.strtab_size = strtab_size;
+    hdr.text_crc = text_crc;
+
+    f = fopen(argv[2], "wb");
+    if(!f)
+    {
+        printf("Failed to create '%s'\n", argv[2]);
+        return -1;
+    }
+
+    fwrite(&hdr, sizeof(hdr), 1, f);
+    fwrite(syms, sizeof(module_symbol_t), sym_count, f);
+    fwrite(hash, sizeof(int), hdr.hash_words, f);
+    fwrite(strtab, 1, strtab_size, f);
+
+    if(fclose(f))
+    {
+        printf("Failed to write '%s'\n", argv[2]);
+        return -1;
+    }
+
+    free(text);
+    free(syms);
+    free(strtab);
+    free(hash);
+    return 0;
+}
@@ -0,0 +1,797 @@
+/*
+ * Host benchmark for module loading: symbol table setup and linking with
+ * the TCC linker from ../../tcc (ARM target), the way module.c does it at
+ * startup. Compares the text symbol file (magiclantern.sym) with the
+ * precompiled one from build_tools/sym2bin (.syb), and both with loading
+ * the prelinked image from the module cache (src/module_cache.c).
+ *
+ * Usage:
+ *   module_bench [--check] [-n loops] [-m modules] magiclantern.sym 5D3_123.syb [*.mo]
+ *   module_bench --make-sym count fake.sym
+ *
+ * Without .mo files, synthetic modules are linked instead: ARM relocatable
+ * objects with -mlong-calls style R_ARM_ABS32 references to random ML symbols,
+ * plus a few BL calls (R_ARM_CALL) to ML functions.
+ * --check verifies both symbol files give the same symbols and the same linked
+ * image, that a cached image moved to another address matches linking there,
+ * and exits with an error code if anything differs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+/* TCC (ARM target) is built separately, see tcc_one.c */
+#include "libtcc.h"
+#include "elf.h"
+
+/* the camera build of TCC allocates through these (see tcc-glue.c) */
+void *__mem_malloc(unsigned long len, int flags, const char *file, unsigned int line);
+void __mem_free(void *buf);
+
+/* and does file I/O through these */
+void _tcc_exit(int code);
+int _tcc_open(const char *pathname, int flags);
+int _tcc_close(int fd);
+int _tcc_read(int fd, void *buf, unsigned int size);
+int _tcc_lseek(int fd, int offset, int whence);
+
+#include "module_symbols.h"
+#include "module_cache.h"
+#include "crc32.h"
+
+/* the camera version of tcc_realloc copies the new size from the old block (reading past
+   its end), which is harmless there but not with a host heap. so TCC gets its memory from
+   an arena that is reset whenever no TCC state is alive. */
+#define ARENA_SIZE (1024 * 1024 * 1024)
+static uint8_t *arena = NULL;
+static uint32_t arena_used = 0;
+
+void *__mem_malloc(unsigned long len, int flags, const char *file, unsigned int line)
+{
+    (void)flags; (void)file; (void)line;
+
+    if(!arena)
+    {
+        arena = mmap(NULL, ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if(arena == MAP_FAILED)
+        {
+            printf("Failed to allocate the TCC arena\n");
+            exit(1);
+        }
+    }
+
+    /* keep enough room behind the last block for the oversized copies */
+    if(arena_used + len + 16 > ARENA_SIZE / 2)
+    {
+        printf("TCC arena full\n");
+        exit(1);
+    }
+
+    void *ptr = &arena[arena_used];
+    arena_used += (len + 15) & ~15;
+    return ptr;
+}
+
+void __mem_free(void *buf)
+{
+    /* freed all at once by arena_reset */
+    (void)buf;
+}
+
+static void arena_reset()
+{
+    arena_used = 0;
+}
+
+void _tcc_exit(int code)
+{
+    exit(code);
+}
+
+int _tcc_open(const char *pathname, int flags)
+{
+    return open(pathname, flags);
+}
+
+int _tcc_close(int fd)
+{
+    return close(fd);
+}
+
+int _tcc_read(int fd, void *buf, unsigned int size)
+{
+    return read(fd, buf, size);
+}
+
+int _tcc_lseek(int fd, int offset, int whence)
+{
+    return lseek(fd, offset, whence);
+}
+
+/* module code has to end up below 4 GiB, since TCC only keeps 32-bit addresses for ARM.
+   fixed addresses close to ML (0x00C80000 in --make-sym), so BL calls are within range */
+#define IMAGE_SIZE (4 * 1024 * 1024)
+#define IMAGE_COUNT 3
+static const uint32_t image_bases[IMAGE_COUNT] = { 0x01000000, 0x01400000, 0x01800000 };
+static uint8_t *images[IMAGE_COUNT];
+
+/* the cache check moves the image to images[2] + this */
+#define CACHE_TEST_OFFSET 0x1230
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+/* synthetic modules: relocations per module, like a mid-sized module with literal pools */
+#define SYNTH_RELOCS  600
+#define SYNTH_GLOBALS 20
+#define SYNTH_CALLS   50
+
+static double get_time()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static uint32_t rand_state = 0x12345678;
+
+static uint32_t rand32()
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+static char *load_file(const char *filename, uint32_t *size)
+{
+    FILE *f = fopen(filename, "rb");
+    if(!f)
+    {
+        printf("Failed to open '%s'\n", filename);
+        exit(1);
+    }
+
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    char *buf = malloc(*size + 1);
+    if(fread(buf, 1, *size, f) != *size)
+    {
+        printf("Failed to read '%s'\n", filename);
+        exit(1);
+    }
+    buf[*size] = '\000';
+    fclose(f);
+    return buf;
+}
+
+/* the text parser from module_load_symbols */
+static void symbols_text(TCCState *s, char *buf, uint32_t size)
+{
+    uint32_t pos = 0;
+    char symbol_buf[MODULE_SYMBOLS_NAME_MAX + 1];
+    uint32_t address = 0;
+    int ret;
+
+    while((ret = module_symbols_parse_line(buf, size, &pos, &address, symbol_buf)) >= 0)
+    {
+        if(ret)
+        {
+            tcc_add_symbol(s, symbol_buf, (void*)(uintptr_t)address);
+        }
+    }
+}
+
+/* crc32 of the .sym, as module_load_symbols_bin checks it */
+static uint32_t symbols_text_crc(char *text, uint32_t text_size)
+{
+    crc32_init();
+    return crc32(text, text_size, CRC32_DEFAULT_SEED);
+}
+
+/* the binary loader from module_load_symbols_bin, including the check against the .sym */
+static int symbols_bin(TCCState *s, char *buf, uint32_t size, char *text, uint32_t text_size)
+{
+    module_symbols_hdr_t *hdr = (module_symbols_hdr_t *)buf;
+
+    if(!module_symbols_valid(hdr, size, text_size, symbols_text_crc(text, text_size)))
+    {
+        return -1;
+    }
+
+    return tcc_add_symbol_table(s, MODULE_SYMBOLS_SYMS(hdr), hdr->sym_count,
+                                MODULE_SYMBOLS_STRTAB(hdr), hdr->strtab_size,
+                                MODULE_SYMBOLS_HASH(hdr));
+}
+
+/* names from the symbol file, to build synthetic modules */
+static char **sym_names = NULL;
+static uint32_t sym_count = 0;
+
+/* targets for BL calls; only ours, Canon stubs are out of range */
+static char **call_names = NULL;
+static uint32_t call_count = 0;
+
+static void collect_names(char *text, uint32_t size)
+{
+    char name[MODULE_SYMBOLS_NAME_MAX + 1];
+    uint32_t address = 0;
+    uint32_t pos = 0;
+    int ret;
+
+    while((ret = module_symbols_parse_line(text, size, &pos, &address, name)) >= 0)
+    {
+        if(ret)
+        {
+            char *copy = strdup(name);
+
+            sym_names = realloc(sym_names, (sym_count + 1) * sizeof(char *));
+            sym_names[sym_count++] = copy;
+
+            if(!strncmp(copy, "ml_func", 7))
+            {
+                call_names = realloc(call_names, (call_count + 1) * sizeof(char *));
+                call_names[call_count++] = copy;
+            }
+        }
+    }
+}
+
+/* ARM ELF relocatable with SYNTH_RELOCS R_ARM_ABS32 literals pointing to ML symbols (and a few to itself)
+   and SYNTH_CALLS R_ARM_CALL to ML functions (if the symbol file has any) */
+static void make_module(const char *filename, uint32_t index)
+{
+    enum { SEC_NULL, SEC_TEXT, SEC_REL, SEC_DATA, SEC_SYMTAB, SEC_STRTAB, SEC_SHSTRTAB, SEC_COUNT };
+    static const char shstrtab[] = "\0.text\0.rel.text\0.data\0.symtab\0.strtab\0.shstrtab";
+    static const uint32_t shname[SEC_COUNT] = { 0, 1, 7, 17, 23, 31, 39 };
+
+    uint32_t calls = call_count ? SYNTH_CALLS : 0;
+    uint32_t nrels = SYNTH_RELOCS + calls;
+    uint32_t text_size = (SYNTH_RELOCS * 2 + calls) * 4;
+    uint32_t nsyms = 1 + SYNTH_GLOBALS + nrels;
+    uint8_t *text = calloc(text_size, 1);
+    Elf32_Rel *rel = calloc(nrels, sizeof(Elf32_Rel));
+    Elf32_Sym *syms = calloc(nsyms, sizeof(Elf32_Sym));
+    char *strtab = calloc(1, 64 * nsyms);
+    uint32_t strtab_size = 1;
+    uint8_t data[64];
+
+    memset(data, 0x55, sizeof(data));
+
+    /* code words followed by their literals */
+    for(uint32_t pos = 0; pos < SYNTH_RELOCS; pos++)
+    {
+        uint32_t insn = 0xE59F0000 | (pos & 0xFFF);  /* ldr r0, [pc, #x] */
+        memcpy(&text[pos * 4], &insn, 4);
+    }
+
+    for(uint32_t sym = 1; sym <= SYNTH_GLOBALS; sym++)
+    {
+        syms[sym].st_name = strtab_size;
+        syms[sym].st_value = (sym - 1) * 16;
+        syms[sym].st_info = ELF32_ST_INFO(STB_GLOBAL, STT_FUNC);
+        syms[sym].st_shndx = SEC_TEXT;
+        strtab_size += sprintf(&strtab[strtab_size], "synth%d_func%d", index, sym) + 1;
+    }
+
+    for(uint32_t pos = 0; pos < SYNTH_RELOCS; pos++)
+    {
+        uint32_t sym = 1 + SYNTH_GLOBALS + pos;
+        const char *name = sym_names[rand32() % sym_count];
+
+        syms[sym].st_name = strtab_size;
+        syms[sym].st_info = ELF32_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+        syms[sym].st_shndx = SHN_UNDEF;
+        strtab_size += sprintf(&strtab[strtab_size], "%s", name) + 1;
+
+        rel[pos].r_offset = (SYNTH_RELOCS + pos) * 4;
+        rel[pos].r_info = ELF32_R_INFO(sym, R_ARM_ABS32);
+
+        /* some literals point to our own functions instead (these move with the module) */
+        if(pos % 8 == 0)
+        {
+            rel[pos].r_info = ELF32_R_INFO(1 + rand32() % SYNTH_GLOBALS, R_ARM_ABS32);
+        }
+    }
+
+    /* after the literals: bl <ML function> */
+    for(uint32_t pos = 0; pos < calls; pos++)
+    {
+        uint32_t sym = 1 + SYNTH_GLOBALS + SYNTH_RELOCS + pos;
+        uint32_t insn = 0xEBFFFFFE;     /* bl . (addend -8) */
+        const char *name = call_names[rand32() % call_count];
+
+        memcpy(&text[(SYNTH_RELOCS * 2 + pos) * 4], &insn, 4);
+
+        syms[sym].st_name = strtab_size;
+        syms[sym].st_info = ELF32_ST_INFO(STB_GLOBAL, STT_FUNC);
+        syms[sym].st_shndx = SHN_UNDEF;
+        strtab_size += sprintf(&strtab[strtab_size], "%s", name) + 1;
+
+        rel[SYNTH_RELOCS + pos].r_offset = (SYNTH_RELOCS * 2 + pos) * 4;
+        rel[SYNTH_RELOCS + pos].r_info = ELF32_R_INFO(sym, R_ARM_CALL);
+    }
+
+    Elf32_Ehdr ehdr;
+    Elf32_Shdr shdr[SEC_COUNT];
+    uint32_t offset = sizeof(ehdr);
+
+    memset(&ehdr, 0, sizeof(ehdr));
+    memset(shdr, 0, sizeof(shdr));
+    memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+    ehdr.e_ident[EI_CLASS] = ELFCLASS32;
+    ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    ehdr.e_type = ET_REL;
+    ehdr.e_machine = EM_ARM;
+    ehdr.e_version = EV_CURRENT;
+    ehdr.e_flags = 0x05000000;    /* EABI version 5 */
+    ehdr.e_ehsize = sizeof(Elf32_Ehdr);
+    ehdr.e_shentsize = sizeof(Elf32_Shdr);
+    ehdr.e_shnum = SEC_COUNT;
+    ehdr.e_shstrndx = SEC_SHSTRTAB;
+
+    const void *contents[SEC_COUNT] = { NULL, text, rel, data, syms, strtab, shstrtab };
+    uint32_t sizes[SEC_COUNT] = { 0, text_size, nrels * sizeof(Elf32_Rel), sizeof(data), nsyms * sizeof(Elf32_Sym), (strtab_size + 3) & ~3, sizeof(shstrtab) };
+    uint32_t types[SEC_COUNT] = { SHT_NULL, SHT_PROGBITS, SHT_REL, SHT_PROGBITS, SHT_SYMTAB, SHT_STRTAB, SHT_STRTAB };
+
+    for(int sec = 1; sec < SEC_COUNT; sec++)
+    {
+        shdr[sec].sh_name = shname[sec];
+        shdr[sec].sh_type = types[sec];
+        shdr[sec].sh_offset = offset;
+        shdr[sec].sh_size = sizes[sec];
+        shdr[sec].sh_addralign = 4;
+        offset += (sizes[sec] + 3) & ~3;
+    }
+    shdr[SEC_TEXT].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+    shdr[SEC_DATA].sh_flags = SHF_ALLOC | SHF_WRITE;
+    shdr[SEC_REL].sh_link = SEC_SYMTAB;
+    shdr[SEC_REL].sh_info = SEC_TEXT;
+    shdr[SEC_REL].sh_entsize = sizeof(Elf32_Rel);
+    shdr[SEC_SYMTAB].sh_link = SEC_STRTAB;
+    shdr[SEC_SYMTAB].sh_info = 1;
+    shdr[SEC_SYMTAB].sh_entsize = sizeof(Elf32_Sym);
+    ehdr.e_shoff = offset;
+
+    FILE *f = fopen(filename, "wb");
+    if(!f)
+    {
+        printf("Failed to create '%s'\n", filename);
+        exit(1);
+    }
+    fwrite(&ehdr, sizeof(ehdr), 1, f);
+    for(int sec = 1; sec < SEC_COUNT; sec++)
+    {
+        static const uint8_t pad[4];
+        fwrite(contents[sec], 1, sizes[sec], f);
+        fwrite(pad, 1, ((sizes[sec] + 3) & ~3) - sizes[sec], f);
+    }
+    fwrite(shdr, sizeof(shdr), 1, f);
+    fclose(f);
+
+    free(text);
+    free(rel);
+    free(syms);
+    free(strtab);
+}
+
+/* what module_link_all does: one TCC state, ML symbols, all modules, relocate into target */
+static int link_all(uint8_t *target, int binary, char *sym_text, uint32_t sym_size, char *syb, uint32_t syb_size, char **modules, int module_count, double *sym_time, double *link_time)
+{
+    double start = get_time();
+
+    TCCState *s = tcc_new();
+    tcc_set_options(s, "-nostdlib");
+
+    if(binary)
+    {
+        if(symbols_bin(s, syb, syb_size, sym_text, sym_size))
+        {
+            printf("Binary symbol file is not valid for this .sym\n");
+            exit(1);
+        }
+    }
+    else
+    {
+        symbols_text(s, sym_text, sym_size);
+    }
+
+    double mid = get_time();
+
+    for(int mod = 0; mod < module_count; mod++)
+    {
+        if(tcc_add_file(s, modules[mod]) < 0)
+        {
+            printf("Failed to load '%s'\n", modules[mod]);
+            exit(1);
+        }
+    }
+
+    int size = tcc_relocate(s, NULL);
+    if(size < 0 || size > IMAGE_SIZE - CACHE_TEST_OFFSET)
+    {
+        printf("Linking failed\n");
+        exit(1);
+    }
+
+    /* zeroed like in module.c, so padding between sections is the same every time */
+    memset(target, 0, size);
+    if(tcc_relocate(s, target) < 0)
+    {
+        printf("Linking failed\n");
+        exit(1);
+    }
+
+    double end = get_time();
+    *sym_time += mid - start;
+    *link_time += end - mid;
+
+    tcc_delete(s);
+    arena_reset();
+    return size;
+}
+
+/* both symbol files must give the same value for every name */
+static int check_symbols(char *sym_text, uint32_t sym_size, char *syb, uint32_t syb_size)
+{
+    /* TCC keeps global state, so only one TCCState at a time */
+    void **values = calloc(sym_count, sizeof(void *));
+    int errors = 0;
+
+    TCCState *s = tcc_new();
+    symbols_text(s, sym_text, sym_size);
+    for(uint32_t sym = 0; sym < sym_count; sym++)
+    {
+        values[sym] = tcc_get_symbol(s, sym_names[sym]);
+    }
+    tcc_delete(s);
+    arena_reset();
+
+    s = tcc_new();
+    if(symbols_bin(s, syb, syb_size, sym_text, sym_size))
+    {
+        printf("Binary symbol file is not valid for this .sym\n");
+        return 1;
+    }
+
+    /* a rebuilt .sym of the same size (e.g. one address changed) must not accept the old .syb */
+    char *stale = malloc(sym_size);
+    memcpy(stale, sym_text, sym_size);
+    stale[0] ^= 1;
+    if(module_symbols_valid((module_symbols_hdr_t *)syb, syb_size, sym_size, symbols_text_crc(stale, sym_size)))
+    {
+        printf("FAILED: binary symbol file accepted for a different .sym of the same size\n");
+        errors++;
+    }
+    free(stale);
+
+    for(uint32_t sym = 0; sym < sym_count; sym++)
+    {
+        void *value = tcc_get_symbol(s, sym_names[sym]);
+        if(value != values[sym] || !value)
+        {
+            if(errors++ < 10)
+            {
+                printf("FAILED: %s is %p (text) and %p (binary)\n", sym_names[sym], values[sym], value);
+            }
+        }
+    }
+
+    /* symbols added afterwards must still go through the hash table */
+    tcc_add_symbol(s, "__module_bench_extra", (void *)0x1234);
+    if(tcc_get_symbol(s, "__module_bench_extra") != (void *)0x1234 || tcc_get_symbol(s, "__module_bench_missing"))
+    {
+        printf("FAILED: lookup after adding a symbol\n");
+        errors++;
+    }
+
+    tcc_delete(s);
+    arena_reset();
+    free(values);
+    return errors;
+}
+
+/* what module_cache_save does: link at two addresses, the differences are the fixups */
+static module_cache_hdr_t *make_cache(char *sym_text, uint32_t sym_size, char *syb, uint32_t syb_size, char **modules, int module_count, uint32_t *cache_size)
+{
+    double dummy = 0;
+    int size = link_all(images[0], 1, sym_text, sym_size, syb, syb_size, modules, module_count, &dummy, &dummy);
+    int size_b = link_all(images[1], 1, sym_text, sym_size, syb, syb_size, modules, module_count, &dummy, &dummy);
+    int count = module_cache_find_fixups(images[0], image_bases[0], images[1], image_bases[1], size, NULL);
+
+    if(size != size_b || count < 0)
+    {
+        printf("FAILED: the linked image can't be cached\n");
+        return NULL;
+    }
+
+    *cache_size = module_cache_size(module_count, 0, count, size);
+    module_cache_hdr_t *hdr = calloc(*cache_size, 1);
+
+    hdr->symbols_size = sym_size;
+    hdr->module_count = module_count;
+    hdr->fixup_count = count;
+    hdr->image_size = size;
+    hdr->image_base = image_bases[0];
+
+    for(int mod = 0; mod < module_count; mod++)
+    {
+        module_cache_entry_t *entry = &MODULE_CACHE_ENTRIES(hdr)[mod];
+        const char *name = strrchr(modules[mod], '/');
+        struct stat st;
+
+        stat(modules[mod], &st);
+        strncpy(entry->name, name ? name + 1 : modules[mod], sizeof(entry->name));
+        entry->file_size = st.st_size;
+        entry->file_time = st.st_mtime;
+    }
+
+    module_cache_find_fixups(images[0], image_bases[0], images[1], image_bases[1], size, MODULE_CACHE_FIXUPS(hdr));
+    memcpy(MODULE_CACHE_IMAGE(hdr), images[0], size);
+    module_cache_seal(hdr);
+    return hdr;
+}
+
+/* the cached image moved to a third address must be exactly what TCC links there */
+static int check_cache(module_cache_hdr_t *hdr, uint32_t cache_size, char *sym_text, uint32_t sym_size, char *syb, uint32_t syb_size, char **modules, int module_count)
+{
+    double dummy = 0;
+    uint8_t *target = images[2] + CACHE_TEST_OFFSET;
+    int size = link_all(target, 1, sym_text, sym_size, syb, syb_size, modules, module_count, &dummy, &dummy);
+    uint8_t *linked = malloc(size);
+    uint32_t types[4] = { 0, 0, 0, 0 };
+    int errors = 0;
+
+    memcpy(linked, target, size);
+    memset(images[2], 0, IMAGE_SIZE);
+
+    for(uint32_t pos = 0; pos < hdr->fixup_count; pos++)
+    {
+        types[MODULE_CACHE_FIXUP_TYPE(MODULE_CACHE_FIXUPS(hdr)[pos])]++;
+    }
+    printf("%d fixups (%d ABS32, %d REL32, %d BL) in %d bytes\n", hdr->fixup_count, types[0], types[1], types[2], hdr->image_size);
+
+    if(!module_cache_valid(hdr, cache_size))
+    {
+        printf("FAILED: cache checksum\n");
+        errors++;
+    }
+
+    memcpy(target, MODULE_CACHE_IMAGE(hdr), hdr->image_size);
+    if((int)hdr->image_size != size || module_cache_relocate(target, size, hdr->image_base, (uint32_t)(uintptr_t)target, MODULE_CACHE_FIXUPS(hdr), hdr->fixup_count) < 0 || memcmp(target, linked, size))
+    {
+        printf("FAILED: moved cache differs from linking at 0x%08X\n", (uint32_t)(uintptr_t)target);
+        errors++;
+    }
+
+    /* sections wouldn't be laid out the same way */
+    memcpy(target, MODULE_CACHE_IMAGE(hdr), hdr->image_size);
+    if(hdr->fixup_count && module_cache_relocate(target, size, hdr->image_base, (uint32_t)(uintptr_t)target + 4, MODULE_CACHE_FIXUPS(hdr), hdr->fixup_count) == 0)
+    {
+        printf("FAILED: misaligned move accepted\n");
+        errors++;
+    }
+
+    MODULE_CACHE_IMAGE(hdr)[hdr->image_size / 2] ^= 1;
+    if(module_cache_valid(hdr, cache_size))
+    {
+        printf("FAILED: corrupted cache accepted\n");
+        errors++;
+    }
+    MODULE_CACHE_IMAGE(hdr)[hdr->image_size / 2] ^= 1;
+
+    /* keys only, as module_cache_save writes it when the modules can't be cached */
+    uint32_t record_size = module_cache_size(hdr->module_count, hdr->core_count, 0, 0);
+    module_cache_hdr_t *record = malloc(record_size);
+    memcpy(record, hdr, record_size);
+    record->fixup_count = 0;
+    record->image_size = 0;
+    module_cache_seal(record);
+    if(!module_cache_valid(record, record_size))
+    {
+        printf("FAILED: \"not cacheable\" record rejected\n");
+        errors++;
+    }
+    free(record);
+
+    free(linked);
+    return errors;
+}
+
+/* what module_cache_load does once the file is read: checksum, copy, move */
+static void bench_cache(module_cache_hdr_t *hdr, uint32_t cache_size, double *cache_time)
+{
+    double start = get_time();
+    uint8_t *target = images[2] + CACHE_TEST_OFFSET;
+
+    if(!module_cache_valid(hdr, cache_size))
+    {
+        printf("Cache invalid\n");
+        exit(1);
+    }
+
+    memcpy(target, MODULE_CACHE_IMAGE(hdr), hdr->image_size);
+    if(module_cache_relocate(target, hdr->image_size, hdr->image_base, (uint32_t)(uintptr_t)target, MODULE_CACHE_FIXUPS(hdr), hdr->fixup_count) < 0)
+    {
+        printf("Cache can't be moved\n");
+        exit(1);
+    }
+
+    *cache_time += get_time() - start;
+}
+
+static void make_sym(uint32_t count, const char *filename)
+{
+    FILE *f = fopen(filename, "w");
+    if(!f)
+    {
+        printf("Failed to create '%s'\n", filename);
+        exit(1);
+    }
+
+    /* roughly what a real magiclantern.sym looks like: our code, Canon stubs, a few duplicates */
+    for(uint32_t sym = 0; sym < count; sym++)
+    {
+        uint32_t address = (sym % 5) ? 0x00C80000 + sym * 0x40 : 0xFF000000 + rand32() % 0x800000;
+        uint32_t name = (sym % 97 == 96) ? sym - 1 : sym;
+        fprintf(f, "%08x %s_%d\n", address, (sym % 5) ? "ml_func" : "canon_stub", name);
+    }
+    fclose(f);
+}
+
+int main(int argc, char *argv[])
+{
+    int check = 0;
+    int loops = 20;
+    int synth_count = 30;
+    int arg = 1;
+
+    if(argc == 4 && !strcmp(argv[1], "--make-sym"))
+    {
+        make_sym(atoi(argv[2]), argv[3]);
+        return 0;
+    }
+
+    while(arg < argc && argv[arg][0] == '-')
+    {
+        if(!strcmp(argv[arg], "--check"))
+        {
+            check = 1;
+        }
+        else if(!strcmp(argv[arg], "-n") && arg + 1 < argc)
+        {
+            loops = atoi(argv[++arg]);
+        }
+        else if(!strcmp(argv[arg], "-m") && arg + 1 < argc)
+        {
+            synth_count = atoi(argv[++arg]);
+        }
+        else
+        {
+            break;
+        }
+        arg++;
+    }
+
+    if(argc - arg < 2 || loops < 1)
+    {
+        printf("Usage: %s [--check] [-n loops] [-m modules] magiclantern.sym 5D3_123.syb [*.mo]\n", argv[0]);
+        printf("       %s --make-sym count fake.sym\n", argv[0]);
+        return 1;
+    }
+
+    uint32_t sym_size = 0;
+    uint32_t syb_size = 0;
+    char *sym_text = load_file(argv[arg], &sym_size);
+    char *syb = load_file(argv[arg + 1], &syb_size);
+    arg += 2;
+
+    collect_names(sym_text, sym_size);
+    if(!sym_count)
+    {
+        printf("No symbols in '%s'\n", argv[arg - 2]);
+        return 1;
+    }
+
+    for(int img = 0; img < IMAGE_COUNT; img++)
+    {
+        images[img] = mmap((void *)(uintptr_t)image_bases[img], IMAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+        if(images[img] != (uint8_t *)(uintptr_t)image_bases[img])
+        {
+            printf("Failed to allocate the image buffer at 0x%08X\n", image_bases[img]);
+            return 1;
+        }
+    }
+
+    /* real modules from the command line, or synthetic ones */
+    char **modules = &argv[arg];
+    int module_count = argc - arg;
+    char synth_dir[] = "/tmp/module_bench_XXXXXX";
+
+    if(!module_count)
+    {
+        if(!mkdtemp(synth_dir))
+        {
+            printf("Failed to create a temporary directory\n");
+            return 1;
+        }
+
+        module_count = synth_count;
+        modules = malloc(module_count * sizeof(char *));
+        for(int mod = 0; mod < module_count; mod++)
+        {
+            modules[mod] = malloc(strlen(synth_dir) + 32);
+            sprintf(modules[mod], "%s/synth%d.mo", synth_dir, mod);
+            make_module(modules[mod], mod);
+        }
+    }
+
+    printf("%d symbols, %d modules\n", sym_count, module_count);
+
+    uint32_t cache_size = 0;
+    module_cache_hdr_t *cache = make_cache(sym_text, sym_size, syb, syb_size, modules, module_count, &cache_size);
+    if(!cache)
+    {
+        return 1;
+    }
+
+    int errors = 0;
+    if(check)
+    {
+        errors += check_symbols(sym_text, sym_size, syb, syb_size);
+
+        double dummy = 0;
+        uint8_t *text_image = malloc(IMAGE_SIZE);
+        int text_size = link_all(images[0], 0, sym_text, sym_size, syb, syb_size, modules, module_count, &dummy, &dummy);
+        memcpy(text_image, images[0], text_size);
+        memset(images[0], 0, IMAGE_SIZE);
+        int bin_size = link_all(images[0], 1, sym_text, sym_size, syb, syb_size, modules, module_count, &dummy, &dummy);
+
+        if(text_size != bin_size || memcmp(text_image, images[0], text_size))
+        {
+            printf("FAILED: linked images differ\n");
+            errors++;
+        }
+        free(text_image);
+
+        errors += check_cache(cache, cache_size, sym_text, sym_size, syb, syb_size, modules, module_count);
+
+        printf("%s\n", errors ? "FAILED" : "Symbols, linked image and module cache: OK");
+    }
+
+    double sym_time[2] = { 0, 0 };
+    double link_time[2] = { 0, 0 };
+    double cache_time = 0;
+    for(int loop = 0; loop < loops; loop++)
+    {
+        link_all(images[0], 0, sym_text, sym_size, syb, syb_size, modules, module_count, &sym_time[0], &link_time[0]);
+        link_all(images[0], 1, sym_text, sym_size, syb, syb_size, modules, module_count, &sym_time[1], &link_time[1]);
+        bench_cache(cache, cache_size, &cache_time);
+    }
+
+    printf("text symbols:   %8.3f ms symbols, %8.3f ms linking\n", sym_time[0] * 1000 / loops, link_time[0] * 1000 / loops);
+    printf("binary symbols: %8.3f ms symbols, %8.3f ms linking\n", sym_time[1] * 1000 / loops, link_time[1] * 1000 / loops);
+    printf("prelinked:      %8.3f ms checksum, copy and fixups (%d bytes cache file)\n", cache_time * 1000 / loops, cache_size);
+
+    if(modules != &argv[arg])
+    {
+        for(int mod = 0; mod < module_count; mod++)
+        {
+            unlink(modules[mod]);
+        }
+        rmdir(synth_dir);
+    }
+
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,13 @@
+/*
+ * The TCC linker for module_bench, built as one source file (ONE_SOURCE).
+ * Kept apart from module_bench.c, so only TCC itself is built with warnings off.
+ */
+
+/* the camera build of TCC allocates through these (see tcc-glue.c); module_bench.c provides them */
+void *__mem_malloc(unsigned long len, int flags, const char *file, unsigned int line);
+void __mem_free(void *buf);
+
+/* TCC is configured as native for the camera; we only need the linker part */
+#include "tcc.h"
+#undef CONFIG_TCC_BACKTRACE
+#include "libtcc.c"
@@ -17,6 +17,7 @@
 #include "../model_list.h"
 #include "logging.h"
 #include "memcheck.h"
+#include "memtrace.h"
 #include "backtrace.h"
 
 #define CALLSTACK_RIGHT_ALIGN 80
@@ -175,6 +176,65 @@ static void eos_log_selftest(EOSState *s, hwaddr addr, uint64_t value, uint32_t
     }
 }
 
+/* memory region for each 4K page, to avoid address_space_translate on every access */
+/* NULL = not looked up yet; pages spanning more than one region are not cached */
+#define MR_PAGE_BITS 12
+#define MR_NOT_CACHED ((MemoryRegion *) 1)
+static MemoryRegion ** mr_cache = NULL;
+
+/* memory map changed? start over */
+static void mr_cache_flush(MemoryListener * listener)
+{
+    if (mr_cache)
+    {
+        memset(mr_cache, 0, sizeof(mr_cache[0]) << (32 - MR_PAGE_BITS));
+    }
+}
+
+static MemoryListener mr_cache_listener = {
+    .commit = mr_cache_flush,
+};
+
+static MemoryRegion * eos_lookup_memory_region(hwaddr addr, int is_write)
+{
+    hwaddr l = 4;
+    hwaddr addr1;
+    uint32_t page = addr >> MR_PAGE_BITS;
+
+    if (addr >> 32)
+    {
+        return address_space_translate(&address_space_memory, addr, &addr1, &l, is_write,
+                                       MEMTXATTRS_UNSPECIFIED);
+    }
+
+    if (!mr_cache)
+    {
+        mr_cache = g_new0(MemoryRegion *, 1 << (32 - MR_PAGE_BITS));
+        memory_listener_register(&mr_cache_listener, &address_space_memory);
+    }
+
+    MemoryRegion * mr = mr_cache[page];
+
+    if (mr == NULL)
+    {
+        /* first access to this page: does a single region cover all of it? */
+        hwaddr page_start = (hwaddr) page << MR_PAGE_BITS;
+        l = 1 << MR_PAGE_BITS;
+        mr = address_space_translate(&address_space_memory, page_start, &addr1, &l, is_write,
+                                     MEMTXATTRS_UNSPECIFIED);
+        mr_cache[page] = (l == 1 << MR_PAGE_BITS) ? mr : MR_NOT_CACHED;
+    }
+
+    if (mr == MR_NOT_CACHED)
+    {
+        l = 4;
+        mr = address_space_translate(&address_space_memory, addr, &addr1, &l, is_write,
+                                     MEMTXATTRS_UNSPECIFIED);
+    }
+
+    return mr;
+}
+
 static void eos_callstack_log_mem(EOSState *s, hwaddr _addr, uint64_t _value, uint32_t size, int flags);
 static void eos_romcpy_log_mem(EOSState *s, MemoryRegion *mr, hwaddr _addr, uint64_t _value, uint32_t size, int flags);
 
@@ -187,11 +247,7 @@ void eos_log_mem(void * opaque, hwaddr addr, uint64_t value, uint32_t size, int
     int mode = is_write ? MODE_WRITE : MODE_READ;
 
     /* find out what kind of memory is this */
-    /* fixme: can be slow */
-    hwaddr l = 4;
-    hwaddr addr1;
-    MemoryRegion * mr = address_space_translate(&address_space_memory, addr, &addr1, &l, is_write,
-                                                MEMTXATTRS_UNSPECIFIED);
+    MemoryRegion * mr = eos_lookup_memory_region(addr, is_write);
 
     if (!should_log_memory_region(mr, is_write))
     {
@@ -257,6 +313,13 @@ void eos_log_mem(void * opaque, hwaddr addr, uint64_t value, uint32_t size, int
             assert(0);
     }
 
+    if (eos_memtrace_enabled())
+    {
+        /* binary output, formatted offline */
+        eos_memtrace_log_mem(s, mr, addr, value, size, flags);
+        return;
+    }
+
     if (is_write)
     {
         /* log the old value as well */
@@ -1946,6 +2009,12 @@ void eos_logging_init(EOSState *s)
         eos_memcheck_init(s);
     }
 
+    const char * memtrace = getenv("QEMU_EOS_MEMTRACE");
+    if (memtrace && memtrace[0])
+    {
+        eos_memtrace_init(s, memtrace);
+    }
+
     if (qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN))
     {
         fprintf(stderr, "[EOS] enabling singlestep.\n");
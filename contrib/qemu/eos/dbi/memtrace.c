@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "qemu/osdep.h"
+#include "qemu/log.h"
+#include "qemu/thread.h"
+#include "qapi/error.h"
+#include "cpu.h"
+
+#include "../eos.h"
+#include "logging.h"
+#include "memtrace.h"
+
+/* The trace is written into a ring of chunks.
+ * Once a chunk is full, it's handed to a background thread,
+ * which saves it to disk while the emulation fills the next one.
+ * If the disk can't keep up, the emulation waits (nothing is dropped).
+ */
+#define CHUNK_SIZE  (1024 * 1024)
+#define NUM_CHUNKS  16
+
+static FILE * trace_file = NULL;
+static char trace_path[256];
+static uint8_t * ring = NULL;
+
+static int fill_chunk = 0;      /* chunk being filled by the emulation */
+static int fill_pos = 0;        /* offset inside fill_chunk */
+static int save_chunk = 0;      /* next chunk to be saved by the writer thread */
+static int full_chunks = 0;     /* chunks waiting to be saved */
+static int finished = 0;
+static uint64_t total_size = 0;
+
+static QemuThread writer_thread;
+static QemuMutex ring_lock;
+static QemuCond ring_cond;
+
+/* state changes are recorded only when they happen */
+static char last_task[32];
+static MemoryRegion * last_region = NULL;
+
+static void * memtrace_writer(void * unused)
+{
+    qemu_mutex_lock(&ring_lock);
+
+    while (1)
+    {
+        while (!full_chunks && !finished)
+        {
+            qemu_cond_wait(&ring_cond, &ring_lock);
+        }
+
+        if (!full_chunks)
+        {
+            break;
+        }
+
+        /* the emulation doesn't touch full chunks, so we can save this one unlocked */
+        uint8_t * chunk = ring + save_chunk * CHUNK_SIZE;
+        qemu_mutex_unlock(&ring_lock);
+        fwrite(chunk, 1, CHUNK_SIZE, trace_file);
+        qemu_mutex_lock(&ring_lock);
+
+        save_chunk = (save_chunk + 1) % NUM_CHUNKS;
+        full_chunks--;
+        qemu_cond_broadcast(&ring_cond);
+    }
+
+    qemu_mutex_unlock(&ring_lock);
+    return NULL;
+}
+
+static void memtrace_next_chunk(void)
+{
+    qemu_mutex_lock(&ring_lock);
+    full_chunks++;
+    qemu_cond_broadcast(&ring_cond);
+
+    while (full_chunks == NUM_CHUNKS)
+    {
+        /* ring full; wait for the writer */
+        qemu_cond_wait(&ring_cond, &ring_lock);
+    }
+    qemu_mutex_unlock(&ring_lock);
+
+    fill_chunk = (fill_chunk + 1) % NUM_CHUNKS;
+    fill_pos = 0;
+}
+
+static void memtrace_put(const void * data, int size)
+{
+    const uint8_t * src = data;
+
+    while (size)
+    {
+        int n = MIN(size, CHUNK_SIZE - fill_pos);
+        memcpy(ring + fill_chunk * CHUNK_SIZE + fill_pos, src, n);
+        fill_pos += n;
+        src += n;
+        size -= n;
+
+        if (fill_pos == CHUNK_SIZE)
+        {
+            memtrace_next_chunk();
+        }
+    }
+
+    total_size += src - (const uint8_t *) data;
+}
+
+static void memtrace_put_name(enum memtrace_type type, const char * name)
+{
+    uint8_t header[2] = { type, MIN(strlen(name), 255) };
+    memtrace_put(header, sizeof(header));
+    memtrace_put(name, header[1]);
+}
+
+/* QEMU is usually closed with CTRL-C, so call this when finished */
+static void memtrace_close(void)
+{
+    qemu_mutex_lock(&ring_lock);
+    finished = 1;
+    qemu_cond_broadcast(&ring_cond);
+    qemu_mutex_unlock(&ring_lock);
+    qemu_thread_join(&writer_thread);
+
+    /* the last chunk is only partially filled */
+    fwrite(ring + fill_chunk * CHUNK_SIZE, 1, fill_pos, trace_file);
+    fclose(trace_file); trace_file = 0;
+    fprintf(stderr, "%s saved (%"PRIu64" bytes).\n", trace_path, total_size);
+}
+
+int eos_memtrace_enabled(void)
+{
+    return trace_file != NULL;
+}
+
+void eos_memtrace_init(EOSState *s, const char * filename)
+{
+    snprintf(trace_path, sizeof(trace_path), "%s", filename);
+    trace_file = fopen(trace_path, "wb");
+    if (!trace_file)
+    {
+        fprintf(stderr, "Could not open %s.\n", trace_path);
+        return;
+    }
+
+    ring = malloc(CHUNK_SIZE * NUM_CHUNKS);
+    assert(ring);
+
+    uint8_t header[8] = MEMTRACE_MAGIC;
+    header[7] = MEMTRACE_VERSION;
+    fwrite(header, 1, sizeof(header), trace_file);
+    uint8_t flags = CPU_NEXT(first_cpu) ? MEMTRACE_MULTICORE : 0;
+    fwrite(&flags, 1, 1, trace_file);
+
+    qemu_mutex_init(&ring_lock);
+    qemu_cond_init(&ring_cond);
+    qemu_thread_create(&writer_thread, "memtrace", memtrace_writer, NULL, QEMU_THREAD_JOINABLE);
+    atexit(memtrace_close);
+
+    fprintf(stderr, "Saving memory trace to %s.\n", trace_path);
+}
+
+void eos_memtrace_log_mem(EOSState *s, MemoryRegion * mr, hwaddr addr, uint64_t value, uint32_t size, int flags)
+{
+    if (finished)
+    {
+        return;
+    }
+
+    int is_write = flags & 1;
+
+    if (mr != last_region)
+    {
+        /* same name as printed by eos_log_mem; the decoder adds the colors */
+        memtrace_put_name(MEMTRACE_REGION, mr->name ? mr->name + 4 : "");
+        last_region = mr;
+    }
+
+    const char * task_name = eos_get_current_task_name(s);
+    if (!task_name) task_name = "";
+    if (strncmp(task_name, last_task, sizeof(last_task)) != 0)
+    {
+        /* io_log trims task names to 15 chars or less */
+        snprintf(last_task, sizeof(last_task), "%s", task_name);
+        memtrace_put_name(MEMTRACE_TASK, last_task);
+    }
+
+    struct memtrace_access rec = {
+        .type       = MEMTRACE_ACCESS,
+        .flags      = is_write | (size << 4),
+        .cpu        = current_cpu ? current_cpu->cpu_index : 0,
+        .indent     = MIN(eos_callstack_get_indent(s), 255),
+        .pc         = CURRENT_CPU->env.regs[15],
+        .lr         = CURRENT_CPU->env.regs[14],
+        .addr       = addr,
+        .value      = value,
+    };
+
+    if (is_write)
+    {
+        cpu_physical_memory_read(addr, &rec.old_value, size);
+    }
+
+    memtrace_put(&rec, sizeof(rec));
+}
@@ -0,0 +1,37 @@
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "cpu.h"
+
+#include "../eos.h"
+
+/* binary trace of memory accesses, decoded offline with scripts/memtrace_decode.py */
+/* enabled with QEMU_EOS_MEMTRACE=file.bin, replaces the text output of -d ram/rom etc */
+
+/* file header: magic, version, flags */
+#define MEMTRACE_MAGIC      "EOSMTRC"
+#define MEMTRACE_VERSION    1
+#define MEMTRACE_MULTICORE  1   /* print CPU index for each message */
+
+/* record types; keep in sync with the decoder */
+enum memtrace_type {
+    MEMTRACE_ACCESS = 1,        /* struct memtrace_access */
+    MEMTRACE_TASK   = 2,        /* type, length, name: current task changed */
+    MEMTRACE_REGION = 3,        /* type, length, name: memory region changed */
+};
+
+struct __attribute__((packed)) memtrace_access
+{
+    uint8_t  type;              /* MEMTRACE_ACCESS */
+    uint8_t  flags;             /* bit 0: write; bits 4-7: size in bytes */
+    uint8_t  cpu;
+    uint8_t  indent;            /* call stack depth, as printed by io_log */
+    uint32_t pc;
+    uint32_t lr;
+    uint32_t addr;
+    uint32_t value;
+    uint32_t old_value;         /* previous contents, for writes */
+};
+
+void eos_memtrace_init(EOSState *s, const char * filename);
+int  eos_memtrace_enabled(void);
+void eos_memtrace_log_mem(EOSState *s, MemoryRegion * mr, hwaddr addr, uint64_t value, uint32_t size, int flags);
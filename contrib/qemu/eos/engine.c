@@ -425,16 +425,173 @@ static void edmac_test_format_size(void)
     exit(1);
 }
 
+/* Hypothesis
+ * ==========
+ * 
+ * (
+ *    ((xa, skip off1a) * ya, xa, skip off2a) * xn
+ *     (xb, skip off1b) * ya, xb, skip off3
+ * ) * yn,
+ * 
+ * (
+ *    ((xa, skip off1a) * yb, xa, skip off2b) * xn
+ *     (xb, skip off1b) * yb, xb, skip off3
+ * )
+ * 
+ * This is compiled into a list of contiguous spans, in transfer order;
+ * pieces that follow each other in memory (zero offsets) are merged.
+ * The list is cached, as the geometry of a channel rarely changes.
+ */
+static void edmac_build_spans(EOSState *s, int channel)
+{
+    EDmacChState * ch = &s->edmac.ch[channel];
+
+    uint32_t geometry[COUNT(ch->spans_geometry)] = {
+        ch->xa, ch->ya, ch->xb, ch->yb, ch->xn, ch->yn,
+        ch->off1a, ch->off1b, ch->off2a, ch->off2b, ch->off3,
+    };
+
+    if (ch->spans && memcmp(geometry, ch->spans_geometry, sizeof(geometry)) == 0)
+    {
+        return;
+    }
+    memcpy(ch->spans_geometry, geometry, sizeof(geometry));
+
+    int xa = ch->xa;
+    int ya = ch->ya;
+    int xb = ch->xb;
+    int yb = ch->yb;
+    int xn = ch->xn;
+    int yn = ch->yn;
+    int off1a = edmac_fix_off1(s, ch->off1a);
+    int off1b = edmac_fix_off1(s, ch->off1b);
+    int off2a = edmac_fix_off2(s, ch->off2a);
+    int off2b = edmac_fix_off2(s, ch->off2b);
+    int off3  = edmac_fix_off2(s, ch->off3);
+
+    int max_spans = 16;
+    ch->spans = realloc(ch->spans, max_spans * sizeof(ch->spans[0]));
+    assert(ch->spans);
+    ch->num_spans = 0;
+    ch->spans_min = 0;
+    ch->spans_max = 0;
+
+    int32_t pos = 0;
+
+    for (int jn = 0; jn <= yn; jn++)
+    {
+        int y     = (jn < yn) ? ya    : yb;
+        int off2  = (jn < yn) ? off2a : off2b;
+        for (int in = 0; in <= xn; in++)
+        {
+            int x     = (in < xn) ? xa    : xb;
+            int off1  = (in < xn) ? off1a : off1b;
+            int off23 = (in < xn) ? off2  : off3;
+            for (int j = 0; j <= y; j++)
+            {
+                int off = (j < y) ? off1 : off23;
+
+                if (x)
+                {
+                    EDmacSpan * last = ch->num_spans ? &ch->spans[ch->num_spans - 1] : NULL;
+
+                    if (last && last->offset + last->size == pos)
+                    {
+                        last->size += x;
+                    }
+                    else
+                    {
+                        if (ch->num_spans == max_spans)
+                        {
+                            max_spans *= 2;
+                            ch->spans = realloc(ch->spans, max_spans * sizeof(ch->spans[0]));
+                            assert(ch->spans);
+                        }
+                        ch->spans[ch->num_spans].offset = pos;
+                        ch->spans[ch->num_spans].size = x;
+                        ch->num_spans++;
+                    }
+
+                    ch->spans_min = MIN(ch->spans_min, pos);
+                    ch->spans_max = MAX(ch->spans_max, pos + x);
+                }
+
+                pos += x + off;
+            }
+        }
+    }
+
+    ch->spans_end = pos;
+}
+
+/* copy between memory, laid out as described by the spans, and a linear buffer */
+static void edmac_copy_spans(EOSState *s, int channel, void * buf, int to_memory)
+{
+    EDmacChState * ch = &s->edmac.ch[channel];
+    hwaddr start = (uint32_t)(ch->addr + ch->spans_min);
+    hwaddr len = ch->spans_max - ch->spans_min;
+    uint8_t * mem = NULL;
+
+    /* plain RAM? copy directly, unless memory accesses have to be logged */
+    if (len && !qemu_loglevel_mask(to_memory ? EOS_LOG_MEM_W : EOS_LOG_MEM_R))
+    {
+        MemoryRegionSection section = memory_region_find(s->system_mem, start, len);
+        if (section.mr)
+        {
+            if (int128_get64(section.size) == len &&
+                memory_region_is_ram(section.mr) &&
+                !(to_memory && memory_region_is_rom(section.mr)))
+            {
+                hwaddr mapped = len;
+                mem = cpu_physical_memory_map(start, &mapped, to_memory);
+                if (mem && mapped != len)
+                {
+                    cpu_physical_memory_unmap(mem, mapped, to_memory, 0);
+                    mem = NULL;
+                }
+            }
+            memory_region_unref(section.mr);
+        }
+    }
+
+    for (int i = 0; i < ch->num_spans; i++)
+    {
+        EDmacSpan * span = &ch->spans[i];
+
+        if (mem)
+        {
+            uint8_t * ptr = mem + (span->offset - ch->spans_min);
+            if (to_memory)
+            {
+                memcpy(ptr, buf, span->size);
+            }
+            else
+            {
+                memcpy(buf, ptr, span->size);
+            }
+        }
+        else if (to_memory)
+        {
+            eos_mem_write(s, ch->addr + span->offset, buf, span->size);
+        }
+        else
+        {
+            eos_mem_read(s, ch->addr + span->offset, buf, span->size);
+        }
+
+        buf += span->size;
+    }
+
+    if (mem)
+    {
+        /* this also takes care of dirty tracking and of translated code in that area */
+        cpu_physical_memory_unmap(mem, len, to_memory, len);
+    }
+}
+
 /* 1 on success, 0 = no data available yet (should retry) */
 static int edmac_do_transfer(EOSState *s, int channel)
 {
-    /* not fully implemented */
-    fprintf(stderr, "[EDMAC#%d] Starting transfer %s 0x%X %s ", channel,
-        (channel & 8) ? "from" : "to",
-        s->edmac.ch[channel].addr,
-        (channel & 8) ? "to" : "from"
-    );
-    
     uint32_t conn = 0;
     
     if (channel & 8)
@@ -455,23 +612,6 @@ static int edmac_do_transfer(EOSState *s, int channel)
     {
         conn = s->edmac.write_conn[channel];
     }
-    
-    fprintf(stderr, "<%d>, ", conn);
-
-    /* Hypothesis
-     * ==========
-     * 
-     * (
-     *    ((xa, skip off1a) * ya, xa, skip off2a) * xn
-     *     (xb, skip off1b) * ya, xb, skip off3
-     * ) * yn,
-     * 
-     * (
-     *    ((xa, skip off1a) * yb, xa, skip off2b) * xn
-     *     (xb, skip off1b) * yb, xb, skip off3
-     * )
-     * 
-     */
 
     int xa = s->edmac.ch[channel].xa;
     int ya = s->edmac.ch[channel].ya;
@@ -485,10 +625,19 @@ static int edmac_do_transfer(EOSState *s, int channel)
     int off2b = edmac_fix_off2(s, s->edmac.ch[channel].off2b);
     int off3  = edmac_fix_off2(s, s->edmac.ch[channel].off3);
     int flags = edmac_fix_off2(s, s->edmac.ch[channel].flags);
-    
-    fprintf(stderr, "%s, ", edmac_format_size(yn, ya, yb, xn, xa, xb, off1a, off1b, off2a, off2b, off3));
 
-    fprintf(stderr, "flags=0x%X\n", flags);
+    /* not fully implemented */
+    if (qemu_loglevel_mask(EOS_LOG_EDMAC))
+    {
+        qemu_log("[EDMAC#%d] Starting transfer %s 0x%X %s <%d>, %s, flags=0x%X\n", channel,
+            (channel & 8) ? "from" : "to",
+            s->edmac.ch[channel].addr,
+            (channel & 8) ? "to" : "from",
+            conn,
+            edmac_format_size(yn, ya, yb, xn, xa, xb, off1a, off1b, off2a, off2b, off3),
+            flags
+        );
+    }
 
     /* actual amount of data transferred */
     uint32_t transfer_data_size =
@@ -505,17 +654,19 @@ static int edmac_do_transfer(EOSState *s, int channel)
     /* we must have some valid address configured */
     assert(s->edmac.ch[channel].addr);
 
+    edmac_build_spans(s, channel);
+    assert(s->edmac.ch[channel].spans_end == transfer_data_skip_size);
+
     if (channel & 8)
     {
         /* from memory to image processing modules */
-        uint32_t src = s->edmac.ch[channel].addr;
         
         /* repeated transfers will append to existing buffer */
         uint32_t old_size = s->edmac.conn_data[conn].data_size;
         uint32_t new_size = old_size + transfer_data_size;
         if (s->edmac.conn_data[conn].buf)
         {
-            fprintf(stderr, "[EDMAC] <%d>: data size %d -> %d.\n",
+            qemu_log_mask(EOS_LOG_EDMAC, "[EDMAC] <%d>: data size %d -> %d.\n",
                 conn, old_size, new_size
             );
         }
@@ -523,31 +674,13 @@ static int edmac_do_transfer(EOSState *s, int channel)
         void * dst = s->edmac.conn_data[conn].buf + old_size;
         s->edmac.conn_data[conn].data_size = new_size;
         
-        for (int jn = 0; jn <= yn; jn++)
-        {
-            int y     = (jn < yn) ? ya    : yb;
-            int off2  = (jn < yn) ? off2a : off2b;
-            for (int in = 0; in <= xn; in++)
-            {
-                int x     = (in < xn) ? xa    : xb;
-                int off1  = (in < xn) ? off1a : off1b;
-                int off23 = (in < xn) ? off2  : off3;
-                for (int j = 0; j <= y; j++)
-                {
-                    int off = (j < y) ? off1 : off23;
-                    eos_mem_read(s, src, dst, x);
-                    src += x + off;
-                    dst += x;
-                }
-            }
-        }
-        fprintf(stderr, "[EDMAC#%d] %d bytes read from %X-%X.\n", channel, transfer_data_size, s->edmac.ch[channel].addr, s->edmac.ch[channel].addr + transfer_data_skip_size);
+        edmac_copy_spans(s, channel, dst, 0);
+
+        qemu_log_mask(EOS_LOG_EDMAC, "[EDMAC#%d] %d bytes read from %X-%X.\n", channel, transfer_data_size, s->edmac.ch[channel].addr, s->edmac.ch[channel].addr + transfer_data_skip_size);
     }
     else
     {
         /* from image processing modules to memory */
-        uint32_t dst = s->edmac.ch[channel].addr;
-        
         if (conn == 0 || conn == 35)
         {
             /* sensor data? */
@@ -586,35 +719,14 @@ static int edmac_do_transfer(EOSState *s, int channel)
 
         if (s->edmac.conn_data[conn].data_size < transfer_data_size)
         {
-            fprintf(stderr, "[EDMAC#%d] Data %s; will try again later.\n", channel,
+            qemu_log_mask(EOS_LOG_EDMAC, "[EDMAC#%d] Data %s; will try again later.\n", channel,
                 s->edmac.conn_data[conn].data_size ? "incomplete" : "unavailable"
             );
             return 0;
         }
         assert(s->edmac.conn_data[conn].buf);
 
-        void * src = s->edmac.conn_data[conn].buf;
-
-        for (int jn = 0; jn <= yn; jn++)
-        {
-            int y     = (jn < yn) ? ya    : yb;
-            int off2  = (jn < yn) ? off2a : off2b;
-            for (int in = 0; in <= xn; in++)
-            {
-                int x     = (in < xn) ? xa    : xb;
-                int off1  = (in < xn) ? off1a : off1b;
-                int off23 = (in < xn) ? off2  : off3;
-                for (int j = 0; j <= y; j++)
-                {
-                    int off = (j < y) ? off1 : off23;
-                    eos_mem_write(s, dst, src, x);
-                    src += x;
-                    dst += x + off;
-                }
-            }
-        }
-        assert(src - s->edmac.conn_data[conn].buf == transfer_data_size);
-        assert(dst - s->edmac.ch[channel].addr == transfer_data_skip_size);
+        edmac_copy_spans(s, channel, s->edmac.conn_data[conn].buf, 1);
 
         uint32_t old_size = s->edmac.conn_data[conn].data_size;
         uint32_t new_size = old_size - transfer_data_size;
@@ -628,7 +740,7 @@ static int edmac_do_transfer(EOSState *s, int channel)
             memmove(s->edmac.conn_data[conn].buf, s->edmac.conn_data[conn].buf + transfer_data_size, new_size);
             s->edmac.conn_data[conn].buf = realloc(s->edmac.conn_data[conn].buf, new_size);
             s->edmac.conn_data[conn].data_size = new_size;
-            fprintf(stderr, "[EDMAC] <%d>: data size %d -> %d.\n",
+            qemu_log_mask(EOS_LOG_EDMAC, "[EDMAC] <%d>: data size %d -> %d.\n",
                 conn, old_size, new_size
             );
         }
@@ -639,7 +751,7 @@ static int edmac_do_transfer(EOSState *s, int channel)
             s->edmac.conn_data[conn].data_size = 0;
         }
         
-        fprintf(stderr, "[EDMAC#%d] %d bytes written to %X-%X.\n", channel, transfer_data_size, s->edmac.ch[channel].addr, s->edmac.ch[channel].addr + transfer_data_skip_size);
+        qemu_log_mask(EOS_LOG_EDMAC, "[EDMAC#%d] %d bytes written to %X-%X.\n", channel, transfer_data_size, s->edmac.ch[channel].addr, s->edmac.ch[channel].addr + transfer_data_skip_size);
     }
 
     /* return end address when reading back the register */
@@ -655,7 +767,7 @@ static int edmac_do_transfer(EOSState *s, int channel)
         delay++;
     }
 
-    fprintf(stderr, "[EDMAC#%d] transfer delay %d x 256 us.\n", channel, delay);
+    qemu_log_mask(EOS_LOG_EDMAC, "[EDMAC#%d] transfer delay %d x 256 us.\n", channel, delay);
 
     edmac_trigger_interrupt(s, channel, delay);
     return 1;
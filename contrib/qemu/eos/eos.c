@@ -29,6 +29,10 @@
 #include "hw/eos/eos_bufcon_100D.h"
 #include "hw/eos/engine.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define IGNORE_CONNECT_POLL
 
 #define DIGIC_TIMER_STEP 0x100
@@ -37,6 +41,7 @@
 
 static void eos_init_common(EOSState *s);
 static void *eos_init_cpu(EOSState *s);
+static void eos_handlers_init(void);
 
 #define TYPE_EOS "eos"
 
@@ -986,6 +991,12 @@ static int yuv2rgb_GU[256];
 static int yuv2rgb_GV[256];
 static int yuv2rgb_BU[256];
 
+/* the coefficients behind the above tables, for the SIMD code */
+static int yuv2rgb_coef_RV;
+static int yuv2rgb_coef_GU;
+static int yuv2rgb_coef_GV;
+static int yuv2rgb_coef_BU;
+
 // http://www.martinreddy.net/gfx/faqs/colorconv.faq
 // BT 601:
 // R'= Y' + 0.000*U' + 1.403*V'
@@ -1001,6 +1012,12 @@ static int yuv2rgb_BU[256];
 static void precompute_yuv2rgb(int rec709)
 {
     int u, v;
+
+    yuv2rgb_coef_RV = rec709 ? 1608 : 1437;
+    yuv2rgb_coef_GU = rec709 ? -191 : -352;
+    yuv2rgb_coef_GV = rec709 ? -478 : -731;
+    yuv2rgb_coef_BU = rec709 ? 1900 : 1812;
+
     if (rec709)
     {
         //
@@ -1112,10 +1129,89 @@ static uint8_t yuv_to_b(uint8_t y, int8_t u) {
     return clip_yuv(((y<<12) + u*7258          + 2048)>>12);
 }
 
+#ifdef __SSE2__
+/* (a * b) >> 10 on signed 16-bit lanes; exact as long as the result fits in 16 bits */
+static inline __m128i mul_shr10_epi16(__m128i a, __m128i b)
+{
+    __m128i lo = _mm_mullo_epi16(a, b);
+    __m128i hi = _mm_mulhi_epi16(a, b);
+    return _mm_or_si128(_mm_slli_epi16(hi, 6), _mm_srli_epi16(lo, 10));
+}
+
+/* two signed 16-bit constants, for _mm_madd_epi16 */
+#define PAIR_EPI16(a, b) _mm_set1_epi32((uint16_t)(a) | ((uint32_t)(uint16_t)(b) << 16))
+
+/* (x0 * c0 + x1 * c1 + x2 * c2 + x3 * c3) >> 12 for 8 pixels, from 16-bit lanes */
+static inline __m128i madd2_shr12_epi16(__m128i x0, __m128i x1, __m128i c01,
+                                        __m128i x2, __m128i x3, __m128i c23)
+{
+    __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(x0, x1), c01),
+                               _mm_madd_epi16(_mm_unpacklo_epi16(x2, x3), c23));
+    __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(x0, x1), c01),
+                               _mm_madd_epi16(_mm_unpackhi_epi16(x2, x3), c23));
+    return _mm_packs_epi32(_mm_srai_epi32(lo, 12), _mm_srai_epi32(hi, 12));
+}
+
+/* 8 pixels from 16-bit R, G, B lanes (clipped to 0...255), stored as rgb_to_pixel32 */
+static inline void store_pixel32_x8(uint8_t * d, __m128i r, __m128i g, __m128i b)
+{
+    __m128i r8 = _mm_packus_epi16(r, r);
+    __m128i g8 = _mm_packus_epi16(g, g);
+    __m128i b8 = _mm_packus_epi16(b, b);
+    __m128i bg = _mm_unpacklo_epi8(b8, g8);
+    __m128i r0 = _mm_unpacklo_epi8(r8, _mm_setzero_si128());
+    _mm_storeu_si128((__m128i *) d, _mm_unpacklo_epi16(bg, r0));
+    _mm_storeu_si128((__m128i *) (d + 16), _mm_unpackhi_epi16(bg, r0));
+}
+
+/* duplicate lanes 0, 2, 4, 6 (chroma of each UYVY pair) for both pixels */
+#define UYVY_DUP_U(x) _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, _MM_SHUFFLE(2,2,0,0)), _MM_SHUFFLE(2,2,0,0))
+#define UYVY_DUP_V(x) _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, _MM_SHUFFLE(3,3,1,1)), _MM_SHUFFLE(3,3,1,1))
+#endif
+
 static void draw_line_YUV8B_32(void *opaque,
                 uint8_t *d, const uint8_t *s, int width, int deststep)
 {
     uint8_t v, r, g, b;
+
+#ifdef __SSE2__
+    /* 8 pixels at a time; same results as the scalar loop below */
+    const __m128i mask_ff = _mm_set1_epi16(0xFF);
+    const __m128i half = _mm_set1_epi16(0x80);
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; width >= 8; width -= 8)
+    {
+        __m128i uyvy = _mm_loadu_si128((const __m128i *) s);
+        __m128i y  = _mm_srli_epi16(uyvy, 8);
+        __m128i uv = _mm_and_si128(uyvy, mask_ff);
+        __m128i gray = UYVY_DUP_U(_mm_cmpeq_epi16(uv, zero));
+        uv = _mm_sub_epi16(uv, half);
+        __m128i u = UYVY_DUP_U(uv);
+        __m128i v = UYVY_DUP_V(uv);
+
+        /* same as yuv_to_r/g/b, including the rounding term */
+        __m128i R = madd2_shr12_epi16(y, v, PAIR_EPI16(4096, 5743), one, zero, PAIR_EPI16(2048, 0));
+        __m128i G = madd2_shr12_epi16(y, u, PAIR_EPI16(4096, -1411), v, one, PAIR_EPI16(-2925, 2048));
+        __m128i B = madd2_shr12_epi16(y, u, PAIR_EPI16(4096, 7258), one, zero, PAIR_EPI16(2048, 0));
+
+        /* U = 0: gray */
+        R = _mm_or_si128(_mm_and_si128(gray, half), _mm_andnot_si128(gray, R));
+        G = _mm_or_si128(_mm_and_si128(gray, half), _mm_andnot_si128(gray, G));
+        B = _mm_or_si128(_mm_and_si128(gray, half), _mm_andnot_si128(gray, B));
+
+        store_pixel32_x8(d, R, G, B);
+        s += 16;
+        d += 32;
+    }
+
+    if (width < 2)
+    {
+        return;
+    }
+#endif
+
     width = width / 2;
     do {
         v = ldub_p((void *) s);
@@ -1174,11 +1270,56 @@ static void draw_line4_32(void *opaque,
     }
 }
 
+/* one line of UYVY to 32-bit pixels; same results as yuv2rgb */
+/* yuv must start at a pixel pair (U byte) */
+static void draw_line_yuv422_32(uint32_t *d, const uint8_t *yuv, int width)
+{
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128i crv = _mm_set1_epi16(yuv2rgb_coef_RV);
+    const __m128i cgu = _mm_set1_epi16(yuv2rgb_coef_GU);
+    const __m128i cgv = _mm_set1_epi16(yuv2rgb_coef_GV);
+    const __m128i cbu = _mm_set1_epi16(yuv2rgb_coef_BU);
+
+    for (; i + 8 <= width; i += 8)
+    {
+        __m128i uyvy = _mm_loadu_si128((const __m128i *) (yuv + i * 2));
+        __m128i y  = _mm_srli_epi16(uyvy, 8);
+        __m128i uv = _mm_srai_epi16(_mm_slli_epi16(uyvy, 8), 8);
+        __m128i u  = UYVY_DUP_U(uv);
+        __m128i v  = UYVY_DUP_V(uv);
+
+        __m128i R = _mm_add_epi16(y, mul_shr10_epi16(v, crv));
+        __m128i G = _mm_add_epi16(y, _mm_add_epi16(mul_shr10_epi16(u, cgu), mul_shr10_epi16(v, cgv)));
+        __m128i B = _mm_add_epi16(y, mul_shr10_epi16(u, cbu));
+        store_pixel32_x8((uint8_t *) (d + i), R, G, B);
+    }
+#endif
+
+    for (; i < width; i++)
+    {
+        uint32_t uyvy = ldl_p(yuv + (i & ~1) * 2);
+        int Y = (i & 1) ? UYVY_GET_Y2(uyvy) : UYVY_GET_Y1(uyvy);
+        int R, G, B;
+        yuv2rgb(Y, UYVY_GET_U(uyvy), UYVY_GET_V(uyvy), &R, &G, &B);
+        d[i] = rgb_to_pixel32(R, G, B);
+    }
+}
+
 static void draw_line8_32_bmp_yuv(void *opaque,
                 uint8_t *d, const uint8_t *bmp, const uint8_t *yuv, int width, int deststep, int yuvstep)
 {
     EOSState* ws = (EOSState*) opaque;
-    
+
+    // same pixel pitch in both planes (e.g. LCD)?
+    // convert the entire YUV line first, directly into the output buffer
+    int yuv_predrawn = (yuvstep == 2 && ((uintptr_t)yuv & 3) == 0);
+    if (yuv_predrawn)
+    {
+        draw_line_yuv422_32((uint32_t *) d, yuv, width);
+    }
+
     do {
         uint8_t v = ldub_p((void *) bmp);
         int r = ws->disp.palette_8bit[v].R;
@@ -1194,12 +1335,22 @@ static void draw_line8_32_bmp_yuv(void *opaque,
         else
         {
             // some sort of transparency
-            uint32_t uyvy =  ldl_p((void*)((uintptr_t)yuv & ~3));
-            int Y = (uintptr_t)yuv & 3 ? UYVY_GET_Y2(uyvy) : UYVY_GET_Y1(uyvy);
-            int U = UYVY_GET_U(uyvy);
-            int V = UYVY_GET_V(uyvy);
             int R, G, B;
-            yuv2rgb(Y, U, V, &R, &G, &B);
+            if (yuv_predrawn)
+            {
+                uint32_t pixel = ((uint32_t *) d)[0];
+                R = (pixel >> 16) & 0xFF;
+                G = (pixel >>  8) & 0xFF;
+                B = (pixel      ) & 0xFF;
+            }
+            else
+            {
+                uint32_t uyvy =  ldl_p((void*)((uintptr_t)yuv & ~3));
+                int Y = (uintptr_t)yuv & 3 ? UYVY_GET_Y2(uyvy) : UYVY_GET_Y1(uyvy);
+                int U = UYVY_GET_U(uyvy);
+                int V = UYVY_GET_V(uyvy);
+                yuv2rgb(Y, U, V, &R, &G, &B);
+            }
             
             if (o == 0 && r == 255 && g == 255 && b == 255)
             {
@@ -1247,6 +1398,7 @@ static void framebuffer_update_display_bmp_yuv(
     int dest_row_pitch, // Bytes between adjacent horizontal output pixels.
     int dest_col_pitch, // Bytes between adjacent vertical output pixels.
     int invalidate, // nonzero to redraw the whole image.
+    DispState *disp, // for the copy of the previous image (dirty lines)
     drawfn_bmp_yuv fn,
     void *opaque,
     int *first_row, // Input and output.
@@ -1260,7 +1412,6 @@ static void framebuffer_update_display_bmp_yuv(
     uint8_t *src_base_bmp;
     uint8_t *src_base_yuv;
     int first, last = 0;
-    //int dirty;
     int i;
     ram_addr_t addr_bmp;
     ram_addr_t addr_yuv;
@@ -1335,13 +1486,23 @@ static void framebuffer_update_display_bmp_yuv(
     // fixme: only works for integer factors
     int src_yuv_pitch = src_width_yuv / cols;
 
+    // dirty lines: compare both planes with their contents from last update
+    // (the dirty memory bitmap is not enabled for our RAM)
+    int shadow_pitch = src_width_bmp + src_width_yuv;
+    if (disp->shadow_size != shadow_pitch * rows_bmp) {
+        disp->shadow_size = shadow_pitch * rows_bmp;
+        disp->shadow = g_realloc(disp->shadow, disp->shadow_size);
+        invalidate = 1;
+    }
+    uint8_t *shadow = disp->shadow + i * shadow_pitch;
+
     for (; i < rows_bmp; i++) {
-        //dirty = memory_region_get_dirty(mem_bmp, addr_bmp, src_width_bmp,
-        //                                     DIRTY_MEMORY_VGA);
-        //dirty |= memory_region_get_dirty(mem_yuv, addr_yuv, src_width_yuv,
-        //                                     DIRTY_MEMORY_VGA);
-        //if (dirty || invalidate) {
-        if (invalidate) {
+        int dirty =
+            memcmp(shadow, src_bmp, src_width_bmp) ||
+            memcmp(shadow + src_width_bmp, src_yuv, src_width_yuv);
+        if (dirty || invalidate) {
+            memcpy(shadow, src_bmp, src_width_bmp);
+            memcpy(shadow + src_width_bmp, src_yuv, src_width_yuv);
             fn(opaque, dest, src_bmp, src_yuv, cols, dest_col_pitch, src_yuv_pitch);
             if (first == -1)
                 first = i;
@@ -1354,6 +1515,7 @@ static void framebuffer_update_display_bmp_yuv(
         addr_yuv = addr_base_yuv + j * src_width_yuv;
         src_yuv = src_base_yuv + j * src_width_yuv;
         dest += dest_row_pitch;
+        shadow += shadow_pitch;
     }
     cpu_physical_memory_unmap(src_base_bmp, src_len_bmp, 0, 0);
     cpu_physical_memory_unmap(src_base_yuv, src_len_yuv, 0, 0);
@@ -1458,7 +1620,7 @@ static void eos_update_display(void *parm)
             s->disp.img_vram,
             width, height, yuv_height,
             s->disp.bmp_pitch, yuv_width*2, linesize, 0, s->disp.invalidate,
-            draw_line8_32_bmp_yuv, s,
+            &s->disp, draw_line8_32_bmp_yuv, s,
             &first, &last
         );
     }
@@ -1657,6 +1819,9 @@ static void *eos_init_cpu(EOSState *s)
     s->verbosity = 0xFFFFFFFF;
     s->tio_rxbyte = 0x100;
 
+    /* MMIO dispatch table, see eos_find_handler */
+    eos_handlers_init();
+
     s->system_mem = get_system_memory();
 
     if (ATCM_SIZE)
@@ -2254,14 +2419,144 @@ unsigned int eos_default_handle ( EOSState *s, unsigned int address, unsigned ch
     return data;
 }
 
+/* MMIO dispatch table: for each 4K page covered by eos_handlers[],
+ * the handlers overlapping that page, in table order (first match wins, as before).
+ * Consecutive pages with the same handlers share their list. */
+#define HANDLER_PAGE_BITS 12
+#define HANDLER_LIST_END  0xFF
+
+static uint32_t handler_page_base;      /* first page, address >> HANDLER_PAGE_BITS */
+static uint32_t handler_page_count;
+static uint32_t *handler_page_list;     /* for each page: offset of its list in handler_lists */
+static uint8_t *handler_lists;          /* indices in eos_handlers[], each list ends with HANDLER_LIST_END */
+
+/* access counters (QEMU_EOS_IO_STATS=1); the last entry counts unhandled accesses */
+static int handler_stats;
+static uint64_t handler_reads[ARRAY_SIZE(eos_handlers) + 1];
+static uint64_t handler_writes[ARRAY_SIZE(eos_handlers) + 1];
+
+static void eos_handler_stats_print(void)
+{
+    int idx[ARRAY_SIZE(eos_handlers) + 1];
+    int n = ARRAY_SIZE(idx);
+
+    for (int i = 0; i < n; i++)
+    {
+        idx[i] = i;
+    }
+
+    /* most accessed first; there are only a few of them */
+    for (int i = 1; i < n; i++)
+    {
+        for (int j = i; j > 0; j--)
+        {
+            uint64_t a = handler_reads[idx[j-1]] + handler_writes[idx[j-1]];
+            uint64_t b = handler_reads[idx[j]]   + handler_writes[idx[j]];
+            if (a >= b) break;
+            int t = idx[j]; idx[j] = idx[j-1]; idx[j-1] = t;
+        }
+    }
+
+    fprintf(stderr, "\n[EOS] MMIO accesses per handler:\n");
+    fprintf(stderr, "    %-14s %-21s %12s %12s\n", "Handler", "Range", "Reads", "Writes");
+
+    for (int k = 0; k < n; k++)
+    {
+        int i = idx[k];
+        if (!handler_reads[i] && !handler_writes[i])
+        {
+            break;
+        }
+
+        if (i == ARRAY_SIZE(eos_handlers))
+        {
+            fprintf(stderr, "    %-14s %-21s %12"PRIu64" %12"PRIu64"\n",
+                "*unk*", "", handler_reads[i], handler_writes[i]
+            );
+            continue;
+        }
+
+        char name[16];
+        snprintf(name, sizeof(name), "%s:%X", eos_handlers[i].name, eos_handlers[i].parm);
+        fprintf(stderr, "    %-14s %08X-%08X    %12"PRIu64" %12"PRIu64"\n",
+            name, eos_handlers[i].start, eos_handlers[i].end,
+            handler_reads[i], handler_writes[i]
+        );
+    }
+}
+
+static void eos_handlers_init(void)
+{
+    uint32_t lo = 0xFFFFFFFF;
+    uint32_t hi = 0;
+    uint8_t list[ARRAY_SIZE(eos_handlers)];
+    int prev = -1;
+    int prev_len = 0;
+
+    assert(ARRAY_SIZE(eos_handlers) < HANDLER_LIST_END);
+
+    for (int i = 0; i < ARRAY_SIZE(eos_handlers); i++)
+    {
+        lo = MIN(lo, eos_handlers[i].start);
+        hi = MAX(hi, eos_handlers[i].end);
+    }
+
+    handler_page_base  = lo >> HANDLER_PAGE_BITS;
+    handler_page_count = (hi >> HANDLER_PAGE_BITS) - handler_page_base + 1;
+    handler_page_list  = g_new(uint32_t, handler_page_count);
+
+    GArray *lists = g_array_new(FALSE, FALSE, sizeof(uint8_t));
+    const uint8_t end = HANDLER_LIST_END;
+
+    for (uint32_t page = 0; page < handler_page_count; page++)
+    {
+        uint32_t page_start = (handler_page_base + page) << HANDLER_PAGE_BITS;
+        uint32_t page_end = page_start + (1 << HANDLER_PAGE_BITS) - 1;
+        int len = 0;
+
+        for (int i = 0; i < ARRAY_SIZE(eos_handlers); i++)
+        {
+            if (eos_handlers[i].start <= page_end && eos_handlers[i].end >= page_start)
+            {
+                list[len++] = i;
+            }
+        }
+
+        if (prev < 0 || len != prev_len || memcmp(&g_array_index(lists, uint8_t, prev), list, len) != 0)
+        {
+            prev = lists->len;
+            prev_len = len;
+            g_array_append_vals(lists, list, len);
+            g_array_append_val(lists, end);
+        }
+
+        handler_page_list[page] = prev;
+    }
+
+    handler_lists = (uint8_t *) g_array_free(lists, FALSE);
+
+    if (getenv("QEMU_EOS_IO_STATS"))
+    {
+        handler_stats = 1;
+        atexit(eos_handler_stats_print);
+    }
+}
+
 EOSRegionHandler *eos_find_handler(unsigned int address)
 {
-    int pos = 0;
-    for(pos = 0; pos < sizeof(eos_handlers) / sizeof(eos_handlers[0]); pos++)
+    /* addresses below the first page wrap around to large values */
+    uint32_t page = (address >> HANDLER_PAGE_BITS) - handler_page_base;
+
+    if (page >= handler_page_count)
     {
-        if(eos_handlers[pos].start <= address && eos_handlers[pos].end >= address)
+        return NULL;
+    }
+
+    for (const uint8_t *i = &handler_lists[handler_page_list[page]]; *i != HANDLER_LIST_END; i++)
+    {
+        if (eos_handlers[*i].start <= address && eos_handlers[*i].end >= address)
         {
-            return &eos_handlers[pos];
+            return &eos_handlers[*i];
         }
     }
 
@@ -2272,6 +2567,19 @@ unsigned int eos_handler(EOSState *s, unsigned int address, unsigned char type,
 {
     EOSRegionHandler *handler = eos_find_handler(address);
 
+    if (unlikely(handler_stats))
+    {
+        int i = handler ? handler - eos_handlers : ARRAY_SIZE(eos_handlers);
+        if (type & MODE_WRITE)
+        {
+            handler_writes[i]++;
+        }
+        else
+        {
+            handler_reads[i]++;
+        }
+    }
+
     if(handler)
     {
         return handler->handle(handler->parm, s, address, type, value);
@@ -5373,6 +5681,7 @@ unsigned int eos_handle_display ( unsigned int parm, EOSState *s, unsigned int a
             {
                 int entry = (((address & 0xFFF) - 0x400) / 4) % 0x100;
                 process_palette_entry(value, &s->disp.palette_8bit[entry], entry, &msg);
+                s->disp.invalidate = 1;
                 s->disp.is_4bit = 0;
                 s->disp.bmp_pitch = 960;
             }
@@ -152,6 +152,8 @@ typedef struct
     struct palette_entry palette_8bit[256];
     int is_4bit;
     int is_half_height;
+    uint8_t * shadow;           /* BMP and YUV lines from last update, to find the changed ones */
+    int shadow_size;
 } DispState;
 
 struct HPTimer
@@ -203,6 +205,13 @@ typedef struct
     Notifier powerdown_notifier;
 } MPUState;
 
+/* contiguous piece of an EDMAC transfer */
+typedef struct
+{
+    int32_t offset;             /* in memory, from the channel address */
+    uint32_t size;
+} EDmacSpan;
+
 typedef struct
 {
     uint32_t addr;
@@ -220,6 +229,14 @@ typedef struct
     uint32_t off34;     /* 3 = abort request */
     uint32_t off40;
     uint32_t flags;
+
+    /* transfer geometry compiled into spans (see edmac_do_transfer) */
+    EDmacSpan * spans;          /* malloc'd */
+    int num_spans;
+    int32_t spans_min;          /* memory range covered by the spans, from the channel address */
+    int32_t spans_max;
+    int32_t spans_end;          /* where the transfer ends, including the last offset */
+    uint32_t spans_geometry[11];/* register values the spans were built for */
 } EDmacChState;
 
 typedef struct
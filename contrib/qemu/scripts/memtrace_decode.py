@@ -0,0 +1,90 @@
+#!/usr/bin/env python
+
+# Decode a binary memory trace saved with QEMU_EOS_MEMTRACE=file.bin
+# into the same text output as -d ram/rom/etc (see io_log in eos.c)
+#
+# usage: memtrace_decode.py trace.bin > trace.log
+
+import sys, struct
+
+MEMTRACE_MAGIC     = b"EOSMTRC"
+MEMTRACE_VERSION   = 1
+MEMTRACE_MULTICORE = 1
+
+MEMTRACE_ACCESS = 1
+MEMTRACE_TASK   = 2
+MEMTRACE_REGION = 3
+
+# struct memtrace_access, without the type byte
+access_fmt = struct.Struct("<BBBIIIII")
+
+KLRED  = "\x1B[1;31m"
+KRESET = "\x1B[0m"
+
+def io_log(cpu_name, region, task, indent, pc, lr, address, is_write, value, msg):
+    mod_name = (" " * min(indent, 16) + "[%s]" % region)[:23]
+
+    if task is not None:
+        task = task[:max(5, 15 - len(mod_name))]
+        spaces = " " * max(0, 15 - len(mod_name) - len(task))
+        mod_name_and_pc = "%s%s%s at %s:%08X:%08X" % (mod_name, KRESET, spaces, task, pc, lr)
+    else:
+        mod_name_and_pc = "%-14s at 0x%08X:%08X" % (mod_name, pc, lr)
+
+    return "%s%-28s [0x%08X] %s 0x%-8X" % (
+        cpu_name, mod_name_and_pc[:71], address,
+        "<-" if is_write else "->", value
+    ) + KRESET + (": " if msg else "") + msg[:199]
+
+def decode(data, out):
+    if data[:7] != MEMTRACE_MAGIC:
+        raise ValueError("not a memory trace")
+    if ord(data[7:8]) != MEMTRACE_VERSION:
+        raise ValueError("unsupported version %d" % ord(data[7:8]))
+
+    multicore = ord(data[8:9]) & MEMTRACE_MULTICORE
+    region = ""
+    task = None
+    pos = 9
+
+    while pos < len(data):
+        rec_type = ord(data[pos:pos+1])
+        pos += 1
+
+        if rec_type in (MEMTRACE_TASK, MEMTRACE_REGION):
+            length = ord(data[pos:pos+1])
+            name = data[pos+1:pos+1+length].decode("ascii", "replace")
+            pos += 1 + length
+            if rec_type == MEMTRACE_TASK:
+                task = name or None
+            else:
+                region = name or KLRED + "UNMAPPED" + KRESET
+            continue
+
+        if rec_type != MEMTRACE_ACCESS:
+            raise ValueError("unknown record type %d at offset %d" % (rec_type, pos - 1))
+
+        if pos + access_fmt.size > len(data):
+            sys.stderr.write("trace truncated at offset %d\n" % (pos - 1))
+            break
+
+        flags, cpu, indent, pc, lr, address, value, old_value = \
+            access_fmt.unpack_from(data, pos)
+        pos += access_fmt.size
+
+        is_write = flags & 1
+        size = flags >> 4
+        msg = { 1: "8-bit", 2: "16-bit", 4: "" }[size]
+        if is_write:
+            msg = "was 0x%X; %s" % (old_value, msg)
+
+        cpu_name = "[CPU%d] " % cpu if multicore else ""
+        out.write(io_log(cpu_name, region, task, indent, pc, lr, address, is_write, value, msg) + "\n")
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        print("usage: %s trace.bin" % sys.argv[0])
+        sys.exit(1)
+
+    with open(sys.argv[1], "rb") as f:
+        decode(f.read(), sys.stdout)
@@ -0,0 +1,397 @@
+/**
+ * Benchmark and golden-output check for the LiveView overlay kernels
+ * (src/zebra_kernels.c), built for the PC.
+ *
+ * usage:
+ *   zebra_bench [-n iterations] [-w width -h height] [frame.422]
+ *   zebra_bench --check     compare the kernel outputs against known checksums
+ *   zebra_bench --golden    print the checksums (after an intentional change)
+ *
+ * Frames are raw UYVY, as saved by the "Dump LiveView buffer" options
+ * (720x480 by default). Without a file, a synthetic frame is used.
+ * The checks always run on the synthetic frame, so they are reproducible.
+ **/
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <x86intrin.h>
+#define HAS_RDTSC
+#endif
+
+#include "zebra_kernels.h"
+
+/* from imgconv.c (BT 601) */
+int yuv2rgb_RV[256];
+int yuv2rgb_GU[256];
+int yuv2rgb_GV[256];
+int yuv2rgb_BU[256];
+
+void precompute_yuv2rgb()
+{
+    for (int u = 0; u < 256; u++)
+    {
+        int8_t U = u;
+        yuv2rgb_GU[u] = (-352 * U) >> 10;
+        yuv2rgb_BU[u] = (1812 * U) >> 10;
+    }
+
+    for (int v = 0; v < 256; v++)
+    {
+        int8_t V = v;
+        yuv2rgb_RV[v] = (1437 * V) >> 10;
+        yuv2rgb_GV[v] = (-731 * V) >> 10;
+    }
+}
+
+/* zebra thresholds, as with the default menu settings */
+#define ZLH 245
+#define ZLL 5
+
+#define WAVEFORM_WIDTH  180
+#define WAVEFORM_HEIGHT 120
+
+static int width = 720;
+static int height = 480;
+static uint32_t * frame = NULL;     /* width/2 UYVY pairs per line */
+static uint32_t * dst = NULL;
+static uint8_t * zebras = NULL;
+static uint8_t waveform[WAVEFORM_WIDTH * WAVEFORM_HEIGHT];
+static struct Histogram histogram;
+static int peak_scaling[256];
+
+/* something that looks a bit like a real image: gradients (for zebras and histogram),
+ * a few hard edges and some noise (for focus peaking), and saturated colors (for RGB zebras) */
+static void synthetic_frame()
+{
+    uint32_t seed = 12345;
+    int pairs = width / 2;
+
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < pairs; x++)
+        {
+            seed = seed * 1103515245 + 12345;
+            int noise = (seed >> 16) % 9 - 4;
+
+            int luma = (x * 2 * 255 / width + y * 64 / height) & 0xFF;
+            if (((x / 16) ^ (y / 32)) & 1) luma = 255 - luma;
+            if (y < height / 8) luma = 255;         /* overexposed band */
+            if (y >= height - height / 8) luma = 0; /* underexposed band */
+
+            int y1 = COERCE(luma + noise, 0, 255);
+            int y2 = COERCE(luma - noise, 0, 255);
+            int u = (int8_t)((x * 7 + y * 3) & 0xFF) / 2;
+            int v = (int8_t)((x * 3 - y * 5) & 0xFF) / 2;
+            frame[y * pairs + x] = UYVY_PACK(u, y1, v, y2);
+        }
+    }
+}
+
+static int load_frame(const char * filename)
+{
+    FILE * f = fopen(filename, "rb");
+    if (!f)
+    {
+        fprintf(stderr, "Could not open %s\n", filename);
+        return 0;
+    }
+
+    size_t size = width * height * 2;
+    size_t r = fread(frame, 1, size, f);
+    fclose(f);
+
+    if (r != size)
+    {
+        fprintf(stderr, "%s: expected %dx%d UYVY (%d bytes), got %d\n", filename, width, height, (int) size, (int) r);
+        return 0;
+    }
+    return 1;
+}
+
+static uint32_t fnv1a(const void * data, int size, uint32_t hash)
+{
+    const uint8_t * p = data;
+    for (int i = 0; i < size; i++)
+    {
+        hash ^= p[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+/* kernels to benchmark; each one returns a checksum of its output */
+
+static uint32_t run_zebra_luma(void * arg)
+{
+    int pairs = width / 2;
+    for (int y = 0; y < height; y++)
+    {
+        zebra_classify_line(&frame[y * pairs], pairs, 0, ZLH, ZLL, &zebras[y * pairs]);
+    }
+    return fnv1a(zebras, pairs * height, 2166136261u);
+}
+
+static uint32_t run_zebra_rgb(void * arg)
+{
+    int pairs = width / 2;
+    for (int y = 0; y < height; y++)
+    {
+        zebra_classify_line(&frame[y * pairs], pairs, 1, ZLH, ZLL, &zebras[y * pairs]);
+    }
+    return fnv1a(zebras, pairs * height, 2166136261u);
+}
+
+static uint32_t run_histogram(void * arg)
+{
+    int is_rgb = (intptr_t) arg;
+    int pairs = width / 2;
+    memset(&histogram, 0, sizeof(histogram));
+    histogram.is_rgb = is_rgb;
+    for (int y = 0; y < height; y++)
+    {
+        hist_waveform_add_line(&histogram, 0, 0, 0, &frame[y * pairs], pairs, 1);
+    }
+    return fnv1a(&histogram, sizeof(histogram), 2166136261u);
+}
+
+static uint32_t run_waveform(void * arg)
+{
+    int pairs = width / 2;
+    memset(waveform, 0, sizeof(waveform));
+    for (int y = 0; y < height; y++)
+    {
+        hist_waveform_add_line(0, waveform, WAVEFORM_WIDTH, WAVEFORM_HEIGHT, &frame[y * pairs], pairs, 1);
+    }
+    return fnv1a(waveform, sizeof(waveform), 2166136261u);
+}
+
+struct peak_args
+{
+    int mode;
+    int grayscale;
+    int filter_edges;
+};
+
+static uint32_t run_peaking(void * arg)
+{
+    struct peak_args * a = arg;
+    int pairs = width / 2;
+
+    /* the kernel looks one line up and down */
+    memset(dst, 0, pairs * height * 4);
+    int n_over = peak_disp_filter_range(
+        frame, dst, pairs, pairs * (height - 1), width * 2,
+        a->mode, a->grayscale, a->filter_edges, peak_scaling
+    );
+    uint32_t hash = fnv1a(dst, pairs * height * 4, 2166136261u);
+    return fnv1a(&n_over, sizeof(n_over), hash);
+}
+
+static struct peak_args peak_solid       = { PEAK_DISP_BLEND_SOLID, 0, 0 };
+static struct peak_args peak_solid_edges = { PEAK_DISP_BLEND_SOLID, 0, 2 };
+static struct peak_args peak_solid_gray  = { PEAK_DISP_BLEND_SOLID, 1, 0 };
+static struct peak_args peak_alpha       = { PEAK_DISP_BLEND_ALPHA, 0, 0 };
+static struct peak_args peak_alpha_gray  = { PEAK_DISP_BLEND_ALPHA, 1, 1 };
+static struct peak_args peak_sharpen     = { PEAK_DISP_SHARPEN,     0, 0 };
+static struct peak_args peak_raw         = { PEAK_DISP_RAW,         0, 1 };
+
+static struct
+{
+    const char * name;
+    uint32_t (*run)(void * arg);
+    void * arg;
+    uint32_t golden;    /* checksum on the 720x480 synthetic frame */
+}
+kernels[] = {
+    { "zebras (luma)",          run_zebra_luma, 0,                  0x64A18E58 },
+    { "zebras (RGB)",           run_zebra_rgb,  0,                  0x4B2EAC3A },
+    { "histogram (luma)",       run_histogram,  (void *) 0,         0xDDF59B4E },
+    { "histogram (RGB)",        run_histogram,  (void *) 1,         0xD9B58D8C },
+    { "waveform",               run_waveform,   0,                  0xAF7CF5FA },
+    { "peaking solid",          run_peaking,    &peak_solid,        0x558026D3 },
+    { "peaking solid, edges",   run_peaking,    &peak_solid_edges,  0x46242ABA },
+    { "peaking solid, gray",    run_peaking,    &peak_solid_gray,   0x93071A32 },
+    { "peaking alpha",          run_peaking,    &peak_alpha,        0x7C7320CB },
+    { "peaking alpha, gray",    run_peaking,    &peak_alpha_gray,   0x4F5247BA },
+    { "peaking sharpen",        run_peaking,    &peak_sharpen,      0x4D37D20E },
+    { "peaking raw",            run_peaking,    &peak_raw,          0x330DBE75 },
+};
+
+#define COUNT(x) ((int)(sizeof(x)/sizeof((x)[0])))
+
+static uint64_t get_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void benchmark(int iterations)
+{
+    double pixels = (double) width * height;
+
+    printf("%dx%d, %d iterations\n\n", width, height, iterations);
+    #ifdef HAS_RDTSC
+    printf("%-24s %10s %10s %10s\n", "kernel", "cycles/px", "ns/px", "Mpx/s");
+    #else
+    printf("%-24s %10s %10s\n", "kernel", "ns/px", "Mpx/s");
+    #endif
+
+    for (int k = 0; k < COUNT(kernels); k++)
+    {
+        /* warm up the caches */
+        kernels[k].run(kernels[k].arg);
+
+        uint64_t t0 = get_ns();
+        #ifdef HAS_RDTSC
+        uint64_t c0 = __rdtsc();
+        #endif
+
+        for (int i = 0; i < iterations; i++)
+        {
+            kernels[k].run(kernels[k].arg);
+        }
+
+        #ifdef HAS_RDTSC
+        uint64_t c1 = __rdtsc();
+        #endif
+        uint64_t t1 = get_ns();
+
+        /* this includes the checksum, which is cheap compared to the kernels */
+        double ns_px = (t1 - t0) / pixels / iterations;
+        #ifdef HAS_RDTSC
+        double cycles_px = (c1 - c0) / pixels / iterations;
+        printf("%-24s %10.2f %10.3f %10.1f\n", kernels[k].name, cycles_px, ns_px, 1000 / ns_px);
+        #else
+        printf("%-24s %10.3f %10.1f\n", kernels[k].name, ns_px, 1000 / ns_px);
+        #endif
+    }
+}
+
+static int check(int print_golden)
+{
+    int errors = 0;
+
+    for (int k = 0; k < COUNT(kernels); k++)
+    {
+        uint32_t hash = kernels[k].run(kernels[k].arg);
+
+        if (print_golden)
+        {
+            printf("%-24s 0x%08X\n", kernels[k].name, hash);
+        }
+        else if (hash != kernels[k].golden)
+        {
+            printf("%-24s FAILED (0x%08X, expected 0x%08X)\n", kernels[k].name, hash, kernels[k].golden);
+            errors++;
+        }
+        else
+        {
+            printf("%-24s OK\n", kernels[k].name);
+        }
+    }
+
+    return errors ? 1 : 0;
+}
+
+static void usage(const char * prog)
+{
+    printf("usage: %s [-n iterations] [-w width -h height] [frame.422]\n", prog);
+    printf("       %s --check | --golden\n", prog);
+}
+
+int main(int argc, char ** argv)
+{
+    int iterations = 100;
+    int do_check = 0;
+    int print_golden = 0;
+    const char * filename = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--check"))
+        {
+            do_check = 1;
+        }
+        else if (!strcmp(argv[i], "--golden"))
+        {
+            print_golden = 1;
+        }
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+        {
+            iterations = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-w") && i + 1 < argc)
+        {
+            width = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-h") && i + 1 < argc)
+        {
+            height = atoi(argv[++i]);
+        }
+        else if (argv[i][0] != '-' && !filename)
+        {
+            filename = argv[i];
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (do_check || print_golden)
+    {
+        if (filename || width != 720 || height != 480)
+        {
+            printf("Checks are done on the 720x480 synthetic frame only.\n");
+            return 1;
+        }
+    }
+
+    if (width < 4 || height < 3 || width % 2 || iterations < 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    precompute_yuv2rgb();
+
+    /* same scaling as peak_disp_filter, with the initial threshold */
+    const int thr = 50;
+    for (int i = 0, i_fthr = 0; i < 255; i++, i_fthr += FOCUSED_THR)
+        peak_scaling[i] = MIN(i_fthr / thr, 255);
+
+    frame = malloc(width * height * 2);
+    dst = malloc(width * height * 2);
+    zebras = malloc(width * height / 2);
+    if (!frame || !dst || !zebras)
+    {
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    if (filename)
+    {
+        if (!load_frame(filename)) return 1;
+    }
+    else
+    {
+        synthetic_frame();
+    }
+
+    if (do_check || print_golden)
+    {
+        return check(print_golden);
+    }
+
+    benchmark(iterations);
+    return 0;
+}
@@ -32,22 +32,53 @@
 #include <string.h>
 #include <math.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "amaze-port.c"
 
-void amaze_demosaic_RT(
-    float** rawData,    /* holds preprocessed pixel values, rawData[i][j] corresponds to the ith row and jth column */
-    float** red,        /* the interpolated red plane */
-    float** green,      /* the interpolated green plane */
-    float** blue,       /* the interpolated blue plane */
-    int winx, int winy, /* crop window for demosaicing */
-    int winw, int winh
-)
+#define TS 160	 // Tile size; the image is processed in square tiles to lower memory requirements and facilitate multi-threading
+#define TSH 80	 // half of Tile size
+
+/* the tiles overlap by 32 pixels (16 on each side); each one only writes its inner area, so they can run in parallel */
+struct amaze_tiles
+{
+    float** rawData;
+    float** red;
+    float** green;
+    float** blue;
+    int winx, winy;
+    int winw, winh;
+    int tiles_x;                /* tiles in one row */
+    int num_tiles;
+    int next_tile;              /* next tile to be handed out */
+    pthread_mutex_t mutex;
+};
+
+/* returns 0 when there are no more tiles */
+static int amaze_next_tile(struct amaze_tiles* t, int* top, int* left)
 {
-    printf ("AMaZE interpolation ...\n");
+    pthread_mutex_lock(&t->mutex);
+    int tile = t->next_tile++;
+    pthread_mutex_unlock(&t->mutex);
 
-    clock_t	t1,t2;
-    t1 = clock();
+    if (tile >= t->num_tiles)
+        return 0;
+
+    *top  = t->winy - 16 + (tile / t->tiles_x) * (TS-32);
+    *left = t->winx - 16 + (tile % t->tiles_x) * (TS-32);
+    return 1;
+}
+
+/* one worker: takes tiles until there are none left; each worker has its own tile buffers (about 2 MB) */
+static void* amaze_demosaic_tiles(void* arg)
+{
+    struct amaze_tiles* t = arg;
+    float** rawData = t->rawData;
+    float** red = t->red;
+    float** green = t->green;
+    float** blue = t->blue;
+    int winx = t->winx, winy = t->winy;
+    int winw = t->winw, winh = t->winh;
 
 #define HCLIP(x) x //is this still necessary???
 	//min(clip_pt,x)
@@ -58,10 +89,6 @@ void amaze_demosaic_RT(
 	const float clip_pt = 1/initialGain;
 	const float clip_pt8 = 0.8f/initialGain;
 
-
-#define TS 160	 // Tile size; the image is processed in square tiles to lower memory requirements and facilitate multi-threading
-#define TSH 80	 // half of Tile size
-
 	// local variables
 
 
@@ -214,8 +241,7 @@ void amaze_demosaic_RT(
 // Issue 1676
 // use collapse(2) to collapse the 2 loops to one large loop, so there is better scaling
 //~ #pragma omp for schedule(dynamic) collapse(2) nowait
-	for (top=winy-16; top < winy+height; top += TS-32)
-		for (left=winx-16; left < winx+width; left += TS-32) {
+	while (amaze_next_tile(t, &top, &left)) {
 			memset(nyquist, 0, sizeof(char)*TS*TSH);
 			memset(rbint, 0, sizeof(float)*TS*TSH);
 			//location of tile bottom edge
@@ -227,6 +253,12 @@ void amaze_demosaic_RT(
 			//tile height (=TS except for bottom edge of image)
 			int cc1 = right - left;
 
+			// partial tiles (right and bottom edges) read a little outside the area they fill;
+			// start them from a clean buffer, so the result doesn't depend on which tile this thread did before
+			if (rr1 < TS || cc1 < TS) {
+				memset(buffer, 0, 22*sizeof(float)*TS*TS + sizeof(char)*TS*TSH+23*64 + 63);
+			}
+
 			//tile vars
 			//counters for pixel location in the image
 			int row, col;
@@ -1403,10 +1435,50 @@ void amaze_demosaic_RT(
 }
 
 	// done
+	return 0;
+}
 
-#undef TS
-
-t2 = clock() - t1;
-printf("Amaze took %.2f s\n", (double)t2 / CLOCKS_PER_SEC);
-
+void amaze_demosaic_RT(
+    float** rawData,    /* holds preprocessed pixel values, rawData[i][j] corresponds to the ith row and jth column */
+    float** red,        /* the interpolated red plane */
+    float** green,      /* the interpolated green plane */
+    float** blue,       /* the interpolated blue plane */
+    int winx, int winy, /* crop window for demosaicing */
+    int winw, int winh,
+    int threads         /* worker threads */
+)
+{
+    /* same tile grid as the original "for top, for left" loop */
+    struct amaze_tiles t = {
+        .rawData = rawData,
+        .red = red,
+        .green = green,
+        .blue = blue,
+        .winx = winx, .winy = winy,
+        .winw = winw, .winh = winh,
+        .tiles_x = (winw + 16 + TS-33) / (TS-32),
+        .num_tiles = (winw + 16 + TS-33) / (TS-32) * ((winh + 16 + TS-33) / (TS-32)),
+        .next_tile = 0,
+    };
+    pthread_mutex_init(&t.mutex, 0);
+
+    pthread_t tid[64];
+    int n = 0;
+    for (n = 0; n < threads-1 && n < 64; n++)
+    {
+        if (pthread_create(&tid[n], 0, amaze_demosaic_tiles, &t))
+            break;
+    }
+
+    /* this thread is a worker too */
+    amaze_demosaic_tiles(&t);
+
+    for (int i = 0; i < n; i++)
+    {
+        pthread_join(tid[i], 0);
+    }
+    pthread_mutex_destroy(&t.mutex);
 }
+
+#undef TS
+#undef TSH
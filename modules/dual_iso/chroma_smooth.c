@@ -1,41 +1,128 @@
+/* vector medians for the SIMD path; needs optmed.h included before */
+#include "optmed_simd.h"
+
 #ifdef CHROMA_SMOOTH_2X2
 #define CHROMA_SMOOTH_FUNC chroma_smooth_2x2
+#define CHROMA_SMOOTH_CELL chroma_smooth_2x2_cell
+#define CHROMA_SMOOTH_REF chroma_smooth_2x2_ref
+#define CHROMA_SMOOTH_SIMD chroma_smooth_2x2_simd
 #define CHROMA_SMOOTH_MAX_IJ 2
 #define CHROMA_SMOOTH_FILTER_SIZE 5
 #define CHROMA_SMOOTH_MEDIAN opt_med5
+#define CHROMA_SMOOTH_MEDIAN_SIMD opt_med5_simd
 #elif defined(CHROMA_SMOOTH_3X3)
 #define CHROMA_SMOOTH_FUNC chroma_smooth_3x3
+#define CHROMA_SMOOTH_CELL chroma_smooth_3x3_cell
+#define CHROMA_SMOOTH_REF chroma_smooth_3x3_ref
+#define CHROMA_SMOOTH_SIMD chroma_smooth_3x3_simd
 #define CHROMA_SMOOTH_MAX_IJ 2
 #define CHROMA_SMOOTH_FILTER_SIZE 9
 #define CHROMA_SMOOTH_MEDIAN opt_med9
+#define CHROMA_SMOOTH_MEDIAN_SIMD opt_med9_simd
 #else
 #define CHROMA_SMOOTH_FUNC chroma_smooth_5x5
+#define CHROMA_SMOOTH_CELL chroma_smooth_5x5_cell
+#define CHROMA_SMOOTH_REF chroma_smooth_5x5_ref
+#define CHROMA_SMOOTH_SIMD chroma_smooth_5x5_simd
 #define CHROMA_SMOOTH_MAX_IJ 4
 #define CHROMA_SMOOTH_FILTER_SIZE 25
 #define CHROMA_SMOOTH_MEDIAN opt_med25
+#define CHROMA_SMOOTH_MEDIAN_SIMD opt_med25_simd
 #endif
 
-static void CHROMA_SMOOTH_FUNC(uint32_t * inp, uint32_t * out, int* raw2ev, int* ev2raw)
+/* one 2x2 cell at (x,y); scalar reference, also used for the right edge of the SIMD version */
+static inline void CHROMA_SMOOTH_CELL(uint32_t * inp, uint32_t * out, int* raw2ev, int* ev2raw, int x, int y, int w)
+{
+    int g1 = inp[x+1 +     y * w];
+    int g2 = inp[x   + (y+1) * w];
+    int ge = (raw2ev[g1] + raw2ev[g2]) / 2;
+    
+    /* looks ugly in darkness */
+    if (ge < 2*EV_RESOLUTION) return;
+
+    int i,j;
+    int k = 0;
+    int med_r[CHROMA_SMOOTH_FILTER_SIZE];
+    int med_b[CHROMA_SMOOTH_FILTER_SIZE];
+    for (i = -CHROMA_SMOOTH_MAX_IJ; i <= CHROMA_SMOOTH_MAX_IJ; i += 2)
+    {
+        for (j = -CHROMA_SMOOTH_MAX_IJ; j <= CHROMA_SMOOTH_MAX_IJ; j += 2)
+        {
+            #ifdef CHROMA_SMOOTH_2X2
+            if (ABS(i) + ABS(j) == 4)
+                continue;
+            #endif
+            
+            int r  = inp[x+i   +   (y+j) * w];
+            int g1 = inp[x+i+1 +   (y+j) * w];
+            int g2 = inp[x+i   + (y+j+1) * w];
+            int b  = inp[x+i+1 + (y+j+1) * w];
+            
+            int ge = (raw2ev[g1] + raw2ev[g2]) / 2;
+            med_r[k] = raw2ev[r] - ge;
+            med_b[k] = raw2ev[b] - ge;
+            k++;
+        }
+    }
+    int dr = CHROMA_SMOOTH_MEDIAN(med_r);
+    int db = CHROMA_SMOOTH_MEDIAN(med_b);
+
+    if (ge + dr <= EV_RESOLUTION) return;
+    if (ge + db <= EV_RESOLUTION) return;
+
+    out[x   +     y * w] = ev2raw[COERCE(ge + dr, 0, 14*EV_RESOLUTION-1)];
+    out[x+1 + (y+1) * w] = ev2raw[COERCE(ge + db, 0, 14*EV_RESOLUTION-1)];
+}
+
+/* rows y0...y1-1 (y0 even); the output rows only depend on the input image, so bands can run in parallel */
+static inline void CHROMA_SMOOTH_REF(uint32_t * inp, uint32_t * out, int* raw2ev, int* ev2raw, int y0, int y1)
 {
     int w = raw_info.width;
     int h = raw_info.height;
     int x,y;
 
-    for (y = 4; y < h-5; y += 2)
+    for (y = MAX(y0, 4); y < MIN(y1, h-5); y += 2)
     {
         for (x = 4; x < w-4; x += 2)
         {
-            int g1 = inp[x+1 +     y * w];
-            int g2 = inp[x   + (y+1) * w];
-            int ge = (raw2ev[g1] + raw2ev[g2]) / 2;
+            CHROMA_SMOOTH_CELL(inp, out, raw2ev, ev2raw, x, y, w);
+        }
+    }
+}
+
+#if OPTMED_SIMD_LANES
+/* 
+ * OPTMED_SIMD_LANES neighbouring cells (x, x+2, x+4...) at once:
+ * the table lookups are scalar, the median networks run on vectors,
+ * then every lane takes the same decisions as the scalar code.
+ */
+static void CHROMA_SMOOTH_SIMD(uint32_t * inp, uint32_t * out, int* raw2ev, int* ev2raw, int y0, int y1)
+{
+    int w = raw_info.width;
+    int h = raw_info.height;
+    int x,y,l;
+
+    for (y = MAX(y0, 4); y < MIN(y1, h-5); y += 2)
+    {
+        for (x = 4; x + 2 * (OPTMED_SIMD_LANES-1) < w-4; x += 2 * OPTMED_SIMD_LANES)
+        {
+            int ge[OPTMED_SIMD_LANES];
+            int all_dark = 1;
+            for (l = 0; l < OPTMED_SIMD_LANES; l++)
+            {
+                int xl = x + 2*l;
+                int g1 = inp[xl+1 +     y * w];
+                int g2 = inp[xl   + (y+1) * w];
+                ge[l] = (raw2ev[g1] + raw2ev[g2]) / 2;
+                all_dark &= (ge[l] < 2*EV_RESOLUTION);
+            }
             
-            /* looks ugly in darkness */
-            if (ge < 2*EV_RESOLUTION) continue;
+            if (all_dark) continue;
 
             int i,j;
             int k = 0;
-            int med_r[CHROMA_SMOOTH_FILTER_SIZE];
-            int med_b[CHROMA_SMOOTH_FILTER_SIZE];
+            vint32 med_r[CHROMA_SMOOTH_FILTER_SIZE];
+            vint32 med_b[CHROMA_SMOOTH_FILTER_SIZE];
             for (i = -CHROMA_SMOOTH_MAX_IJ; i <= CHROMA_SMOOTH_MAX_IJ; i += 2)
             {
                 for (j = -CHROMA_SMOOTH_MAX_IJ; j <= CHROMA_SMOOTH_MAX_IJ; j += 2)
@@ -45,30 +132,66 @@ static void CHROMA_SMOOTH_FUNC(uint32_t * inp, uint32_t * out, int* raw2ev, int*
                         continue;
                     #endif
                     
-                    int r  = inp[x+i   +   (y+j) * w];
-                    int g1 = inp[x+i+1 +   (y+j) * w];
-                    int g2 = inp[x+i   + (y+j+1) * w];
-                    int b  = inp[x+i+1 + (y+j+1) * w];
-                    
-                    int ge = (raw2ev[g1] + raw2ev[g2]) / 2;
-                    med_r[k] = raw2ev[r] - ge;
-                    med_b[k] = raw2ev[b] - ge;
+                    int lane_r[OPTMED_SIMD_LANES];
+                    int lane_b[OPTMED_SIMD_LANES];
+                    for (l = 0; l < OPTMED_SIMD_LANES; l++)
+                    {
+                        int xl = x + 2*l;
+                        int r  = inp[xl+i   +   (y+j) * w];
+                        int g1 = inp[xl+i+1 +   (y+j) * w];
+                        int g2 = inp[xl+i   + (y+j+1) * w];
+                        int b  = inp[xl+i+1 + (y+j+1) * w];
+                        
+                        int ge = (raw2ev[g1] + raw2ev[g2]) / 2;
+                        lane_r[l] = raw2ev[r] - ge;
+                        lane_b[l] = raw2ev[b] - ge;
+                    }
+                    med_r[k] = VINT32_LOAD(lane_r);
+                    med_b[k] = VINT32_LOAD(lane_b);
                     k++;
                 }
             }
-            int dr = CHROMA_SMOOTH_MEDIAN(med_r);
-            int db = CHROMA_SMOOTH_MEDIAN(med_b);
+            
+            int dr[OPTMED_SIMD_LANES];
+            int db[OPTMED_SIMD_LANES];
+            VINT32_STORE(dr, CHROMA_SMOOTH_MEDIAN_SIMD(med_r));
+            VINT32_STORE(db, CHROMA_SMOOTH_MEDIAN_SIMD(med_b));
 
-            if (ge + dr <= EV_RESOLUTION) continue;
-            if (ge + db <= EV_RESOLUTION) continue;
+            for (l = 0; l < OPTMED_SIMD_LANES; l++)
+            {
+                int xl = x + 2*l;
+                if (ge[l] < 2*EV_RESOLUTION) continue;
+                if (ge[l] + dr[l] <= EV_RESOLUTION) continue;
+                if (ge[l] + db[l] <= EV_RESOLUTION) continue;
 
-            out[x   +     y * w] = ev2raw[COERCE(ge + dr, 0, 14*EV_RESOLUTION-1)];
-            out[x+1 + (y+1) * w] = ev2raw[COERCE(ge + db, 0, 14*EV_RESOLUTION-1)];
+                out[xl   +     y * w] = ev2raw[COERCE(ge[l] + dr[l], 0, 14*EV_RESOLUTION-1)];
+                out[xl+1 + (y+1) * w] = ev2raw[COERCE(ge[l] + db[l], 0, 14*EV_RESOLUTION-1)];
+            }
+        }
+        
+        /* leftover cells */
+        for ( ; x < w-4; x += 2)
+        {
+            CHROMA_SMOOTH_CELL(inp, out, raw2ev, ev2raw, x, y, w);
         }
     }
 }
+#endif
+
+static void CHROMA_SMOOTH_FUNC(uint32_t * inp, uint32_t * out, int* raw2ev, int* ev2raw, int y0, int y1)
+{
+#if OPTMED_SIMD_LANES
+    CHROMA_SMOOTH_SIMD(inp, out, raw2ev, ev2raw, y0, y1);
+#else
+    CHROMA_SMOOTH_REF(inp, out, raw2ev, ev2raw, y0, y1);
+#endif
+}
 
 #undef CHROMA_SMOOTH_FUNC
+#undef CHROMA_SMOOTH_CELL
+#undef CHROMA_SMOOTH_REF
+#undef CHROMA_SMOOTH_SIMD
 #undef CHROMA_SMOOTH_MAX_IJ
 #undef CHROMA_SMOOTH_FILTER_SIZE
 #undef CHROMA_SMOOTH_MEDIAN
+#undef CHROMA_SMOOTH_MEDIAN_SIMD
@@ -0,0 +1,438 @@
+#include <stdint.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../src/chdk-dng.h"
+#include "../mlv_rec/lj92.h"
+#include "cr2-reader.h"
+
+/* CR2 files are always little endian ("II") */
+/* offsets are 64-bit, so callers can add to untrusted 32-bit values from the file without wrapping around */
+static int get2(struct cr2_info* cr2, uint64_t offset)
+{
+    if (cr2->size < 2 || offset > cr2->size - 2) return 0;
+    uint8_t* p = cr2->data + offset;
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get4(struct cr2_info* cr2, uint64_t offset)
+{
+    if (cr2->size < 4 || offset > cr2->size - 4) return 0;
+    uint8_t* p = cr2->data + offset;
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int tiff_type_size(int type)
+{
+    switch (type)
+    {
+        case 1: case 2: case 6: case 7: return 1;   /* BYTE, ASCII, SBYTE, UNDEFINED */
+        case 3: case 8:                 return 2;   /* SHORT, SSHORT */
+        case 4: case 9: case 11:        return 4;   /* LONG, SLONG, FLOAT */
+        case 5: case 10: case 12:       return 8;   /* RATIONAL, SRATIONAL, DOUBLE */
+        default:                        return 0;
+    }
+}
+
+/* offset of the value of an IFD entry (inline values are stored in the entry itself) */
+static uint32_t tag_value_offset(struct cr2_info* cr2, uint32_t entry)
+{
+    int type = get2(cr2, (uint64_t) entry + 2);
+    uint32_t count = get4(cr2, (uint64_t) entry + 4);
+    uint64_t size = (uint64_t) tiff_type_size(type) * count;
+    return size <= 4 ? entry + 8 : get4(cr2, (uint64_t) entry + 8);
+}
+
+/* returns the offset of the entry with the given tag, or 0 */
+static uint32_t find_tag(struct cr2_info* cr2, uint32_t ifd, int tag)
+{
+    int entries = get2(cr2, ifd);
+    for (int i = 0; i < entries; i++)
+    {
+        uint64_t entry = (uint64_t) ifd + 2 + i * 12;
+        if (entry + 12 > cr2->size) break;
+        if (get2(cr2, entry) == tag) return entry;
+    }
+    return 0;
+}
+
+static int read_int(struct cr2_info* cr2, uint32_t ifd, int tag, int def)
+{
+    uint32_t entry = find_tag(cr2, ifd, tag);
+    if (!entry) return def;
+    uint32_t value = tag_value_offset(cr2, entry);
+    return get2(cr2, (uint64_t) entry + 2) == 3 ? get2(cr2, value) : (int) get4(cr2, value);
+}
+
+static void read_rational(struct cr2_info* cr2, uint32_t ifd, int tag, int* out)
+{
+    uint32_t entry = find_tag(cr2, ifd, tag);
+    if (!entry) return;
+    uint32_t value = tag_value_offset(cr2, entry);
+    out[0] = get4(cr2, value);
+    out[1] = get4(cr2, (uint64_t) value + 4);
+}
+
+/* copies an ASCII tag, without the trailing spaces some cameras pad their strings with */
+static void read_string(struct cr2_info* cr2, uint32_t ifd, int tag, char* out, int out_size)
+{
+    uint32_t entry = find_tag(cr2, ifd, tag);
+    if (!entry) return;
+    uint32_t count = get4(cr2, (uint64_t) entry + 4);
+    uint32_t value = tag_value_offset(cr2, entry);
+    if (value >= cr2->size) return;
+    if (count > cr2->size - value) count = cr2->size - value;
+    if (count > (uint32_t) out_size - 1) count = out_size - 1;
+    memcpy(out, cr2->data + value, count);
+    out[count] = 0;
+    int len = strlen(out);
+    while (len > 0 && out[len-1] == ' ')
+        out[--len] = 0;
+}
+
+static void read_makernotes(struct cr2_info* cr2, uint32_t ifd)
+{
+    if (!cr2->serial[0])
+    {
+        uint32_t serial = read_int(cr2, ifd, 0x000C, 0);
+        if (serial) snprintf(cr2->serial, sizeof(cr2->serial), "%u", serial);
+    }
+
+    if (!cr2->lens[0])
+    {
+        read_string(cr2, ifd, 0x0095, cr2->lens, sizeof(cr2->lens));
+    }
+
+    /* SensorInfo: int16u[17], borders at indices 5...8 */
+    uint32_t entry = find_tag(cr2, ifd, 0x00E0);
+    if (entry && get4(cr2, (uint64_t) entry + 4) >= 9)
+    {
+        uint64_t value = tag_value_offset(cr2, entry);
+        cr2->sensor_left   = get2(cr2, value + 5*2);
+        cr2->sensor_top    = get2(cr2, value + 6*2);
+        cr2->sensor_right  = get2(cr2, value + 7*2);
+        cr2->sensor_bottom = get2(cr2, value + 8*2);
+    }
+
+    /* ColorData: the layout depends on the camera generation, identified by the number of entries */
+    /* WB_RGGBLevelsAsShot, followed by ColorTempAsShot, WB_RGGBLevelsAuto, ColorTempAuto, WB_RGGBLevelsMeasured */
+    entry = find_tag(cr2, ifd, 0x4001);
+    if (entry)
+    {
+        uint32_t count = get4(cr2, (uint64_t) entry + 4);
+        uint64_t value = tag_value_offset(cr2, entry);
+        int as_shot = 0;
+        int measured = 0;
+
+        switch (count)
+        {
+            case 582:                               /* ColorData1: 20D, 350D */
+                as_shot = 0x19;
+                break;
+            case 653:                               /* ColorData2: 1D Mark II (offset from dcraw) */
+                as_shot = 0x22;
+                break;
+            case 796:                               /* ColorData3: 5D, 30D, 400D */
+            case 674: case 692: case 702:           /* ColorData4: 40D, 50D, 450D, 500D, 5D Mark II, 7D, 550D... */
+            case 1227: case 1250: case 1251:
+            case 1337: case 1338: case 1346:
+            case 1273: case 1275:                   /* ColorData6: 600D, 1100D */
+            case 1312: case 1313: case 1316:        /* ColorData7: 5D Mark III, 6D, 650D, 700D, 70D... */
+            case 1506:
+            case 1560: case 1592: case 1353:        /* ColorData8 */
+            case 1602:
+                as_shot = 0x3F;
+                measured = as_shot + 10;
+                break;
+            case 1816: case 1820: case 1824:        /* ColorData9 */
+                as_shot = 0x47;
+                measured = as_shot + 10;
+                break;
+        }
+
+        for (int c = 0; c < 4; c++)
+        {
+            if (as_shot) cr2->wb_rggb_as_shot[c] = get2(cr2, value + (as_shot + c) * 2);
+            if (measured) cr2->wb_rggb_measured[c] = get2(cr2, value + (measured + c) * 2);
+        }
+    }
+}
+
+static void read_exif(struct cr2_info* cr2, uint32_t ifd)
+{
+    read_rational(cr2, ifd, 0x829A, cr2->shutter);
+    read_rational(cr2, ifd, 0x829D, cr2->aperture);
+    cr2->iso = read_int(cr2, ifd, 0x8827, 0);
+    read_string(cr2, ifd, 0x9003, cr2->datetime, sizeof(cr2->datetime));
+    read_rational(cr2, ifd, 0x9204, cr2->exposure_bias);
+    read_rational(cr2, ifd, 0x920A, cr2->focal_length);
+    read_string(cr2, ifd, 0x9291, cr2->subsectime, sizeof(cr2->subsectime));
+    cr2->white_balance = read_int(cr2, ifd, 0xA403, -1);
+    read_string(cr2, ifd, 0xA431, cr2->serial, sizeof(cr2->serial));
+    read_string(cr2, ifd, 0xA434, cr2->lens, sizeof(cr2->lens));
+
+    /* Canon maker notes are a plain IFD, with offsets relative to the TIFF header */
+    uint32_t entry = find_tag(cr2, ifd, 0x927C);
+    if (entry)
+    {
+        read_makernotes(cr2, tag_value_offset(cr2, entry));
+    }
+}
+
+int cr2_open(const char* filename, struct cr2_info* cr2)
+{
+    memset(cr2, 0, sizeof(*cr2));
+    cr2->white_balance = -1;
+
+    FILE* f = fopen(filename, "rb");
+    if (!f)
+    {
+        printf("Could not open %s\n", filename);
+        return 0;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    if (size < 16 || size > 0x7FFFFFFF)
+    {
+        goto not_cr2;
+    }
+
+    cr2->size = size;
+    cr2->data = malloc(size);
+    if (!cr2->data)
+    {
+        printf("Could not allocate %ld bytes for %s\n", size, filename);
+        fclose(f);
+        return 0;
+    }
+
+    if (fread(cr2->data, 1, size, f) != (size_t) size)
+    {
+        printf("Could not read %s\n", filename);
+        fclose(f);
+        cr2_close(cr2);
+        return 0;
+    }
+    fclose(f);
+    f = 0;
+
+    if (get2(cr2, 0) != 0x4949 || get2(cr2, 2) != 42 || get2(cr2, 8) != 0x5243)
+    {
+        goto not_cr2;
+    }
+
+    /* IFD0 has the EXIF info; the raw data is the IFD whose strip is a lossless JPEG (usually IFD3) */
+    uint32_t ifd0 = get4(cr2, 4);
+    read_string(cr2, ifd0, 0x10F, cr2->make, sizeof(cr2->make));
+    read_string(cr2, ifd0, 0x110, cr2->model, sizeof(cr2->model));
+    read_string(cr2, ifd0, 0x13B, cr2->artist, sizeof(cr2->artist));
+    read_string(cr2, ifd0, 0x8298, cr2->copyright, sizeof(cr2->copyright));
+    cr2->orientation = read_int(cr2, ifd0, 0x112, 1);
+
+    uint32_t exif = read_int(cr2, ifd0, 0x8769, 0);
+    if (exif)
+    {
+        read_exif(cr2, exif);
+    }
+
+    lj92_info_t jpeg;
+    int ifds = 0;
+    for (uint32_t ifd = ifd0; ifd && ifd < cr2->size - 2 && ifds < 8; ifds++)
+    {
+        uint32_t offset = read_int(cr2, ifd, 0x111, 0);
+        uint32_t bytes = read_int(cr2, ifd, 0x117, 0);
+
+        if (offset && bytes && offset < cr2->size && bytes <= cr2->size - offset &&
+            lj92_read_info(cr2->data + offset, bytes, &jpeg) == LJ92_ERR_OK)
+        {
+            cr2->raw_offset = offset;
+            cr2->raw_size = bytes;
+
+            uint32_t entry = find_tag(cr2, ifd, 0xC640);
+            if (entry && get4(cr2, (uint64_t) entry + 4) == 3)
+            {
+                uint64_t value = tag_value_offset(cr2, entry);
+                for (int i = 0; i < 3; i++)
+                    cr2->slices[i] = get2(cr2, value + i * 2);
+            }
+            break;
+        }
+
+        ifd = get4(cr2, (uint64_t) ifd + 2 + get2(cr2, ifd) * 12);
+    }
+
+    if (!cr2->raw_offset)
+    {
+        goto not_cr2;
+    }
+
+    /* frame geometry, as in dcraw; the slice tag comes from the file, so do the math in 64 bits */
+    /* cr2_decode allocates the whole frame, so keep its size in bytes within an int */
+    int64_t samples = (int64_t) jpeg.width * jpeg.components * jpeg.height;
+    int64_t raw_width;
+    if (cr2->slices[0])
+    {
+        raw_width = (int64_t) cr2->slices[0] * cr2->slices[1] + cr2->slices[2];
+    }
+    else
+    {
+        raw_width = (int64_t) jpeg.width * jpeg.components;
+        if (raw_width > 4 * jpeg.height)
+        {
+            raw_width /= 2;
+        }
+    }
+    int64_t raw_height = raw_width ? samples / raw_width : 0;
+    cr2->bits = jpeg.bitdepth;
+
+    if (!raw_height || raw_width * raw_height != samples || samples > INT_MAX / 2)
+    {
+        printf("Unsupported CR2 layout (%dx%d x%d components, slices %d %d %d)\n",
+            jpeg.width, jpeg.height, jpeg.components, cr2->slices[0], cr2->slices[1], cr2->slices[2]);
+        cr2_close(cr2);
+        return 0;
+    }
+
+    cr2->raw_width = raw_width;
+    cr2->raw_height = raw_height;
+    return 1;
+
+not_cr2:
+    printf("Not a CR2 file: %s\n", filename);
+    if (f) fclose(f);
+    cr2_close(cr2);
+    return 0;
+}
+
+int cr2_decode(struct cr2_info* cr2, uint16_t* buf)
+{
+    int samples = cr2->raw_width * cr2->raw_height;
+    uint16_t* jpeg = malloc(samples * sizeof(jpeg[0]));
+    if (!jpeg)
+    {
+        printf("Could not allocate %d bytes\n", samples * (int)sizeof(jpeg[0]));
+        return 0;
+    }
+
+    int r = lj92_decode(cr2->data + cr2->raw_offset, cr2->raw_size, jpeg, samples, 0);
+    if (r != LJ92_ERR_OK)
+    {
+        printf("Lossless JPEG decoding failed (%d)\n", r);
+        free(jpeg);
+        return 0;
+    }
+
+    if (cr2->slices[0])
+    {
+        /* the JPEG frame holds vertical slices one after another, each one full height */
+        uint16_t* src = jpeg;
+        for (int s = 0; s <= cr2->slices[0]; s++)
+        {
+            int width = s < cr2->slices[0] ? cr2->slices[1] : cr2->slices[2];
+            for (int y = 0; y < cr2->raw_height; y++)
+            {
+                memcpy(&buf[y * cr2->raw_width + s * cr2->slices[1]], src, width * sizeof(buf[0]));
+                src += width;
+            }
+        }
+    }
+    else
+    {
+        memcpy(buf, jpeg, samples * sizeof(buf[0]));
+    }
+
+    /* dcraw quirk for raw_width == 3984 (1D Mark III): data is shifted by two pixels */
+    if (cr2->raw_width == 3984)
+    {
+        memmove(buf, buf + 2, (samples - 2) * sizeof(buf[0]));
+        buf[samples-2] = buf[samples-1] = 0;
+    }
+
+    free(jpeg);
+    return 1;
+}
+
+void cr2_close(struct cr2_info* cr2)
+{
+    if (cr2->data)
+    {
+        free(cr2->data);
+    }
+    cr2->data = 0;
+    cr2->size = 0;
+}
+
+const char* cr2_camera_model(struct cr2_info* cr2)
+{
+    if (strncmp(cr2->model, "Canon ", 6) == 0)
+    {
+        return cr2->model + 6;
+    }
+
+    if (!cr2->model[0])
+    {
+        printf("**WARNING** Could not identify the camera from EXIF. Assuming 5D Mark III.\n");
+        return "EOS 5D Mark III";
+    }
+
+    return cr2->model;
+}
+
+int cr2_read_white_balance(struct cr2_info* cr2, float* red_balance, float* blue_balance)
+{
+    int mode = cr2->white_balance;
+    int* wb = mode != 0 ? cr2->wb_rggb_as_shot : cr2->wb_rggb_measured;
+
+    if (mode < 0 || !wb[0] || !wb[1] || !wb[2] || !wb[3])
+    {
+        return 0;
+    }
+
+    /* see read_white_balance in exiftool-bridge.c */
+    if ((mode != 0) || (wb[1]-wb[2] > wb[2]/2) || (wb[2]-wb[1] > wb[1]/2))
+    {
+        printf("White balance   : from %s\n", mode != 0 ? "WB_RGGBLevelsAsShot" : "WB_RGGBLevelsMeasured");
+        *red_balance = ((float)wb[0])/wb[1];
+        *blue_balance = ((float)wb[3])/wb[2];
+        return 1;
+    }
+
+    /* needs RawMeasuredRGGB */
+    return 0;
+}
+
+static const char dual_iso_xmp[] =
+    "<?xpacket begin='\xEF\xBB\xBF' id='W5M0MpCehiHzreSzNTczkc9d'?>\n"
+    "<x:xmpmeta xmlns:x='adobe:ns:meta/'>\n"
+    " <rdf:RDF xmlns:rdf='http://www.w3.org/1999/02/22-rdf-syntax-ns#'>\n"
+    "  <rdf:Description rdf:about='' xmlns:dc='http://purl.org/dc/elements/1.1/'>\n"
+    "   <dc:subject><rdf:Bag><rdf:li>Dual-ISO</rdf:li></rdf:Bag></dc:subject>\n"
+    "  </rdf:Description>\n"
+    " </rdf:RDF>\n"
+    "</x:xmpmeta>\n"
+    "<?xpacket end='w'?>";
+
+void cr2_copy_tags_to_dng(struct cr2_info* cr2)
+{
+    /* Model and UniqueCameraModel; Make is always Canon */
+    dng_set_camname(cr2->model);
+    dng_set_camserial(cr2->serial);
+    dng_set_lensmodel(cr2->lens);
+    dng_set_artist(cr2->artist);
+    dng_set_copyright(cr2->copyright);
+    dng_set_datetime(cr2->datetime, cr2->subsectime);
+    dng_set_orientation(cr2->orientation ? cr2->orientation : 1);
+    dng_set_iso(cr2->iso);
+
+    /* missing rationals are left as 0/1, not 0/0 */
+    dng_set_shutter(cr2->shutter[0], cr2->shutter[1] ? cr2->shutter[1] : 1);
+    dng_set_aperture(cr2->aperture[0], cr2->aperture[1] ? cr2->aperture[1] : 1);
+    dng_set_exposure_bias(cr2->exposure_bias[0], cr2->exposure_bias[1] ? cr2->exposure_bias[1] : 1);
+    dng_set_focal(cr2->focal_length[0], cr2->focal_length[1] ? cr2->focal_length[1] : 1);
+
+    dng_set_xmp(dual_iso_xmp, sizeof(dual_iso_xmp) - 1);
+}
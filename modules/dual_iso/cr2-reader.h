@@ -0,0 +1,78 @@
+#ifndef _CR2_READER_H
+#define _CR2_READER_H
+
+#include <stdint.h>
+
+/*
+ * Built-in CR2 reader: TIFF container, EXIF, the Canon maker notes we need
+ * and the lossless JPEG raw data (decoded with ../mlv_rec/lj92.c).
+ *
+ * Replaces "dcraw -v -i" + "dcraw -4 -E -c" (same pixel values, including
+ * the masked borders) and most of the "exiftool" calls, so one cr2hdr process
+ * can convert a whole folder without spawning anything.
+ */
+
+struct cr2_info
+{
+    /* EXIF; strings are empty and numbers zero when missing */
+    char make[32];
+    char model[64];                 /* full EXIF model, e.g. "Canon EOS 5D Mark III" */
+    char serial[64];
+    char lens[64];
+    char artist[64];
+    char copyright[64];
+    char datetime[20];              /* DateTimeOriginal */
+    char subsectime[4];
+    int orientation;
+    int iso;
+    int shutter[2];
+    int aperture[2];
+    int exposure_bias[2];
+    int focal_length[2];
+    int white_balance;              /* EXIF WhiteBalance: 0 = auto, 1 = manual, -1 = missing */
+
+    /* Canon maker notes */
+    int wb_rggb_as_shot[4];         /* all zero if the ColorData version is unknown */
+    int wb_rggb_measured[4];
+    int sensor_left;                /* SensorInfo borders (inclusive); sensor_right is 0 if missing */
+    int sensor_top;
+    int sensor_right;
+    int sensor_bottom;
+
+    /* raw image */
+    int raw_width;
+    int raw_height;
+    int bits;
+
+    /* private */
+    uint8_t* data;
+    uint32_t size;
+    uint32_t raw_offset;
+    uint32_t raw_size;
+    int slices[3];                  /* Canon CR2 slice tag: count, width, last width */
+};
+
+/* reads the whole file and parses the metadata; returns 1 on success */
+/* on failure, it prints the reason and leaves nothing allocated */
+int cr2_open(const char* filename, struct cr2_info* cr2);
+
+/* decodes the full raw frame (raw_width x raw_height, masked areas included) into buf */
+/* returns 1 on success */
+int cr2_decode(struct cr2_info* cr2, uint16_t* buf);
+
+void cr2_close(struct cr2_info* cr2);
+
+/* model without the "Canon " prefix, as expected by get_raw_info */
+const char* cr2_camera_model(struct cr2_info* cr2);
+
+/*
+ * Same logic as read_white_balance from exiftool-bridge, from the parsed tags.
+ * Returns 0 if it needs a tag we don't decode (RawMeasuredRGGB, unknown ColorData),
+ * in which case the caller can fall back to exiftool.
+ */
+int cr2_read_white_balance(struct cr2_info* cr2, float* red_balance, float* blue_balance);
+
+/* passes the EXIF info (and UniqueCameraModel, xmp:subject=Dual-ISO) to the DNG writer; call before save_dng */
+void cr2_copy_tags_to_dng(struct cr2_info* cr2);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef _CR2HDR_LIB_H
+#define _CR2HDR_LIB_H
+
+/*
+ * cr2hdr's Dual ISO core, for video frames (mlv_dump --dual-iso).
+ * Built from cr2hdr.c with -DCR2HDR_LIB: no command line, no CR2 reading,
+ * no exiftool; all cr2hdr options keep their default values.
+ */
+
+struct raw_info;
+struct cr2hdr_clip;
+
+/*
+ * One per video clip. The line pattern, white levels, ISO match and white balance
+ * are measured on the first frame that converts successfully and reused
+ * for all the others, so the clip does not flicker and the other frames are faster.
+ */
+struct cr2hdr_clip* cr2hdr_clip_new();
+void cr2hdr_clip_free(struct cr2hdr_clip* clip);
+
+/* returns 1 once a frame of this clip was converted */
+int cr2hdr_clip_calibrated(struct cr2hdr_clip* clip);
+
+/*
+ * Converts one interlaced ISO frame, in place.
+ * Input: raw_info->buffer has width x height uint16_t pixels (14-bit values),
+ * plus one spare line, and raw_info has the levels and geometry of the frame.
+ * Output: 16-bit big endian pixels for chdk-dng; bits_per_pixel, pitch,
+ * frame_size and levels in raw_info are updated, wbgain is the AsShotNeutral
+ * for dng_set_wbgain.
+ * camera_model (EXIF style, e.g. "Canon EOS 5D Mark III") is only used for messages.
+ * Messages are printed after the frame, only if verbose is set or if it fails.
+ * Returns 1 on success; on failure, raw_info is unchanged, but the buffer is not.
+ * Frames of the same clip can be converted in parallel, from different threads.
+ */
+int cr2hdr_process_frame(struct cr2hdr_clip* clip, struct raw_info* raw_info, const char* camera_model, int wbgain[6], int verbose);
+
+#endif
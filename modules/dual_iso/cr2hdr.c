@@ -26,9 +26,11 @@
 
 #define EV_RESOLUTION 65536
 
-static int is_bright[4];
 #define BRIGHT_ROW (is_bright[y % 4])
 
+/* worker threads for one image (--threads) */
+#define MAX_THREADS 64
+
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -38,6 +40,9 @@ static int is_bright[4];
 #include <unistd.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <sys/time.h>
 
 #include "../../src/raw.h"
 #include "../../src/chdk-dng.h"
@@ -48,15 +53,20 @@ static int is_bright[4];
 
 #include "dcraw-bridge.h"
 #include "exiftool-bridge.h"
+#include "cr2-reader.h"
+#include "dng-tags.h"
 #include "adobedng-bridge.h"
 #include "dither.h"
 #include "timing.h"
 #include "kelvin.h"
+#include "cr2hdr-lib.h"
 
+#ifndef CR2HDR_LIB
 #define MODULE_STRINGS_PREFIX dual_iso_strings
 #include "../module_strings_wrapper.h"
 #include "module_strings.h"
 MODULE_STRINGS()
+#endif
 
 /** Command-line interface */
 
@@ -93,9 +103,14 @@ int compress = 0;
 int same_levels = 0;
 int skip_existing = 0;
 int embed_original = 0;
+int use_exiftool = 0;
+int jobs = 1;
+int threads = 1;
 
 int shortcut_fast = 0;
 
+/* the library build (cr2hdr-lib.h) has no command line; it runs with the defaults above */
+#ifndef CR2HDR_LIB
 void check_shortcuts()
 {
     if (shortcut_fast)
@@ -213,6 +228,10 @@ struct cmd_group options[] = {
                                     "                  To recover the original: exiftool IMG_1234.DNG -OriginalRawFileData -b > IMG_1234.CR2" },
             { &embed_original, 2, "--embed-original-copy",  "\n"
                                     "                  Similar to --embed-original, but without deleting the original.\n" },
+            { &use_exiftool,   1, "--exiftool",       "Copy all EXIF tags (including maker notes) with exiftool.\n"
+                                    "                  By default, only the common EXIF tags are copied (without external tools)." },
+            { &jobs,           1, "--jobs=%d",        "Process this many images in parallel (needs about 1 GB of RAM for each job)" },
+            { &threads,        1, "--threads=%d",     "Worker threads for each image (AMaZE, edge-directed interpolation, chroma smoothing)" },
             OPTION_EOL
         },
     },
@@ -374,6 +393,23 @@ static void solve_commandline_deps()
 {
     if (!use_fullres)
         use_alias_map = 0;
+
+    if (jobs < 1)
+        jobs = 1;
+
+    if (threads < 1)
+        threads = 1;
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+
+    /* debug files and plots have fixed names */
+    int debug = debug_black || debug_blend || debug_amaze || debug_edge || debug_alias || debug_rggb || debug_bddb || debug_wb ||
+                plot_iso_curve || plot_mix_curve || plot_fullres_curve;
+    if (debug && jobs > 1)
+    {
+        printf("Debug options require --jobs=1\n");
+        jobs = 1;
+    }
 }
 
 static void show_active_options()
@@ -403,9 +439,7 @@ static void show_active_options()
         }
     }
 }
-
-/* here we only have a global raw_info */
-#define save_dng(filename) save_dng(filename, &raw_info)
+#endif
 
 #define FAIL(fmt,...) { fprintf(stderr, "Error: "); fprintf(stderr, fmt, ## __VA_ARGS__); fprintf(stderr, "\n"); exit(1); }
 #define CHECK(ok, fmt,...) { if (!(ok)) FAIL(fmt, ## __VA_ARGS__); }
@@ -445,7 +479,8 @@ static void* malloc_or_die(size_t size)
 #define EV2RAW(x) ev2raw[COERCE(x, -10*EV_RESOLUTION, 14*EV_RESOLUTION-1)]
 #define RAW2EV(x) raw2ev[COERCE(x, 0, 0xFFFFF)]
 
-struct raw_info raw_info = {
+/* starting point for each image (the color matrix comes from get_raw_info) */
+static const struct raw_info raw_info_template = {
     .api_version = 1,
     .bits_per_pixel = 16,
     .black_level = 2048,
@@ -454,6 +489,242 @@ struct raw_info raw_info = {
     .calibration_illuminant1 = 1,       // Daylight
 };
 
+/**
+ * What hdr_interpolate measures on the image itself (besides white balance).
+ * For video (cr2hdr-lib.h), these are measured on the first frame of a clip
+ * and reused for the others, so the clip does not flicker.
+ */
+struct hdr_calib
+{
+    int rggb;                           /* from identify_rggb_or_gbrg */
+    int bright_lines[4];                /* is_bright, from identify_bright_and_dark_fields */
+    int white;                          /* 14-bit white levels from white_detect */
+    int white_bright;
+    double iso_a;                       /* exposure match: dark = iso_a * bright + iso_b (16-bit units) */
+    double iso_b;
+};
+
+/**
+ * Everything that belongs to the image being processed.
+ * 
+ * With --jobs, each worker thread owns one of these and processes one image at a time with it.
+ * The processing code reaches it through the thread-local "ctx" pointer,
+ * so raw_info and is_bright can still be used as if they were globals.
+ */
+struct cr2hdr_image
+{
+    struct raw_info raw_info;
+    int is_bright[4];
+
+    float custom_wb[3];                 /* from --wb, replaced by the WB used for this image */
+    int wbgain[6];                      /* AsShotNeutral, passed to the DNG writer */
+
+    struct cr2_info cr2;                /* EXIF info from the built-in CR2 reader */
+    int copy_tags;                      /* fill the DNG tags from cr2 when saving */
+
+    struct hdr_calib calib;             /* measured on this image */
+    const struct hdr_calib* reuse_calib;/* if set, use these instead of measuring them again */
+
+    /* lookup tables, allocated once per worker */
+    int* raw2ev;                        /* 1<<20 entries */
+    int* ev2raw_0;                      /* 24*EV_RESOLUTION entries */
+    double* fullres_curve;              /* 1<<20 entries */
+    double* mix_curve;                  /* 1<<20 entries */
+
+    /* when several images are processed in parallel, messages are printed after each image */
+    char* log;
+    int log_len;
+    int log_size;
+};
+
+static __thread struct cr2hdr_image* ctx;
+
+static void image_alloc(struct cr2hdr_image* image, int buffered_log)
+{
+    memset(image, 0, sizeof(*image));
+    image->raw2ev = malloc((1<<20) * sizeof(image->raw2ev[0]));
+    image->ev2raw_0 = malloc(24*EV_RESOLUTION * sizeof(image->ev2raw_0[0]));
+    image->fullres_curve = malloc((1<<20) * sizeof(image->fullres_curve[0]));
+    image->mix_curve = malloc((1<<20) * sizeof(image->mix_curve[0]));
+
+    if (buffered_log)
+    {
+        image->log_size = 16384;
+        image->log = malloc(image->log_size);
+        image->log[0] = 0;
+    }
+}
+
+static void image_free(struct cr2hdr_image* image)
+{
+    free(image->raw2ev);
+    free(image->ev2raw_0);
+    free(image->fullres_curve);
+    free(image->mix_curve);
+    free(image->log);
+}
+
+/* to be called before processing each image */
+static void image_reset(struct cr2hdr_image* image)
+{
+    image->raw_info = raw_info_template;
+    memset(image->is_bright, 0, sizeof(image->is_bright));
+    memcpy(image->custom_wb, custom_wb, sizeof(image->custom_wb));
+
+    /* chdk-dng default (daylight) */
+    static const int default_wbgain[6] = {473635, 1000000, 1000000, 1000000, 624000, 1000000};
+    memcpy(image->wbgain, default_wbgain, sizeof(image->wbgain));
+
+    image->copy_tags = 0;
+    image->reuse_calib = 0;
+
+    /* same anti-posterization noise for an image, regardless of what was processed before it */
+    fast_randn_reset();
+}
+
+#ifdef CR2HDR_LIB
+/* "struct raw_info" can't be spelled once raw_info is a macro */
+typedef struct raw_info cr2hdr_frame_info;
+#endif
+
+/* from here on, raw_info and is_bright refer to the image being processed by this thread */
+#define raw_info  (ctx->raw_info)
+#define is_bright (ctx->is_bright)
+
+static void image_set_wbgain(float red_balance, float blue_balance)
+{
+    int wbgain[6] = {1000000, red_balance*1000000, 1, 1, 1000000, blue_balance*1000000};
+    memcpy(ctx->wbgain, wbgain, sizeof(wbgain));
+}
+
+static int image_printf(const char* fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+
+    if (!ctx || !ctx->log)
+    {
+        int len = vprintf(fmt, ap);
+        va_end(ap);
+        return len;
+    }
+
+    char msg[1024];
+    int len = vsnprintf(msg, sizeof(msg), fmt, ap);
+    va_end(ap);
+    if (len < 0 || len >= (int)sizeof(msg))
+    {
+        len = strlen(msg);
+    }
+
+    if (ctx->log_len + len + 1 > ctx->log_size)
+    {
+        ctx->log_size = (ctx->log_len + len + 1) * 2;
+        ctx->log = realloc(ctx->log, ctx->log_size);
+        CHECK(ctx->log, "realloc");
+    }
+
+    memcpy(ctx->log + ctx->log_len, msg, len + 1);
+    ctx->log_len += len;
+    return len;
+}
+
+#define printf image_printf
+
+/* the DNG writer keeps its settings in globals, so only one image can be saved at a time */
+static pthread_mutex_t dng_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int save_image_dng(char* filename)
+{
+    pthread_mutex_lock(&dng_mutex);
+
+    int* g = ctx->wbgain;
+    dng_set_wbgain(g[0], g[1], g[2], g[3], g[4], g[5]);
+
+#ifndef CR2HDR_LIB
+    if (ctx->copy_tags)
+    {
+        cr2_copy_tags_to_dng(&ctx->cr2);
+    }
+#endif
+
+    int ok = save_dng(filename, &raw_info);
+
+    pthread_mutex_unlock(&dng_mutex);
+    return ok;
+}
+
+#define save_dng(filename) save_image_dng(filename)
+
+/*
+ * Row-parallel processing for one image (--threads):
+ * func(arg, y0, y1) is called for bands of "band" rows, on all worker threads.
+ * The workers share the image context of the caller; func must not print anything
+ * (messages are buffered per image) and must only write to its own rows.
+ * With one thread, the bands are processed in order, on the calling thread.
+ */
+struct row_bands
+{
+    void (*func)(void* arg, int y0, int y1);
+    void* arg;
+    int band;
+    int next;
+    int end;
+    struct cr2hdr_image* image;
+    pthread_mutex_t mutex;
+};
+
+static void* row_bands_worker(void* arg)
+{
+    struct row_bands* rb = arg;
+    ctx = rb->image;
+
+    while (1)
+    {
+        pthread_mutex_lock(&rb->mutex);
+        int y0 = rb->next;
+        rb->next += rb->band;
+        pthread_mutex_unlock(&rb->mutex);
+
+        if (y0 >= rb->end)
+            break;
+
+        int y1 = y0 + rb->band < rb->end ? y0 + rb->band : rb->end;
+        rb->func(rb->arg, y0, y1);
+    }
+    return 0;
+}
+
+static void parallel_rows(void (*func)(void* arg, int y0, int y1), void* arg, int y_start, int y_end, int band)
+{
+    struct row_bands rb = {
+        .func = func,
+        .arg = arg,
+        .band = band,
+        .next = y_start,
+        .end = y_end,
+        .image = ctx,
+    };
+    pthread_mutex_init(&rb.mutex, 0);
+
+    pthread_t tid[MAX_THREADS];
+    int n;
+    for (n = 0; n < threads - 1; n++)
+    {
+        if (pthread_create(&tid[n], 0, row_bands_worker, &rb))
+            break;
+    }
+
+    /* the calling thread is a worker too */
+    row_bands_worker(&rb);
+
+    for (int i = 0; i < n; i++)
+    {
+        pthread_join(tid[i], 0);
+    }
+    pthread_mutex_destroy(&rb.mutex);
+}
+
 static int hdr_check();
 static int hdr_interpolate();
 static int black_subtract(int left_margin, int top_margin);
@@ -500,9 +771,12 @@ static inline void raw_set_pixel20(int x, int y, int value)
     buf[x + y * raw_info.width] = COERCE(value, 0, 0xFFFFF);
 }
 
+#ifndef CR2HDR_LIB
+/* for the DNG thumbnail; in the library build, the caller provides it */
 int raw_get_pixel(int x, int y) {
     return raw_get_pixel16(x,y);
 }
+#endif
 
 /* from 14 bit to 16 bit */
 int raw_get_pixel_14to16(int x, int y) {
@@ -553,6 +827,7 @@ static void save_debug_dng(char* filename)
     raw_info.white_level = white20;
 }
 
+#ifndef CR2HDR_LIB
 static int is_file(const char* filename)
 {
     FILE* f = fopen(filename, "r");
@@ -567,304 +842,455 @@ static int is_file(const char* filename)
     }
 }
 
-int main(int argc, char** argv)
+/* fallback for files the built-in CR2 reader doesn't handle: run dcraw and read its PGM output */
+/* returns the raw buffer (with 1 extra line), or 0 on error */
+static void* read_raw_dcraw(const char* filename, int* raw_width, int* raw_height, int* out_width, int* out_height)
 {
-    printf("cr2hdr: a post processing tool for Dual ISO images\n\n");
-    printf("Last update: %s\n", module_get_string(dual_iso_strings, "Last update"));
-
-    fast_randn_init();
+    int r;
+    char dcraw_cmd[1000];
+    snprintf(dcraw_cmd, sizeof(dcraw_cmd), "dcraw -v -i -t 0 \"%s\"", filename);
+    FILE* t = popen(dcraw_cmd, "r");
+    CHECK(t, "%s", filename);
+    
+    const char * model = get_camera_model(filename);
+    get_raw_info(model, &raw_info);
 
-    if (argc == 1)
+    char line[100];
+    while (fgets(line, sizeof(line), t))
     {
-        printf("No input files.\n\n");
-        printf("GUI usage: drag some CR2 or DNG files over cr2hdr.exe.\n\n");
-        show_commandline_help(argv[0]);
-        return 0;
+        if (startswith(line, "Full size: "))
+        {
+            r = sscanf(line, "Full size: %d x %d\n", raw_width, raw_height);
+            CHECK(r == 2, "sscanf");
+        }
+        else if (startswith(line, "Output size: "))
+        {
+            r = sscanf(line, "Output size: %d x %d\n", out_width, out_height);
+            CHECK(r == 2, "sscanf");
+        }
     }
+    pclose(t);
     
-    int r;
+    if (*raw_width == 0)
+    {
+        printf("dcraw could not open this file\n");
+        return 0;
+    }
 
-    /* parse all command-line options */
-    for (int k = 1; k < argc; k++)
-        if (argv[k][0] == '-')
-            parse_commandline_option(argv[k]);
-    
-    solve_commandline_deps();
-    show_active_options();
-    
-    /* keep track of black and white levels (useful for deflicker) */
-    /* (we will not have more than "argc" files) */
-    int* file_indices = malloc(argc * sizeof(file_indices[0]));
-    int* blacks = malloc(argc * sizeof(blacks[0]));
-    int* whites = malloc(argc * sizeof(whites[0]));
-    int num_files = 0;
-    
-    /* all other arguments are input files */
-    for (int k = 1; k < argc; k++)
+    snprintf(dcraw_cmd, sizeof(dcraw_cmd), "dcraw -4 -E -c -t 0 \"%s\"", filename);
+    FILE* fp = popen(dcraw_cmd, "r");
+    CHECK(fp, "%s", filename);
+    #ifdef _O_BINARY
+    _setmode(_fileno(fp), _O_BINARY);
+    #endif
+
+    /* PGM read code from dcraw */
+      int dim[3]={0,0,0}, comment=0, number=0, error=0, nd=0, c;
+
+      if (fgetc(fp) != 'P' || fgetc(fp) != '5') error = 1;
+      while (!error && nd < 3 && (c = fgetc(fp)) != EOF) {
+        if (c == '#')  comment = 1;
+        if (c == '\n') comment = 0;
+        if (comment) continue;
+        if (isdigit(c)) number = 1;
+        if (number) {
+          if (isdigit(c)) dim[nd] = dim[nd]*10 + c -'0';
+          else if (isspace(c)) {
+        number = 0;  nd++;
+          } else error = 1;
+        }
+      }
+
+    if (error || nd < 3)
     {
-        if (argv[k][0] == '-')
-            continue;
-        
-        char* filename = argv[k];
+        pclose(fp);
+        printf("dcraw output is not a valid PGM file\n");
+        return 0;
+    }
 
-        printf("\nInput file      : %s\n", filename);
-        int len = strlen(filename);
+    int width = dim[0];
+    int height = dim[1];
+    CHECK(width == *raw_width, "pgm width");
+    CHECK(height == *raw_height, "pgm height");
 
-        char orig_filename[1000]; orig_filename[0] = 0;
-        char out_filename[1000];
+    void* buf = malloc(width * (height+1) * 2); /* 1 extra line for handling GBRG easier */
+    int size = fread(buf, 1, width * height * 2, fp);
+    CHECK(size == width * height * 2, "fread");
+    pclose(fp);
 
-        if (strcmp(filename+len-4, ".DNG") == 0)
-        {
-            /* this DNG might have embedded CR2 data inside */
-            /* note: we only save uppercase .DNGs, so a case-sensitive extension check should be fine */
+    /* PGM is big endian, need to reverse it */
+    reverse_bytes_order(buf, width * height * 2);
+    return buf;
+}
 
-            if (dng_has_original_raw(filename))
-            {
-                snprintf(orig_filename, sizeof(orig_filename), "%s", filename);
-                orig_filename[len-3] = 'C';
-                orig_filename[len-2] = 'R';
-                orig_filename[len-1] = '2';
-                
-                if (is_file(orig_filename))
-                {
-                    printf("Already exists  : %s (error)\n", orig_filename);
-                    continue;
-                }
+/* converts one file; on success, returns 1 and the black/white levels of the output DNG */
+static int process_file(char* filename, int* black, int* white)
+{
 
-                if (extract_original_raw(filename, orig_filename))
-                {
-                    /* use the extracted CR2 as input */
-                    filename = orig_filename;
-                }
-                else
-                {
-                    /* error message was already printed, now just skip this file */
-                    continue;
-                }
-            }
-        }
+    printf("\nInput file      : %s\n", filename);
+    int len = strlen(filename);
 
-        snprintf(out_filename, sizeof(out_filename), "%s", filename);
-        out_filename[len-3] = 'D';
-        out_filename[len-2] = 'N';
-        out_filename[len-1] = 'G';
-        
-        /* note: skip_existing will be ignored if we are working on a DNG file with embedded RAW */
-        if (skip_existing && is_file(out_filename) && !orig_filename[0])
-        {
-            printf("Already exists  : %s (skipping)\n", out_filename);
-            continue;
-        }
+    char orig_filename[1000]; orig_filename[0] = 0;
+    char out_filename[1000];
 
-        char dcraw_cmd[1000];
-        snprintf(dcraw_cmd, sizeof(dcraw_cmd), "dcraw -v -i -t 0 \"%s\"", filename);
-        FILE* t = popen(dcraw_cmd, "r");
-        CHECK(t, "%s", filename);
-        
-        const char * model = get_camera_model(filename);
-        get_raw_info(model, &raw_info);
+    if (strcmp(filename+len-4, ".DNG") == 0)
+    {
+        /* this DNG might have embedded CR2 data inside */
+        /* note: we only save uppercase .DNGs, so a case-sensitive extension check should be fine */
 
-        int raw_width = 0, raw_height = 0;
-        int out_width = 0, out_height = 0;
-        
-        char line[100];
-        while (fgets(line, sizeof(line), t))
+        if (dng_has_tag(filename, DNG_TAG_ORIGINAL_RAW_FILE_DATA))
         {
-            if (startswith(line, "Full size: "))
+            snprintf(orig_filename, sizeof(orig_filename), "%s", filename);
+            orig_filename[len-3] = 'C';
+            orig_filename[len-2] = 'R';
+            orig_filename[len-1] = '2';
+            
+            if (is_file(orig_filename))
             {
-                r = sscanf(line, "Full size: %d x %d\n", &raw_width, &raw_height);
-                CHECK(r == 2, "sscanf");
+                printf("Already exists  : %s (error)\n", orig_filename);
+                return 0;
             }
-            else if (startswith(line, "Output size: "))
+
+            if (extract_original_raw(filename, orig_filename))
             {
-                r = sscanf(line, "Output size: %d x %d\n", &out_width, &out_height);
-                CHECK(r == 2, "sscanf");
+                /* use the extracted CR2 as input */
+                filename = orig_filename;
+            }
+            else
+            {
+                /* error message was already printed, now just skip this file */
+                return 0;
             }
         }
-        pclose(t);
-        
-        if (raw_width == 0)
+    }
+
+    snprintf(out_filename, sizeof(out_filename), "%s", filename);
+    out_filename[len-3] = 'D';
+    out_filename[len-2] = 'N';
+    out_filename[len-1] = 'G';
+    
+    /* note: skip_existing will be ignored if we are working on a DNG file with embedded RAW */
+    if (skip_existing && is_file(out_filename) && !orig_filename[0])
+    {
+        printf("Already exists  : %s (skipping)\n", out_filename);
+        return 0;
+    }
+
+    struct cr2_info* cr2 = &ctx->cr2;
+    int have_cr2 = cr2_open(filename, cr2);
+
+    int raw_width = 0, raw_height = 0;
+    int out_width = 0, out_height = 0;
+    void* buf = 0;
+
+    if (have_cr2)
+    {
+        get_raw_info(cr2_camera_model(cr2), &raw_info);
+
+        raw_width = cr2->raw_width;
+        raw_height = cr2->raw_height;
+
+        /* active area from SensorInfo, like dcraw's table */
+        out_width = cr2->sensor_right ? cr2->sensor_right - cr2->sensor_left + 1 : raw_width;
+        out_height = cr2->sensor_right ? cr2->sensor_bottom - cr2->sensor_top + 1 : raw_height;
+
+        buf = malloc(raw_width * (raw_height+1) * 2); /* 1 extra line for handling GBRG easier */
+        if (!cr2_decode(cr2, buf))
         {
-            printf("dcraw could not open this file\n");
-            continue;
+            free(buf);
+            have_cr2 = 0;
         }
 
-        printf("Full size       : %d x %d\n", raw_width, raw_height);
-        printf("Active area     : %d x %d\n", out_width, out_height);
-        
-        int left_margin = raw_width - out_width;
-        int top_margin = raw_height - out_height;
-
-        snprintf(dcraw_cmd, sizeof(dcraw_cmd), "dcraw -4 -E -c -t 0 \"%s\"", filename);
-        FILE* fp = popen(dcraw_cmd, "r");
-        CHECK(fp, "%s", filename);
-        #ifdef _O_BINARY
-        _setmode(_fileno(fp), _O_BINARY);
-        #endif
-
-        /* PGM read code from dcraw */
-          int dim[3]={0,0,0}, comment=0, number=0, error=0, nd=0, c;
-
-          if (fgetc(fp) != 'P' || fgetc(fp) != '5') error = 1;
-          while (!error && nd < 3 && (c = fgetc(fp)) != EOF) {
-            if (c == '#')  comment = 1;
-            if (c == '\n') comment = 0;
-            if (comment) continue;
-            if (isdigit(c)) number = 1;
-            if (number) {
-              if (isdigit(c)) dim[nd] = dim[nd]*10 + c -'0';
-              else if (isspace(c)) {
-            number = 0;  nd++;
-              } else error = 1;
-            }
-          }
-
-        if (error || nd < 3)
-        {
-            pclose(fp);
-            printf("dcraw output is not a valid PGM file\n");
-            continue;
-        }
-
-        int width = dim[0];
-        int height = dim[1];
-        CHECK(width == raw_width, "pgm width");
-        CHECK(height == raw_height, "pgm height");
-
-        void* buf = malloc(width * (height+1) * 2); /* 1 extra line for handling GBRG easier */
-        int size = fread(buf, 1, width * height * 2, fp);
-        CHECK(size == width * height * 2, "fread");
-        pclose(fp);
+        /* only the metadata is needed from now on */
+        cr2_close(cr2);
+    }
 
-        /* PGM is big endian, need to reverse it */
-        reverse_bytes_order(buf, width * height * 2);
+    if (!have_cr2)
+    {
+        printf("Using dcraw\n");
+        buf = read_raw_dcraw(filename, &raw_width, &raw_height, &out_width, &out_height);
+        if (!buf)
+        {
+            return 0;
+        }
+    }
 
-        raw_info.buffer = buf;
-        
-        /* did we read the PGM correctly? (right byte order etc) */
-        //~ for (int i = 0; i < 10; i++)
-            //~ printf("%d ", raw_get_pixel16(i, 0));
-        //~ printf("\n");
-        
-        raw_info.black_level = 2048;
-        raw_info.white_level = 15000;
-
-        raw_info.width = width;
-        raw_info.height = height;
-        raw_info.pitch = width * 2;
-        raw_info.frame_size = raw_info.height * raw_info.pitch;
-
-        raw_info.active_area.x1 = left_margin;
-        raw_info.active_area.x2 = raw_info.width;
-        raw_info.active_area.y1 = top_margin;
-        raw_info.active_area.y2 = raw_info.height;
-        raw_info.jpeg.x = 0;
-        raw_info.jpeg.y = 0;
-        raw_info.jpeg.width = raw_info.width - left_margin;
-        raw_info.jpeg.height = raw_info.height - top_margin;
-        
-        dng_set_thumbnail_size(384, 252);
+    printf("Full size       : %d x %d\n", raw_width, raw_height);
+    printf("Active area     : %d x %d\n", out_width, out_height);
+    
+    int left_margin = raw_width - out_width;
+    int top_margin = raw_height - out_height;
+    int width = raw_width;
+    int height = raw_height;
+
+    raw_info.buffer = buf;
+    
+    /* did we read the PGM correctly? (right byte order etc) */
+    //~ for (int i = 0; i < 10; i++)
+        //~ printf("%d ", raw_get_pixel16(i, 0));
+    //~ printf("\n");
+    
+    raw_info.black_level = 2048;
+    raw_info.white_level = 15000;
+
+    raw_info.width = width;
+    raw_info.height = height;
+    raw_info.pitch = width * 2;
+    raw_info.frame_size = raw_info.height * raw_info.pitch;
+
+    raw_info.active_area.x1 = left_margin;
+    raw_info.active_area.x2 = raw_info.width;
+    raw_info.active_area.y1 = top_margin;
+    raw_info.active_area.y2 = raw_info.height;
+    raw_info.jpeg.x = 0;
+    raw_info.jpeg.y = 0;
+    raw_info.jpeg.width = raw_info.width - left_margin;
+    raw_info.jpeg.height = raw_info.height - top_margin;
+
+    int ok = 0;
+    if (hdr_check())
+    {
+        if (!black_subtract(left_margin, top_margin))
+            printf("Black subtract didn't work\n");
 
-        if (hdr_check())
+        if (hdr_interpolate())
         {
-            if (!black_subtract(left_margin, top_margin))
-                printf("Black subtract didn't work\n");
+            reverse_bytes_order(raw_info.buffer, raw_info.frame_size);
 
-            if (hdr_interpolate())
+            /* This option doesn't really work, since Canon WB is broken with Dual ISO. */
+            if (exif_wb)
             {
-                reverse_bytes_order(raw_info.buffer, raw_info.frame_size);
-
-                /* This option doesn't really work, since Canon WB is broken with Dual ISO. */
-                if (exif_wb)
+                float red_balance = -1, blue_balance = -1;
+                if (!have_cr2 || !cr2_read_white_balance(cr2, &red_balance, &blue_balance))
                 {
-                    float red_balance = -1, blue_balance = -1;
                     read_white_balance(filename, &red_balance, &blue_balance);
-                    if ((red_balance > 0) && (blue_balance > 0))
-                    {
-                        dng_set_wbgain(1000000, red_balance*1000000, 1, 1, 1000000, blue_balance*1000000);
-                        printf("AsShotNeutral   : %.2f 1 %.2f\n", 1/red_balance, 1/blue_balance);
-                    }
-                    else
-                    {
-                        printf("AsShotNeutral   : (using default values)\n");
-                    }
                 }
-                
-                char renamed_filename[1000];
-                char* old_filename = 0;
-                if (strcasecmp(filename, out_filename) == 0)
+                if ((red_balance > 0) && (blue_balance > 0))
                 {
-                    /* if the filesystem is not case-sensitive, we will overwrite the input file */
-                    /* I don't know how to detect this in a portable way, so I'll rename the input file just in case */
-                    /* if no overwriting takes place, the renaming will be undone */
-                    //~ printf("Might overwrite input file.\n");
-                    snprintf(renamed_filename, sizeof(renamed_filename), "%s", filename);
-                    int len = strlen(renamed_filename);
-                    renamed_filename[len-1] = '6';
-                    rename(filename, renamed_filename);
-                    old_filename = filename;
-                    filename = renamed_filename;
+                    image_set_wbgain(red_balance, blue_balance);
+                    printf("AsShotNeutral   : %.2f 1 %.2f\n", 1/red_balance, 1/blue_balance);
                 }
-
-                if (orig_filename[0])
+                else
                 {
-                    dng_backup_metadata(out_filename);
+                    printf("AsShotNeutral   : (using default values)\n");
                 }
+            }
+            
+            char renamed_filename[1000];
+            char* old_filename = 0;
+            if (strcasecmp(filename, out_filename) == 0)
+            {
+                /* if the filesystem is not case-sensitive, we will overwrite the input file */
+                /* I don't know how to detect this in a portable way, so I'll rename the input file just in case */
+                /* if no overwriting takes place, the renaming will be undone */
+                //~ printf("Might overwrite input file.\n");
+                snprintf(renamed_filename, sizeof(renamed_filename), "%s", filename);
+                int len = strlen(renamed_filename);
+                renamed_filename[len-1] = '6';
+                rename(filename, renamed_filename);
+                old_filename = filename;
+                filename = renamed_filename;
+            }
+
+            if (orig_filename[0])
+            {
+                dng_backup_metadata(out_filename);
+            }
 
-                printf("Output file     : %s %s\n", out_filename, is_file(out_filename) ? "(already exists, overwriting)" : "");
-                save_dng(out_filename);
+            /* built-in EXIF copier; exiftool also copies maker notes and everything else */
+            int tags_with_exiftool = use_exiftool || !have_cr2;
+            ctx->copy_tags = !tags_with_exiftool;
 
+            printf("Output file     : %s %s\n", out_filename, is_file(out_filename) ? "(already exists, overwriting)" : "");
+            save_dng(out_filename);
+
+            if (tags_with_exiftool)
+            {
                 copy_tags_from_source(filename, out_filename);
+            }
 
-                if (orig_filename[0])
-                {
-                    dng_restore_metadata(out_filename);
-                }
-                
-                if (compress)
+            if (orig_filename[0])
+            {
+                dng_restore_metadata(out_filename);
+            }
+            
+            if (compress)
+            {
+                dng_compress(out_filename, compress-1);
+            }
+            
+            if (embed_original || orig_filename[0])
+            {
+                /* this will move the input file into the DNG (and maybe delete the original) */
+                int delete_original = (embed_original != 2);
+                embed_original_raw(out_filename, filename, delete_original);
+            }
+
+            if (old_filename && is_file(renamed_filename))
+            {
+                if (!is_file(old_filename))
                 {
-                    dng_compress(out_filename, compress-1);
+                    /* input file not overwritten, undo renaming */
+                    rename(renamed_filename, old_filename);
                 }
-                
-                if (embed_original || orig_filename[0])
+                else
                 {
-                    /* this will move the input file into the DNG (and maybe delete the original) */
-                    int delete_original = (embed_original != 2);
-                    embed_original_raw(out_filename, filename, delete_original);
+                    /* output file would overwrite the input file */
+                    unlink(renamed_filename);
                 }
-
-                if (old_filename && is_file(renamed_filename))
-                {
-                    if (!is_file(old_filename))
-                    {
-                        /* input file not overwritten, undo renaming */
-                        rename(renamed_filename, old_filename);
-                    }
-                    else
-                    {
-                        /* output file would overwrite the input file */
-                        unlink(renamed_filename);
-                    }
-                }
-
-                /* record black and white levels */
-                file_indices[num_files] = k;
-                blacks[num_files] = raw_info.black_level;
-                whites[num_files] = raw_info.white_level;
-                num_files++;
-            }
-            else
-            {
-                printf("ISO blending didn't work\n");
             }
+
+            /* record black and white levels */
+            *black = raw_info.black_level;
+            *white = raw_info.white_level;
+            ok = 1;
         }
         else
         {
-            printf("Doesn't look like interlaced ISO\n");
+            printf("ISO blending didn't work\n");
         }
+    }
+    else
+    {
+        printf("Doesn't look like interlaced ISO\n");
+    }
+
+    free(buf);
+    return ok;
+}
+
+/* files are handed out to the worker threads in command line order */
+struct batch
+{
+    int argc;
+    char** argv;
+    int next;                           /* next argv index to look at */
+    int* done;                          /* per argv index: 1 if converted */
+    int* blacks;
+    int* whites;
+    pthread_mutex_t mutex;
+};
+
+static pthread_mutex_t output_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void* batch_worker(void* arg)
+{
+    struct batch* batch = arg;
+    struct cr2hdr_image image;
+    image_alloc(&image, jobs > 1);
+    ctx = &image;
 
-        free(buf);
+    while (1)
+    {
+        pthread_mutex_lock(&batch->mutex);
+        int k = batch->next;
+        while (k < batch->argc && batch->argv[k][0] == '-')
+            k++;
+        batch->next = k + 1;
+        pthread_mutex_unlock(&batch->mutex);
+
+        if (k >= batch->argc)
+            break;
+
+        image_reset(&image);
+        batch->done[k] = process_file(batch->argv[k], &batch->blacks[k], &batch->whites[k]);
+
+        if (image.log)
+        {
+            /* print the messages of each image in one piece */
+            pthread_mutex_lock(&output_mutex);
+            fputs(image.log, stdout);
+            fflush(stdout);
+            pthread_mutex_unlock(&output_mutex);
+            image.log_len = 0;
+            image.log[0] = 0;
+        }
     }
+
+    ctx = 0;
+    image_free(&image);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    printf("cr2hdr: a post processing tool for Dual ISO images\n\n");
+    printf("Last update: %s\n", module_get_string(dual_iso_strings, "Last update"));
+
+    fast_randn_init();
+
+    if (argc == 1)
+    {
+        printf("No input files.\n\n");
+        printf("GUI usage: drag some CR2 or DNG files over cr2hdr.exe.\n\n");
+        show_commandline_help(argv[0]);
+        return 0;
+    }
+
+    /* parse all command-line options */
+    for (int k = 1; k < argc; k++)
+        if (argv[k][0] == '-')
+            parse_commandline_option(argv[k]);
+    
+    solve_commandline_deps();
+    show_active_options();
+    
+    /* keep track of black and white levels (useful for deflicker) */
+    /* (we will not have more than "argc" files) */
+    int* file_indices = malloc(argc * sizeof(file_indices[0]));
+    int* blacks = malloc(argc * sizeof(blacks[0]));
+    int* whites = malloc(argc * sizeof(whites[0]));
+    int num_files = 0;
+    
+    /* all other arguments are input files */
+    struct batch batch = {
+        .argc = argc,
+        .argv = argv,
+        .next = 1,
+        .done = calloc(argc, sizeof(int)),
+        .blacks = calloc(argc, sizeof(int)),
+        .whites = calloc(argc, sizeof(int)),
+    };
+    CHECK(batch.done && batch.blacks && batch.whites, "calloc");
+    pthread_mutex_init(&batch.mutex, 0);
+
+    dng_set_thumbnail_size(384, 252);
+
+    if (jobs > 1)
+    {
+        printf("Jobs            : %d\n", jobs);
+        pthread_t* threads = malloc(jobs * sizeof(threads[0]));
+        for (int i = 0; i < jobs; i++)
+        {
+            CHECK(pthread_create(&threads[i], 0, batch_worker, &batch) == 0, "pthread_create");
+        }
+        for (int i = 0; i < jobs; i++)
+        {
+            pthread_join(threads[i], 0);
+        }
+        free(threads);
+    }
+    else
+    {
+        batch_worker(&batch);
+    }
+
+    /* collect the levels in command line order, as if the files were processed one by one */
+    for (int k = 1; k < argc; k++)
+    {
+        if (batch.done[k])
+        {
+            file_indices[num_files] = k;
+            blacks[num_files] = batch.blacks[k];
+            whites[num_files] = batch.whites[k];
+            num_files++;
+        }
+    }
+    
+    free(batch.done);
+    free(batch.blacks);
+    free(batch.whites);
+    pthread_mutex_destroy(&batch.mutex);
     
     if (same_levels && num_files > 1)
     {
@@ -903,7 +1329,10 @@ int main(int argc, char** argv)
 
             int new_white = blacks[i] + new_range;
             printf("%-16s: %d ... %d\n", out_filename, blacks[i], new_white);
-            set_white_level(out_filename, new_white);
+            if (!dng_patch_white_level(out_filename, new_white))
+            {
+                set_white_level(out_filename, new_white);
+            }
         }
         
         free(ranges);
@@ -915,6 +1344,7 @@ int main(int argc, char** argv)
     
     return 0;
 }
+#endif
 
 static void white_detect(int* white_dark, int* white_bright)
 {
@@ -1254,7 +1684,7 @@ static int hdr_check()
     int w = raw_info.width;
     int h = raw_info.height;
 
-    static double raw2ev[16384];
+    double raw2ev[16384];
     
     for (int i = 0; i < 16384; i++)
         raw2ev[i] = log2(MAX(1, i - black));
@@ -1538,13 +1968,9 @@ static int bin_search(int lo, int hi, CritFunc crit)
 
 static int mean2(int a, int b, int white, int* err);
 
-static int match_exposures(double* corr_ev, int* white_darkened)
+/* guess ISO - find the factor and the offset for matching the bright and dark images (dark = a * bright + b) */
+static void fit_exposures(int black, int white, double* out_a, double* out_b)
 {
-    /* guess ISO - find the factor and the offset for matching the bright and dark images */
-    int black20 = raw_info.black_level;
-    int white20 = MIN(raw_info.white_level, *white_darkened);
-    int black = black20/16;
-    int white = white20/16;
     int clip0 = white - black;
     int clip  = clip0 * 0.95;    /* there may be nonlinear response in very bright areas */
 
@@ -1752,6 +2178,31 @@ static int match_exposures(double* corr_ev, int* white_darkened)
     if (dps) free(dps);
     if (bps) free(bps);
 
+    *out_a = a;
+    *out_b = b;
+}
+
+static int match_exposures(double* corr_ev, int* white_darkened)
+{
+    int black20 = raw_info.black_level;
+    int white20 = MIN(raw_info.white_level, *white_darkened);
+
+    double a, b;
+    if (ctx->reuse_calib)
+    {
+        a = ctx->reuse_calib->iso_a;
+        b = ctx->reuse_calib->iso_b;
+    }
+    else
+    {
+        fit_exposures(black20/16, white20/16, &a, &b);
+    }
+    ctx->calib.iso_a = a;
+    ctx->calib.iso_b = b;
+
+    int w = raw_info.width;
+    int h = raw_info.height;
+
     /* apply the correction */
     double b20 = b * 16;
     for (int y = 0; y < h; y ++)
@@ -1839,22 +2290,37 @@ static int mean3(int a, int b, int c, int white, int* err)
 #include "chroma_smooth.c"
 #undef CHROMA_SMOOTH_5X5
 
-static void chroma_smooth(uint32_t * inp, uint32_t * out, int* raw2ev, int* ev2raw)
+struct chroma_smooth_args
 {
+    uint32_t * inp;
+    uint32_t * out;
+    int* raw2ev;
+    int* ev2raw;
+};
+
+static void chroma_smooth_rows(void* arg, int y0, int y1)
+{
+    struct chroma_smooth_args* a = arg;
     switch (chroma_smooth_method)
     {
         case 2:
-            chroma_smooth_2x2(inp, out, raw2ev, ev2raw);
+            chroma_smooth_2x2(a->inp, a->out, a->raw2ev, a->ev2raw, y0, y1);
             break;
         case 3:
-            chroma_smooth_3x3(inp, out, raw2ev, ev2raw);
+            chroma_smooth_3x3(a->inp, a->out, a->raw2ev, a->ev2raw, y0, y1);
             break;
         case 5:
-            chroma_smooth_5x5(inp, out, raw2ev, ev2raw);
+            chroma_smooth_5x5(a->inp, a->out, a->raw2ev, a->ev2raw, y0, y1);
             break;
     }
 }
 
+static void chroma_smooth(uint32_t * inp, uint32_t * out, int* raw2ev, int* ev2raw)
+{
+    struct chroma_smooth_args args = { inp, out, raw2ev, ev2raw };
+    parallel_rows(chroma_smooth_rows, &args, 0, raw_info.height, 64);
+}
+
 static inline int FC(int row, int col)
 {
     if ((row%2) == 0 && (col%2) == 0)
@@ -2004,13 +2470,300 @@ static int soft_film_bakedwb(double raw, double exposure, int in_black, int in_w
     return round(raw_adjusted + fast_randn05());
 }
 
+/* define edge directions for interpolation */
+struct xy { int x; int y; };
+static const struct
+{
+    struct xy ack;      /* verification pixel near a */
+    struct xy a;        /* interpolation pixel from the nearby line: normally (0,s) but also (1,s) or (-1,s) */
+    struct xy b;        /* interpolation pixel from the other line: normally (0,-2s) but also (1,-2s), (-1,-2s), (2,-2s) or (-2,-2s) */
+    struct xy bck;      /* verification pixel near b */
+}
+edge_directions[] = {       /* note: all y coords should be multiplied by s */
+    //~ { {-6,2}, {-3,1}, { 6,-2}, { 9,-3} },     /* almost horizontal (little or no improvement) */
+    { {-4,2}, {-2,1}, { 4,-2}, { 6,-3} },
+    { {-3,2}, {-1,1}, { 3,-2}, { 4,-3} },
+    { {-2,2}, {-1,1}, { 2,-2}, { 3,-3} },     /* 45-degree diagonal */
+    { {-1,2}, {-1,1}, { 1,-2}, { 2,-3} },
+    { {-1,2}, { 0,1}, { 1,-2}, { 1,-3} },
+    { { 0,2}, { 0,1}, { 0,-2}, { 0,-3} },     /* vertical, preferred; no extra confirmations needed */
+    { { 1,2}, { 0,1}, {-1,-2}, {-1,-3} },
+    { { 1,2}, { 1,1}, {-1,-2}, {-2,-3} },
+    { { 2,2}, { 1,1}, {-2,-2}, {-3,-3} },     /* 45-degree diagonal */
+    { { 3,2}, { 1,1}, {-3,-2}, {-4,-3} },
+    { { 4,2}, { 2,1}, {-4,-2}, {-6,-3} },
+    //~ { { 6,2}, { 3,1}, {-6,-2}, {-9,-3} },     /* almost horizontal */
+};
+
+struct edge_interp_args
+{
+    int w, h;
+    int black;
+    int white_darkened;
+    double fullres_thr;
+    double* fullres_curve;
+    int* raw2ev;
+    int* ev2raw;
+    int* squeezed;                      /* AMaZE output rows for each image row */
+    float** red;
+    float** green;
+    float** blue;
+    uint32_t* dark;                     /* outputs */
+    uint32_t* bright;
+
+    /* statistics, summed over all bands */
+    int semi_overexposed;
+    int not_overexposed;
+    int deep_shadow;
+    int not_shadow;
+};
+
+/*
+ * Edge-directed interpolation for rows y0...y1-1.
+ * The working set is the grayscale image for these rows (plus the 3 rows above and below,
+ * needed by the cross-correlation) and their edge directions, so a band costs
+ * about 5 bytes per pixel instead of the whole image.
+ */
+static void edge_interpolate_rows(void* arg, int y0, int y1)
+{
+    struct edge_interp_args* args = arg;
+    int w = args->w;
+    int h = args->h;
+    int black = args->black;
+    int white_darkened = args->white_darkened;
+    double fullres_thr = args->fullres_thr;
+    double* fullres_curve = args->fullres_curve;
+    int* raw2ev = args->raw2ev;
+    int* ev2raw = args->ev2raw;
+    int* squeezed = args->squeezed;
+    float** red = args->red;
+    float** green = args->green;
+    float** blue = args->blue;
+    uint32_t* dark = args->dark;
+    uint32_t* bright = args->bright;
+
+    /* convert to grayscale and de-squeeze for easier processing */
+    int gy0 = MAX(y0 - 3, 0);
+    int gy1 = MIN(y1 + 3, h);
+    uint32_t * gray = malloc(w * (gy1 - gy0) * sizeof(gray[0]));
+    for (int y = gy0; y < gy1; y ++)
+        for (int x = 0; x < w; x ++)
+            gray[x + (y-gy0)*w] = green[squeezed[y]][x]/2 + red[squeezed[y]][x]/4 + blue[squeezed[y]][x]/4;
+
+    uint8_t* edge_direction = malloc(w * (y1 - y0) * sizeof(edge_direction[0]));
+    int d0 = COUNT(edge_directions)/2;
+    for (int y = y0; y < y1; y ++)
+        for (int x = 0; x < w; x ++)
+            edge_direction[x + (y-y0)*w] = d0;
+
+    //~ printf("Cross-correlation...\n");
+    int semi_overexposed = 0;
+    int not_overexposed = 0;
+    int deep_shadow = 0;
+    int not_shadow = 0;
+    
+    for (int y = MAX(y0, 5); y < MIN(y1, h-5); y ++)
+    {
+        int s = (is_bright[y%4] == is_bright[(y+1)%4]) ? -1 : 1;    /* points to the closest row having different exposure */
+        for (int x = 5; x < w-5; x ++)
+        {
+            int e_best = INT_MAX;
+            int d_best = d0;
+            int dmin = 0;
+            int dmax = COUNT(edge_directions)-1;
+            int search_area = 5;
+
+            /* only use high accuracy on the dark exposure where the bright ISO is overexposed */
+            if (!BRIGHT_ROW)
+            {
+                /* interpolating bright exposure */
+                if (fullres_curve[raw_get_pixel32(x, y)] > fullres_thr && !debug_edge)
+                {
+                    /* no high accuracy needed, just interpolate vertically */
+                    not_shadow++;
+                    dmin = d0;
+                    dmax = d0;
+                }
+                else
+                {
+                    /* deep shadows, unlikely to use fullres, so we need a good interpolation */
+                    deep_shadow++;
+                }
+            }
+            else if (raw_get_pixel32(x, y) < white_darkened && !debug_edge)
+            {
+                /* interpolating dark exposure, but we also have good data from the bright one */
+                not_overexposed++;
+                dmin = d0;
+                dmax = d0;
+            }
+            else
+            {
+                /* interpolating dark exposure, but the bright one is clipped */
+                semi_overexposed++;
+            }
+
+            if (dmin == dmax)
+            {
+                d_best = dmin;
+            }
+            else
+            {
+                for (int d = dmin; d <= dmax; d++)
+                {
+                    int e = 0;
+                    for (int j = -search_area; j <= search_area; j++)
+                    {
+                        int dx1 = edge_directions[d].ack.x + j;
+                        int dy1 = edge_directions[d].ack.y * s;
+                        int p1 = raw2ev[gray[x+dx1 + (y+dy1-gy0)*w]];
+                        int dx2 = edge_directions[d].a.x + j;
+                        int dy2 = edge_directions[d].a.y * s;
+                        int p2 = raw2ev[gray[x+dx2 + (y+dy2-gy0)*w]];
+                        int dx3 = edge_directions[d].b.x + j;
+                        int dy3 = edge_directions[d].b.y * s;
+                        int p3 = raw2ev[gray[x+dx3 + (y+dy3-gy0)*w]];
+                        int dx4 = edge_directions[d].bck.x + j;
+                        int dy4 = edge_directions[d].bck.y * s;
+                        int p4 = raw2ev[gray[x+dx4 + (y+dy4-gy0)*w]];
+                        e += ABS(p1-p2) + ABS(p2-p3) + ABS(p3-p4);
+                    }
+                    
+                    /* add a small penalty for diagonal directions */
+                    /* (the improvement should be significant in order to choose one of these) */
+                    e += ABS(d - d0) * EV_RESOLUTION/8;
+                    
+                    if (e < e_best)
+                    {
+                        e_best = e;
+                        d_best = d;
+                    }
+                }
+            }
+            
+            edge_direction[x + (y-y0)*w] = d_best;
+        }
+    }
+
+    __sync_fetch_and_add(&args->semi_overexposed, semi_overexposed);
+    __sync_fetch_and_add(&args->not_overexposed, not_overexposed);
+    __sync_fetch_and_add(&args->deep_shadow, deep_shadow);
+    __sync_fetch_and_add(&args->not_shadow, not_shadow);
+
+    /* burn the interpolation directions into a test image */
+    /* (only called with the full image, see hdr_interpolate) */
+    if (debug_edge)
+    {
+        for (int y = 4; y < h-4; y += 10)
+        {
+            /* only show bright rows (interpolated from dark ones) */
+            while (!BRIGHT_ROW) y++;
+            
+            int s = (is_bright[y%4] == is_bright[(y+1)%4]) ? -1 : 1;    /* points to the closest row having different exposure */
+            for (int x = 4; x < w-4; x += 10)
+            {
+                gray[x + (y-gy0)*w] = black;
+
+                int dir = edge_direction[x + (y-y0)*w];
+
+                int dx = edge_directions[dir].a.x;
+                int dy = edge_directions[dir].a.y * s;
+                gray[x+dx + (y+dy-gy0)*w] = black;
+
+                dx = edge_directions[dir].b.x;
+                dy = edge_directions[dir].b.y * s;
+                gray[x+dx + (y+dy-gy0)*w] = black;
+
+                dx = edge_directions[dir].ack.x;
+                dy = edge_directions[dir].ack.y * s;
+                gray[x+dx + (y+dy-gy0)*w] = black;
+
+                dx = edge_directions[dir].bck.x;
+                dy = edge_directions[dir].bck.y * s;
+                gray[x+dx + (y+dy-gy0)*w] = black;
+            }
+        }
+
+        for (int y = 0; y < h; y ++)
+            for (int x = 2; x < w-2; x ++)
+                raw_set_pixel_20to16(x, y, gray[x + (y-gy0)*w]);
+        save_debug_dng("edges.dng");
+        if(system("dcraw -d -r 1 1 1 1 edges.dng"));
+        /* best viewed at 400% with nearest neighbour interpolation (no filtering) */
+
+        for (int y = 0; y < h; y ++)
+        {
+            for (int x = 2; x < w-2; x ++)
+            {
+                int dir = edge_direction[x + (y-y0)*w];
+                if (y%2) dir = COUNT(edge_directions)-1-dir;
+                raw_set_pixel16(x, y, ev2raw[dir * EV_RESOLUTION]);
+            }
+        }
+        save_debug_dng("edge-map.dng");
+        if(system("dcraw -d -r 1 1 1 1 edge-map.dng"));
+        printf("debug exit\n");
+        exit(1);
+    }
+    
+    //~ printf("Actual interpolation...\n");
+
+    for (int y = MAX(y0, 2); y < MIN(y1, h-2); y ++)
+    {
+        uint32_t* native = BRIGHT_ROW ? bright : dark;
+        uint32_t* interp = BRIGHT_ROW ? dark : bright;
+        int is_rg = (y % 2 == 0); /* RG or GB? */
+        int s = (is_bright[y%4] == is_bright[(y+1)%4]) ? -1 : 1;    /* points to the closest row having different exposure */
+
+        //~ printf("Interpolating %s line %d from [near] %d (squeezed %d) and [far] %d (squeezed %d)\n", BRIGHT_ROW ? "BRIGHT" : "DARK", y, y+s, yh_near, y-2*s, yh_far);
+        
+        for (int x = 2; x < w-2; x += 2)
+        {
+            for (int k = 0; k < 2; k++, x++)
+            {
+                float** plane = is_rg ? (x%2 == 0 ? red   : green)
+                                      : (x%2 == 0 ? green : blue );
+
+                int dir = edge_direction[x + (y-y0)*w];
+                
+                int edge_interp(int dir)
+                {
+                    
+                    int dxa = edge_directions[dir].a.x;
+                    int dya = edge_directions[dir].a.y * s;
+                    int pa = COERCE((int)plane[squeezed[y+dya]][x+dxa], 0, 0xFFFFF);
+                    int dxb = edge_directions[dir].b.x;
+                    int dyb = edge_directions[dir].b.y * s;
+                    int pb = COERCE((int)plane[squeezed[y+dyb]][x+dxb], 0, 0xFFFFF);
+                    int pi = (raw2ev[pa] * 2 + raw2ev[pb]) / 3;
+                    
+                    return pi;
+                }
+                
+                /* vary the interpolation direction and average the result (reduces aliasing) */
+                int pi0 = edge_interp(dir);
+                int pip = edge_interp(MIN(dir+1, COUNT(edge_directions)-1));
+                int pim = edge_interp(MAX(dir-1,0));
+                
+                interp[x   + y * w] = ev2raw[(2*pi0+pip+pim)/4];
+                native[x   + y * w] = raw_get_pixel32(x, y);
+            }
+            x -= 2;
+        }
+    }
+
+    free(gray);
+    free(edge_direction);
+}
+
 static int hdr_interpolate()
 {
     int w = raw_info.width;
     int h = raw_info.height;
 
     /* RGGB or GBRG? */
-    int rggb = identify_rggb_or_gbrg();
+    int rggb = ctx->reuse_calib ? ctx->reuse_calib->rggb : identify_rggb_or_gbrg();
+    ctx->calib.rggb = rggb;
     
     if (!rggb) /* this code assumes RGGB, so we need to skip one line */
     {
@@ -2023,10 +2776,15 @@ static int hdr_interpolate()
         h--;
     }
 
-    if (!identify_bright_and_dark_fields(rggb))
+    if (ctx->reuse_calib)
+    {
+        memcpy(is_bright, ctx->reuse_calib->bright_lines, sizeof(is_bright));
+    }
+    else if (!identify_bright_and_dark_fields(rggb))
     {
         return 0;
     }
+    memcpy(ctx->calib.bright_lines, is_bright, sizeof(is_bright));
 
     int ret = 1;
 
@@ -2038,14 +2796,24 @@ static int hdr_interpolate()
     int white = raw_info.white_level;
 
     int white_bright = white;
-    white_detect(&white, &white_bright);
+    if (ctx->reuse_calib)
+    {
+        white = ctx->reuse_calib->white;
+        white_bright = ctx->reuse_calib->white_bright;
+    }
+    else
+    {
+        white_detect(&white, &white_bright);
+    }
+    ctx->calib.white = white;
+    ctx->calib.white_bright = white_bright;
     white *= 64;
     white_bright *= 64;
     raw_info.white_level = white;
 
     /* for fast EV - raw conversion */
-    static int raw2ev[1<<20];   /* EV x EV_RESOLUTION */
-    static int ev2raw_0[24*EV_RESOLUTION];
+    int* raw2ev = ctx->raw2ev;      /* EV x EV_RESOLUTION, 1<<20 entries */
+    int* ev2raw_0 = ctx->ev2raw_0;  /* 24*EV_RESOLUTION entries */
     
     /* handle sub-black values (negative EV) */
     int* ev2raw = ev2raw_0 + 10*EV_RESOLUTION;
@@ -2147,7 +2915,7 @@ static int hdr_interpolate()
     memset(alias_map, 0, w * h * sizeof(uint16_t));
 
     /* fullres mixing curve */
-    static double fullres_curve[1<<20];
+    double* fullres_curve = ctx->fullres_curve;     /* 1<<20 entries */
     
     const double fullres_start = 4;
     const double fullres_transition = 4;
@@ -2297,10 +3065,23 @@ static int hdr_interpolate()
             float** green,      /* the interpolated green plane */
             float** blue,       /* the interpolated blue plane */
             int winx, int winy, /* crop window for demosaicing */
-            int winw, int winh
+            int winw, int winh,
+            int threads         /* worker threads */
         );
 
-        amaze_demosaic_RT(rawData, red, green, blue, 0, 0, w, h);
+        printf("AMaZE interpolation ...\n");
+        struct timeval t1, t2;
+        gettimeofday(&t1, 0);
+        amaze_demosaic_RT(rawData, red, green, blue, 0, 0, w, h, threads);
+        gettimeofday(&t2, 0);
+        printf("Amaze took %.2f s\n", (t2.tv_sec - t1.tv_sec) + (t2.tv_usec - t1.tv_usec) * 1e-6);
+
+        /* AMaZE input no longer needed */
+        for (int i = 0; i < h; i++)
+        {
+            free(rawData[i]);
+        }
+        free(rawData); rawData = 0;
 
         /* undo green channel scaling and clamp the other channels */
         for (int y = 0; y < h; y ++)
@@ -2336,264 +3117,46 @@ static int hdr_interpolate()
         }
 
         printf("Edge-directed interpolation...\n");
-        
-        //~ printf("Grayscale...\n");
-        /* convert to grayscale and de-squeeze for easier processing */
-        uint32_t * gray = malloc(w * h * sizeof(gray[0]));
-        for (int y = 0; y < h; y ++)
-            for (int x = 0; x < w; x ++)
-                gray[x + y*w] = green[squeezed[y]][x]/2 + red[squeezed[y]][x]/4 + blue[squeezed[y]][x]/4;
 
-        #if 0
-        for (int y = 0; y < h; y ++)
-            for (int x = 2; x < w-2; x ++)
-                raw_set_pixel_20to16(x, y, gray[x + y*w]);
-        save_debug_dng("edge-gray.dng");
-        exit(1);
-        #endif
-
-        /* define edge directions for interpolation */
-        struct xy { int x; int y; };
-        const struct
-        {
-            struct xy ack;      /* verification pixel near a */
-            struct xy a;        /* interpolation pixel from the nearby line: normally (0,s) but also (1,s) or (-1,s) */
-            struct xy b;        /* interpolation pixel from the other line: normally (0,-2s) but also (1,-2s), (-1,-2s), (2,-2s) or (-2,-2s) */
-            struct xy bck;      /* verification pixel near b */
-        }
-        edge_directions[] = {       /* note: all y coords should be multiplied by s */
-            //~ { {-6,2}, {-3,1}, { 6,-2}, { 9,-3} },     /* almost horizontal (little or no improvement) */
-            { {-4,2}, {-2,1}, { 4,-2}, { 6,-3} },
-            { {-3,2}, {-1,1}, { 3,-2}, { 4,-3} },
-            { {-2,2}, {-1,1}, { 2,-2}, { 3,-3} },     /* 45-degree diagonal */
-            { {-1,2}, {-1,1}, { 1,-2}, { 2,-3} },
-            { {-1,2}, { 0,1}, { 1,-2}, { 1,-3} },
-            { { 0,2}, { 0,1}, { 0,-2}, { 0,-3} },     /* vertical, preferred; no extra confirmations needed */
-            { { 1,2}, { 0,1}, {-1,-2}, {-1,-3} },
-            { { 1,2}, { 1,1}, {-1,-2}, {-2,-3} },
-            { { 2,2}, { 1,1}, {-2,-2}, {-3,-3} },     /* 45-degree diagonal */
-            { { 3,2}, { 1,1}, {-3,-2}, {-4,-3} },
-            { { 4,2}, { 2,1}, {-4,-2}, {-6,-3} },
-            //~ { { 6,2}, { 3,1}, {-6,-2}, {-9,-3} },     /* almost horizontal */
+        struct edge_interp_args edge_args = {
+            .w = w,
+            .h = h,
+            .black = black,
+            .white_darkened = white_darkened,
+            .fullres_thr = fullres_thr,
+            .fullres_curve = fullres_curve,
+            .raw2ev = raw2ev,
+            .ev2raw = ev2raw,
+            .squeezed = squeezed,
+            .red = red,
+            .green = green,
+            .blue = blue,
+            .dark = dark,
+            .bright = bright,
         };
 
-        uint8_t* edge_direction = malloc(w * h * sizeof(edge_direction[0]));
-        int d0 = COUNT(edge_directions)/2;
-        for (int y = 0; y < h; y ++)
-            for (int x = 0; x < w; x ++)
-                edge_direction[x + y*w] = d0;
-
-        //~ printf("Cross-correlation...\n");
-        int semi_overexposed = 0;
-        int not_overexposed = 0;
-        int deep_shadow = 0;
-        int not_shadow = 0;
-        
-        for (int y = 5; y < h-5; y ++)
-        {
-            int s = (is_bright[y%4] == is_bright[(y+1)%4]) ? -1 : 1;    /* points to the closest row having different exposure */
-            for (int x = 5; x < w-5; x ++)
-            {
-                int e_best = INT_MAX;
-                int d_best = d0;
-                int dmin = 0;
-                int dmax = COUNT(edge_directions)-1;
-                int search_area = 5;
-
-                /* only use high accuracy on the dark exposure where the bright ISO is overexposed */
-                if (!BRIGHT_ROW)
-                {
-                    /* interpolating bright exposure */
-                    if (fullres_curve[raw_get_pixel32(x, y)] > fullres_thr && !debug_edge)
-                    {
-                        /* no high accuracy needed, just interpolate vertically */
-                        not_shadow++;
-                        dmin = d0;
-                        dmax = d0;
-                    }
-                    else
-                    {
-                        /* deep shadows, unlikely to use fullres, so we need a good interpolation */
-                        deep_shadow++;
-                    }
-                }
-                else if (raw_get_pixel32(x, y) < white_darkened && !debug_edge)
-                {
-                    /* interpolating dark exposure, but we also have good data from the bright one */
-                    not_overexposed++;
-                    dmin = d0;
-                    dmax = d0;
-                }
-                else
-                {
-                    /* interpolating dark exposure, but the bright one is clipped */
-                    semi_overexposed++;
-                }
-
-                if (dmin == dmax)
-                {
-                    d_best = dmin;
-                }
-                else
-                {
-                    for (int d = dmin; d <= dmax; d++)
-                    {
-                        int e = 0;
-                        for (int j = -search_area; j <= search_area; j++)
-                        {
-                            int dx1 = edge_directions[d].ack.x + j;
-                            int dy1 = edge_directions[d].ack.y * s;
-                            int p1 = raw2ev[gray[x+dx1 + (y+dy1)*w]];
-                            int dx2 = edge_directions[d].a.x + j;
-                            int dy2 = edge_directions[d].a.y * s;
-                            int p2 = raw2ev[gray[x+dx2 + (y+dy2)*w]];
-                            int dx3 = edge_directions[d].b.x + j;
-                            int dy3 = edge_directions[d].b.y * s;
-                            int p3 = raw2ev[gray[x+dx3 + (y+dy3)*w]];
-                            int dx4 = edge_directions[d].bck.x + j;
-                            int dy4 = edge_directions[d].bck.y * s;
-                            int p4 = raw2ev[gray[x+dx4 + (y+dy4)*w]];
-                            e += ABS(p1-p2) + ABS(p2-p3) + ABS(p3-p4);
-                        }
-                        
-                        /* add a small penalty for diagonal directions */
-                        /* (the improvement should be significant in order to choose one of these) */
-                        e += ABS(d - d0) * EV_RESOLUTION/8;
-                        
-                        if (e < e_best)
-                        {
-                            e_best = e;
-                            d_best = d;
-                        }
-                    }
-                }
-                
-                edge_direction[x + y*w] = d_best;
-            }
-        }
-
-        if (!debug_edge)
-        {
-            printf("Semi-overexposed: %.02f%%\n", semi_overexposed * 100.0 / (semi_overexposed + not_overexposed));
-            printf("Deep shadows    : %.02f%%\n", deep_shadow * 100.0 / (deep_shadow + not_shadow));
-        }
-
-        /* burn the interpolation directions into a test image */
         if (debug_edge)
         {
-            for (int y = 4; y < h-4; y += 10)
-            {
-                /* only show bright rows (interpolated from dark ones) */
-                while (!BRIGHT_ROW) y++;
-                
-                int s = (is_bright[y%4] == is_bright[(y+1)%4]) ? -1 : 1;    /* points to the closest row having different exposure */
-                for (int x = 4; x < w-4; x += 10)
-                {
-                    gray[x + y*w] = black;
-
-                    int dir = edge_direction[x + y*w];
-
-                    int dx = edge_directions[dir].a.x;
-                    int dy = edge_directions[dir].a.y * s;
-                    gray[x+dx + (y+dy)*w] = black;
-
-                    dx = edge_directions[dir].b.x;
-                    dy = edge_directions[dir].b.y * s;
-                    gray[x+dx + (y+dy)*w] = black;
-
-                    dx = edge_directions[dir].ack.x;
-                    dy = edge_directions[dir].ack.y * s;
-                    gray[x+dx + (y+dy)*w] = black;
-
-                    dx = edge_directions[dir].bck.x;
-                    dy = edge_directions[dir].bck.y * s;
-                    gray[x+dx + (y+dy)*w] = black;
-                }
-            }
-
-            for (int y = 0; y < h; y ++)
-                for (int x = 2; x < w-2; x ++)
-                    raw_set_pixel_20to16(x, y, gray[x + y*w]);
-            save_debug_dng("edges.dng");
-            if(system("dcraw -d -r 1 1 1 1 edges.dng"));
-            /* best viewed at 400% with nearest neighbour interpolation (no filtering) */
-
-            for (int y = 0; y < h; y ++)
-            {
-                for (int x = 2; x < w-2; x ++)
-                {
-                    int dir = edge_direction[x + y*w];
-                    if (y%2) dir = COUNT(edge_directions)-1-dir;
-                    raw_set_pixel16(x, y, ev2raw[dir * EV_RESOLUTION]);
-                }
-            }
-            save_debug_dng("edge-map.dng");
-            if(system("dcraw -d -r 1 1 1 1 edge-map.dng"));
-            printf("debug exit\n");
-            exit(1);
+            /* the debug images need the whole frame at once; doesn't return */
+            edge_interpolate_rows(&edge_args, 0, h);
         }
-        
-        //~ printf("Actual interpolation...\n");
-
-        for (int y = 2; y < h-2; y ++)
-        {
-            uint32_t* native = BRIGHT_ROW ? bright : dark;
-            uint32_t* interp = BRIGHT_ROW ? dark : bright;
-            int is_rg = (y % 2 == 0); /* RG or GB? */
-            int s = (is_bright[y%4] == is_bright[(y+1)%4]) ? -1 : 1;    /* points to the closest row having different exposure */
 
-            //~ printf("Interpolating %s line %d from [near] %d (squeezed %d) and [far] %d (squeezed %d)\n", BRIGHT_ROW ? "BRIGHT" : "DARK", y, y+s, yh_near, y-2*s, yh_far);
-            
-            for (int x = 2; x < w-2; x += 2)
-            {
-                for (int k = 0; k < 2; k++, x++)
-                {
-                    float** plane = is_rg ? (x%2 == 0 ? red   : green)
-                                          : (x%2 == 0 ? green : blue );
+        parallel_rows(edge_interpolate_rows, &edge_args, 0, h, 32);
 
-                    int dir = edge_direction[x + y*w];
-                    
-                    int edge_interp(int dir)
-                    {
-                        
-                        int dxa = edge_directions[dir].a.x;
-                        int dya = edge_directions[dir].a.y * s;
-                        int pa = COERCE((int)plane[squeezed[y+dya]][x+dxa], 0, 0xFFFFF);
-                        int dxb = edge_directions[dir].b.x;
-                        int dyb = edge_directions[dir].b.y * s;
-                        int pb = COERCE((int)plane[squeezed[y+dyb]][x+dxb], 0, 0xFFFFF);
-                        int pi = (raw2ev[pa] * 2 + raw2ev[pb]) / 3;
-                        
-                        return pi;
-                    }
-                    
-                    /* vary the interpolation direction and average the result (reduces aliasing) */
-                    int pi0 = edge_interp(dir);
-                    int pip = edge_interp(MIN(dir+1, COUNT(edge_directions)-1));
-                    int pim = edge_interp(MAX(dir-1,0));
-                    
-                    interp[x   + y * w] = ev2raw[(2*pi0+pip+pim)/4];
-                    native[x   + y * w] = raw_get_pixel32(x, y);
-                }
-                x -= 2;
-            }
-        }
+        printf("Semi-overexposed: %.02f%%\n", edge_args.semi_overexposed * 100.0 / (edge_args.semi_overexposed + edge_args.not_overexposed));
+        printf("Deep shadows    : %.02f%%\n", edge_args.deep_shadow * 100.0 / (edge_args.deep_shadow + edge_args.not_shadow));
 
         for (int i = 0; i < h; i++)
         {
-            free(rawData[i]);
             free(red[i]);
             free(green[i]);
             free(blue[i]);
         }
         
         free(squeezed); squeezed = 0;
-        free(rawData); rawData = 0;
         free(red); red = 0;
         free(green); green = 0;
         free(blue); blue = 0;
-        free(gray); gray = 0;
-        free(edge_direction);
     }
     else /* mean23 */
     {
@@ -2792,7 +3355,7 @@ static int hdr_interpolate()
 
     /* mixing curve */
     double max_ev = log2(white/64 - black/64);
-    static double mix_curve[1<<20];
+    double* mix_curve = ctx->mix_curve;             /* 1<<20 entries */
     
     for (int i = 0; i < 1<<20; i++)
     {
@@ -3233,25 +3796,25 @@ static int hdr_interpolate()
         AsShotNeutral_method = "fixme";
         
         /* fixme: exif WB will not be applied to soft-film curve (will use some dummy values instead) */
-        custom_wb[0] = 2;
-        custom_wb[1] = 1;
-        custom_wb[2] = 2;
+        ctx->custom_wb[0] = 2;
+        ctx->custom_wb[1] = 1;
+        ctx->custom_wb[2] = 2;
     }
-    else if (custom_wb[1])
+    else if (ctx->custom_wb[1])
     {
-        float red_balance = custom_wb[0]/custom_wb[1];
-        float blue_balance = custom_wb[2]/custom_wb[1];
-        dng_set_wbgain(1000000, red_balance*1000000, 1, 1, 1000000, blue_balance*1000000);
+        float red_balance = ctx->custom_wb[0]/ctx->custom_wb[1];
+        float blue_balance = ctx->custom_wb[2]/ctx->custom_wb[1];
+        image_set_wbgain(red_balance, blue_balance);
         AsShotNeutral_method = "custom";
     }
     else /* if (gray_wb) */
     {
         float red_balance = -1, blue_balance = -1;
         white_balance_gray(&red_balance, &blue_balance, gray_wb);
-        dng_set_wbgain(1000000, red_balance*1000000, 1, 1, 1000000, blue_balance*1000000);
-        custom_wb[0] = red_balance;
-        custom_wb[1] = 1;
-        custom_wb[2] = blue_balance;
+        image_set_wbgain(red_balance, blue_balance);
+        ctx->custom_wb[0] = red_balance;
+        ctx->custom_wb[1] = 1;
+        ctx->custom_wb[2] = blue_balance;
         AsShotNeutral_method = 
             gray_wb == WB_GRAY_MED ? "gray med" : 
             gray_wb == WB_GRAY_MAX ? "gray max" :
@@ -3260,13 +3823,13 @@ static int hdr_interpolate()
 
     if (!exif_wb)
     {
-        custom_wb[0] /= custom_wb[1];
-        custom_wb[2] /= custom_wb[1];
-        custom_wb[1] = 1;
-        double multipliers[3] = {custom_wb[0], custom_wb[1], custom_wb[2]};
+        ctx->custom_wb[0] /= ctx->custom_wb[1];
+        ctx->custom_wb[2] /= ctx->custom_wb[1];
+        ctx->custom_wb[1] = 1;
+        double multipliers[3] = {ctx->custom_wb[0], ctx->custom_wb[1], ctx->custom_wb[2]};
         double temperature, green;
         ufraw_multipliers_to_kelvin_green(multipliers, &temperature, &green);
-        printf("AsShotNeutral   : %.2f 1 %.2f, %dK/g=%.2f (%s)\n", 1/custom_wb[0], 1/custom_wb[2], (int)temperature, green, AsShotNeutral_method);
+        printf("AsShotNeutral   : %.2f 1 %.2f, %dK/g=%.2f (%s)\n", 1/ctx->custom_wb[0], 1/ctx->custom_wb[2], (int)temperature, green, AsShotNeutral_method);
     }
 
     if (soft_film_ev > 0)
@@ -3275,9 +3838,9 @@ static int hdr_interpolate()
         double exposure = pow(2, soft_film_ev);
 
         double baked_wb[3] = {
-            custom_wb[0]/custom_wb[1],
+            ctx->custom_wb[0]/ctx->custom_wb[1],
             1,
-            custom_wb[2]/custom_wb[1],
+            ctx->custom_wb[2]/ctx->custom_wb[1],
         };
         
         double max_wb = MAX(baked_wb[0], baked_wb[2]);
@@ -3661,3 +4224,115 @@ static void white_balance_gray(float* red_balance, float* blue_balance, int meth
     free(histblur);
     free(hist);
 }
+
+#ifdef CR2HDR_LIB
+
+struct cr2hdr_clip
+{
+    pthread_mutex_t mutex;
+    int calibrated;
+    struct hdr_calib calib;
+    float wb[3];                        /* white balance from the first frame */
+};
+
+struct cr2hdr_clip* cr2hdr_clip_new()
+{
+    static pthread_once_t randn_once = PTHREAD_ONCE_INIT;
+    pthread_once(&randn_once, fast_randn_init);
+
+    struct cr2hdr_clip* clip = malloc(sizeof(*clip));
+    memset(clip, 0, sizeof(*clip));
+    pthread_mutex_init(&clip->mutex, 0);
+    return clip;
+}
+
+void cr2hdr_clip_free(struct cr2hdr_clip* clip)
+{
+    if (!clip) return;
+    pthread_mutex_destroy(&clip->mutex);
+    free(clip);
+}
+
+int cr2hdr_clip_calibrated(struct cr2hdr_clip* clip)
+{
+    pthread_mutex_lock(&clip->mutex);
+    int calibrated = clip->calibrated;
+    pthread_mutex_unlock(&clip->mutex);
+    return calibrated;
+}
+
+int cr2hdr_process_frame(struct cr2hdr_clip* clip, cr2hdr_frame_info* frame, const char* camera_model, int wbgain[6], int verbose)
+{
+    struct cr2hdr_image image;
+    image_alloc(&image, 1);
+    image_reset(&image);
+    ctx = &image;
+
+    /* the camera matrix is only used for the color temperature in the messages */
+    if (verbose && camera_model)
+    {
+        adobe_coeff("Canon", camera_model);
+    }
+
+    raw_info = *frame;
+    raw_info.bits_per_pixel = 16;
+    raw_info.pitch = raw_info.width * 2;
+    raw_info.frame_size = raw_info.height * raw_info.pitch;
+
+    struct hdr_calib calib;
+    pthread_mutex_lock(&clip->mutex);
+    int calibrated = clip->calibrated;
+    if (calibrated)
+    {
+        calib = clip->calib;
+        memcpy(ctx->custom_wb, clip->wb, sizeof(clip->wb));
+        ctx->reuse_calib = &calib;
+    }
+    pthread_mutex_unlock(&clip->mutex);
+
+    int ok = 0;
+    if (calibrated || hdr_check())
+    {
+        if (!black_subtract(raw_info.active_area.x1, raw_info.active_area.y1))
+            printf("Black subtract didn't work\n");
+
+        ok = hdr_interpolate();
+        if (!ok)
+            printf("ISO blending didn't work\n");
+    }
+    else
+    {
+        printf("Doesn't look like interlaced ISO\n");
+    }
+
+    if (ok)
+    {
+        reverse_bytes_order(raw_info.buffer, raw_info.frame_size);
+        *frame = raw_info;
+        memcpy(wbgain, ctx->wbgain, sizeof(ctx->wbgain));
+
+        if (!calibrated)
+        {
+            /* several frames may have been processed in parallel without calibration; the first one wins */
+            pthread_mutex_lock(&clip->mutex);
+            if (!clip->calibrated)
+            {
+                clip->calib = ctx->calib;
+                memcpy(clip->wb, ctx->custom_wb, sizeof(clip->wb));
+                clip->calibrated = 1;
+            }
+            pthread_mutex_unlock(&clip->mutex);
+        }
+    }
+
+    if (verbose || !ok)
+    {
+        fputs(ctx->log, stdout);
+    }
+
+    ctx = 0;
+    image_free(&image);
+    return ok;
+}
+
+#endif
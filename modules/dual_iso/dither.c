@@ -21,6 +21,7 @@
 /* anti-posterization noise */
 /* before rounding, it's a good idea to add a Gaussian noise of stdev=0.5 */
 static float randn05_cache[1024];
+static __thread int randn05_index = 0;
 
 void fast_randn_init()
 {
@@ -31,8 +32,13 @@ void fast_randn_init()
     }
 }
 
+/* restart the noise sequence (per thread) */
+void fast_randn_reset()
+{
+    randn05_index = 0;
+}
+
 float fast_randn05()
 {
-    static int k = 0;
-    return randn05_cache[(k++) & 1023];
+    return randn05_cache[(randn05_index++) & 1023];
 }
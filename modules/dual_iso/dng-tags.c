@@ -0,0 +1,127 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "dng-tags.h"
+
+struct tiff_file
+{
+    FILE* f;
+    int big_endian;
+};
+
+static uint32_t tiff_get(struct tiff_file* t, long offset, int size)
+{
+    uint8_t b[4] = {0, 0, 0, 0};
+    if (fseek(t->f, offset, SEEK_SET) || fread(b, 1, size, t->f) != (size_t) size)
+    {
+        return 0;
+    }
+
+    uint32_t value = 0;
+    for (int i = 0; i < size; i++)
+    {
+        int k = t->big_endian ? i : size - 1 - i;
+        value = (value << 8) | b[k];
+    }
+    return value;
+}
+
+static int tiff_put(struct tiff_file* t, long offset, int size, uint32_t value)
+{
+    uint8_t b[4];
+    for (int i = 0; i < size; i++)
+    {
+        int k = t->big_endian ? size - 1 - i : i;
+        b[k] = value >> (8 * i);
+    }
+    return fseek(t->f, offset, SEEK_SET) == 0 && fwrite(b, 1, size, t->f) == (size_t) size;
+}
+
+/* returns the offset of IFD0, or 0 if this is not a TIFF file */
+static uint32_t tiff_open(struct tiff_file* t, const char* filename, const char* mode)
+{
+    t->f = fopen(filename, mode);
+    if (!t->f) return 0;
+
+    int order = tiff_get(t, 0, 2);
+    if (order != 0x4949 && order != 0x4D4D)
+    {
+        return 0;
+    }
+    t->big_endian = (order == 0x4D4D);
+
+    if (tiff_get(t, 2, 2) != 42)
+    {
+        return 0;
+    }
+    return tiff_get(t, 4, 4);
+}
+
+/* returns the offset of the entry with the given tag, or 0 */
+static uint32_t tiff_find_tag(struct tiff_file* t, uint32_t ifd, int tag)
+{
+    int entries = tiff_get(t, ifd, 2);
+    for (int i = 0; i < entries; i++)
+    {
+        uint32_t entry = ifd + 2 + i * 12;
+        if (tiff_get(t, entry, 2) == (uint32_t) tag) return entry;
+    }
+    return 0;
+}
+
+int dng_has_tag(const char* dng_file, int tag)
+{
+    struct tiff_file t;
+    uint32_t ifd0 = tiff_open(&t, dng_file, "rb");
+    int ans = ifd0 && tiff_find_tag(&t, ifd0, tag);
+    if (t.f) fclose(t.f);
+    return ans;
+}
+
+/* WhiteLevel with a single SHORT or LONG value is stored in the entry itself */
+static int patch_white_level(struct tiff_file* t, uint32_t ifd, int level)
+{
+    uint32_t entry = tiff_find_tag(t, ifd, DNG_TAG_WHITE_LEVEL);
+    if (!entry || tiff_get(t, entry + 4, 4) != 1)
+    {
+        return 0;
+    }
+
+    int type = tiff_get(t, entry + 2, 2);
+    if (type == 3 && level <= 0xFFFF)
+    {
+        return tiff_put(t, entry + 8, 2, level);
+    }
+    if (type == 4)
+    {
+        return tiff_put(t, entry + 8, 4, level);
+    }
+    return 0;
+}
+
+int dng_patch_white_level(const char* dng_file, int level)
+{
+    struct tiff_file t;
+    int patched = 0;
+    uint32_t ifd0 = tiff_open(&t, dng_file, "r+b");
+    if (!ifd0) goto end;
+
+    /* the raw image is either in IFD0 or in one of its SubIFDs */
+    patched += patch_white_level(&t, ifd0, level);
+
+    uint32_t entry = tiff_find_tag(&t, ifd0, 0x14A);
+    if (entry)
+    {
+        uint32_t count = tiff_get(&t, entry + 4, 4);
+        uint32_t list = count == 1 ? entry + 8 : tiff_get(&t, entry + 8, 4);
+        for (uint32_t i = 0; i < count && i < 16; i++)
+        {
+            uint32_t subifd = tiff_get(&t, list + i * 4, 4);
+            if (subifd) patched += patch_white_level(&t, subifd, level);
+        }
+    }
+
+end:
+    if (t.f) fclose(t.f);
+    return patched > 0;
+}
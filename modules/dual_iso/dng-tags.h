@@ -0,0 +1,19 @@
+#ifndef _DNG_TAGS_H
+#define _DNG_TAGS_H
+
+/* in-place DNG tag access, without exiftool */
+
+#define DNG_TAG_WHITE_LEVEL             0xC61D
+#define DNG_TAG_ORIGINAL_RAW_FILE_DATA  0xC68B
+
+/* returns 1 if IFD0 has the given tag */
+int dng_has_tag(const char* dng_file, int tag);
+
+/*
+ * Overwrites WhiteLevel in the raw IFD(s).
+ * Returns 0 if there is nothing it can patch in place
+ * (no such tag, or one value per channel), so the caller can use exiftool.
+ */
+int dng_patch_white_level(const char* dng_file, int level);
+
+#endif
@@ -20,7 +20,7 @@ void copy_tags_from_source(const char* source, const char* dest)
 
 const char * get_camera_model(const char* filename)
 {
-    static char model[100];
+    static __thread char model[100];
     char exif_cmd[10000];
     snprintf(exif_cmd, sizeof(exif_cmd), "exiftool -Model -b \"%s\"", filename);
     FILE* exif_file = popen(exif_cmd, "r");
@@ -219,24 +219,6 @@ void embed_original_raw(const char* dng_file, const char* raw_file, int delete_o
     }
 }
 
-int dng_has_original_raw(const char* dng_file)
-{
-    char exif_cmd[1000];
-
-    snprintf(exif_cmd, sizeof(exif_cmd), "exiftool -OriginalRawFileData \"%s\"", dng_file);
-    FILE* exif_file = popen(exif_cmd, "r");
-    if (exif_file)
-    {
-        char ch;
-        int has_original_raw = fscanf(exif_file, "%c", &ch) == 1;
-        pclose(exif_file);
-        return has_original_raw;
-    }
-
-    printf("%-16s: could not run exiftool\n", dng_file);
-    return 0;
-}
-
 /* returns 1 on success */
 int extract_original_raw(const char* dng_file, const char* raw_file)
 {
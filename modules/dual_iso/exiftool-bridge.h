@@ -16,8 +16,6 @@ void set_white_level(const char* file, int level);
 
 void embed_original_raw(const char* dng_file, const char* raw_file, int delete_original);
 
-int dng_has_original_raw(const char* dng_file);
-
 int extract_original_raw(const char* dng_file, const char* raw_file);
 
 void dng_backup_metadata(const char* dng_file);
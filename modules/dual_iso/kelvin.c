@@ -68,7 +68,7 @@ static void pseudoinverse (double (*in)[3], double (*out)[3], int size);
 void ufraw_kelvin_green_to_multipliers(double temperature, double green, double chanMulArray[3])
 {
     /* color matrices from dcraw */
-    extern float pre_mul[4], rgb_cam[3][4];
+    extern __thread float pre_mul[4], rgb_cam[3][4];
     double rgbWB[3];
     int c, cc, i, j;
 
@@ -123,7 +123,7 @@ void ufraw_multipliers_to_kelvin_green(double chanMulArray[3], double* temperatu
     double rgbWB[3];
 
     /* color matrices from dcraw */
-    extern float pre_mul[4], rgb_cam[3][4];
+    extern __thread float pre_mul[4], rgb_cam[3][4];
 
     /* (1/chanMul)[4] = (1/preMul)[4][4] * cam_rgb[4][3] * rgbWB[3]
      * Therefore:
@@ -157,15 +157,16 @@ void ufraw_multipliers_to_kelvin_green(double chanMulArray[3], double* temperatu
 #define ushort unsigned short
 #endif
 
-float cam_mul[4], pre_mul[4], cmatrix[3][4], rgb_cam[3][4];
+/* set by adobe_coeff for the camera of the current image; thread-local for cr2hdr --jobs */
+__thread float cam_mul[4], pre_mul[4], cmatrix[3][4], rgb_cam[3][4];
 
 const double xyz_rgb[3][3] = {                        /* XYZ from RGB */
   { 0.412453, 0.357580, 0.180423 },
   { 0.212671, 0.715160, 0.072169 },
   { 0.019334, 0.119193, 0.950227 } };
 
-int black, maximum;
-unsigned raw_color;
+__thread int black, maximum;
+__thread unsigned raw_color;
 int colors = 3;
 
 
@@ -7,10 +7,14 @@
  */
 
 
+/* optmed_simd.h includes this again with vector types, see there */
+#ifndef OPTMED_VECTOR
 typedef int pixelvalue ;
 
 #define PIX_SORT(a,b) { if ((a)>(b)) PIX_SWAP((a),(b)); }
 #define PIX_SWAP(a,b) { pixelvalue temp=(a);(a)=(b);(b)=temp; }
+#define OPTMED(name) name
+#endif
 
 /*----------------------------------------------------------------------------
    Function :   opt_med3()
@@ -22,7 +26,7 @@ typedef int pixelvalue ;
                 on the nature of the input signal.
  ---------------------------------------------------------------------------*/
 
-static inline pixelvalue opt_med3(pixelvalue * p)
+static inline pixelvalue OPTMED(opt_med3)(pixelvalue * p)
 {
     PIX_SORT(p[0],p[1]) ; PIX_SORT(p[1],p[2]) ; PIX_SORT(p[0],p[1]) ;
     return(p[1]) ;
@@ -38,7 +42,7 @@ static inline pixelvalue opt_med3(pixelvalue * p)
                 on the nature of the input signal.
  ---------------------------------------------------------------------------*/
 
-static inline pixelvalue opt_med5(pixelvalue * p)
+static inline pixelvalue OPTMED(opt_med5)(pixelvalue * p)
 {
     PIX_SORT(p[0],p[1]) ; PIX_SORT(p[3],p[4]) ; PIX_SORT(p[0],p[3]) ;
     PIX_SORT(p[1],p[4]) ; PIX_SORT(p[1],p[2]) ; PIX_SORT(p[2],p[3]) ;
@@ -57,7 +61,8 @@ static inline pixelvalue opt_med5(pixelvalue * p)
                 If you need larger even length kernels check the paper
  ---------------------------------------------------------------------------*/
 
-static inline pixelvalue opt_med6(pixelvalue * p)
+#ifndef OPTMED_VECTOR
+static inline pixelvalue OPTMED(opt_med6)(pixelvalue * p)
 {
     PIX_SORT(p[1], p[2]); PIX_SORT(p[3],p[4]);
     PIX_SORT(p[0], p[1]); PIX_SORT(p[2],p[3]); PIX_SORT(p[4],p[5]);
@@ -67,6 +72,7 @@ static inline pixelvalue opt_med6(pixelvalue * p)
     return ( p[2] + p[3] ) * 0.5;
     /* PIX_SORT(p[2], p[3]) results in lower median in p[2] and upper median in p[3] */
 }
+#endif
 
 
 /*----------------------------------------------------------------------------
@@ -79,7 +85,7 @@ static inline pixelvalue opt_med6(pixelvalue * p)
                 on the nature of the input signal.
  ---------------------------------------------------------------------------*/
 
-static inline pixelvalue opt_med7(pixelvalue * p)
+static inline pixelvalue OPTMED(opt_med7)(pixelvalue * p)
 {
     PIX_SORT(p[0], p[5]) ; PIX_SORT(p[0], p[3]) ; PIX_SORT(p[1], p[6]) ;
     PIX_SORT(p[2], p[4]) ; PIX_SORT(p[0], p[1]) ; PIX_SORT(p[3], p[5]) ;
@@ -104,7 +110,7 @@ static inline pixelvalue opt_med7(pixelvalue * p)
                 in middle position, but other elements are NOT sorted.
  ---------------------------------------------------------------------------*/
 
-static inline pixelvalue opt_med9(pixelvalue * p)
+static inline pixelvalue OPTMED(opt_med9)(pixelvalue * p)
 {
     PIX_SORT(p[1], p[2]) ; PIX_SORT(p[4], p[5]) ; PIX_SORT(p[7], p[8]) ;
     PIX_SORT(p[0], p[1]) ; PIX_SORT(p[3], p[4]) ; PIX_SORT(p[6], p[7]) ;
@@ -126,7 +132,7 @@ static inline pixelvalue opt_med9(pixelvalue * p)
   				Code taken from Graphic Gems.
  ---------------------------------------------------------------------------*/
 
-static inline pixelvalue opt_med25(pixelvalue * p)
+static inline pixelvalue OPTMED(opt_med25)(pixelvalue * p)
 {
 
 
@@ -171,5 +177,6 @@ static inline pixelvalue opt_med25(pixelvalue * p)
 
 #undef PIX_SORT
 #undef PIX_SWAP
+#undef OPTMED
 
 
@@ -0,0 +1,80 @@
+/*
+ * Vector versions of the median networks from optmed.h.
+ *
+ * optmed.h is included once more with pixelvalue being a vector of int32 and PIX_SORT
+ * being a min/max pair, so every lane gets the median of its own inputs, with the very
+ * same comparisons as the scalar code (bit-exact results).
+ *
+ * The functions are named opt_med5_simd, opt_med9_simd... and process OPTMED_SIMD_LANES
+ * medians at once (AVX2: 8, SSE2/NEON: 4). Without SIMD support, OPTMED_SIMD_LANES is 0
+ * and nothing else is defined.
+ *
+ * Include optmed.h before this file.
+ */
+
+#ifndef _optmed_simd_h_
+#define _optmed_simd_h_
+
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+#define OPTMED_SIMD_LANES 8
+typedef __m256i vint32;
+#define VINT32_LOAD(p)      _mm256_loadu_si256((const __m256i *)(p))
+#define VINT32_STORE(p, v)  _mm256_storeu_si256((__m256i *)(p), (v))
+#define VINT32_MIN(a, b)    _mm256_min_epi32((a), (b))
+#define VINT32_MAX(a, b)    _mm256_max_epi32((a), (b))
+
+#elif defined(__SSE2__)
+
+#include <emmintrin.h>
+#define OPTMED_SIMD_LANES 4
+typedef __m128i vint32;
+
+/* no signed 32-bit min/max before SSE4.1 */
+static inline __m128i vint32_min_sse2(__m128i a, __m128i b)
+{
+    __m128i gt = _mm_cmpgt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(gt, b), _mm_andnot_si128(gt, a));
+}
+
+static inline __m128i vint32_max_sse2(__m128i a, __m128i b)
+{
+    __m128i gt = _mm_cmpgt_epi32(a, b);
+    return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+}
+
+#define VINT32_LOAD(p)      _mm_loadu_si128((const __m128i *)(p))
+#define VINT32_STORE(p, v)  _mm_storeu_si128((__m128i *)(p), (v))
+#define VINT32_MIN(a, b)    vint32_min_sse2((a), (b))
+#define VINT32_MAX(a, b)    vint32_max_sse2((a), (b))
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+#define OPTMED_SIMD_LANES 4
+typedef int32x4_t vint32;
+#define VINT32_LOAD(p)      vld1q_s32((const int32_t *)(p))
+#define VINT32_STORE(p, v)  vst1q_s32((int32_t *)(p), (v))
+#define VINT32_MIN(a, b)    vminq_s32((a), (b))
+#define VINT32_MAX(a, b)    vmaxq_s32((a), (b))
+
+#else
+
+#define OPTMED_SIMD_LANES 0
+
+#endif
+
+#if OPTMED_SIMD_LANES
+
+#define OPTMED_VECTOR
+#define pixelvalue vint32
+#define PIX_SORT(a,b) { vint32 temp = VINT32_MIN((a),(b)); (b) = VINT32_MAX((a),(b)); (a) = temp; }
+#define OPTMED(name) name##_simd
+#include "optmed.h"
+#undef pixelvalue
+#undef OPTMED_VECTOR
+
+#endif
+
+#endif
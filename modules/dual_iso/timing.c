@@ -1,7 +1,7 @@
 #include <time.h>
 #include <stdio.h>
 
-static int __t0;
+static __thread int __t0;
 
 void tic()
 {
@@ -64,11 +64,16 @@ static void crypt_lfsr64_clock(lfsr64_ctx_t *ctx, uint32_t clocks)
 {
     uint64_t lfsr = ctx->lfsr_state;
     
-    for(uint32_t clock = 0; clock < clocks; clock++)
+    /* maximum length LFSR according to http://www.xilinx.com/support/documentation/application_notes/xapp052.pdf
+       every clock shifts in bit = (lfsr >> 63) ^ (lfsr >> 62) ^ (lfsr >> 60) ^ (lfsr >> 59).
+       the taps are at least 60 bits away from the new bits, so up to 60 clocks can be done in one go. */
+    while(clocks > 0)
     {
-        /* maximum length LFSR according to http://www.xilinx.com/support/documentation/application_notes/xapp052.pdf */
-        int bit = ((lfsr >> 63) ^ (lfsr >> 62) ^ (lfsr >> 60) ^ (lfsr >> 59)) & 1;
-        lfsr = (lfsr << 1) | bit;
+        uint32_t step = (clocks < 60) ? clocks : 60;
+        uint64_t bits = (lfsr >> (64 - step)) ^ (lfsr >> (63 - step)) ^ (lfsr >> (61 - step)) ^ (lfsr >> (60 - step));
+        
+        lfsr = (lfsr << step) | (bits & ((1ULL << step) - 1));
+        clocks -= step;
     }
     
     ctx->lfsr_state = lfsr;
@@ -166,15 +171,18 @@ static void update_key(lfsr64_ctx_t *ctx, uint32_t offset, uint32_t force)
     /* build an array with key elements for every offset in uint64_t mode */
     for(int pos = 0; pos < 8; pos++)
     {
-        uint32_t elem_addr = (uint32_t)&ctx->key_uint64[pos];
+        uint8_t *elem_addr = (uint8_t *)&ctx->key_uint64[pos];
         
-        memcpy((void*)elem_addr, &ctx->key_uint8[pos], 8 - pos);
-        memcpy((void*)(elem_addr + (8 - pos)), &ctx->key_uint8[0], pos);
+        memcpy(elem_addr, &ctx->key_uint8[pos], 8 - pos);
+        memcpy(elem_addr + (8 - pos), &ctx->key_uint8[0], pos);
     }
 }
 
-/* de-/encryption routine, XORing every 64 bit word with an offset based crypt key */
-static uint32_t crypt_lfsr64_encrypt(crypt_priv_t *priv, uint8_t *dst_in, uint8_t *src_in, uint32_t in_length, uint32_t offset)
+/* de-/encryption routine, XORing every 64 bit word with an offset based crypt key.
+   handles any block size, but checks for block boundaries every 8 bytes. when the block size
+   is not a multiple of 8, boundaries inside a 64 bit word are missed in the aligned loop,
+   so the key stream depends on how the data is split into calls. keep this behavior. */
+static uint32_t crypt_lfsr64_encrypt_generic(crypt_priv_t *priv, uint8_t *dst_in, uint8_t *src_in, uint32_t in_length, uint32_t offset)
 {
     lfsr64_ctx_t *ctx = (lfsr64_ctx_t *)priv;
     uint8_t *dst = dst_in;
@@ -190,7 +198,7 @@ static uint32_t crypt_lfsr64_encrypt(crypt_priv_t *priv, uint8_t *dst_in, uint8_
     //trace_write(iocrypt_trace_ctx, "crypt_lfsr64_encrypt: dst 0x%08X, src 0x%08X, length: 0x%08X, offset: 0x%08X", dst, src, length, offset);
     
     /* try to get the addresses aligned */
-    while((((uint32_t)dst) % 8) && (length > 0))
+    while((((uintptr_t)dst) % 8) && (length > 0))
     {
         /* at every block start, rerun key update */
         if((offset % blocksize) == 0)
@@ -291,13 +299,126 @@ static uint32_t crypt_lfsr64_encrypt(crypt_priv_t *priv, uint8_t *dst_in, uint8_
         length -= 1;
     }
     
-    if((uint32_t)dst_in + in_length != (uint32_t)dst)
+    if(dst_in + in_length != dst)
+    {
+        trace_write(iocrypt_trace_ctx, "crypt_lfsr64_encrypt: ADDRESS ERROR dst 0x%08X/0x%08X, src 0x%08X/0x%08X, length: 0x%08X, offset: 0x%08X", (uint32_t)(uintptr_t)dst, (uint32_t)(uintptr_t)dst_in, (uint32_t)(uintptr_t)src, (uint32_t)(uintptr_t)src_in, length, offset);
+    }
+    if(src_in + in_length != src)
+    {
+        trace_write(iocrypt_trace_ctx, "crypt_lfsr64_encrypt: ADDRESS ERROR dst 0x%08X/0x%08X, src 0x%08X/0x%08X, length: 0x%08X, offset: 0x%08X", (uint32_t)(uintptr_t)dst, (uint32_t)(uintptr_t)dst_in, (uint32_t)(uintptr_t)src, (uint32_t)(uintptr_t)src_in, length, offset);
+    }
+    
+    return in_length;
+}
+
+/* XOR a range that is within a single block, so the key doesn't change */
+static void crypt_lfsr64_xor_range(uint8_t *dst, uint8_t *src, uint32_t length, lfsr64_ctx_t *ctx, uint32_t offset)
+{
+    /* get the destination 64 bit aligned */
+    while((((uintptr_t)dst) % 8) && (length > 0))
+    {
+        crypt_lfsr64_xor_uint8(dst, src, ctx, offset);
+        dst += 1;
+        src += 1;
+        offset += 1;
+        length -= 1;
+    }
+    
+    /* the key word for this offset, rotated so it can be applied to aligned words */
+    uint64_t key = ctx->key_uint64[offset % 8];
+    
+    if((((uintptr_t)src) % 8) == 0)
+    {
+        /* 32 bytes per iteration, so the compiler can use LDM/STM bursts */
+        while(length >= 32)
+        {
+            uint64_t *dst64 = (uint64_t *)dst;
+            uint64_t *src64 = (uint64_t *)src;
+            uint64_t w0 = src64[0];
+            uint64_t w1 = src64[1];
+            uint64_t w2 = src64[2];
+            uint64_t w3 = src64[3];
+            
+            dst64[0] = w0 ^ key;
+            dst64[1] = w1 ^ key;
+            dst64[2] = w2 ^ key;
+            dst64[3] = w3 ^ key;
+            dst += 32;
+            src += 32;
+            offset += 32;
+            length -= 32;
+        }
+        
+        while(length >= 8)
+        {
+            *(uint64_t *)dst = *(uint64_t *)src ^ key;
+            dst += 8;
+            src += 8;
+            offset += 8;
+            length -= 8;
+        }
+    }
+    else
+    {
+        /* unaligned source, ARMv5 can't load that word-wise */
+        while(length >= 8)
+        {
+            uint64_t word;
+            
+            memcpy(&word, src, 8);
+            *(uint64_t *)dst = word ^ key;
+            dst += 8;
+            src += 8;
+            offset += 8;
+            length -= 8;
+        }
+    }
+    
+    while(length > 0)
+    {
+        crypt_lfsr64_xor_uint8(dst, src, ctx, offset);
+        dst += 1;
+        src += 1;
+        offset += 1;
+        length -= 1;
+    }
+}
+
+/* de-/encryption routine. with block sizes that are a multiple of 8 (all the camera uses)
+   every byte at offset x is XORed with byte (x % 8) of the key for block (x / blocksize),
+   so we can process the data block by block without any per-word checks. */
+static uint32_t crypt_lfsr64_encrypt(crypt_priv_t *priv, uint8_t *dst_in, uint8_t *src_in, uint32_t in_length, uint32_t offset)
+{
+    lfsr64_ctx_t *ctx = (lfsr64_ctx_t *)priv;
+    uint8_t *dst = dst_in;
+    uint8_t *src = src_in;
+    uint32_t length = in_length;
+    uint32_t blocksize = ctx->blocksize;
+    
+    if(blocksize % 8)
     {
-        trace_write(iocrypt_trace_ctx, "crypt_lfsr64_encrypt: ADDRESS ERROR dst 0x%08X/0x%08X, src 0x%08X/0x%08X, length: 0x%08X, offset: 0x%08X", dst, dst_in, src, src_in, length, offset);
+        return crypt_lfsr64_encrypt_generic(priv, dst_in, src_in, in_length, offset);
     }
-    if((uint32_t)src_in + in_length != (uint32_t)src)
+    
+    /* ensure initial key creation if necessary */
+    update_key(ctx, offset, 0);
+    
+    while(length > 0)
     {
-        trace_write(iocrypt_trace_ctx, "crypt_lfsr64_encrypt: ADDRESS ERROR dst 0x%08X/0x%08X, src 0x%08X/0x%08X, length: 0x%08X, offset: 0x%08X", dst, dst_in, src, src_in, length, offset);
+        uint32_t block_remain = blocksize - (offset % blocksize);
+        uint32_t size = (length < block_remain) ? length : block_remain;
+        
+        crypt_lfsr64_xor_range(dst, src, size, ctx, offset);
+        dst += size;
+        src += size;
+        offset += size;
+        length -= size;
+        
+        /* next block, next key */
+        if(length > 0)
+        {
+            update_key(ctx, offset, 0);
+        }
     }
     
     return in_length;
@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/* host test for the LFSR64 fast path: checks the word-wise LFSR clocking against
+   the original bit by bit loop, then runs random call sequences through
+   crypt_lfsr64_encrypt and the original crypt_lfsr64_encrypt_generic and
+   compares the output and the cipher state after every call.
+
+   usage: crypt_lfsr64_test [iterations]
+ */
+
+#include <sys/time.h>
+
+/* we need the static functions */
+#include "crypt_lfsr64.c"
+
+#define MAX_LENGTH (64 * 1024)
+
+static uint32_t lfsr113[] = { 0x00009821, 0x00098722, 0x00986332, 0x961FEFA7 };
+
+static uint32_t rand32()
+{
+    lfsr113[0] = ((lfsr113[0] & 0xFFFFFFFE) << 18) ^ (((lfsr113[0] <<  6) ^ lfsr113[0]) >> 13);
+    lfsr113[1] = ((lfsr113[1] & 0xFFFFFFF8) <<  2) ^ (((lfsr113[1] <<  2) ^ lfsr113[1]) >> 27);
+    lfsr113[2] = ((lfsr113[2] & 0xFFFFFFF0) <<  7) ^ (((lfsr113[2] << 13) ^ lfsr113[2]) >> 21);
+    lfsr113[3] = ((lfsr113[3] & 0xFFFFFF80) << 13) ^ (((lfsr113[3] <<  3) ^ lfsr113[3]) >> 12);
+
+    return lfsr113[0] ^ lfsr113[1] ^ lfsr113[2] ^ lfsr113[3];
+}
+
+static void rand_fill(uint8_t *buffer, uint32_t length)
+{
+    for(uint32_t pos = 0; pos < length; pos++)
+    {
+        buffer[pos] = rand32();
+    }
+}
+
+static double get_time()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+/* the original bit by bit LFSR clocking */
+static uint64_t clock_bitwise(uint64_t lfsr, uint32_t clocks)
+{
+    for(uint32_t clock = 0; clock < clocks; clock++)
+    {
+        int bit = ((lfsr >> 63) ^ (lfsr >> 62) ^ (lfsr >> 60) ^ (lfsr >> 59)) & 1;
+        lfsr = (lfsr << 1) | bit;
+    }
+
+    return lfsr;
+}
+
+static int test_clock()
+{
+    lfsr64_ctx_t ctx;
+
+    for(uint32_t test = 0; test < 100000; test++)
+    {
+        uint64_t lfsr = ((uint64_t)rand32() << 32) | rand32();
+        uint32_t clocks = rand32() % 300;
+
+        ctx.lfsr_state = lfsr;
+        crypt_lfsr64_clock(&ctx, clocks);
+
+        if(ctx.lfsr_state != clock_bitwise(lfsr, clocks))
+        {
+            printf("FAILED: clocking 0x%08X%08X by %d\n", (uint32_t)(lfsr >> 32), (uint32_t)lfsr, clocks);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* block sizes io_crypt uses (16 << n), some other multiples of 8 and a few odd ones (generic path) */
+static const uint32_t blocksizes[] = { 16, 32, 64, 128, 256, 512, 1024, 2048, 4096, 8192, 0x20000, 8, 24, 0x228, 0x224, 13, 0x1001 };
+
+static int run_test(uint32_t iteration)
+{
+    static uint8_t src[MAX_LENGTH + 16];
+    static uint8_t dst_fast[MAX_LENGTH + 16];
+    static uint8_t dst_ref[MAX_LENGTH + 16];
+
+    crypt_cipher_t fast;
+    crypt_cipher_t ref;
+    uint64_t password = ((uint64_t)rand32() << 32) | rand32();
+    uint32_t blocksize = blocksizes[rand32() % (sizeof(blocksizes) / sizeof(blocksizes[0]))];
+    uint32_t offset = 0;
+
+    crypt_lfsr64_init(&fast, password);
+    crypt_lfsr64_init(&ref, password);
+    fast.set_blocksize(fast.priv, blocksize);
+    ref.set_blocksize(ref.priv, blocksize);
+
+    lfsr64_ctx_t *fast_ctx = (lfsr64_ctx_t *)fast.priv;
+    lfsr64_ctx_t *ref_ctx = (lfsr64_ctx_t *)ref.priv;
+
+    rand_fill(src, sizeof(src));
+
+    for(int call = 0; call < 64; call++)
+    {
+        /* mostly sequential, sometimes seeking around like FIO does */
+        switch(rand32() % 8)
+        {
+            case 0:
+                offset = rand32() % (64 * blocksize + 64);
+                break;
+            case 1:
+                offset = (offset > blocksize) ? (offset - blocksize) : 0;
+                break;
+            default:
+                break;
+        }
+
+        uint32_t length = rand32() % 4;
+        switch(length)
+        {
+            case 0:
+                length = rand32() % 16;
+                break;
+            case 1:
+                length = rand32() % (2 * blocksize + 16);
+                break;
+            default:
+                length = rand32() % MAX_LENGTH;
+                break;
+        }
+        if(length > MAX_LENGTH)
+        {
+            length = MAX_LENGTH;
+        }
+
+        uint32_t src_align = rand32() % 8;
+        uint32_t dst_align = (rand32() % 4) ? src_align : (rand32() % 8);
+        int in_place = !(rand32() % 3);
+
+        memcpy(dst_fast, src, sizeof(src));
+        memcpy(dst_ref, src, sizeof(src));
+
+        if(in_place)
+        {
+            fast.encrypt(fast.priv, &dst_fast[src_align], &dst_fast[src_align], length, offset);
+            crypt_lfsr64_encrypt_generic(ref.priv, &dst_ref[src_align], &dst_ref[src_align], length, offset);
+        }
+        else
+        {
+            fast.encrypt(fast.priv, &dst_fast[dst_align], &src[src_align], length, offset);
+            crypt_lfsr64_encrypt_generic(ref.priv, &dst_ref[dst_align], &src[src_align], length, offset);
+        }
+
+        if(memcmp(dst_fast, dst_ref, sizeof(dst_fast)) || fast_ctx->current_block != ref_ctx->current_block || fast_ctx->lfsr_state != ref_ctx->lfsr_state)
+        {
+            printf("FAILED: iteration %d, call %d, blocksize 0x%X, offset 0x%X, length 0x%X, src +%d, dst +%d%s\n", iteration, call, blocksize, offset, length, src_align, dst_align, in_place ? " (in place)" : "");
+            fast.deinit(fast.priv);
+            ref.deinit(ref.priv);
+            return 1;
+        }
+
+        offset += length;
+    }
+
+    fast.deinit(fast.priv);
+    ref.deinit(ref.priv);
+    return 0;
+}
+
+/* MiB/s of both implementations, the way io_crypt calls them: 1 MiB writes, in place */
+static void run_benchmark(uint32_t blocksize)
+{
+    uint32_t size = 1024 * 1024;
+    uint32_t loops = 64;
+    uint8_t *buffer = malloc(size);
+    crypt_cipher_t fast;
+    crypt_cipher_t ref;
+
+    rand_fill(buffer, size);
+    crypt_lfsr64_init(&fast, 0x0123456789ABCDEFULL);
+    crypt_lfsr64_init(&ref, 0x0123456789ABCDEFULL);
+    fast.set_blocksize(fast.priv, blocksize);
+    ref.set_blocksize(ref.priv, blocksize);
+
+    double start = get_time();
+    for(uint32_t loop = 0; loop < loops; loop++)
+    {
+        crypt_lfsr64_encrypt_generic(ref.priv, buffer, buffer, size, loop * size);
+    }
+    double ref_time = get_time() - start;
+
+    start = get_time();
+    for(uint32_t loop = 0; loop < loops; loop++)
+    {
+        fast.encrypt(fast.priv, buffer, buffer, size, loop * size);
+    }
+    double fast_time = get_time() - start;
+
+    printf("blocksize %6d: %8.1f MiB/s (was %8.1f MiB/s)\n", blocksize, loops / fast_time, loops / ref_time);
+
+    fast.deinit(fast.priv);
+    ref.deinit(ref.priv);
+    free(buffer);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t iterations = 500;
+
+    if(argc > 1)
+    {
+        iterations = atoi(argv[1]);
+    }
+
+    if(test_clock())
+    {
+        return 1;
+    }
+    printf("LFSR clocking: OK\n");
+
+    for(uint32_t iteration = 0; iteration < iterations; iteration++)
+    {
+        if(run_test(iteration))
+        {
+            return 1;
+        }
+    }
+    printf("%d random call sequences: OK\n", iterations);
+
+    run_benchmark(16);
+    run_benchmark(256);
+    run_benchmark(8192);
+    run_benchmark(0x20000);
+
+    return 0;
+}
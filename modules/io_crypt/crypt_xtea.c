@@ -24,6 +24,9 @@
 
 #endif
 
+/* common includes */
+#include <string.h>
+
 #include "io_crypt.h"
 #include "crypt_xtea.h"
 
@@ -116,6 +116,11 @@ static char iocrypt_ime_text[128];
 struct msg_queue *iocrypt_msgs = NULL;
 static uint32_t iocrypt_shutdown = 0;
 
+/* writer thread data, it stores one scratch buffer while the crypt thread fills the other */
+static struct msg_queue *iocrypt_write_msgs = NULL;
+static iocrypt_job_t iocrypt_write_jobs[CRYPT_WRITE_BUFFERS];
+static uint32_t iocrypt_writer_shutdown = 0;
+
 /* en-/decrypt on the fly with a symmetric cipher and given password */
 #define CRYPT_MODE_SYMMETRIC            0
 
@@ -921,6 +926,115 @@ static struct menu_entry iocrypt_menus[] =
     },
 };
 
+static void iocrypt_writer_task()
+{
+    while(!iocrypt_writer_shutdown && !ml_shutdown_requested)
+    {
+        int timeout = 500;
+        iocrypt_job_t *job = NULL;
+
+        if(msg_queue_receive(iocrypt_write_msgs, &job, timeout))
+        {
+            continue;
+        }
+        
+        trace_write(iocrypt_trace_ctx, "   ->> WRITE 0x%08X", job->length);
+        job->ret = orig_iodev->WriteFile(job->fd, job->buf, job->length);
+        trace_write(iocrypt_trace_ctx, "   ->> WRITE DONE (%d)", job->ret);
+        
+        give_semaphore(job->semaphore);
+    }
+    
+    iocrypt_writer_shutdown = 0;
+}
+
+/* encrypt the data chunk by chunk into the scratch buffers and let the writer task store them,
+   so encryption of the next chunk overlaps with the card write of the previous one.
+   returns the number of bytes written, or -1 like WriteFile if the first chunk failed */
+static uint32_t iocrypt_encrypt_write(iocrypt_job_t *job)
+{
+    uint32_t pending[CRYPT_WRITE_BUFFERS];
+    uint32_t written = 0;
+    uint32_t failed = 0;
+    uint32_t idle = 0;
+    uint32_t pos = 0;
+    uint32_t buffer = 0;
+    
+    memset(pending, 0x00, sizeof(pending));
+    
+    /* the buffers are used round robin, so the oldest write is always the next one */
+    while(idle < CRYPT_WRITE_BUFFERS)
+    {
+        iocrypt_job_t *write = &iocrypt_write_jobs[buffer];
+        
+        /* wait until the previous write from this buffer is done */
+        if(pending[buffer])
+        {
+            take_semaphore(write->semaphore, 0);
+            pending[buffer] = 0;
+            
+            if(!failed)
+            {
+                /* WriteFile returns -1 on errors, which ret (unsigned) would take for a huge write */
+                int ret = (int)write->ret;
+                
+                /* card full or write error: report what got written, don't queue anything else */
+                if(ret < 0 || (uint32_t)ret < write->length)
+                {
+                    failed = 1;
+                }
+                
+                if(ret > 0)
+                {
+                    written += MIN((uint32_t)ret, write->length);
+                }
+            }
+        }
+        
+        if(pos < job->length && !failed)
+        {
+            uint32_t size = MIN(job->length - pos, CRYPT_WRITE_CHUNK);
+            uint8_t *scratch = &iocrypt_scratch[buffer * CRYPT_WRITE_CHUNK];
+            
+            trace_write(iocrypt_trace_ctx, "   ->> ENCRYPT 0x%08X", size);
+            job->ctx->encrypt(job->ctx->priv, scratch, (uint8_t *)job->buf + pos, size, job->fd_pos + pos);
+            
+            write->type = CRYPT_JOB_WRITE;
+            write->fd = job->fd;
+            write->buf = scratch;
+            write->length = size;
+            write->ret = 0;
+            msg_queue_post(iocrypt_write_msgs, (uint32_t)write);
+            
+            pending[buffer] = 1;
+            pos += size;
+        }
+        else
+        {
+            /* nothing more to queue, just collect the outstanding writes */
+            idle++;
+        }
+        
+        buffer = (buffer + 1) % CRYPT_WRITE_BUFFERS;
+    }
+    
+    /* a chunk queued after the failed one may still have been stored behind the short write.
+       instead of reporting that misplaced tail to the caller, move the file position back to the end
+       of the data that was written in order, so the caller can rely on fd_pos + written.
+       the position still includes the header offset here, the caller removes it afterwards. */
+    if(failed)
+    {
+        iodev_SetPosition(job->fd, job->fd_pos + iocrypt_files[job->fd].header_size + written);
+    }
+    
+    if(failed && !written)
+    {
+        return (uint32_t)-1;
+    }
+    
+    return written;
+}
+
 static void iocrypt_task()
 {
     while(!iocrypt_shutdown && !ml_shutdown_requested)
@@ -939,11 +1053,8 @@ static void iocrypt_task()
             /* combined encrypt and write job which is atomic */
             case CRYPT_JOB_ENCRYPT_WRITE:
             {
-                trace_write(iocrypt_trace_ctx, "   ->> ENCRYPT");
-                job->ctx->encrypt(job->ctx->priv, iocrypt_scratch, job->buf, job->length, job->fd_pos);
-                trace_write(iocrypt_trace_ctx, "   ->> WRITE");
-                job->ret = orig_iodev->WriteFile(job->fd, iocrypt_scratch, job->length);
-                trace_write(iocrypt_trace_ctx, "   ->> DONE");
+                job->ret = iocrypt_encrypt_write(job);
+                trace_write(iocrypt_trace_ctx, "   ->> DONE (%d)", job->ret);
                 
                 give_semaphore(job->semaphore);
                 break;
@@ -996,6 +1107,11 @@ static unsigned int iocrypt_init()
         iocrypt_files[pos].semaphore = create_named_semaphore("iocrypt_pw", 0);
     }
     
+    for(int pos = 0; pos < COUNT(iocrypt_write_jobs); pos++)
+    {
+        iocrypt_write_jobs[pos].semaphore = create_named_semaphore("iocrypt_wr", 0);
+    }
+    
     if(is_camera("600D", "1.0.2"))
     {
         trace_write(iocrypt_trace_ctx, "io_crypt: Detected 600D");
@@ -1088,10 +1204,12 @@ static unsigned int iocrypt_init()
     
     /* create a message queue for processing crypt tasks asyncrhonously */
     iocrypt_msgs = (struct msg_queue *) msg_queue_create("iocrypt_msgs", 100);
+    iocrypt_write_msgs = (struct msg_queue *) msg_queue_create("iocrypt_write_msgs", CRYPT_WRITE_BUFFERS);
     
     crypt_rsa_init(&iocrypt_rsa_ctx);
     
     task_create("iocrypt_task", 0x1A, 0x1000, iocrypt_task, (void*)0);
+    task_create("iocrypt_writer", 0x1A, 0x1000, iocrypt_writer_task, (void*)0);
     
     /* any file operation is routed through us now */
     menu_add("Shoot", iocrypt_menus, COUNT(iocrypt_menus) );
@@ -1102,8 +1220,9 @@ static unsigned int iocrypt_init()
 static unsigned int iocrypt_deinit()
 {
     iocrypt_shutdown = 1;
+    iocrypt_writer_shutdown = 1;
     
-    while(iocrypt_shutdown && !ml_shutdown_requested)
+    while((iocrypt_shutdown || iocrypt_writer_shutdown) && !ml_shutdown_requested)
     {
         msleep(20);
     }
@@ -2,12 +2,16 @@
 #ifndef __IO_CRYPT_H
 #define __IO_CRYPT_H
 
-#define CRYPT_SCRATCH_SIZE 0x00800000
+/* encrypted writes are split into chunks, one is written while the next gets encrypted */
+#define CRYPT_WRITE_CHUNK   0x00080000
+#define CRYPT_WRITE_BUFFERS 2
+#define CRYPT_SCRATCH_SIZE  (CRYPT_WRITE_CHUNK * CRYPT_WRITE_BUFFERS)
 
 
 #define CRYPT_JOB_ENCRYPT       0
 #define CRYPT_JOB_ENCRYPT_WRITE 1
 #define CRYPT_JOB_DECRYPT       2
+#define CRYPT_JOB_WRITE         3
 
 
 typedef void crypt_priv_t;
@@ -24,6 +24,19 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <inttypes.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #include "io_crypt.h"
 #include "crypt_lfsr64.h"
@@ -120,21 +133,484 @@ static void io_decrypt_test()
     free(buf_dst);
 }
 
+/* parallel decryption works on slices of the file that are multiples of this
+ * and keeps the BLOCKSIZE calls of the sequential loop within each slice:
+ * when the LFSR64 block size is not a multiple of 8, the keystream depends on
+ * where the calls are split, so we must split them exactly the same way */
+#define SLICE_ALIGN (64 * BLOCKSIZE)
+
+/* large buffers when the file can't be mapped */
+#define CHUNK_SIZE (64 * 1024 * 1024)
+
+#define CIPHER_LFSR64 1
+#define CIPHER_XTEA   2
+
+typedef struct
+{
+    uint32_t type;
+    uint64_t key;
+    uint32_t blocksize;
+} cipher_params_t;
+
+/* every thread has its own cipher context, as LFSR64 keeps the current block key */
+typedef struct
+{
+    crypt_cipher_t crypt_ctx;
+    uint8_t *dst;
+    uint8_t *src;
+    uint64_t length;
+    uint64_t offset;
+    pthread_t thread;
+} decrypt_job_t;
+
+static void cipher_setup(crypt_cipher_t *crypt_ctx, cipher_params_t *params)
+{
+    if(params->type == CIPHER_XTEA)
+    {
+        /* todo: fill it correctly */
+        uint32_t password[4];
+        memset(password, 0x00, sizeof(password));
+        crypt_xtea_init(crypt_ctx, password, params->key);
+    }
+    else
+    {
+        crypt_lfsr64_init(crypt_ctx, params->key);
+        crypt_ctx->set_blocksize(crypt_ctx->priv, params->blocksize);
+    }
+}
+
+/* the file offset passed to the cipher is 32 bits, as in the sequential loop */
+static void decrypt_range(crypt_cipher_t *crypt_ctx, uint8_t *dst, uint8_t *src, uint64_t length, uint64_t offset)
+{
+    while(length > 0)
+    {
+        uint32_t size = (length < BLOCKSIZE) ? length : BLOCKSIZE;
+        
+        crypt_ctx->decrypt(crypt_ctx->priv, dst, src, size, (uint32_t)offset);
+        dst += size;
+        src += size;
+        offset += size;
+        length -= size;
+    }
+}
+
+static void *decrypt_worker(void *arg)
+{
+    decrypt_job_t *job = (decrypt_job_t *)arg;
+    
+    decrypt_range(&job->crypt_ctx, job->dst, job->src, job->length, job->offset);
+    return NULL;
+}
+
+/* decrypt length bytes starting at the given offset, split across the jobs */
+static void decrypt_parallel(decrypt_job_t *jobs, int threads, uint8_t *dst, uint8_t *src, uint64_t length, uint64_t offset)
+{
+    uint64_t slice = (length / threads + SLICE_ALIGN - 1) / SLICE_ALIGN * SLICE_ALIGN;
+    int started = 0;
+    
+    for(int thread = 0; thread < threads; thread++)
+    {
+        uint64_t start = thread * slice;
+        
+        if(start >= length)
+        {
+            break;
+        }
+        
+        decrypt_job_t *job = &jobs[thread];
+        job->dst = dst + start;
+        job->src = src + start;
+        job->length = (length - start < slice) ? (length - start) : slice;
+        job->offset = offset + start;
+        
+        if(threads == 1)
+        {
+            decrypt_worker(job);
+            return;
+        }
+        
+        if(pthread_create(&job->thread, NULL, &decrypt_worker, job))
+        {
+            /* no more threads? do it here */
+            decrypt_worker(job);
+            continue;
+        }
+        started |= (1 << thread);
+    }
+    
+    for(int thread = 0; thread < threads; thread++)
+    {
+        if(started & (1 << thread))
+        {
+            pthread_join(jobs[thread].thread, NULL);
+        }
+    }
+}
+
+static int get_cpu_count()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    return sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
+static double get_time()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static void *aligned_buffer(uint64_t size)
+{
+    /* 64-bit words, and pages for the kernel */
+#ifdef _WIN32
+    return _aligned_malloc(size, 4096);
+#else
+    void *buf = NULL;
+    if(posix_memalign(&buf, 4096, size))
+    {
+        return NULL;
+    }
+    return buf;
+#endif
+}
+
+static void aligned_free(void *buf)
+{
+#ifdef _WIN32
+    _aligned_free(buf);
+#else
+    free(buf);
+#endif
+}
+
+/* the original io_decrypt loop, BLOCKSIZE at a time with a single context
+ * if ref_file is given, the output is compared with it instead of written */
+static int decrypt_sequential(FILE *in_file, uint64_t data_offset, cipher_params_t *params, FILE *out_file, FILE *ref_file)
+{
+    crypt_cipher_t crypt_ctx;
+    char *buffer = malloc(BLOCKSIZE);
+    char *ref_buffer = malloc(BLOCKSIZE);
+    uint32_t file_offset = 0;
+    int ret = 0;
+    
+    cipher_setup(&crypt_ctx, params);
+    fseeko(in_file, data_offset, SEEK_SET);
+    
+    while(!feof(in_file))
+    {
+        int size = fread(buffer, 1, BLOCKSIZE, in_file);
+        
+        if(size > 0)
+        {
+            crypt_ctx.decrypt(crypt_ctx.priv, (uint8_t *)buffer, (uint8_t *)buffer, size, file_offset);
+            
+            if(ref_file)
+            {
+                if(fread(ref_buffer, 1, size, ref_file) != (size_t)size || memcmp(buffer, ref_buffer, size))
+                {
+                    printf("Output differs at offset 0x%08X\n", file_offset);
+                    ret = 1;
+                    break;
+                }
+            }
+            else
+            {
+                fwrite(buffer, 1, size, out_file);
+            }
+            file_offset += size;
+        }
+        if(size < 0)
+        {
+            ret = -1;
+            break;
+        }
+    }
+    
+    /* the output must not be longer, either */
+    if(ref_file && !ret && fread(ref_buffer, 1, 1, ref_file) == 1)
+    {
+        printf("Output is too long\n");
+        ret = 1;
+    }
+    
+    crypt_ctx.deinit(crypt_ctx.priv);
+    free(buffer);
+    free(ref_buffer);
+    return ret;
+}
+
+/* decrypt with large buffers, in place */
+static int decrypt_chunked(FILE *in_file, uint64_t data_offset, decrypt_job_t *jobs, int threads, FILE *out_file)
+{
+    uint8_t *buffer = aligned_buffer(CHUNK_SIZE);
+    uint64_t file_offset = 0;
+    
+    if(!buffer)
+    {
+        printf("Could not allocate %d MiB\n", CHUNK_SIZE >> 20);
+        return -1;
+    }
+    
+    fseeko(in_file, data_offset, SEEK_SET);
+    
+    while(1)
+    {
+        size_t size = fread(buffer, 1, CHUNK_SIZE, in_file);
+        
+        if(!size)
+        {
+            break;
+        }
+        
+        decrypt_parallel(jobs, threads, buffer, buffer, size, file_offset);
+        
+        if(fwrite(buffer, 1, size, out_file) != size)
+        {
+            aligned_free(buffer);
+            return -1;
+        }
+        file_offset += size;
+    }
+    
+    aligned_free(buffer);
+    return ferror(in_file) ? -1 : 0;
+}
+
+#ifndef _WIN32
+/* decrypt straight from the mapped input file to the mapped output file */
+static int decrypt_mapped(char *in_filename, uint64_t data_offset, decrypt_job_t *jobs, int threads, char *out_filename)
+{
+    int ret = -1;
+    int in_fd = open(in_filename, O_RDONLY);
+    int out_fd = open(out_filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    uint8_t *in_map = MAP_FAILED;
+    uint8_t *out_map = MAP_FAILED;
+    struct stat st;
+    
+    if(in_fd < 0 || out_fd < 0 || fstat(in_fd, &st) || (uint64_t)st.st_size <= data_offset)
+    {
+        goto cleanup;
+    }
+    
+    uint64_t in_size = st.st_size;
+    uint64_t out_size = in_size - data_offset;
+    
+    /* fails if it doesn't fit into the address space (32-bit build) */
+    if((size_t)in_size != in_size || ftruncate(out_fd, out_size))
+    {
+        goto cleanup;
+    }
+    
+    in_map = mmap(NULL, in_size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+    out_map = mmap(NULL, out_size, PROT_READ | PROT_WRITE, MAP_SHARED, out_fd, 0);
+    if(in_map == MAP_FAILED || out_map == MAP_FAILED)
+    {
+        goto cleanup;
+    }
+    
+    madvise(in_map, in_size, MADV_SEQUENTIAL);
+    
+    decrypt_parallel(jobs, threads, out_map, in_map + data_offset, out_size, 0);
+    ret = 0;
+    
+cleanup:
+    if(in_map != MAP_FAILED)
+    {
+        munmap(in_map, in_size);
+    }
+    if(out_map != MAP_FAILED)
+    {
+        munmap(out_map, out_size);
+    }
+    if(in_fd >= 0)
+    {
+        close(in_fd);
+    }
+    if(out_fd >= 0)
+    {
+        close(out_fd);
+    }
+    return ret;
+}
+#endif
+
+/* decrypt the file in memory with the sequential loop and with 1..threads threads, print MiB/s */
+static int benchmark(FILE *in_file, uint64_t data_offset, cipher_params_t *params, int threads)
+{
+    uint64_t size = 256 * 1024 * 1024;
+    
+    if(in_file)
+    {
+        fseeko(in_file, 0, SEEK_END);
+        size = ftello(in_file) - data_offset;
+    }
+    
+    uint8_t *src = aligned_buffer(size);
+    uint8_t *dst = aligned_buffer(size);
+    
+    if(!src || !dst)
+    {
+        printf("Could not allocate %d MiB\n", (int)(size >> 19));
+        return -1;
+    }
+    
+    if(in_file)
+    {
+        fseeko(in_file, data_offset, SEEK_SET);
+        if(fread(src, 1, size, in_file) != size)
+        {
+            printf("Could not read the input file\n");
+            return -1;
+        }
+    }
+    else
+    {
+        rand_seed(0x12341234);
+        rand_fill((uint32_t *)src, size / 4);
+    }
+    
+    decrypt_job_t *jobs = calloc(threads, sizeof(decrypt_job_t));
+    
+    printf("%s, %d MiB, %s\n", params->type == CIPHER_XTEA ? "XTEA" : "LFSR64", (int)(size >> 20), in_file ? "from file" : "random data");
+    
+    /* reference: one context, BLOCKSIZE at a time, in place (like the sequential loop) */
+    memcpy(dst, src, size);
+    cipher_setup(&jobs[0].crypt_ctx, params);
+    double start = get_time();
+    for(uint64_t pos = 0; pos < size; pos += BLOCKSIZE)
+    {
+        uint32_t len = (size - pos < BLOCKSIZE) ? (size - pos) : BLOCKSIZE;
+        jobs[0].crypt_ctx.decrypt(jobs[0].crypt_ctx.priv, dst + pos, dst + pos, len, pos);
+    }
+    double elapsed = get_time() - start;
+    jobs[0].crypt_ctx.deinit(jobs[0].crypt_ctx.priv);
+    printf("  sequential:      %8.1f MiB/s\n", size / 1048576.0 / elapsed);
+    
+    uint8_t *ref = dst;
+    dst = aligned_buffer(size);
+    int ret = 0;
+    
+    /* fault in the output pages, so we don't measure the kernel */
+    if(dst)
+    {
+        memset(dst, 0, size);
+    }
+    
+    for(int count = 1; count <= threads && dst; count = (count * 2 > threads && count < threads) ? threads : count * 2)
+    {
+        for(int thread = 0; thread < count; thread++)
+        {
+            cipher_setup(&jobs[thread].crypt_ctx, params);
+        }
+        
+        start = get_time();
+        decrypt_parallel(jobs, count, dst, src, size, 0);
+        elapsed = get_time() - start;
+        
+        for(int thread = 0; thread < count; thread++)
+        {
+            jobs[thread].crypt_ctx.deinit(jobs[thread].crypt_ctx.priv);
+        }
+        
+        int same = !memcmp(dst, ref, size);
+        printf("  %2d thread(s):    %8.1f MiB/s%s\n", count, size / 1048576.0 / elapsed, same ? "" : "  OUTPUT DIFFERS");
+        if(!same)
+        {
+            ret = 1;
+        }
+    }
+    
+    free(jobs);
+    aligned_free(src);
+    aligned_free(dst);
+    aligned_free(ref);
+    return ret;
+}
+
+static void print_usage(char *name)
+{
+    printf("Usage: '%s [options] <infile> [outfile] [password]\n", name);
+    printf("\n");
+    printf("Options:\n");
+    printf(" -t, --threads=N  decrypt on N threads (default: one per CPU core)\n");
+    printf("                  -t 1 uses the original sequential loop\n");
+    printf(" --verify         check the output against the sequential loop\n");
+    printf(" --benchmark      report the decryption speed (without an input file: on random data)\n");
+}
+
 static crypt_cipher_t iocrypt_rsa_ctx;
 int main(int argc, char *argv[])
 {
     //io_decrypt_test();
     //crypt_rsa_test();
     
-    if(argc < 2)
+    int threads = get_cpu_count();
+    int verify = 0;
+    int benchmark_mode = 0;
+    
+    struct option long_options[] = {
+        {"threads",   required_argument, NULL,            't' },
+        {"verify",    no_argument,       &verify,          1  },
+        {"benchmark", no_argument,       &benchmark_mode,  1  },
+        {"help",      no_argument,       NULL,            'h' },
+        {0,           0,                 0,                0  }
+    };
+    
+    int opt;
+    while((opt = getopt_long(argc, argv, "t:h", long_options, NULL)) != -1)
     {
-        printf("Usage: '%s <infile> [outfile] [password]\n", argv[0]);
-        return -1;
+        switch(opt)
+        {
+            case 0:
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
     }
     
+    /* a bitmask of started threads is used in decrypt_parallel */
+    if(threads < 1)
+    {
+        threads = 1;
+    }
+    if(threads > 32)
+    {
+        threads = 32;
+    }
+    
+    argc -= optind - 1;
+    argv += optind - 1;
+    
     uint64_t key = 0;
     uint32_t lfsr_blocksize = 0x00020000;
-    crypt_cipher_t crypt_ctx;
+    cipher_params_t params;
+    
+    if(benchmark_mode && argc < 2)
+    {
+        /* random data with a fixed key */
+        hash_password("benchmark", &params.key);
+        params.type = CIPHER_LFSR64;
+        params.blocksize = lfsr_blocksize;
+        int ret = benchmark(NULL, 0, &params, threads);
+        params.type = CIPHER_XTEA;
+        return ret | benchmark(NULL, 0, &params, threads);
+    }
+    
+    if(argc < 2)
+    {
+        print_usage(argv[-optind + 1]);
+        return -1;
+    }
     
     char *in_filename = argv[1];
     char *out_filename = malloc(strlen(in_filename) + 9);
@@ -162,7 +638,7 @@ int main(int argc, char *argv[])
     } 
     
     char *buffer = malloc(BLOCKSIZE);
-    
+    uint64_t data_offset = 0;
     
     /* try to detect file type */
     if(fread(buffer, 1, 4, in_file) != 4)
@@ -196,9 +672,8 @@ int main(int argc, char *argv[])
             return -1;
         }
         
-        fseek(in_file, 0x200, SEEK_SET);
-        crypt_lfsr64_init(&crypt_ctx, key);
-        crypt_ctx.set_blocksize(crypt_ctx.priv, lfsr_blocksize);
+        data_offset = 0x200;
+        params.type = CIPHER_LFSR64;
     }
     else if(!memcmp(buffer, xtea_magic, 4))
     {
@@ -215,12 +690,8 @@ int main(int argc, char *argv[])
             return -1;
         }
         
-        fseek(in_file, 0x200, SEEK_SET);
-        
-        /* todo: fill it correctly */
-        uint32_t password[4];
-        memset(password, 0x00, sizeof(password));
-        crypt_xtea_init(&crypt_ctx, password, key);
+        data_offset = 0x200;
+        params.type = CIPHER_XTEA;
     }
     else if(!memcmp(buffer, rsa_magic, 4))
     {
@@ -286,10 +757,8 @@ int main(int argc, char *argv[])
         uint32_t aligned_header = (used_header + 0x1FF) & ~0x1FF;
         
         /* now skip that header and continue with LFSR64 decryption */
-        fseek(in_file, aligned_header, SEEK_SET);
-        
-        crypt_lfsr64_init(&crypt_ctx, key);
-        crypt_ctx.set_blocksize(crypt_ctx.priv, lfsr_blocksize);
+        data_offset = aligned_header;
+        params.type = CIPHER_LFSR64;
     }
     else if(!memcmp(buffer, rsaxtea_magic, 4))
     {
@@ -354,19 +823,16 @@ int main(int argc, char *argv[])
         uint32_t aligned_header = (used_header + 0x1FF) & ~0x1FF;
         
         /* now skip that header and continue with LFSR113 decryption */
-        fseek(in_file, aligned_header, SEEK_SET);
-        
-        /* todo: fill it correctly */
-        uint32_t password[4];
-        memset(password, 0x00, sizeof(password));
-        crypt_xtea_init(&crypt_ctx, password, key);
+        data_offset = aligned_header;
+        params.type = CIPHER_XTEA;
     }
     else
     {
         if(key)
         {
             printf("File type: unknown. assuming LFSR64\n");
-            crypt_lfsr64_init(&crypt_ctx, key);
+            data_offset = 4;
+            params.type = CIPHER_LFSR64;
         }
         else
         {
@@ -375,63 +841,116 @@ int main(int argc, char *argv[])
         }
     }
     
-    /* setup cipher with that hash */
-    uint32_t first = 1;
-    FILE *out_file = NULL;
+    params.key = key;
+    params.blocksize = lfsr_blocksize;
     
+    if(benchmark_mode)
+    {
+        return benchmark(in_file, data_offset, &params, threads);
+    }
     
-    uint32_t file_offset = 0;
+    /* decrypt the first block with a throwaway context to check the key before writing anything */
+    crypt_cipher_t crypt_ctx;
+    cipher_setup(&crypt_ctx, &params);
+    fseeko(in_file, data_offset, SEEK_SET);
+    int size = fread(buffer, 1, BLOCKSIZE, in_file);
+    if(size > 0)
+    {
+        crypt_ctx.decrypt(crypt_ctx.priv, (uint8_t *)buffer, (uint8_t *)buffer, size, 0);
+    }
+    crypt_ctx.deinit(crypt_ctx.priv);
     
+    if(size < 4)
+    {
+        printf("Could not read '%s'\n", in_filename);
+        return -1;
+    }
+    else if(!memcmp(buffer, jpg_magic, 4))
+    {
+        printf("File type: JPEG (decrypted)\n");
+    }
+    else if(!memcmp(buffer, cr2_magic, 4))
+    {
+        printf("File type: CR2 (decrypted)\n");
+    }
+    else
+    {
+        printf("File type: unknown. invalid key?\n");
+        fclose(in_file);
+        free(out_filename);
+        return 0;
+    }
+    free(buffer);
     
-    while(!feof(in_file))
+    int ret = 0;
+    double start = get_time();
+    
+    if(threads == 1)
     {
-        int ret = fread(buffer, 1, BLOCKSIZE, in_file);
+        FILE *out_file = fopen(out_filename, "wb");
+        if(!out_file)
+        {
+            printf("Could not open '%s'\n", out_filename);
+            return -1;
+        }
+        ret = decrypt_sequential(in_file, data_offset, &params, out_file, NULL);
+        fclose(out_file);
+    }
+    else
+    {
+        decrypt_job_t *jobs = calloc(threads, sizeof(decrypt_job_t));
+        for(int thread = 0; thread < threads; thread++)
+        {
+            cipher_setup(&jobs[thread].crypt_ctx, &params);
+        }
         
-        if(ret > 0)
+        ret = -1;
+#ifndef _WIN32
+        ret = decrypt_mapped(in_filename, data_offset, jobs, threads, out_filename);
+#endif
+        if(ret)
         {
-            crypt_ctx.decrypt(crypt_ctx.priv, (uint8_t *)buffer, (uint8_t *)buffer, ret, file_offset);
-            
-            /* try to detect file type */
-            if(first)
+            /* could not map the files, use large buffers instead */
+            FILE *out_file = fopen(out_filename, "wb");
+            if(!out_file)
             {
-                first = 0;
-                
-                if(!memcmp(buffer, jpg_magic, 4))
-                {
-                    printf("File type: JPEG (decrypted)\n");
-                }
-                else if(!memcmp(buffer, cr2_magic, 4))
-                {
-                    printf("File type: CR2 (decrypted)\n");
-                }
-                else
-                {
-                    printf("File type: unknown. invalid key?\n");
-                    fclose(in_file);
-                    free(out_filename);
-                    return 0;
-                }
-                
-                out_file = fopen(out_filename, "w");
-                if(!out_file)
-                {
-                    printf("Could not open '%s'\n", out_filename);
-                    return -1;
-                }
+                printf("Could not open '%s'\n", out_filename);
+                return -1;
             }
-            
-            fwrite(buffer, 1, ret, out_file);
-            file_offset += ret;
+            ret = decrypt_chunked(in_file, data_offset, jobs, threads, out_file);
+            fclose(out_file);
         }
-        if(ret < 0)
+        
+        for(int thread = 0; thread < threads; thread++)
         {
-            printf("Could not read '%s'\n", in_filename);
-            break;
+            jobs[thread].crypt_ctx.deinit(jobs[thread].crypt_ctx.priv);
+        }
+        free(jobs);
+    }
+    
+    if(ret)
+    {
+        printf("Could not decrypt '%s' to '%s'\n", in_filename, out_filename);
+    }
+    else
+    {
+        printf("Decrypted in %.2f s (%d thread%s)\n", get_time() - start, threads, threads > 1 ? "s" : "");
+    }
+    
+    if(!ret && verify)
+    {
+        FILE *ref_file = fopen(out_filename, "rb");
+        if(!ref_file)
+        {
+            printf("Could not open '%s'\n", out_filename);
+            return -1;
         }
+        ret = decrypt_sequential(in_file, data_offset, &params, NULL, ref_file);
+        printf("Verify: %s\n", ret ? "FAILED" : "OK");
+        fclose(ref_file);
     }
     
     fclose(in_file);
-    fclose(out_file);
     free(out_filename);
-    return 0;
+    return ret;
 }
@@ -30,24 +30,39 @@
 #include "lv_rec.h"
 #include <raw.h>
 #include <chdk-dng.h>
+#include <raw_pack.h>
 #include "qsort.h"  /* much faster than standard C qsort */
 #include "../dual_iso/optmed.h"
 #include "../dual_iso/wirth.h"
 #include "../mlv_rec/mlv.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define RAW2DNG_SIMD
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RAW2DNG_SIMD
+#endif
+
 
 /* useful to clean pink dots, may also help with color aliasing, but it's best turned off if you don't have these problems */
 //~ #define CHROMA_SMOOTH
 
 lv_rec_file_footer_t lv_rec_footer;
+#ifdef MLV_USE_THREADS
+__thread struct raw_info raw_info;
+#else
 struct raw_info raw_info;
+#endif
 
 #define FAIL(fmt,...) { fprintf(stderr, "Error: "); fprintf(stderr, fmt, ## __VA_ARGS__); fprintf(stderr, "\n"); exit(1); }
 #define CHECK(ok, fmt,...) { if (!(ok)) FAIL(fmt, ## __VA_ARGS__); }
 
-void fix_vertical_stripes();
-void find_and_fix_cold_pixels(int force_analysis);
-void chroma_smooth();
+void raw_unpack_plane(uint16_t * plane);
+void raw_pack_plane(uint16_t * plane);
+void fix_vertical_stripes(uint16_t * plane);
+void find_and_fix_cold_pixels(uint16_t * plane, int force_analysis);
+void chroma_smooth(uint16_t * plane);
 
 #define EV_RESOLUTION 32768
 
@@ -305,13 +320,21 @@ int main(int argc, char** argv)
             char fn[100];
             snprintf(fn, sizeof(fn), "%s%06d.dng", prefix, framenumber);
 
-            fix_vertical_stripes();
-            find_and_fix_cold_pixels(0);
+            /* the filters work on unpacked pixels */
+            uint16_t * plane = malloc(raw_info.width * raw_info.height * sizeof(uint16_t));
+            CHECK(plane, "malloc");
+            raw_unpack_plane(plane);
+
+            fix_vertical_stripes(plane);
+            find_and_fix_cold_pixels(plane, 0);
 
             #ifdef CHROMA_SMOOTH
-            chroma_smooth();
+            chroma_smooth(plane);
             #endif
 
+            raw_pack_plane(plane);
+            free(plane);
+
             dng_set_camname((char*)idnt_hdr.cameraName);
             dng_set_framerate(lv_rec_footer.sourceFpsx1000);
             save_dng(fn, &raw_info);
@@ -818,6 +841,13 @@ uint32_t file_set_pos(FILE *stream, uint64_t offset, int whence)
 #endif
 
 int raw_get_pixel(int x, int y) {
+    if (raw_info.bits_per_pixel == 16)
+    {
+        /* merged Dual ISO frames from mlv_dump (DNG thumbnail only) */
+        uint16_t * p = (void*)raw_info.buffer + y * raw_info.pitch;
+        return p[x];
+    }
+
     struct raw_pixblock * p = (void*)raw_info.buffer + y * raw_info.pitch + (x/8)*14;
     switch (x%8) {
         case 0: return p->a;
@@ -911,6 +941,95 @@ static int stripes_correction_needed = 0;
 #define F2H(ev) COERCE((int)(FIXP_RANGE/2 + ev * FIXP_RANGE/2), 0, FIXP_RANGE-1)
 #define H2F(x) ((double)((x) - FIXP_RANGE/2) / (FIXP_RANGE/2))
 
+/**
+ * Unpacked frame ("plane"): one uint16_t per pixel, width x height, no padding.
+ * 
+ * The filters below used to go through raw_get_pixel / raw_set_pixel for every single pixel;
+ * now the frame is unpacked once (raw_pack.c), all filters run on the plane, then it's packed back.
+ * 
+ * With SSE2 or NEON, the hot loops are vectorized. The scalar code is kept as reference
+ * (and for builds without SIMD); raw2dng_selftest() checks that both give the same output.
+ * 
+ * Only 14-bit frames, just like raw_get_pixel.
+ */
+
+/* pixels written into the plane must look as if they went through raw_set_pixel */
+#define RAW_PIXEL_MASK 0x3FFF
+
+#ifdef RAW2DNG_SIMD
+/* the old per-line code, with struct raw_pixblock; raw2dng_selftest() compares raw_pack.c against it */
+static void raw_unpack_row_ref(uint16_t * dst, int y)
+{
+    int w = raw_info.width;
+    struct raw_pixblock * p = (void*)raw_info.buffer + y * raw_info.pitch;
+    int x;
+    
+    for (x = 0; x + 8 <= w; x += 8, p++)
+    {
+        dst[x  ] = PA;
+        dst[x+1] = PB;
+        dst[x+2] = PC;
+        dst[x+3] = PD;
+        dst[x+4] = PE;
+        dst[x+5] = PF;
+        dst[x+6] = PG;
+        dst[x+7] = PH;
+    }
+    
+    /* incomplete pixel block at the end of the line */
+    for ( ; x < w; x++)
+    {
+        dst[x] = raw_get_pixel(x, y);
+    }
+}
+
+static void raw_pack_row_ref(uint16_t * src, int y)
+{
+    int w = raw_info.width;
+    struct raw_pixblock * p = (void*)raw_info.buffer + y * raw_info.pitch;
+    int x;
+    
+    for (x = 0; x + 8 <= w; x += 8, p++)
+    {
+        SET_PA(src[x  ]);
+        SET_PB(src[x+1]);
+        SET_PC(src[x+2]);
+        SET_PD(src[x+3]);
+        SET_PE(src[x+4]);
+        SET_PF(src[x+5]);
+        SET_PG(src[x+6]);
+        SET_PH(src[x+7]);
+    }
+    
+    for ( ; x < w; x++)
+    {
+        raw_set_pixel(x, y, src[x]);
+    }
+}
+#endif
+
+void raw_unpack_plane(uint16_t * plane)
+{
+    int w = raw_info.width;
+    int h = raw_info.height;
+    
+    for (int y = 0; y < h; y++)
+    {
+        raw_unpack_line((uint8_t *) raw_info.buffer + y * raw_info.pitch, plane + y * w, w, 14);
+    }
+}
+
+void raw_pack_plane(uint16_t * plane)
+{
+    int w = raw_info.width;
+    int h = raw_info.height;
+    
+    for (int y = 0; y < h; y++)
+    {
+        raw_pack_line(plane + y * w, (uint8_t *) raw_info.buffer + y * raw_info.pitch, w, 14);
+    }
+}
+
 static void add_pixel(int hist[8][FIXP_RANGE], int num[8], int offset, int pa, int pb)
 {
     int a = pa;
@@ -946,7 +1065,7 @@ static void add_pixel(int hist[8][FIXP_RANGE], int num[8], int offset, int pa, i
 }
 
 
-static void detect_vertical_stripes_coeffs()
+static void detect_vertical_stripes_coeffs(uint16_t * plane)
 {
     static int hist[8][FIXP_RANGE];
     static int num[8];
@@ -954,39 +1073,40 @@ static void detect_vertical_stripes_coeffs()
     memset(hist, 0, sizeof(hist));
     memset(num, 0, sizeof(num));
 
+    int w = raw_info.width;
+    int h = raw_info.height;
+    int black = raw_info.black_level;
+
     /* compute 7 histograms: b./a, c./a ... h./a */
     /* that is, adjust all columns to make them as bright as a */
     /* process green pixels only, assuming the image is RGGB */
-    struct raw_pixblock * row;
-    for (row = raw_info.buffer; (void*)row < (void*)raw_info.buffer + raw_info.pitch * raw_info.height; row += 2 * raw_info.pitch / sizeof(struct raw_pixblock))
+    for (int y = 0; y + 1 < h; y += 2)
     {
         /* first line is RG */
-        struct raw_pixblock * rg;
-        for (rg = row; (void*)rg < (void*)row + raw_info.pitch - sizeof(struct raw_pixblock); rg++)
+        uint16_t * rg = plane + y * w;
+        
+        /* next line is GB */
+        uint16_t * gb = rg + w;
+
+        /* every pixel block is compared with the first pixel of the next one, so skip the last block */
+        for (int x = 0; x + 16 <= w; x += 8)
         {
-            /* next line is GB */
-            struct raw_pixblock * gb = rg + raw_info.pitch / sizeof(struct raw_pixblock);
-
-            struct raw_pixblock * p = rg;
-            int pb = PB - raw_info.black_level;
-            int pd = PD - raw_info.black_level;
-            int pf = PF - raw_info.black_level;
-            int ph = PH - raw_info.black_level;
-            p++;
-            int pb2 = PB - raw_info.black_level;
-            int pd2 = PD - raw_info.black_level;
-            int pf2 = PF - raw_info.black_level;
-            int ph2 = PH - raw_info.black_level;
-            p = gb;
-            //int pa = PA - raw_info.black_level;
-            int pc = PC - raw_info.black_level;
-            int pe = PE - raw_info.black_level;
-            int pg = PG - raw_info.black_level;
-            p++;
-            int pa2 = PA - raw_info.black_level;
-            int pc2 = PC - raw_info.black_level;
-            int pe2 = PE - raw_info.black_level;
-            int pg2 = PG - raw_info.black_level;
+            int pb = rg[x+1] - black;
+            int pd = rg[x+3] - black;
+            int pf = rg[x+5] - black;
+            int ph = rg[x+7] - black;
+            int pb2 = rg[x+9] - black;
+            int pd2 = rg[x+11] - black;
+            int pf2 = rg[x+13] - black;
+            int ph2 = rg[x+15] - black;
+            //int pa = gb[x] - black;
+            int pc = gb[x+2] - black;
+            int pe = gb[x+4] - black;
+            int pg = gb[x+6] - black;
+            int pa2 = gb[x+8] - black;
+            int pc2 = gb[x+10] - black;
+            int pe2 = gb[x+12] - black;
+            int pg2 = gb[x+14] - black;
             
             /**
              * verification: introducing strong banding in one column
@@ -1090,88 +1210,232 @@ static void detect_vertical_stripes_coeffs()
     }
 }
 
-static void apply_vertical_stripes_correction()
+/**
+ * inexact white level will result in banding in highlights, especially if some channels are clipped
+ * 
+ * so... we'll try to use a better estimation of white level *for this particular purpose*
+ * start with a gross under-estimation, then consider white = max(all pixels)
+ * just in case the exif one is way off
+ * reason: 
+ *   - if there are no pixels above the true white level, it shouldn't hurt;
+ *     worst case, the brightest pixel(s) will be underexposed by 0.1 EV or so
+ *   - if there are, we will choose the true white level
+ */
+static int stripes_white_level(uint16_t * plane)
 {
+    int white = raw_info.white_level * 2 / 3;
+    int n = raw_info.width * raw_info.height;
+    int i = 0;
+
+#if defined(__SSE2__)
+    /* pixels are 14-bit, so signed compares are fine */
+    __m128i vwhite = _mm_set1_epi16(white);
+    for ( ; i + 8 <= n; i += 8)
+    {
+        vwhite = _mm_max_epi16(vwhite, _mm_loadu_si128((__m128i *)(plane + i)));
+    }
+    int16_t lanes[8];
+    _mm_storeu_si128((__m128i *)lanes, vwhite);
+    for (int j = 0; j < 8; j++)
+    {
+        white = MAX(white, lanes[j]);
+    }
+#elif defined(RAW2DNG_SIMD)
+    uint16x8_t vwhite = vdupq_n_u16(white);
+    for ( ; i + 8 <= n; i += 8)
+    {
+        vwhite = vmaxq_u16(vwhite, vld1q_u16(plane + i));
+    }
+    uint16_t lanes[8];
+    vst1q_u16(lanes, vwhite);
+    for (int j = 0; j < 8; j++)
+    {
+        white = MAX(white, lanes[j]);
+    }
+#endif
+
+    for ( ; i < n; i++)
+    {
+        white = MAX(white, plane[i]);
+    }
+    
+    return white;
+}
+
+/* n pixels (up to 8) of the pixel block starting at p */
+static inline void apply_vertical_stripes_correction_block(uint16_t * p, int n, int white)
+{
+    int black = raw_info.black_level;
+    int pa = p[0];
+
     /**
-     * inexact white level will result in banding in highlights, especially if some channels are clipped
+     * Thou shalt not exceed the white level (the exact one, not the exif one)
+     * otherwise you'll be blessed with banding instead of nice and smooth highlight recovery
      * 
-     * so... we'll try to use a better estimation of white level *for this particular purpose*
-     * start with a gross under-estimation, then consider white = max(all pixels)
-     * just in case the exif one is way off
-     * reason: 
-     *   - if there are no pixels above the true white level, it shouldn't hurt;
-     *     worst case, the brightest pixel(s) will be underexposed by 0.1 EV or so
-     *   - if there are, we will choose the true white level
+     * At very dark levels, you will introduce roundoff errors, so don't correct there
      */
-     
-    int white = raw_info.white_level * 2 / 3;
-    
-    struct raw_pixblock * row;
+    if (pa <= black + 64)
+        return;
     
-    for (row = raw_info.buffer; (void*)row < (void*)raw_info.buffer + raw_info.pitch * raw_info.height; row += raw_info.pitch / sizeof(struct raw_pixblock))
+    for (int j = 0; j < n; j++)
     {
-        struct raw_pixblock * p;
-        for (p = row; (void*)p < (void*)row + raw_info.pitch; p++)
+        int pj = p[j];
+        if (stripes_coeffs[j] && pj && pj < white)
         {
-            white = MAX(white, PA);
-            white = MAX(white, PB);
-            white = MAX(white, PC);
-            white = MAX(white, PD);
-            white = MAX(white, PE);
-            white = MAX(white, PF);
-            white = MAX(white, PG);
-            white = MAX(white, PH);
+            p[j] = MIN(white, RAW_MUL(pj, stripes_coeffs[j])) & RAW_PIXEL_MASK;
+        }
+    }
+}
+
+static void apply_vertical_stripes_correction_ref(uint16_t * plane)
+{
+    int white = stripes_white_level(plane);
+    int w = raw_info.width;
+    int h = raw_info.height;
+
+    for (int y = 0; y < h; y++)
+    {
+        uint16_t * row = plane + y * w;
+        for (int x = 0; x < w; x += 8)
+        {
+            apply_vertical_stripes_correction_block(row + x, MIN(8, w - x), white);
+        }
+    }
+}
+
+#ifdef RAW2DNG_SIMD
+/**
+ * One pixel block per vector; lane j is always column j, so it always uses stripes_coeffs[j].
+ * With c = 65536 + d, the 32-bit product (p - black) * c is (p - black) << 16 plus a 16x16-bit product,
+ * as long as d fits in 16 bits (the coefficients are very close to 1, anything else goes the scalar way).
+ */
+static void apply_vertical_stripes_correction_simd(uint16_t * plane)
+{
+    for (int j = 0; j < 8; j++)
+    {
+        if (stripes_coeffs[j] && (stripes_coeffs[j] - FIXP_ONE < INT16_MIN || stripes_coeffs[j] - FIXP_ONE > INT16_MAX))
+        {
+            apply_vertical_stripes_correction_ref(plane);
+            return;
         }
     }
     
+    int white = stripes_white_level(plane);
     int black = raw_info.black_level;
-    for (row = raw_info.buffer; (void*)row < (void*)raw_info.buffer + raw_info.pitch * raw_info.height; row += raw_info.pitch / sizeof(struct raw_pixblock))
+    int w = raw_info.width;
+    int h = raw_info.height;
+    
+    int16_t frac[8];
+    int16_t enable[8];
+    for (int j = 0; j < 8; j++)
+    {
+        frac[j] = stripes_coeffs[j] ? stripes_coeffs[j] - FIXP_ONE : 0;
+        enable[j] = stripes_coeffs[j] ? -1 : 0;
+    }
+
+#if defined(__SSE2__)
+    const __m128i vfrac    = _mm_loadu_si128((__m128i *)frac);
+    const __m128i venable  = _mm_loadu_si128((__m128i *)enable);
+    const __m128i vblack   = _mm_set1_epi16(black);
+    const __m128i vdark    = _mm_set1_epi16(black + 64);
+    const __m128i vwhite   = _mm_set1_epi16(white);
+    const __m128i vmask    = _mm_set1_epi16(RAW_PIXEL_MASK);
+    const __m128i zero     = _mm_setzero_si128();
+#else
+    const int16x8_t vfrac    = vld1q_s16(frac);
+    const uint16x8_t venable = vreinterpretq_u16_s16(vld1q_s16(enable));
+    const int16x8_t vblack   = vdupq_n_s16(black);
+    const int16x8_t vdark    = vdupq_n_s16(black + 64);
+    const int16x8_t vwhite   = vdupq_n_s16(white);
+    const uint16x8_t vmask   = vdupq_n_u16(RAW_PIXEL_MASK);
+#endif
+
+    for (int y = 0; y < h; y++)
     {
-        struct raw_pixblock * p;
-        for (p = row; (void*)p < (void*)row + raw_info.pitch; p++)
+        uint16_t * row = plane + y * w;
+        int x;
+        for (x = 0; x + 8 <= w; x += 8)
         {
-            int pa = PA;
-            int pb = PB;
-            int pc = PC;
-            int pd = PD;
-            int pe = PE;
-            int pf = PF;
-            int pg = PG;
-            int ph = PH;
+#if defined(__SSE2__)
+            __m128i p  = _mm_loadu_si128((__m128i *)(row + x));
+            __m128i pa = _mm_shuffle_epi32(_mm_shufflelo_epi16(p, 0), 0);
             
-            /**
-             * Thou shalt not exceed the white level (the exact one, not the exif one)
-             * otherwise you'll be blessed with banding instead of nice and smooth highlight recovery
-             * 
-             * At very dark levels, you will introduce roundoff errors, so don't correct there
-             */
+            /* coef && p && p < white && pa > black + 64 */
+            __m128i m = _mm_and_si128(venable, _mm_cmpgt_epi16(pa, vdark));
+            m = _mm_andnot_si128(_mm_cmpeq_epi16(p, zero), m);
+            m = _mm_and_si128(m, _mm_cmplt_epi16(p, vwhite));
+            if (!_mm_movemask_epi8(m))
+                continue;
+            
+            /* RAW_MUL, with the division rounding towards zero, as in C */
+            __m128i d  = _mm_sub_epi16(p, vblack);
+            __m128i lo = _mm_mullo_epi16(d, vfrac);
+            __m128i hi = _mm_mulhi_epi16(d, vfrac);
+            __m128i q0 = _mm_add_epi32(_mm_unpacklo_epi16(zero, d), _mm_unpacklo_epi16(lo, hi));
+            __m128i q1 = _mm_add_epi32(_mm_unpackhi_epi16(zero, d), _mm_unpackhi_epi16(lo, hi));
+            q0 = _mm_srai_epi32(_mm_add_epi32(q0, _mm_srli_epi32(_mm_srai_epi32(q0, 31), 16)), 16);
+            q1 = _mm_srai_epi32(_mm_add_epi32(q1, _mm_srli_epi32(_mm_srai_epi32(q1, 31), 16)), 16);
+            __m128i v = _mm_add_epi16(_mm_packs_epi32(q0, q1), vblack);
+            v = _mm_and_si128(_mm_min_epi16(v, vwhite), vmask);
             
-            if (stripes_coeffs[0] && pa && pa < white && pa > black + 64) SET_PA(MIN(white, RAW_MUL(pa, stripes_coeffs[0])));
-            if (stripes_coeffs[1] && pb && pb < white && pa > black + 64) SET_PB(MIN(white, RAW_MUL(pb, stripes_coeffs[1])));
-            if (stripes_coeffs[2] && pc && pc < white && pa > black + 64) SET_PC(MIN(white, RAW_MUL(pc, stripes_coeffs[2])));
-            if (stripes_coeffs[3] && pd && pd < white && pa > black + 64) SET_PD(MIN(white, RAW_MUL(pd, stripes_coeffs[3])));
-            if (stripes_coeffs[4] && pe && pe < white && pa > black + 64) SET_PE(MIN(white, RAW_MUL(pe, stripes_coeffs[4])));
-            if (stripes_coeffs[5] && pf && pf < white && pa > black + 64) SET_PF(MIN(white, RAW_MUL(pf, stripes_coeffs[5])));
-            if (stripes_coeffs[6] && pg && pg < white && pa > black + 64) SET_PG(MIN(white, RAW_MUL(pg, stripes_coeffs[6])));
-            if (stripes_coeffs[7] && ph && ph < white && pa > black + 64) SET_PH(MIN(white, RAW_MUL(ph, stripes_coeffs[7])));
+            p = _mm_or_si128(_mm_and_si128(m, v), _mm_andnot_si128(m, p));
+            _mm_storeu_si128((__m128i *)(row + x), p);
+#else
+            int16x8_t p  = vreinterpretq_s16_u16(vld1q_u16(row + x));
+            int16x8_t pa = vdupq_lane_s16(vget_low_s16(p), 0);
+            
+            /* coef && p && p < white && pa > black + 64 */
+            uint16x8_t m = vandq_u16(venable, vcgtq_s16(pa, vdark));
+            m = vandq_u16(m, vtstq_s16(p, p));
+            m = vandq_u16(m, vcltq_s16(p, vwhite));
+            uint64x2_t m64 = vreinterpretq_u64_u16(m);
+            if (!(vgetq_lane_u64(m64, 0) | vgetq_lane_u64(m64, 1)))
+                continue;
+            
+            /* RAW_MUL, with the division rounding towards zero, as in C */
+            int16x8_t d  = vsubq_s16(p, vblack);
+            int32x4_t q0 = vaddq_s32(vshll_n_s16(vget_low_s16(d), 16), vmull_s16(vget_low_s16(d), vget_low_s16(vfrac)));
+            int32x4_t q1 = vaddq_s32(vshll_n_s16(vget_high_s16(d), 16), vmull_s16(vget_high_s16(d), vget_high_s16(vfrac)));
+            q0 = vshrq_n_s32(vaddq_s32(q0, vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(vshrq_n_s32(q0, 31)), 16))), 16);
+            q1 = vshrq_n_s32(vaddq_s32(q1, vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(vshrq_n_s32(q1, 31)), 16))), 16);
+            int16x8_t v = vaddq_s16(vcombine_s16(vmovn_s32(q0), vmovn_s32(q1)), vblack);
+            uint16x8_t vu = vandq_u16(vreinterpretq_u16_s16(vminq_s16(v, vwhite)), vmask);
+            
+            vst1q_u16(row + x, vbslq_u16(m, vu, vreinterpretq_u16_s16(p)));
+#endif
+        }
+        
+        if (x < w)
+        {
+            apply_vertical_stripes_correction_block(row + x, w - x, white);
         }
     }
 }
+#endif
+
+static void apply_vertical_stripes_correction(uint16_t * plane)
+{
+#ifdef RAW2DNG_SIMD
+    apply_vertical_stripes_correction_simd(plane);
+#else
+    apply_vertical_stripes_correction_ref(plane);
+#endif
+}
 
-void fix_vertical_stripes()
+void fix_vertical_stripes(uint16_t * plane)
 {
     /* for speed: only detect correction factors from the first frame */
     static int first_time = 1;
     if (first_time)
     {
-        detect_vertical_stripes_coeffs();
+        detect_vertical_stripes_coeffs(plane);
         first_time = 0;
     }
     
     /* only apply stripe correction if we need it, since it takes a little CPU time */
     if (stripes_correction_needed)
     {
-        apply_vertical_stripes_correction();
+        apply_vertical_stripes_correction(plane);
     }
 }
 
@@ -1192,36 +1456,76 @@ static inline int FC(int row, int col)
 }
 
 
-void find_and_fix_cold_pixels(int force_analysis)
+#define MAX_COLD_PIXELS 200000
+
+struct xy { int x; int y; };
+
+static int find_cold_pixels_ref(uint16_t * plane, int cold_thr, struct xy * cold_pixel_list)
 {
-    #define MAX_COLD_PIXELS 200000
-  
-    struct xy { int x; int y; };
-    
-    static struct xy cold_pixel_list[MAX_COLD_PIXELS];
-    static int cold_pixels = -1;
-    
     int w = raw_info.width;
     int h = raw_info.height;
-    
-    /* scan for bad pixels in the first frame only, or on request*/
-    if (cold_pixels < 0 || force_analysis)
-    {
-        cold_pixels = 0;
-        
-        /* at sane ISOs, noise stdev is well less than 50, so 200 should be enough */
-        int cold_thr = MAX(0, raw_info.black_level - 200);
+    int cold_pixels = 0;
 
-        /* analyse all pixels of the frame */
-        for (int y = 0; y < h; y++)
+    for (int y = 0; y < h; y++)
+    {
+        for (int x = 0; x < w; x++)
         {
-            for (int x = 0; x < w; x++)
+            int p = plane[x + y * w];
+            int is_cold = (p < cold_thr);
+
+            /* create a list containing the cold pixels */
+            if (is_cold && cold_pixels < MAX_COLD_PIXELS)
             {
-                int p = raw_get_pixel(x, y);
-                int is_cold = (p < cold_thr);
+                cold_pixel_list[cold_pixels].x = x;
+                cold_pixel_list[cold_pixels].y = y;
+                cold_pixels++;
+            }
+        }
+    }
+    
+    return cold_pixels;
+}
+
+#ifdef RAW2DNG_SIMD
+/* cold pixels are rare, so only look closer at the 8 pixel groups that have some */
+static int find_cold_pixels_simd(uint16_t * plane, int cold_thr, struct xy * cold_pixel_list)
+{
+    int w = raw_info.width;
+    int h = raw_info.height;
+    int cold_pixels = 0;
 
-                /* create a list containing the cold pixels */
-                if (is_cold && cold_pixels < MAX_COLD_PIXELS)
+#if defined(__SSE2__)
+    const __m128i thr = _mm_set1_epi16(cold_thr);
+#else
+    const uint16x8_t thr = vdupq_n_u16(cold_thr);
+#endif
+
+    for (int y = 0; y < h; y++)
+    {
+        uint16_t * row = plane + y * w;
+        int x = 0;
+        while (x < w)
+        {
+            int n = MIN(8, w - x);
+            if (n == 8)
+            {
+#if defined(__SSE2__)
+                __m128i m = _mm_cmplt_epi16(_mm_loadu_si128((__m128i *)(row + x)), thr);
+                int any_cold = _mm_movemask_epi8(m);
+#else
+                uint64x2_t m = vreinterpretq_u64_u16(vcltq_u16(vld1q_u16(row + x), thr));
+                int any_cold = (vgetq_lane_u64(m, 0) | vgetq_lane_u64(m, 1)) != 0;
+#endif
+                if (!any_cold)
+                {
+                    x += 8;
+                    continue;
+                }
+            }
+            
+            for (int j = 0; j < n; j++, x++)
+            {
+                if (row[x] < cold_thr && cold_pixels < MAX_COLD_PIXELS)
                 {
                     cold_pixel_list[cold_pixels].x = x;
                     cold_pixel_list[cold_pixels].y = y;
@@ -1229,7 +1533,48 @@ void find_and_fix_cold_pixels(int force_analysis)
                 }
             }
         }
+    }
+    
+    return cold_pixels;
+}
+#endif
+
+void find_and_fix_cold_pixels(uint16_t * plane, int force_analysis)
+{
+    static struct xy static_cold_pixel_list[MAX_COLD_PIXELS];
+    static int static_cold_pixels = -1;
+    
+    /* the list from the first frame is shared, a forced analysis uses its own (callers may run in parallel) */
+    struct xy * cold_pixel_list = static_cold_pixel_list;
+    int cold_pixels = static_cold_pixels;
+    
+    int w = raw_info.width;
+    int h = raw_info.height;
+    
+    if (force_analysis)
+    {
+        cold_pixel_list = malloc(MAX_COLD_PIXELS * sizeof(struct xy));
+        CHECK(cold_pixel_list, "malloc");
+    }
+    
+    /* scan for bad pixels in the first frame only, or on request*/
+    if (cold_pixels < 0 || force_analysis)
+    {
+        /* at sane ISOs, noise stdev is well less than 50, so 200 should be enough */
+        int cold_thr = MAX(0, raw_info.black_level - 200);
+
+        /* analyse all pixels of the frame */
+#ifdef RAW2DNG_SIMD
+        cold_pixels = find_cold_pixels_simd(plane, cold_thr, cold_pixel_list);
+#else
+        cold_pixels = find_cold_pixels_ref(plane, cold_thr, cold_pixel_list);
+#endif
         printf("\rCold pixels : %d                             \n", (cold_pixels));
+        
+        if (!force_analysis)
+        {
+            static_cold_pixels = cold_pixels;
+        }
     }  
 
     /* repair the cold pixels */
@@ -1265,15 +1610,19 @@ void find_and_fix_cold_pixels(int force_analysis)
                     continue;
                 }
 
-                int p = raw_get_pixel(x+j, y+i);
+                int p = plane[(x+j) + (y+i) * w];
                 neighbours[k++] = -p;
             }
         }
         
         /* replace the cold pixel with the median of the neighbours */
-        raw_set_pixel(x, y, -median_int_wirth(neighbours, k));
+        plane[x + y * w] = -median_int_wirth(neighbours, k);
     }
     
+    if (cold_pixel_list != static_cold_pixel_list)
+    {
+        free(cold_pixel_list);
+    }
 }
 
 #ifdef CHROMA_SMOOTH
@@ -1778,7 +2127,7 @@ static void chroma_smooth_5x5(unsigned short * inp, unsigned short * out, int* r
     }
 }
 
-void chroma_smooth()
+void chroma_smooth(uint16_t * plane)
 {
     int black = raw_info.black_level;
     static int raw2ev[16384];
@@ -1800,20 +2149,144 @@ void chroma_smooth()
     int h = raw_info.height;
 
     unsigned short * aux = malloc(w * h * sizeof(short));
-    unsigned short * aux2 = malloc(w * h * sizeof(short));
-
-    int x,y;
-    for (y = 0; y < h; y++)
-        for (x = 0; x < w; x++)
-            aux[x + y*w] = aux2[x + y*w] = raw_get_pixel(x, y);
+    memcpy(aux, plane, w * h * sizeof(short));
     
-    chroma_smooth_2x2(aux, aux2, raw2ev, ev2raw);
-    
-    for (y = 0; y < h; y++)
-        for (x = 0; x < w; x++)
-            raw_set_pixel(x, y, aux2[x + y*w]);
+    chroma_smooth_2x2(aux, plane, raw2ev, ev2raw);
 
     free(aux);
-    free(aux2);
 }
 #endif
+
+/* small PRNG for the self test, so we don't disturb rand() (used by the stripe detection) */
+static uint32_t selftest_rand(uint32_t * state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+/**
+ * Compare the SIMD code paths with the scalar reference on random frames.
+ * Returns the number of mismatches.
+ */
+int raw2dng_selftest()
+{
+#ifdef RAW2DNG_SIMD
+    /* one size with complete pixel blocks only, one with half a block at the end of each line */
+    static const int sizes[2][2] = { { 1024, 64 }, { 516, 33 } };
+    
+    struct raw_info saved_raw_info = raw_info;
+    int saved_coeffs[8];
+    memcpy(saved_coeffs, stripes_coeffs, sizeof(stripes_coeffs));
+    
+    uint32_t seed = 0x1234567;
+    int errors = 0;
+    
+    for (int s = 0; s < 2; s++)
+    {
+        int w = sizes[s][0];
+        int h = sizes[s][1];
+        int n = w * h;
+        
+        memset(&raw_info, 0, sizeof(raw_info));
+        raw_info.width = w;
+        raw_info.height = h;
+        raw_info.pitch = w * 14 / 8;
+        raw_info.frame_size = raw_info.pitch * h;
+        raw_info.bits_per_pixel = 14;
+        raw_info.black_level = 2048;
+        raw_info.white_level = 15000;
+        
+        /* raw_get_pixel / raw_set_pixel access a whole struct raw_pixblock, even for the last pixels of a frame */
+        int slack = sizeof(struct raw_pixblock);
+        uint8_t * packed = calloc(raw_info.frame_size + slack, 1);
+        uint8_t * packed_ref = calloc(raw_info.frame_size + slack, 1);
+        uint8_t * packed_simd = calloc(raw_info.frame_size + slack, 1);
+        uint16_t * ref = malloc(n * sizeof(uint16_t));
+        uint16_t * simd = malloc(n * sizeof(uint16_t));
+        struct xy * cold_ref = malloc(MAX_COLD_PIXELS * sizeof(struct xy));
+        struct xy * cold_simd = malloc(MAX_COLD_PIXELS * sizeof(struct xy));
+        CHECK(packed && packed_ref && packed_simd && ref && simd && cold_ref && cold_simd, "malloc");
+        
+        for (int i = 0; i < raw_info.frame_size; i++)
+        {
+            packed[i] = selftest_rand(&seed);
+        }
+        
+        /* unpacking */
+        raw_info.buffer = packed;
+        for (int y = 0; y < h; y++)
+        {
+            raw_unpack_row_ref(ref + y * w, y);
+            raw_unpack_line(packed + y * raw_info.pitch, simd + y * w, w, 14);
+        }
+        int unpack_errors = 0;
+        for (int i = 0; i < n; i++)
+        {
+            unpack_errors += (ref[i] != simd[i]) || (ref[i] != raw_get_pixel(i % w, i / w));
+        }
+        
+        /* packing; use out-of-range values too, these must be truncated as raw_set_pixel does */
+        for (int i = 0; i < n; i++)
+        {
+            ref[i] = simd[i] = selftest_rand(&seed);
+        }
+        memcpy(packed_ref, packed, raw_info.frame_size);
+        memcpy(packed_simd, packed, raw_info.frame_size);
+        raw_info.buffer = packed_ref;
+        for (int y = 0; y < h; y++)
+        {
+            raw_pack_row_ref(ref + y * w, y);
+        }
+        for (int y = 0; y < h; y++)
+        {
+            raw_pack_line(simd + y * w, packed_simd + y * raw_info.pitch, w, 14);
+        }
+        int pack_errors = memcmp(packed_ref, packed_simd, raw_info.frame_size) != 0;
+        
+        /* stripe correction: random pixels around black, a few typical coefficients, one column disabled */
+        static const int coeffs[8] = { FIXP_ONE, 64800, 66000, 0, 65900, 65000, 66400, FIXP_ONE + 300 };
+        memcpy(stripes_coeffs, coeffs, sizeof(stripes_coeffs));
+        for (int i = 0; i < n; i++)
+        {
+            uint32_t r = selftest_rand(&seed);
+            ref[i] = simd[i] = (r & 1) ? r % 16384 : (r >> 8) % 256 + raw_info.black_level - 128;
+        }
+        apply_vertical_stripes_correction_ref(ref);
+        apply_vertical_stripes_correction_simd(simd);
+        int stripes_errors = 0;
+        for (int i = 0; i < n; i++)
+        {
+            stripes_errors += (ref[i] != simd[i]);
+        }
+        
+        /* cold pixels */
+        int cold_thr = raw_info.black_level - 200;
+        int cold_pixels_ref = find_cold_pixels_ref(ref, cold_thr, cold_ref);
+        int cold_pixels_simd = find_cold_pixels_simd(ref, cold_thr, cold_simd);
+        int cold_errors = (cold_pixels_ref != cold_pixels_simd) || memcmp(cold_ref, cold_simd, cold_pixels_ref * sizeof(struct xy));
+        
+        printf("%4dx%-4d  unpack: %s  pack: %s  stripes: %s  cold pixels: %s\n", w, h,
+            unpack_errors ? "FAIL" : "ok", pack_errors ? "FAIL" : "ok",
+            stripes_errors ? "FAIL" : "ok", cold_errors ? "FAIL" : "ok"
+        );
+        errors += unpack_errors + pack_errors + stripes_errors + cold_errors;
+        
+        free(packed);
+        free(packed_ref);
+        free(packed_simd);
+        free(ref);
+        free(simd);
+        free(cold_ref);
+        free(cold_simd);
+    }
+    
+    raw_info = saved_raw_info;
+    memcpy(stripes_coeffs, saved_coeffs, sizeof(stripes_coeffs));
+    return errors;
+#else
+    printf("Built without SIMD support, nothing to compare.\n");
+    return 0;
+#endif
+}
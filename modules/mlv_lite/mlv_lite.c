@@ -66,6 +66,8 @@
 #include "focus.h"
 #include "fps.h"
 #include "../mlv_rec/mlv.h"
+#include "../mlv_rec/lj92.h"
+#include "raw_pack.h"
 #include "../trace/trace.h"
 #include "powersave.h"
 
@@ -118,6 +120,7 @@ static CONFIG_INT("raw.write.speed", measured_write_speed, 0);
 static CONFIG_INT("raw.pre-record", pre_record, 0);
 static int pre_record_triggered = 0;    /* becomes 1 once you press REC twice */
 static int pre_record_num_frames = 0;   /* how many frames we should pre-record */
+static int pre_record_ring_pos = 0;     /* next slot of the pre-record ring (slots 0 ... pre_record_num_frames-1) */
 
 static CONFIG_INT("raw.dolly", dolly_mode, 0);
 #define FRAMING_CENTER (dolly_mode == 0)
@@ -133,6 +136,17 @@ static CONFIG_INT("raw.warm.up", warm_up, 0);
 static CONFIG_INT("raw.use.srm.memory", use_srm_memory, 1);
 static CONFIG_INT("raw.small.hacks", small_hacks, 1);
 
+static CONFIG_INT("raw.compress", compress_frames, 0);
+static int compress_active = 0;                 /* compression enabled for this clip (and buffer allocated) */
+static uint16_t * compress_buffer = 0;          /* unpacked pixels of the frame being compressed */
+static volatile int compress_pending = 0;       /* queued frames the compressor did not get to yet */
+static volatile int compress_task_running = 0;
+static int compressed_frames = 0;               /* statistics, for this clip */
+static int compress_ratio = 0;                  /* last compressed size, percent of the uncompressed one */
+
+/* the compressor works on at most this many queued frames; older ones are written uncompressed */
+#define COMPRESS_QUEUE_MAX 4
+
 /* Recording Status Indicator Options */
 #define INDICATOR_OFF        0
 #define INDICATOR_IN_LVINFO  1
@@ -184,7 +198,9 @@ struct frame_slot
 {
     void* ptr;          /* image data, size=frame_size */
     int frame_number;   /* from 0 to n */
+    int size;           /* bytes to write: frame_size, or less if compressed */
     enum {SLOT_FREE, SLOT_FULL, SLOT_WRITING} status;
+    enum {FRAME_RAW, FRAME_PENDING, FRAME_COMPRESSING, FRAME_LJ92} compress;
 };
 
 static struct memSuite * shoot_mem_suite = 0;     /* memory suite for our buffers */
@@ -695,7 +711,9 @@ static int add_mem_suite(struct memSuite * mem_suite, int chunk_index)
                 vidf_hdr->panPosY    = skip_y;
                 
                 slots[slot_count].ptr = (void*) ptr;
+                slots[slot_count].size = frame_size;
                 slots[slot_count].status = SLOT_FREE;
+                slots[slot_count].compress = FRAME_RAW;
                 ptr += frame_size;
                 size -= frame_size;
                 group_size += frame_size;
@@ -741,6 +759,14 @@ static int setup_buffers()
         return 0;
     }
 
+    /* unpacked copy of the frame being compressed */
+    /* without it, we simply record uncompressed */
+    if (compress_frames)
+    {
+        compress_buffer = malloc(res_x * res_y * sizeof(uint16_t));
+        compress_active = (compress_buffer != 0);
+    }
+
     /* allocate the entire memory, but only use large chunks */
     /* yes, this may be a bit wasteful, but at least it works */
     
@@ -773,7 +799,7 @@ static int setup_buffers()
 
         /* leave at least 16MB for buffering */
         int max_frames = slot_count - 16*1024*1024 / frame_size;
-        pre_record_num_frames = MIN(requested_frames, max_frames);
+        pre_record_num_frames = MAX(MIN(requested_frames, max_frames), 1);
     }
     
     return 1;
@@ -787,6 +813,9 @@ static void free_buffers()
     srm_mem_suite = 0;
     if (fullsize_buffers[0]) fio_free(fullsize_buffers[0]);
     fullsize_buffers[0] = 0;
+    if (compress_buffer) free(compress_buffer);
+    compress_buffer = 0;
+    compress_active = 0;
 }
 
 static int get_free_slots()
@@ -1301,59 +1330,59 @@ static int FAST choose_next_capture_slot()
     return best_index;
 }
 
+/* send a captured frame to the writer, through the compressor if enabled */
+static void FAST queue_frame(int slot_index)
+{
+    if (compress_active)
+    {
+        slots[slot_index].compress = FRAME_PENDING;
+        compress_pending++;
+    }
+    else
+    {
+        slots[slot_index].compress = FRAME_RAW;
+    }
+
+    writing_queue[writing_queue_tail] = slot_index;
+    writing_queue_tail = MOD(writing_queue_tail + 1, COUNT(writing_queue));
+}
+
+/* pre-recording captures into a ring made of the first slots, which are in memory order,
+ * so on trigger the captured frames can be written straight from there, in large contiguous blocks */
 static void pre_record_vsync_step()
 {
     if (raw_recording_state == RAW_PRE_RECORDING)
     {
         if (pre_record_triggered)
         {
-            /* queue all captured frames for writing */
-            /* (they are numbered from 1 to frame_count-1; frame 0 is skipped) */
-            /* they are not ordered, which complicates things a bit */
-            int i = 0;
-            for (int current_frame = 1; current_frame < frame_count; current_frame++)
+            /* the captured frames are numbered from 1 to frame_count-1 (frame 0 is skipped) */
+            /* if the ring wrapped around, the oldest one is where the next frame would go */
+            int captured = frame_count - 1;
+            int oldest = (captured == pre_record_num_frames) ? pre_record_ring_pos : 0;
+            
+            /* number them in capture order; the image data stays where it is */
+            for (int i = 0; i < captured; i++)
             {
-                /* consecutive frames tend to be grouped, 
-                 * so this loop will not run every time */
-                while (slots[i].status != SLOT_FULL || slots[i].frame_number != current_frame)
-                {
-                    i = MOD(i+1, slot_count);
-                }
-                
-                writing_queue[writing_queue_tail] = i;
-                writing_queue_tail = MOD(writing_queue_tail + 1, COUNT(writing_queue));
-                i = MOD(i+1, slot_count);
+                int slot_index = MOD(oldest + i, pre_record_num_frames);
+                slots[slot_index].frame_number = i + 1;
+                ((mlv_vidf_hdr_t*)slots[slot_index].ptr)->frameNumber = i;
+            }
+            
+            /* queue them oldest first, so they are saved in frame order */
+            /* the writer groups them in at most two contiguous blocks: from the oldest one to the end of the ring, then the rest */
+            for (int i = 0; i < captured; i++)
+            {
+                queue_frame(MOD(oldest + i, pre_record_num_frames));
             }
             
             /* done, from now on we can just record normally */
             raw_recording_state = RAW_RECORDING;
         }
-        else if (frame_count >= pre_record_num_frames)
+        else if (frame_count > pre_record_num_frames)
         {
-            /* discard old frames */
-            /* also adjust frame_count so all frames start from 1,
-             * just like the rest of the code assumes */
+            /* ring full, the next frame replaces the oldest one */
+            /* keep frame_count at the number of frames in the ring */
             frame_count--;
-            
-            for (int i = 0; i < slot_count; i++)
-            {
-                /* first frame is 1 */
-                if (slots[i].status == SLOT_FULL)
-                {
-                    ASSERT(slots[i].frame_number > 0);
-                    
-                    if (slots[i].frame_number == 1)
-                    {
-                        slots[i].status = SLOT_FREE;
-                    }
-                    else
-                    {
-                        slots[i].frame_number--;
-                        ((mlv_vidf_hdr_t*)slots[i].ptr)->frameNumber
-                            = slots[i].frame_number - 1;
-                    }
-                }
-            }
         }
     }
 }
@@ -1423,7 +1452,15 @@ static void FAST process_frame()
     }
     
     /* where to save the next frame? */
-    capture_slot = choose_next_capture_slot(capture_slot);
+    if (raw_recording_state == RAW_PRE_RECORDING)
+    {
+        capture_slot = pre_record_ring_pos;
+        pre_record_ring_pos = MOD(pre_record_ring_pos + 1, pre_record_num_frames);
+    }
+    else
+    {
+        capture_slot = choose_next_capture_slot(capture_slot);
+    }
     
     if (capture_slot >= 0)
     {
@@ -1441,8 +1478,7 @@ static void FAST process_frame()
         {
             /* send it for saving, even if it isn't done yet */
             /* it's quite unlikely that FIO DMA will be faster than EDMAC */
-            writing_queue[writing_queue_tail] = capture_slot;
-            writing_queue_tail = MOD(writing_queue_tail + 1, COUNT(writing_queue));
+            queue_frame(capture_slot);
         }
     }
     else
@@ -1454,6 +1490,7 @@ static void FAST process_frame()
 
     /* copy current frame to our buffer and crop it to its final size */
     mlv_vidf_hdr_t* vidf_hdr = (mlv_vidf_hdr_t*)slots[capture_slot].ptr;
+    vidf_hdr->blockSize = slots[capture_slot].size = frame_size; /* the previous frame in this slot may have been compressed */
     vidf_hdr->frameNumber = slots[capture_slot].frame_number - 1;
     mlv_set_timestamp((mlv_hdr_t*)vidf_hdr, mlv_start_timestamp);
     vidf_hdr->cropPosX = (skip_x + 7) & ~7;
@@ -1566,7 +1603,9 @@ static void init_mlv_chunk_headers(struct raw_info * raw_info)
     file_hdr.fileNum = 0;
     file_hdr.fileCount = 0; //autodetect
     file_hdr.fileFlags = 4;
-    file_hdr.videoClass = 1;
+    /* with compression, frames the compressor didn't get to are still stored as they are */
+    /* the STORED flag tells readers to expect them; they are the only ones at full size, compressed frames are always smaller */
+    file_hdr.videoClass = 1 | (compress_frames ? MLV_VIDEO_CLASS_FLAG_LJ92 | MLV_VIDEO_CLASS_FLAG_STORED : 0);
     file_hdr.audioClass = 0;
     file_hdr.videoFrameCount = 0; //autodetect
     file_hdr.audioFrameCount = 0;
@@ -1646,8 +1685,8 @@ static void finish_chunk(FILE* f)
 /* This saves a group of frames, also taking care of file splitting if required */
 static int write_frames(FILE** pf, void* ptr, int size_used, int num_frames)
 {
-    /* note: num_frames can be computed as size_used / frame_size, but compressed frames are around the corner) */
-    ASSERT(num_frames == size_used / frame_size);
+    /* note: compressed frames are smaller than frame_size, and written one by one */
+    ASSERT(num_frames == size_used / frame_size || (num_frames == 1 && size_used < frame_size));
 
     FILE* f = *pf;
     
@@ -1756,6 +1795,124 @@ static int write_frames(FILE** pf, void* ptr, int size_used, int num_frames)
     return 1;
 }
 
+/* compare-and-set of the compression state; the writer and the compressor both take frames from the queue */
+static int frame_compress_transition(int slot_index, int from, int to)
+{
+    uint32_t old_int = cli();
+    int ok = (slots[slot_index].compress == from);
+    if (ok)
+    {
+        slots[slot_index].compress = to;
+        if (from == FRAME_PENDING) compress_pending--;
+    }
+    sei(old_int);
+    return ok;
+}
+
+/* can the writer take this frame? if the compressor can't keep up, the frames waiting for it are taken as they are */
+static int frame_ready_to_write(int slot_index)
+{
+    if (compress_pending > COMPRESS_QUEUE_MAX || !compress_task_running)
+    {
+        frame_compress_transition(slot_index, FRAME_PENDING, FRAME_RAW);
+    }
+
+    return slots[slot_index].compress == FRAME_RAW || slots[slot_index].compress == FRAME_LJ92;
+}
+
+/* oldest queued frame waiting for the compressor, -1 if none is ready */
+static int compress_pick_frame()
+{
+    int w_tail = writing_queue_tail;
+
+    for (int i = writing_queue_head; i != w_tail; i = MOD(i+1, COUNT(writing_queue)))
+    {
+        int slot_index = writing_queue[i];
+
+        if (slots[slot_index].compress != FRAME_PENDING)
+        {
+            continue;
+        }
+
+        /* bounded queue: if we are behind, leave the older frames uncompressed */
+        if (compress_pending > COMPRESS_QUEUE_MAX)
+        {
+            frame_compress_transition(slot_index, FRAME_PENDING, FRAME_RAW);
+            continue;
+        }
+
+        int check = frame_check_saved(slot_index);
+        if (check == 0)
+        {
+            /* EDMAC still copying it */
+            return -1;
+        }
+
+        if (frame_compress_transition(slot_index, FRAME_PENDING, check == 1 ? FRAME_COMPRESSING : FRAME_RAW) && check == 1)
+        {
+            return slot_index;
+        }
+    }
+
+    return -1;
+}
+
+/* lossless JPEG, in place, over the packed pixels; returns 0 if the frame is left as it was */
+static int compress_frame(int slot_index)
+{
+    void* ptr = slots[slot_index].ptr + VIDF_HDR_SIZE;
+    int pixels = res_x * res_y;
+    uint32_t size = 0;
+
+    raw_unpack_line(ptr, compress_buffer, pixels, 14);
+
+    /* same layout as mlv_dump: a bayer row is coded as two components */
+    /* the result must be smaller than the packed frame, with some margin for padding,
+     * so readers can tell it apart from frames stored uncompressed */
+    int components = (res_x % 2) ? 1 : 2;
+    int ret = lj92_encode_to(compress_buffer, res_x / components, res_y, components, 14, 1, ptr, frame_size_real - 1024, &size);
+
+    if (ret != LJ92_ERR_OK)
+    {
+        /* didn't get smaller; put the original pixels back */
+        raw_pack_line(compress_buffer, ptr, pixels, 14);
+        return 0;
+    }
+
+    /* keep the blocks multiple of 512 bytes, like the uncompressed ones */
+    int block_size = (VIDF_HDR_SIZE + size + 511) & ~511;
+    ((mlv_vidf_hdr_t*)slots[slot_index].ptr)->blockSize = block_size;
+    slots[slot_index].size = block_size;
+    compress_ratio = (int64_t) size * 100 / frame_size_real;
+    return 1;
+}
+
+/* runs at lower priority than the writer, so it only uses the CPU time left over */
+static void compress_task()
+{
+    while (RAW_IS_RECORDING)
+    {
+        int slot_index = compress_pick_frame();
+        if (slot_index < 0)
+        {
+            msleep(10);
+            continue;
+        }
+
+        if (compress_frame(slot_index))
+        {
+            slots[slot_index].compress = FRAME_LJ92;
+            compressed_frames++;
+        }
+        else
+        {
+            slots[slot_index].compress = FRAME_RAW;
+        }
+    }
+
+    compress_task_running = 0;
+}
+
 static void raw_video_rec_task()
 {
     //~ console_show();
@@ -1774,6 +1931,11 @@ static void raw_video_rec_task()
     mlv_chunk = 0;
     edmac_active = 0;
     pre_record_triggered = 0;
+    pre_record_ring_pos = 0;
+    compress_active = 0;
+    compress_pending = 0;
+    compressed_frames = 0;
+    compress_ratio = 0;
     
     powersave_prohibit();
 
@@ -1823,6 +1985,12 @@ static void raw_video_rec_task()
     /* this will enable the vsync CBR and the other task(s) */
     raw_recording_state = pre_record ? RAW_PRE_RECORDING : RAW_RECORDING;
 
+    if (compress_active)
+    {
+        compress_task_running = 1;
+        task_create("raw_compress_task", 0x1c, 0x1000, compress_task, (void*)0);
+    }
+
     /* try a sync beep (not very precise, but better than nothing) */
     beep();
 
@@ -1868,7 +2036,15 @@ static void raw_video_rec_task()
             continue;
         }
 
+        /* the compressor may still be working on it */
+        if (!frame_ready_to_write(first_slot))
+        {
+            msleep(10);
+            continue;
+        }
+
         /* group items from the queue in a contiguous block - as many as we can */
+        /* compressed frames don't fill their slots, so they are written one by one */
         int last_grouped = w_head;
         
         for (int i = w_head; i != w_tail; i = MOD(i+1, COUNT(writing_queue)))
@@ -1878,7 +2054,8 @@ static void raw_video_rec_task()
 
             /* TBH, I don't care if these are part of the same group or not,
              * as long as pointers are ordered correctly */
-            if (slots[slot_index].ptr == slots[first_slot].ptr + frame_size * group_pos)
+            if (slots[slot_index].ptr == slots[first_slot].ptr + frame_size * group_pos &&
+                frame_ready_to_write(slot_index) && slots[slot_index].compress == FRAME_RAW)
                 last_grouped = i;
             else
                 break;
@@ -1914,7 +2091,7 @@ static void raw_video_rec_task()
         }
 
         void* ptr = slots[first_slot].ptr;
-        int size_used = frame_size * num_frames;
+        int size_used = (num_frames == 1) ? slots[first_slot].size : frame_size * num_frames;
 
         /* mark these frames as "writing" */
         for (int i = w_head; i != after_last_grouped; i = MOD(i+1, COUNT(writing_queue)))
@@ -2010,6 +2187,10 @@ abort_and_check_early_stop:
 
     /* wait until the other tasks calm down */
     msleep(500);
+    while (compress_task_running)
+    {
+        msleep(20);
+    }
 
     /* exclusive edmac access no longer needed */
     edmac_memcpy_res_unlock();
@@ -2046,9 +2227,12 @@ abort_and_check_early_stop:
         }
         last_processed_frame++;
 
+        /* compressor stopped, frames it didn't get to are saved as they are */
+        frame_ready_to_write(slot_index);
+
         slots[slot_index].status = SLOT_WRITING;
         if (indicator_display == INDICATOR_RAW_BUFFER) show_buffer_status();
-        if (!write_frames(&f, slots[slot_index].ptr, frame_size, 1))
+        if (!write_frames(&f, slots[slot_index].ptr, slots[slot_index].size, 1))
         {
             NotifyBox(5000, "Card Full");
             beep();
@@ -2057,6 +2241,11 @@ abort_and_check_early_stop:
         slots[slot_index].status = SLOT_FREE;
     }
 
+    if (compress_active)
+    {
+        printf("Compressed %d of %d frames (last one %d%%).\n", compressed_frames, last_processed_frame, compress_ratio);
+    }
+
     if (!written_total || !f)
     {
         bmp_printf( FONT_MED, 30, 110, 
@@ -2179,6 +2368,15 @@ static struct menu_entry raw_video_menu[] =
                 .help    = "Pre-records a few seconds of video into memory, discarding old frames.",
                 .help2   = "Press REC twice: 1 - to start pre-recording, 2 - for normal recording.",
             },
+            {
+                .name    = "Compression",
+                .priv    = &compress_frames,
+                .max     = 1,
+                .choices = CHOICES("OFF", "LJ92"),
+                .help    = "Lossless JPEG compression, in a background task. Needs mlv_dump.",
+                .help2   = "Frames the CPU can't keep up with are saved uncompressed.",
+                .advanced = 1,
+            },
             {
                 .name = "Digital dolly",
                 .priv = &dolly_mode,
@@ -0,0 +1,988 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lj92.h"
+
+/* JPEG markers we care about */
+#define M_SOF3  0xC3
+#define M_DHT   0xC4
+#define M_SOI   0xD8
+#define M_EOI   0xD9
+#define M_SOS   0xDA
+#define M_DRI   0xDD
+
+/* difference categories (SSSS) in lossless mode are 0..16 */
+#define LJ92_SYMBOLS    17
+
+/* codes up to this length are decoded with a single table lookup */
+#define LJ92_LUT_BITS   12
+
+typedef struct
+{
+    int present;
+    uint8_t bits[17];
+    uint8_t huffval[256];
+    uint8_t pad[3];                     /* align the tables below without implicit padding (-Wpadded) */
+    int32_t mincode[17];
+    int32_t maxcode[18];
+    int32_t valptr[17];
+    uint16_t lut[1 << LJ92_LUT_BITS];   /* (code length << 8) | value, 0 if the code is longer */
+} lj92_huff_t;
+
+typedef struct
+{
+    const uint8_t *data;
+    uint32_t size;
+    uint32_t pos;
+    uint64_t acc;
+    int bits;
+} lj92_reader_t;
+
+typedef struct
+{
+    lj92_info_t info;
+    int point_transform;
+    int restart_interval;
+    int comp_id[LJ92_MAX_COMPONENTS];
+    int comp_table[LJ92_MAX_COMPONENTS];
+    lj92_huff_t huff[4];
+    uint32_t scan_pos;
+} lj92_decoder_t;
+
+static inline int lj92_predict(int predictor, int ra, int rb, int rc)
+{
+    switch(predictor)
+    {
+        case 1: return ra;
+        case 2: return rb;
+        case 3: return rc;
+        case 4: return ra + rb - rc;
+        case 5: return ra + ((rb - rc) >> 1);
+        case 6: return rb + ((ra - rc) >> 1);
+        case 7: return (ra + rb) >> 1;
+    }
+    return 0;
+}
+
+/* number of bits needed for the magnitude of a difference */
+static inline int lj92_ssss(int diff)
+{
+    int value = diff < 0 ? -diff : diff;
+    int ssss = 0;
+
+    while(value)
+    {
+        ssss++;
+        value >>= 1;
+    }
+    return ssss;
+}
+
+/*
+ * decoder
+ */
+
+static int lj92_build_huff(lj92_huff_t *h)
+{
+    /* generate the code table as described in T.81 annex C */
+    int code = 0;
+    int k = 0;
+
+    memset(h->lut, 0, sizeof(h->lut));
+
+    for(int len = 1; len <= 16; len++)
+    {
+        h->valptr[len] = k;
+        h->mincode[len] = code;
+
+        /* too many codes of this length, they would not fit (and overrun the LUT) */
+        if(code + h->bits[len] > (1 << len))
+        {
+            return LJ92_ERR_CORRUPT;
+        }
+
+        for(int i = 0; i < h->bits[len]; i++)
+        {
+            if(len <= LJ92_LUT_BITS)
+            {
+                /* every LUT index that starts with this code */
+                int shift = LJ92_LUT_BITS - len;
+                for(int fill = 0; fill < (1 << shift); fill++)
+                {
+                    h->lut[(code << shift) | fill] = (len << 8) | h->huffval[k];
+                }
+            }
+            code++;
+            k++;
+        }
+
+        h->maxcode[len] = h->bits[len] ? code - 1 : -1;
+        code <<= 1;
+    }
+    h->maxcode[17] = 0x7FFFFFFF;
+    h->present = 1;
+
+    return LJ92_ERR_OK;
+}
+
+static inline void lj92_fill(lj92_reader_t *r)
+{
+    while(r->bits <= 56)
+    {
+        uint32_t byte = 0;
+
+        if(r->pos < r->size)
+        {
+            byte = r->data[r->pos];
+
+            if(byte == 0xFF)
+            {
+                if(r->pos + 1 < r->size && r->data[r->pos + 1] == 0x00)
+                {
+                    /* stuffed byte */
+                    r->pos += 2;
+                }
+                else
+                {
+                    /* marker, feed zeros from here on and leave the position at the marker */
+                    byte = 0;
+                }
+            }
+            else
+            {
+                r->pos++;
+            }
+        }
+
+        r->acc = (r->acc << 8) | byte;
+        r->bits += 8;
+    }
+}
+
+static inline int lj92_get_bits(lj92_reader_t *r, int count)
+{
+    if(!count)
+    {
+        return 0;
+    }
+    if(r->bits < count)
+    {
+        lj92_fill(r);
+    }
+    r->bits -= count;
+    return (int)((r->acc >> r->bits) & ((1ULL << count) - 1));
+}
+
+static inline int lj92_decode_symbol(lj92_reader_t *r, lj92_huff_t *h)
+{
+    if(r->bits < 16)
+    {
+        lj92_fill(r);
+    }
+
+    int entry = h->lut[(r->acc >> (r->bits - LJ92_LUT_BITS)) & ((1 << LJ92_LUT_BITS) - 1)];
+    if(entry)
+    {
+        r->bits -= entry >> 8;
+        return entry & 0xFF;
+    }
+
+    /* slow path for long codes, T.81 figure F.16 */
+    int len = LJ92_LUT_BITS + 1;
+    int code = (int)((r->acc >> (r->bits - len)) & ((1 << len) - 1));
+    while(code > h->maxcode[len])
+    {
+        /* only 16 bits are guaranteed in the accumulator */
+        if(++len > 16)
+        {
+            return -1;
+        }
+        code = (int)((r->acc >> (r->bits - len)) & ((1 << len) - 1));
+    }
+    r->bits -= len;
+
+    return h->huffval[h->valptr[len] + code - h->mincode[len]];
+}
+
+static inline int lj92_extend(int value, int ssss)
+{
+    if(ssss == 16)
+    {
+        return 32768;
+    }
+    if(ssss && value < (1 << (ssss - 1)))
+    {
+        return value - (1 << ssss) + 1;
+    }
+    return value;
+}
+
+static int lj92_parse(lj92_decoder_t *dec, const uint8_t *data, uint32_t size)
+{
+    uint32_t pos = 0;
+    int have_sof = 0;
+
+    memset(dec, 0, sizeof(lj92_decoder_t));
+
+    if(size < 4 || data[0] != 0xFF || data[1] != M_SOI)
+    {
+        return LJ92_ERR_CORRUPT;
+    }
+    pos = 2;
+
+    while(pos + 4 <= size)
+    {
+        if(data[pos] != 0xFF)
+        {
+            return LJ92_ERR_CORRUPT;
+        }
+
+        int marker = data[pos + 1];
+
+        /* fill bytes */
+        if(marker == 0xFF)
+        {
+            pos++;
+            continue;
+        }
+
+        uint32_t len = (data[pos + 2] << 8) | data[pos + 3];
+        const uint8_t *seg = &data[pos + 4];
+
+        if(len < 2 || pos + 2 + len > size)
+        {
+            return LJ92_ERR_CORRUPT;
+        }
+
+        switch(marker)
+        {
+            case M_DHT:
+            {
+                uint32_t off = 0;
+                while(off + 17 <= len - 2)
+                {
+                    int table = seg[off] & 0x0F;
+                    int count = 0;
+
+                    if(table > 3)
+                    {
+                        return LJ92_ERR_CORRUPT;
+                    }
+
+                    lj92_huff_t *h = &dec->huff[table];
+                    h->bits[0] = 0;
+                    for(int i = 1; i <= 16; i++)
+                    {
+                        h->bits[i] = seg[off + i];
+                        count += h->bits[i];
+                    }
+                    off += 17;
+
+                    if(count > 256 || off + count > len - 2)
+                    {
+                        return LJ92_ERR_CORRUPT;
+                    }
+                    memcpy(h->huffval, &seg[off], count);
+                    off += count;
+
+                    int ret = lj92_build_huff(h);
+                    if(ret)
+                    {
+                        return ret;
+                    }
+                }
+                break;
+            }
+
+            case M_SOF3:
+            {
+                if(len < 8)
+                {
+                    return LJ92_ERR_CORRUPT;
+                }
+                dec->info.bitdepth = seg[0];
+                dec->info.height = (seg[1] << 8) | seg[2];
+                dec->info.width = (seg[3] << 8) | seg[4];
+                dec->info.components = seg[5];
+
+                if(dec->info.bitdepth < 2 || dec->info.bitdepth > 16)
+                {
+                    return LJ92_ERR_UNSUPPORTED;
+                }
+
+                if(dec->info.components < 1 || dec->info.components > LJ92_MAX_COMPONENTS || len < 8 + 3 * (uint32_t)dec->info.components)
+                {
+                    return LJ92_ERR_UNSUPPORTED;
+                }
+
+                for(int comp = 0; comp < dec->info.components; comp++)
+                {
+                    dec->comp_id[comp] = seg[6 + 3 * comp];
+
+                    /* subsampled formats (e.g. sRAW) are not supported */
+                    if(seg[7 + 3 * comp] != 0x11)
+                    {
+                        return LJ92_ERR_UNSUPPORTED;
+                    }
+                }
+                have_sof = 1;
+                break;
+            }
+
+            case M_DRI:
+                dec->restart_interval = (seg[0] << 8) | seg[1];
+                break;
+
+            case M_SOS:
+            {
+                int count = seg[0];
+
+                if(!have_sof || count != dec->info.components || len < 6 + 2 * (uint32_t)count)
+                {
+                    return LJ92_ERR_UNSUPPORTED;
+                }
+
+                for(int comp = 0; comp < count; comp++)
+                {
+                    int id = seg[1 + 2 * comp];
+                    int table = seg[2 + 2 * comp] >> 4;
+
+                    /* components must be in frame order */
+                    if(id != dec->comp_id[comp] || table > 3)
+                    {
+                        return LJ92_ERR_UNSUPPORTED;
+                    }
+                    dec->comp_table[comp] = table;
+                }
+                dec->info.predictor = seg[1 + 2 * count];
+                dec->point_transform = seg[3 + 2 * count] & 0x0F;
+                dec->scan_pos = pos + 2 + len;
+
+                /* the initial prediction is 1 << (bitdepth - pt - 1) */
+                if(dec->info.predictor < 1 || dec->info.predictor > 7 || dec->point_transform >= dec->info.bitdepth)
+                {
+                    return LJ92_ERR_UNSUPPORTED;
+                }
+                return LJ92_ERR_OK;
+            }
+
+            case M_EOI:
+                return LJ92_ERR_CORRUPT;
+
+            default:
+                /* APPn, COM and others */
+                break;
+        }
+
+        pos += 2 + len;
+    }
+
+    return LJ92_ERR_CORRUPT;
+}
+
+int lj92_read_info(const uint8_t *data, uint32_t size, lj92_info_t *info)
+{
+    lj92_decoder_t *dec = malloc(sizeof(lj92_decoder_t));
+
+    if(!dec)
+    {
+        return LJ92_ERR_MALLOC;
+    }
+
+    int ret = lj92_parse(dec, data, size);
+    if(!ret && info)
+    {
+        *info = dec->info;
+    }
+
+    free(dec);
+    return ret;
+}
+
+/* skip to the next RSTn marker and reset the bit reader */
+static int lj92_restart(lj92_reader_t *r)
+{
+    r->acc = 0;
+    r->bits = 0;
+
+    while(r->pos + 1 < r->size)
+    {
+        if(r->data[r->pos] == 0xFF && r->data[r->pos + 1] >= 0xD0 && r->data[r->pos + 1] <= 0xD7)
+        {
+            r->pos += 2;
+            return LJ92_ERR_OK;
+        }
+        r->pos++;
+    }
+    return LJ92_ERR_CORRUPT;
+}
+
+int lj92_decode(const uint8_t *data, uint32_t size, uint16_t *image, uint32_t samples, lj92_info_t *info)
+{
+    lj92_decoder_t *dec = malloc(sizeof(lj92_decoder_t));
+
+    if(!dec)
+    {
+        return LJ92_ERR_MALLOC;
+    }
+
+    int ret = lj92_parse(dec, data, size);
+    if(ret)
+    {
+        free(dec);
+        return ret;
+    }
+
+    const int width = dec->info.width;
+    const int height = dec->info.height;
+    const int comps = dec->info.components;
+    const int stride = width * comps;
+    const int predictor = dec->info.predictor;
+    const int pt = dec->point_transform;
+
+    if((uint64_t)stride * height > samples)
+    {
+        free(dec);
+        return LJ92_ERR_TOO_SMALL;
+    }
+
+    lj92_huff_t *tables[LJ92_MAX_COMPONENTS];
+    for(int comp = 0; comp < comps; comp++)
+    {
+        tables[comp] = &dec->huff[dec->comp_table[comp]];
+        if(!tables[comp]->present)
+        {
+            free(dec);
+            return LJ92_ERR_CORRUPT;
+        }
+    }
+
+    lj92_reader_t reader;
+    reader.data = data;
+    reader.size = size;
+    reader.pos = dec->scan_pos;
+    reader.acc = 0;
+    reader.bits = 0;
+
+    /* restart intervals are a whole number of rows in lossless mode */
+    int rows_per_interval = dec->restart_interval ? dec->restart_interval / width : height;
+    if(rows_per_interval < 1)
+    {
+        rows_per_interval = 1;
+    }
+    int initial = 1 << (dec->info.bitdepth - pt - 1);
+
+    for(int y = 0; y < height; y++)
+    {
+        uint16_t *row = &image[y * stride];
+        uint16_t *prev = row - stride;
+        int first_row = (y % rows_per_interval) == 0;
+
+        if(first_row && y)
+        {
+            if(lj92_restart(&reader))
+            {
+                free(dec);
+                return LJ92_ERR_CORRUPT;
+            }
+        }
+
+        for(int x = 0; x < width; x++)
+        {
+            for(int comp = 0; comp < comps; comp++)
+            {
+                int ssss = lj92_decode_symbol(&reader, tables[comp]);
+                if(ssss < 0 || ssss > 16)
+                {
+                    free(dec);
+                    return LJ92_ERR_CORRUPT;
+                }
+
+                int diff = lj92_extend(lj92_get_bits(&reader, ssss == 16 ? 0 : ssss), ssss);
+                int pos = x * comps + comp;
+                int pred;
+
+                if(first_row)
+                {
+                    pred = x ? row[pos - comps] : initial;
+                }
+                else if(!x)
+                {
+                    pred = prev[pos];
+                }
+                else
+                {
+                    pred = lj92_predict(predictor, row[pos - comps], prev[pos], prev[pos - comps]);
+                }
+
+                row[pos] = (uint16_t)(pred + diff);
+            }
+        }
+    }
+
+    if(pt)
+    {
+        for(uint32_t pos = 0; pos < (uint32_t)(stride * height); pos++)
+        {
+            image[pos] <<= pt;
+        }
+    }
+
+    if(info)
+    {
+        *info = dec->info;
+    }
+
+    free(dec);
+    return LJ92_ERR_OK;
+}
+
+/*
+ * encoder
+ */
+
+typedef struct
+{
+    uint8_t *buf;
+    uint32_t size;
+    uint32_t pos;
+    uint32_t acc;
+    int bits;
+    int fixed;          /* buffer belongs to the caller and can't grow */
+} lj92_writer_t;
+
+static int lj92_reserve(lj92_writer_t *w, uint32_t bytes)
+{
+    if(w->pos + bytes <= w->size)
+    {
+        return LJ92_ERR_OK;
+    }
+
+    if(w->fixed)
+    {
+        return LJ92_ERR_TOO_SMALL;
+    }
+
+    uint32_t new_size = w->size * 2;
+    while(new_size < w->pos + bytes)
+    {
+        new_size *= 2;
+    }
+
+    uint8_t *buf = realloc(w->buf, new_size);
+    if(!buf)
+    {
+        return LJ92_ERR_MALLOC;
+    }
+    w->buf = buf;
+    w->size = new_size;
+
+    return LJ92_ERR_OK;
+}
+
+/* up to 16 bits at once. space must be reserved by the caller */
+static inline void lj92_put_bits(lj92_writer_t *w, uint32_t value, int count)
+{
+    w->acc = (w->acc << count) | (value & ((1 << count) - 1));
+    w->bits += count;
+
+    while(w->bits >= 8)
+    {
+        w->bits -= 8;
+        uint8_t byte = (w->acc >> w->bits) & 0xFF;
+
+        w->buf[w->pos++] = byte;
+        if(byte == 0xFF)
+        {
+            w->buf[w->pos++] = 0x00;
+        }
+    }
+}
+
+static void lj92_put_word(lj92_writer_t *w, int value)
+{
+    w->buf[w->pos++] = value >> 8;
+    w->buf[w->pos++] = value & 0xFF;
+}
+
+/* build a length-limited huffman table from symbol frequencies, T.81 annex K.2 */
+static void lj92_huff_lengths(const uint32_t *counts, uint8_t *bits, uint8_t *huffval)
+{
+    uint32_t freq[LJ92_SYMBOLS + 1];
+    int codesize[LJ92_SYMBOLS + 1];
+    int others[LJ92_SYMBOLS + 1];
+    int bitcount[33];
+
+    memcpy(freq, counts, LJ92_SYMBOLS * sizeof(uint32_t));
+
+    /* reserved symbol, makes sure no code consists of all 1-bits */
+    freq[LJ92_SYMBOLS] = 1;
+
+    for(int i = 0; i <= LJ92_SYMBOLS; i++)
+    {
+        codesize[i] = 0;
+        others[i] = -1;
+    }
+
+    while(1)
+    {
+        int v1 = -1;
+        int v2 = -1;
+
+        /* find the two least frequent symbols, prefer the higher ones on ties */
+        for(int i = 0; i <= LJ92_SYMBOLS; i++)
+        {
+            if(freq[i] && (v1 < 0 || freq[i] <= freq[v1]))
+            {
+                v1 = i;
+            }
+        }
+        for(int i = 0; i <= LJ92_SYMBOLS; i++)
+        {
+            if(freq[i] && i != v1 && (v2 < 0 || freq[i] <= freq[v2]))
+            {
+                v2 = i;
+            }
+        }
+
+        if(v2 < 0)
+        {
+            break;
+        }
+
+        freq[v1] += freq[v2];
+        freq[v2] = 0;
+
+        codesize[v1]++;
+        while(others[v1] >= 0)
+        {
+            v1 = others[v1];
+            codesize[v1]++;
+        }
+        others[v1] = v2;
+
+        codesize[v2]++;
+        while(others[v2] >= 0)
+        {
+            v2 = others[v2];
+            codesize[v2]++;
+        }
+    }
+
+    memset(bitcount, 0, sizeof(bitcount));
+    for(int i = 0; i <= LJ92_SYMBOLS; i++)
+    {
+        if(codesize[i])
+        {
+            bitcount[codesize[i]]++;
+        }
+    }
+
+    /* limit code lengths to 16 bits, figure K.3 */
+    for(int i = 32; i > 16; i--)
+    {
+        while(bitcount[i] > 0)
+        {
+            int j = i - 2;
+            while(bitcount[j] == 0)
+            {
+                j--;
+            }
+            bitcount[i] -= 2;
+            bitcount[i - 1]++;
+            bitcount[j + 1] += 2;
+            bitcount[j]--;
+        }
+    }
+
+    /* remove the reserved code from the longest length */
+    int i = 16;
+    while(bitcount[i] == 0)
+    {
+        i--;
+    }
+    bitcount[i]--;
+
+    bits[0] = 0;
+    for(i = 1; i <= 16; i++)
+    {
+        bits[i] = bitcount[i];
+    }
+
+    /* symbols sorted by code size, figure K.4 */
+    int k = 0;
+    for(int size = 1; size <= 32; size++)
+    {
+        for(int sym = 0; sym < LJ92_SYMBOLS; sym++)
+        {
+            if(codesize[sym] == size)
+            {
+                huffval[k++] = sym;
+            }
+        }
+    }
+}
+
+static int lj92_encode_stream(lj92_writer_t *w, const uint16_t *image, int width, int height, int components, int bitdepth, int predictor)
+{
+    if(!image || width < 1 || height < 1 || width > 0xFFFF || height > 0xFFFF ||
+       components < 1 || components > LJ92_MAX_COMPONENTS || bitdepth < 2 || bitdepth > 16 || predictor < 1 || predictor > 7)
+    {
+        return LJ92_ERR_PARAM;
+    }
+
+    const int stride = width * components;
+    const int initial = 1 << (bitdepth - 1);
+    uint32_t counts[LJ92_SYMBOLS];
+
+    memset(counts, 0, sizeof(counts));
+
+    /* first pass: statistics for the huffman table */
+    for(int y = 0; y < height; y++)
+    {
+        const uint16_t *row = &image[y * stride];
+        const uint16_t *prev = row - stride;
+
+        for(int pos = 0; pos < stride; pos++)
+        {
+            int pred;
+
+            if(!y)
+            {
+                pred = pos >= components ? row[pos - components] : initial;
+            }
+            else if(pos < components)
+            {
+                pred = prev[pos];
+            }
+            else
+            {
+                pred = lj92_predict(predictor, row[pos - components], prev[pos], prev[pos - components]);
+            }
+
+            int diff = (int16_t)(uint16_t)(row[pos] - pred);
+            counts[diff == -32768 ? 16 : lj92_ssss(diff)]++;
+        }
+    }
+
+    uint8_t bits[17];
+    uint8_t huffval[LJ92_SYMBOLS];
+    uint16_t code[LJ92_SYMBOLS];
+    uint8_t code_len[LJ92_SYMBOLS];
+    int symbols = 0;
+
+    memset(huffval, 0, sizeof(huffval));
+    memset(code_len, 0, sizeof(code_len));
+    lj92_huff_lengths(counts, bits, huffval);
+
+    /* canonical codes, T.81 annex C */
+    {
+        int value = 0;
+        int k = 0;
+        for(int len = 1; len <= 16; len++)
+        {
+            for(int i = 0; i < bits[len]; i++)
+            {
+                code[huffval[k]] = value++;
+                code_len[huffval[k]] = len;
+                k++;
+            }
+            value <<= 1;
+        }
+        symbols = k;
+    }
+
+    /* headers are less than 100 bytes */
+    int ret = lj92_reserve(w, 1024);
+    if(ret)
+    {
+        return ret;
+    }
+
+    /* SOI */
+    lj92_put_word(w, 0xFF00 | M_SOI);
+
+    /* DHT with one table for all components */
+    lj92_put_word(w, 0xFF00 | M_DHT);
+    lj92_put_word(w, 2 + 1 + 16 + symbols);
+    w->buf[w->pos++] = 0x00;
+    for(int i = 1; i <= 16; i++)
+    {
+        w->buf[w->pos++] = bits[i];
+    }
+    for(int i = 0; i < symbols; i++)
+    {
+        w->buf[w->pos++] = huffval[i];
+    }
+
+    /* SOF3 */
+    lj92_put_word(w, 0xFF00 | M_SOF3);
+    lj92_put_word(w, 8 + 3 * components);
+    w->buf[w->pos++] = bitdepth;
+    lj92_put_word(w, height);
+    lj92_put_word(w, width);
+    w->buf[w->pos++] = components;
+    for(int comp = 0; comp < components; comp++)
+    {
+        w->buf[w->pos++] = comp;
+        w->buf[w->pos++] = 0x11;
+        w->buf[w->pos++] = 0;
+    }
+
+    /* SOS */
+    lj92_put_word(w, 0xFF00 | M_SOS);
+    lj92_put_word(w, 6 + 2 * components);
+    w->buf[w->pos++] = components;
+    for(int comp = 0; comp < components; comp++)
+    {
+        w->buf[w->pos++] = comp;
+        w->buf[w->pos++] = 0x00;
+    }
+    w->buf[w->pos++] = predictor;
+    w->buf[w->pos++] = 0;
+    w->buf[w->pos++] = 0;
+
+    /* second pass: entropy coded data */
+    for(int y = 0; y < height; y++)
+    {
+        const uint16_t *row = &image[y * stride];
+        const uint16_t *prev = row - stride;
+
+        /* 16 bit code plus 16 bit value, each byte possibly stuffed */
+        ret = lj92_reserve(w, stride * 8 + 16);
+        if(ret)
+        {
+            return ret;
+        }
+
+        for(int pos = 0; pos < stride; pos++)
+        {
+            int pred;
+
+            if(!y)
+            {
+                pred = pos >= components ? row[pos - components] : initial;
+            }
+            else if(pos < components)
+            {
+                pred = prev[pos];
+            }
+            else
+            {
+                pred = lj92_predict(predictor, row[pos - components], prev[pos], prev[pos - components]);
+            }
+
+            int diff = (int16_t)(uint16_t)(row[pos] - pred);
+
+            if(diff == -32768)
+            {
+                /* 32768 is coded as SSSS=16 without additional bits */
+                lj92_put_bits(w, code[16], code_len[16]);
+                continue;
+            }
+
+            int ssss = lj92_ssss(diff);
+            lj92_put_bits(w, code[ssss], code_len[ssss]);
+
+            if(ssss)
+            {
+                lj92_put_bits(w, diff < 0 ? diff - 1 : diff, ssss);
+            }
+        }
+    }
+
+    /* pad the last byte with 1-bits */
+    if(w->bits)
+    {
+        lj92_put_bits(w, 0xFF, 8 - w->bits);
+    }
+
+    ret = lj92_reserve(w, 2);
+    if(ret)
+    {
+        return ret;
+    }
+    lj92_put_word(w, 0xFF00 | M_EOI);
+
+    return LJ92_ERR_OK;
+}
+
+int lj92_encode(const uint16_t *image, int width, int height, int components, int bitdepth, int predictor, uint8_t **encoded, uint32_t *encoded_size)
+{
+    if(!encoded || !encoded_size)
+    {
+        return LJ92_ERR_PARAM;
+    }
+
+    lj92_writer_t w;
+    w.size = 1024;
+    w.buf = malloc(w.size);
+    w.pos = 0;
+    w.acc = 0;
+    w.bits = 0;
+    w.fixed = 0;
+
+    if(!w.buf)
+    {
+        return LJ92_ERR_MALLOC;
+    }
+
+    int ret = lj92_encode_stream(&w, image, width, height, components, bitdepth, predictor);
+    if(ret)
+    {
+        free(w.buf);
+        return ret;
+    }
+
+    *encoded = w.buf;
+    *encoded_size = w.pos;
+
+    return LJ92_ERR_OK;
+}
+
+int lj92_encode_to(const uint16_t *image, int width, int height, int components, int bitdepth, int predictor, uint8_t *encoded, uint32_t max_size, uint32_t *encoded_size)
+{
+    if(!encoded || !encoded_size)
+    {
+        return LJ92_ERR_PARAM;
+    }
+
+    lj92_writer_t w;
+    w.buf = encoded;
+    w.size = max_size;
+    w.pos = 0;
+    w.acc = 0;
+    w.bits = 0;
+    w.fixed = 1;
+
+    int ret = lj92_encode_stream(&w, image, width, height, components, bitdepth, predictor);
+    if(ret)
+    {
+        return ret;
+    }
+
+    *encoded_size = w.pos;
+
+    return LJ92_ERR_OK;
+}
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _lj92_h_
+#define _lj92_h_
+
+#include <stdint.h>
+
+/*
+ * Lossless JPEG (ITU T.81 process 14, "LJ92") as used by CR2 and compressed DNG.
+ *
+ * Images are handled as rows of width * components interleaved samples.
+ * Raw Bayer frames are usually coded with two components of half the width,
+ * so every sample gets predicted from the previous pixel of the same color.
+ */
+
+#define LJ92_ERR_OK          0
+#define LJ92_ERR_PARAM      -1
+#define LJ92_ERR_MALLOC     -2
+#define LJ92_ERR_CORRUPT    -3
+#define LJ92_ERR_UNSUPPORTED -4
+#define LJ92_ERR_TOO_SMALL  -5
+
+#define LJ92_MAX_COMPONENTS  4
+
+typedef struct
+{
+    int width;          /* columns per component */
+    int height;
+    int components;
+    int bitdepth;
+    int predictor;
+} lj92_info_t;
+
+/* parse the headers only, so the caller can size the output buffer */
+int lj92_read_info(const uint8_t *data, uint32_t size, lj92_info_t *info);
+
+/* decode into 'image' that has room for 'samples' uint16_t values. info may be NULL */
+int lj92_decode(const uint8_t *data, uint32_t size, uint16_t *image, uint32_t samples, lj92_info_t *info);
+
+/* encode one frame. the encoded stream is allocated with malloc and has to be freed by the caller */
+int lj92_encode(const uint16_t *image, int width, int height, int components, int bitdepth, int predictor, uint8_t **encoded, uint32_t *encoded_size);
+
+/* encode into a buffer of max_size bytes owned by the caller, no allocations.
+ * returns LJ92_ERR_TOO_SMALL if the stream might not fit; up to one row of worst case output is kept as margin */
+int lj92_encode_to(const uint16_t *image, int width, int height, int components, int bitdepth, int predictor, uint8_t *encoded, uint32_t max_size, uint32_t *encoded_size);
+
+#endif
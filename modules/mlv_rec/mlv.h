@@ -29,6 +29,8 @@
 
 #define MLV_VIDEO_CLASS_FLAG_LZMA    0x80
 #define MLV_VIDEO_CLASS_FLAG_DELTA   0x40
+#define MLV_VIDEO_CLASS_FLAG_LJ92    0x20
+#define MLV_VIDEO_CLASS_FLAG_STORED  0x10    /* with LJ92: frames that didn't get compressed are stored packed, at full size */
 
 #define MLV_AUDIO_CLASS_FLAG_LZMA    0x80
 
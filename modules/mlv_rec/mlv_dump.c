@@ -29,6 +29,7 @@
 #include <getopt.h>
 #include <inttypes.h>
 #include <time.h>
+#include <sys/time.h>
 
 /* dng related headers */
 #include <chdk-dng.h>
@@ -47,6 +48,7 @@
 #define ERR_FILE            3
 #define ERR_INDEX_REQ       4
 #define ERR_MALLOC          5
+#define ERR_SELFTEST        6
 
 #if defined(USE_LUA)
 #define LUA_LIB
@@ -91,11 +93,35 @@ char *strdup(const char *s);
 #include <LzmaLib.h>
 #endif
 
+#ifdef MLV_USE_THREADS
+#include "mlv_pipeline.h"
+#endif
+
+#include "lj92.h"
+
+/* codecs for -c */
+#define CODEC_LZMA          0
+#define CODEC_LJ92          1
+
+/* LZMA settings for -c, this may need some tuning */
+#define LZMA_DICT           (1<<27)
+#define LZMA_LC             0
+#define LZMA_LP             1
+#define LZMA_PB             1
+#define LZMA_FB             16
+#define LZMA_THREADS        8
+
+/* --benchmark loads at most that many bytes of frames into memory, unless -f selects the frames */
+#define BENCHMARK_MAX_SIZE  (256 * 1024 * 1024)
+
 /* project includes */
 #include "../lv_rec/lv_rec.h"
 #include "../../src/raw.h"
+#include "../../src/raw_pack.h"
 #include "mlv.h"
+#include "mlv_reader.h"
 #include "camera_id.h"
+#include "../dual_iso/cr2hdr-lib.h"
 
 enum bug_id
 {
@@ -505,68 +531,160 @@ void xref_sort(frame_xref_t *table, int entries)
     } while (n > 1);
 }
 
+/* single pixel access to packed frames, see raw_pack.h for the bit order */
 void bitinsert(uint16_t *dst, int position, int depth, uint16_t new_value)
 {
-    uint16_t old_value = 0;
-    int dst_pos = position * depth / 16;
-    int bits_to_left = ((depth * position) - (16 * dst_pos)) % 16;
-    int shift_right = 16 - depth - bits_to_left;
-
-    old_value = dst[dst_pos];
-    if(shift_right >= 0)
-    {
-        /* this case is a bit simpler. the word fits into this uint16_t */
-        uint16_t mask = ((1<<depth)-1) << shift_right;
+    raw_pack_set_pixel(dst, position, depth, new_value);
+}
 
-        /* shift and mask out */
-        new_value <<= shift_right;
-        new_value &= mask;
-        old_value &= ~mask;
+uint16_t bitextract(uint16_t *src, int position, int depth)
+{
+    return raw_pack_get_pixel(src, position, depth);
+}
 
-        /* now combine */
-        new_value |= old_value;
-        dst[dst_pos] = new_value;
+/* --selftest: compare the fast pixel (un)packing code paths against the bit by bit reference, for all depths */
+int pack_selftest()
+{
+    /* a few line lengths that hit the SIMD loops, the group loops and the leftover pixels */
+    const uint32_t counts[] = { 1, 7, 8, 15, 16, 17, 33, 63, 100, 1000, 5796 };
+    const uint32_t max_count = 5796;
+    int errors = 0;
+
+    /* some slack behind the packed lines, to catch writes past the end */
+    uint32_t packed_size = raw_pack_line_size(max_count, 16) + 64;
+    uint16_t *pixels = malloc(max_count * sizeof(uint16_t));
+    uint16_t *unpacked_ref = malloc(max_count * sizeof(uint16_t));
+    uint16_t *unpacked = malloc(max_count * sizeof(uint16_t));
+    uint8_t *packed_ref = malloc(packed_size);
+    uint8_t *packed = malloc(packed_size);
+
+    if(!pixels || !unpacked_ref || !unpacked || !packed_ref || !packed)
+    {
+        print_msg(MSG_ERROR, "Failed to allocate memory for the pixel packing test\n");
+        errors = 1;
+        goto pack_selftest_finish;
     }
-    else
+
+    uint32_t seed = 0x2545F491;
+    for(int depth = 1; depth <= RAW_PACK_MAX_DEPTH; depth++)
     {
-        /* here we need two operations as the bits are split over two words */
-        uint16_t mask1 = ((1<<(depth + shift_right))-1);
-        uint16_t mask2 = ((1<<(-shift_right))-1) << (16+shift_right);
+        int failed = 0;
 
-        /* write the upper bits */
-        old_value &= ~mask1;
-        old_value |= (new_value >> (-shift_right)) & mask1;
-        dst[dst_pos] = old_value;
+        for(int pos = 0; pos < COUNT(counts); pos++)
+        {
+            uint32_t count = counts[pos];
+
+            /* random pixel values with random garbage in the bits above 'depth' */
+            for(uint32_t x = 0; x < count; x++)
+            {
+                seed = seed * 1103515245 + 12345;
+                pixels[x] = seed >> 16;
+            }
+            memset(packed_ref, 0xA5, packed_size);
+            memset(packed, 0xA5, packed_size);
+
+            raw_pack_line_ref(pixels, packed_ref, count, depth);
+            raw_pack_line(pixels, packed, count, depth);
+            failed |= memcmp(packed_ref, packed, packed_size) != 0;
+
+            raw_unpack_line_ref(packed_ref, unpacked_ref, count, depth);
+            raw_unpack_line(packed_ref, unpacked, count, depth);
+            failed |= memcmp(unpacked_ref, unpacked, count * sizeof(uint16_t)) != 0;
+
+            for(uint32_t x = 0; x < count; x++)
+            {
+                failed |= unpacked[x] != (pixels[x] & ((1 << depth) - 1));
+                failed |= bitextract((uint16_t *)packed_ref, x, depth) != unpacked[x];
+            }
+
+            /* in place packing, as done for LJ92 frames */
+            memcpy(packed, pixels, count * sizeof(uint16_t));
+            raw_pack_line((uint16_t *)packed, packed, count, depth);
+            raw_unpack_line(packed, unpacked, count, depth);
+            failed |= memcmp(unpacked_ref, unpacked, count * sizeof(uint16_t)) != 0;
+
+            /* same result as bitinsert, which leaves the bits behind the last pixel untouched */
+            memset(packed, 0xA5, packed_size);
+            for(uint32_t x = 0; x < count; x++)
+            {
+                bitinsert((uint16_t *)packed, x, depth, pixels[x]);
+            }
+            failed |= memcmp(packed_ref, packed, packed_size) != 0;
+        }
 
-        /* write the lower bits */
-        old_value = dst[dst_pos + 1];
-        old_value &= ~mask2;
-        old_value |= (new_value << (16+shift_right)) & mask2;
-        dst[dst_pos + 1] = old_value;
+        print_msg(MSG_INFO, "%2d bpp  pixel packing (%s): %s\n", depth, raw_pack_method(depth), failed ? "FAIL" : "ok");
+        errors += failed;
     }
+
+pack_selftest_finish:
+    free(pixels);
+    free(unpacked_ref);
+    free(unpacked);
+    free(packed_ref);
+    free(packed);
+    return errors;
 }
 
-uint16_t bitextract(uint16_t *src, int position, int depth)
+/* --pack-benchmark: pixels per second of the pixel (un)packing code, for all bit depths of raw video */
+int pack_benchmark()
 {
-    uint16_t value = 0;
-    int src_pos = position * depth / 16;
-    int bits_to_left = ((depth * position) - (16 * src_pos)) % 16;
-    int shift_right = 16 - depth - bits_to_left;
+    /* one 5D3 sensor line, repeated until enough pixels went through */
+    const uint32_t count = 5796;
+    const uint32_t lines = 20000;
 
-    value = src[src_pos];
+    uint16_t *pixels = malloc(count * sizeof(uint16_t));
+    uint8_t *packed = malloc(raw_pack_line_size(count, 16));
 
-    if(shift_right >= 0)
+    if(!pixels || !packed)
     {
-        value >>= shift_right;
+        print_msg(MSG_ERROR, "Failed to allocate memory for the pixel packing benchmark\n");
+        free(pixels);
+        free(packed);
+        return ERR_MALLOC;
     }
-    else
+
+    for(uint32_t x = 0; x < count; x++)
+    {
+        pixels[x] = (x * 2531) & 0xFFFF;
+    }
+
+    print_msg(MSG_INFO, "  bpp   method    unpack         pack           unpack (ref)   pack (ref)\n");
+
+    for(int depth = 10; depth <= RAW_PACK_MAX_DEPTH; depth++)
     {
-        value <<= -shift_right;
-        value |= src[src_pos + 1] >> (16 + shift_right);
+        double rate[4];
+
+        for(int pass = 0; pass < 4; pass++)
+        {
+            struct timeval start;
+            struct timeval end;
+
+            /* the reference code is a lot slower, no need to wait that long */
+            uint32_t pass_lines = (pass < 2) ? lines : lines / 10;
+
+            gettimeofday(&start, NULL);
+            for(uint32_t line = 0; line < pass_lines; line++)
+            {
+                switch(pass)
+                {
+                    case 0: raw_unpack_line(packed, pixels, count, depth); break;
+                    case 1: raw_pack_line(pixels, packed, count, depth); break;
+                    case 2: raw_unpack_line_ref(packed, pixels, count, depth); break;
+                    case 3: raw_pack_line_ref(pixels, packed, count, depth); break;
+                }
+            }
+            gettimeofday(&end, NULL);
+
+            double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_usec - start.tv_usec) / 1000000.0;
+            rate[pass] = (double)count * pass_lines / 1000000.0 / MAX(seconds, 0.000001);
+        }
+
+        print_msg(MSG_INFO, "  %2d    %-6s  %6.0f Mpx/s   %6.0f Mpx/s   %6.0f Mpx/s   %6.0f Mpx/s\n", depth, raw_pack_method(depth), rate[0], rate[1], rate[2], rate[3]);
     }
-    value &= (1<<depth) - 1;
 
-    return value;
+    free(pixels);
+    free(packed);
+    return ERR_OK;
 }
 
 int load_frame(char *filename, uint8_t **frame_buffer, uint32_t *frame_buffer_size)
@@ -619,7 +737,7 @@ int load_frame(char *filename, uint8_t **frame_buffer, uint32_t *frame_buffer_si
             }
             file_set_pos(in_file, position + file_hdr.blockSize, SEEK_SET);
 
-            if(file_hdr.videoClass & MLV_VIDEO_CLASS_FLAG_LZMA)
+            if(file_hdr.videoClass & (MLV_VIDEO_CLASS_FLAG_LZMA | MLV_VIDEO_CLASS_FLAG_LJ92))
             {
                 print_msg(MSG_ERROR, "Compressed formats not supported for frame extraction\n");
                 ret = 5;
@@ -669,301 +787,1248 @@ load_frame_finish:
     return ret;
 }
 
-mlv_xref_hdr_t *load_index(char *base_filename)
+void save_index(char *base_filename, mlv_file_hdr_t *ref_file_hdr, int fileCount, frame_xref_t *index, int entries)
 {
-    mlv_xref_hdr_t *block_hdr = NULL;
     int max_name_len = strlen(base_filename) + 16;
     char *filename = malloc(max_name_len);
-    FILE *in_file = NULL;
+    FILE *out_file = NULL;
 
     strncpy(filename, base_filename, max_name_len);
+
     strcpy(&filename[strlen(filename) - 3], "IDX");
 
-    in_file = fopen(filename, "rb");
+    out_file = fopen(filename, "wb+");
 
-    if(!in_file)
+    if(!out_file)
     {
         free(filename);
-        return NULL;
+        print_msg(MSG_ERROR, "Failed writing into .IDX file\n");
+        return;
     }
 
-    print_msg(MSG_INFO, "File %s opened (XREF)\n", filename);
+    print_msg(MSG_INFO, "File %s opened for writing\n", filename);
+
 
-    do
+    /* first write MLVI header */
+    mlv_file_hdr_t file_hdr = *ref_file_hdr;
+
+    /* update fields */
+    file_hdr.blockSize = sizeof(mlv_file_hdr_t);
+    file_hdr.videoFrameCount = 0;
+    file_hdr.audioFrameCount = 0;
+    file_hdr.fileNum = fileCount + 1;
+
+    if(fwrite(&file_hdr, sizeof(mlv_file_hdr_t), 1, out_file) != 1)
     {
-        mlv_hdr_t buf;
-        uint64_t position = 0;
+        free(filename);
+        print_msg(MSG_ERROR, "Failed writing into .IDX file\n");
+        fclose(out_file);
+        return;
+    }
 
-        position = file_get_pos(in_file);
+    /* now write XREF block */
+    mlv_xref_hdr_t hdr;
 
-        if(fread(&buf, sizeof(mlv_hdr_t), 1, in_file) != 1)
+    memset(&hdr, 0x00, sizeof(mlv_xref_hdr_t));
+    memcpy(hdr.blockType, "XREF", 4);
+    hdr.blockSize = sizeof(mlv_xref_hdr_t) + entries * sizeof(mlv_xref_t);
+    hdr.entryCount = entries;
+
+    if(fwrite(&hdr, sizeof(mlv_xref_hdr_t), 1, out_file) != 1)
+    {
+        free(filename);
+        print_msg(MSG_ERROR, "Failed writing into .IDX file\n");
+        fclose(out_file);
+        return;
+    }
+
+    /* and then the single entries */
+    for(int entry = 0; entry < entries; entry++)
+    {
+        mlv_xref_t field;
+
+        memset(&field, 0x00, sizeof(mlv_xref_t));
+
+        field.frameOffset = index[entry].frameOffset;
+        field.fileNumber = index[entry].fileNumber;
+        field.frameType = index[entry].frameType;
+
+        if(fwrite(&field, sizeof(mlv_xref_t), 1, out_file) != 1)
         {
-            break;
+            free(filename);
+            print_msg(MSG_ERROR, "Failed writing into .IDX file\n");
+            fclose(out_file);
+            return;
         }
+    }
 
-        /* jump back to the beginning of the block just read */
-        file_set_pos(in_file, position, SEEK_SET);
+    free(filename);
+    fclose(out_file);
+}
 
-        position = file_get_pos(in_file);
 
-        /* we should check the MLVI header for matching UID value to make sure its the right index... */
-        if(!memcmp(buf.blockType, "XREF", 4))
-        {
-            block_hdr = malloc(buf.blockSize);
+FILE **load_all_chunks(char *base_filename, int *entries)
+{
+    int seq_number = 0;
+    int max_name_len = strlen(base_filename) + 16;
+    char *filename = malloc(max_name_len);
 
-            if(fread(block_hdr, buf.blockSize, 1, in_file) != 1)
-            {
-                print_msg(MSG_ERROR, "File '%s' ends in the middle of a block\n", filename);
-                free(block_hdr);
-                block_hdr = NULL;
-            }
+    strncpy(filename, base_filename, max_name_len - 1);
+    FILE **files = malloc(sizeof(FILE*));
+
+    files[0] = fopen(filename, "rb");
+    if(!files[0])
+    {
+        free(filename);
+        free(files);
+        return NULL;
+    }
+
+    print_msg(MSG_INFO, "File %s opened\n", filename);
+
+    /* get extension and check if it is a .MLV */
+    char *dot = strrchr(filename, '.');
+    if(dot)
+    {
+        dot++;
+        if(strcasecmp(dot, "mlv"))
+        {
+            seq_number = 100;
         }
-        else
+    }
+    
+    (*entries)++;
+    while(seq_number < 99)
+    {
+        FILE **realloc_files = realloc(files, (*entries + 1) * sizeof(FILE*));
+
+        if(!realloc_files)
         {
-            file_set_pos(in_file, position + buf.blockSize, SEEK_SET);
+            free(filename);
+            free(files);
+            return NULL;
         }
 
-        /* we are at the same position as before, so abort */
-        if(position == file_get_pos(in_file))
+        files = realloc_files;
+
+        /* check for the next file M00, M01 etc */
+        char seq_name[8];
+
+        sprintf(seq_name, "%02d", seq_number);
+        seq_number++;
+
+        strcpy(&filename[strlen(filename) - 2], seq_name);
+
+        /* try to open */
+        files[*entries] = fopen(filename, "rb");
+        if(files[*entries])
+        {
+            print_msg(MSG_INFO, "File %s opened\n", filename);
+            (*entries)++;
+        }
+        else
         {
-            print_msg(MSG_ERROR, "File '%s' has invalid blocks\n", filename);
+            print_msg(MSG_INFO, "File %s not existing.\n", filename);
             break;
         }
     }
-    while(!feof(in_file));
-
-    fclose(in_file);
 
     free(filename);
-    return block_hdr;
+    return files;
+}
+
+
+#define EV_RESOLUTION 32768
+
+#define CHROMA_SMOOTH_2X2
+#include "../dual_iso/chroma_smooth.c"
+#undef CHROMA_SMOOTH_2X2
+
+#define CHROMA_SMOOTH_3X3
+#include "../dual_iso/chroma_smooth.c"
+#undef CHROMA_SMOOTH_3X3
+
+#define CHROMA_SMOOTH_5X5
+#include "../dual_iso/chroma_smooth.c"
+#undef CHROMA_SMOOTH_5X5
+
+
+/* lookup tables between raw values and EV for the given black level, returns 0 if out of memory */
+static int chroma_smooth_tables(int black, int **raw2ev, int **ev2raw)
+{
+    *raw2ev = malloc(16384 * sizeof(int));
+    *ev2raw = malloc(24*EV_RESOLUTION * sizeof(int));
+
+    if(!*raw2ev || !*ev2raw)
+    {
+        return 0;
+    }
+
+    for(int i = 0; i < 16384; i++)
+    {
+        (*raw2ev)[i] = log2(MAX(1, i - black)) * EV_RESOLUTION;
+    }
+
+    for(int i = -10*EV_RESOLUTION; i < 14*EV_RESOLUTION; i++)
+    {
+        (*ev2raw)[i + 10*EV_RESOLUTION] = black + pow(2, (float)i / EV_RESOLUTION);
+    }
+
+    return 1;
+}
+
+/* works on the unpacked frame from raw_unpack_plane() */
+void chroma_smooth(int method, struct raw_info *info, uint16_t *plane)
+{
+    if(!method)
+    {
+        return;
+    }
+
+    /* not static, this may run on several frames in parallel */
+    int *raw2ev = NULL;
+    int *_ev2raw = NULL;
+    uint32_t *aux = NULL;
+    uint32_t *aux2 = NULL;
+
+    int w = info->width;
+    int h = info->height;
+
+    if(chroma_smooth_tables(info->black_level, &raw2ev, &_ev2raw))
+    {
+        aux = malloc(w * h * sizeof(uint32_t));
+        aux2 = malloc(w * h * sizeof(uint32_t));
+    }
+
+    if(!aux || !aux2)
+    {
+        print_msg(MSG_ERROR, "VIDF: Failed to allocate chroma smoothing buffers, frame left unfiltered\n");
+        goto end;
+    }
+
+    int* ev2raw = _ev2raw + 10*EV_RESOLUTION;
+
+    for(int i = 0; i < w * h; i++)
+    {
+        aux[i] = aux2[i] = plane[i];
+    }
+
+    switch(method)
+    {
+        case 2:
+            chroma_smooth_2x2(aux, aux2, raw2ev, ev2raw, 0, h);
+            break;
+        case 3:
+            chroma_smooth_3x3(aux, aux2, raw2ev, ev2raw, 0, h);
+            break;
+        case 5:
+            chroma_smooth_5x5(aux, aux2, raw2ev, ev2raw, 0, h);
+            break;
+    }
+
+    /* keep 14 bits, as raw_set_pixel would */
+    for(int i = 0; i < w * h; i++)
+    {
+        plane[i] = aux2[i] & 0x3FFF;
+    }
+
+end:
+    free(aux);
+    free(aux2);
+    free(raw2ev);
+    free(_ev2raw);
+}
+
+/* compare the SIMD chroma smoothing with the scalar reference on a random frame, returns the number of mismatches */
+int chroma_smooth_selftest()
+{
+#if OPTMED_SIMD_LANES
+    struct raw_info saved_raw_info = raw_info;
+    int w = 517;
+    int h = 64;
+    int errors = 0;
+
+    memset(&raw_info, 0, sizeof(raw_info));
+    raw_info.width = w;
+    raw_info.height = h;
+    raw_info.black_level = 2048;
+    raw_info.white_level = 15000;
+
+    int *raw2ev = NULL;
+    int *_ev2raw = NULL;
+    chroma_smooth_tables(raw_info.black_level, &raw2ev, &_ev2raw);
+    int* ev2raw = _ev2raw + 10*EV_RESOLUTION;
+
+    /* with an odd width, the last cells read one pixel past the frame */
+    uint32_t *inp = calloc(w * h + 1, sizeof(uint32_t));
+    uint32_t *out_ref = malloc(w * h * sizeof(uint32_t));
+    uint32_t *out_simd = malloc(w * h * sizeof(uint32_t));
+
+    /* smooth gradient with noise, some dark areas and some clipped pixels */
+    uint32_t seed = 0x2545F491;
+    for(int y = 0; y < h; y++)
+    {
+        for(int x = 0; x < w; x++)
+        {
+            seed = seed * 1103515245 + 12345;
+            int noise = (seed >> 16) % 512;
+            inp[x + y*w] = COERCE(raw_info.black_level - 256 + x * 24 + noise, 0, 16383);
+        }
+    }
+
+    for(int method = 2; method <= 5; method++)
+    {
+        memcpy(out_ref, inp, w * h * sizeof(uint32_t));
+        memcpy(out_simd, inp, w * h * sizeof(uint32_t));
+
+        switch(method)
+        {
+            case 2:
+                chroma_smooth_2x2_ref(inp, out_ref, raw2ev, ev2raw, 0, h);
+                chroma_smooth_2x2_simd(inp, out_simd, raw2ev, ev2raw, 0, h);
+                break;
+            case 3:
+                chroma_smooth_3x3_ref(inp, out_ref, raw2ev, ev2raw, 0, h);
+                chroma_smooth_3x3_simd(inp, out_simd, raw2ev, ev2raw, 0, h);
+                break;
+            case 5:
+                chroma_smooth_5x5_ref(inp, out_ref, raw2ev, ev2raw, 0, h);
+                chroma_smooth_5x5_simd(inp, out_simd, raw2ev, ev2raw, 0, h);
+                break;
+            default:
+                continue;
+        }
+
+        int failed = memcmp(out_ref, out_simd, w * h * sizeof(uint32_t)) != 0;
+        print_msg(MSG_INFO, "%4dx%-4d  chroma smoothing %dx%d (%d lanes): %s\n", w, h, method, method, OPTMED_SIMD_LANES, failed ? "FAIL" : "ok");
+        errors += failed;
+    }
+
+    free(inp);
+    free(out_ref);
+    free(out_simd);
+    free(raw2ev);
+    free(_ev2raw);
+    raw_info = saved_raw_info;
+    return errors;
+#else
+    print_msg(MSG_INFO, "Chroma smoothing built without SIMD support, nothing to compare.\n");
+    return 0;
+#endif
+}
+
+/* raw2dng code */
+void raw_unpack_plane(uint16_t * plane);
+void raw_pack_plane(uint16_t * plane);
+void fix_vertical_stripes(uint16_t * plane);
+void find_and_fix_cold_pixels(uint16_t * plane, int force_analysis);
+int raw2dng_selftest();
+
+/* settings shared by all frame jobs */
+typedef struct
+{
+    int fix_vert_stripes;
+    int fix_cold_pixels;
+    int chroma_smooth_method;
+    FILE *raw_file;
+
+    /* --dual-iso: calibration for the frames flagged by DISO, NULL if disabled */
+    struct cr2hdr_clip *dual_iso_clip;
+} frame_job_opts_t;
+
+/* one frame for DNG or legacy raw output, with a snapshot of all metadata it needs */
+typedef struct
+{
+    uint32_t frame_number;
+    uint8_t *frame_buffer;
+    uint32_t frame_size;
+    uint32_t own_buffer;
+
+    /* frame_buffer holds a lossless JPEG stream that goes into the DNG as it is */
+    uint32_t lj92_passthrough;
+
+    /* interlaced ISO frame (DISO block), merged by cr2hdr into a 16 bit frame with its own white balance */
+    uint32_t dual_iso;
+    uint32_t has_wbgain;
+    int wbgain[6];
+
+    /* DNG output only, NULL for legacy raw output */
+    char *dng_filename;
+    struct raw_info raw_info;
+    uint64_t timestamp;
+    uint32_t fps_nom;
+    uint32_t fps_denom;
+    mlv_lens_hdr_t lens_info;
+    mlv_expo_hdr_t expo_info;
+    mlv_rtci_hdr_t rtci_info;
+    char camname[64];
+    char serial[64];
+    char info_string[256];
+} frame_job_t;
+
+void frame_job_free(frame_job_t *job)
+{
+    if(job->own_buffer)
+    {
+        free(job->frame_buffer);
+    }
+    free(job->dng_filename);
+    free(job);
+}
+
+/* merge the two exposures of a Dual ISO frame with cr2hdr. on success, the unpacked plane becomes the (16 bit) frame buffer */
+static int frame_job_dual_iso(frame_job_opts_t *opts, frame_job_t *job, uint16_t *plane)
+{
+    struct raw_info info = raw_info;
+    info.buffer = plane;
+
+    /* show how the clip was calibrated, then stay quiet unless a frame fails */
+    int verbose = !cr2hdr_clip_calibrated(opts->dual_iso_clip);
+    if(verbose)
+    {
+        print_msg(MSG_INFO, "VIDF: Dual ISO calibration on frame %d\n", job->frame_number);
+    }
+
+    if(!cr2hdr_process_frame(opts->dual_iso_clip, &info, job->camname, job->wbgain, verbose))
+    {
+        print_msg(MSG_ERROR, "VIDF: [W] Dual ISO conversion failed for frame %d, saving it unprocessed\n", job->frame_number);
+        return 0;
+    }
+
+    if(job->own_buffer)
+    {
+        free(job->frame_buffer);
+    }
+    job->frame_buffer = (uint8_t *)plane;
+    job->own_buffer = 1;
+    job->frame_size = info.frame_size;
+    job->raw_info = info;
+    job->has_wbgain = 1;
+    return 1;
+}
+
+/* pixel post-processing, this is the part that may run on several frames in parallel */
+void frame_job_process(void *ctx, void *arg)
+{
+    frame_job_opts_t *opts = ctx;
+    frame_job_t *job = arg;
+
+    if(job->lj92_passthrough)
+    {
+        return;
+    }
+
+    int dual_iso = job->dual_iso && opts->dual_iso_clip;
+
+    if(!dual_iso && !opts->fix_vert_stripes && !opts->fix_cold_pixels && !opts->chroma_smooth_method)
+    {
+        return;
+    }
+
+    /* raw2dng filters operate on the global (thread local) raw_info */
+    raw_info = job->raw_info;
+    raw_info.buffer = job->frame_buffer;
+
+    /* unpack once, all filters work on one uint16_t per pixel. cr2hdr wants a spare line for GBRG frames */
+    int plane_size = raw_info.width * (raw_info.height + 1) * sizeof(uint16_t);
+    uint16_t *plane = malloc(plane_size);
+    if(!plane)
+    {
+        print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", plane_size);
+        return;
+    }
+    raw_unpack_plane(plane);
+
+    if(dual_iso)
+    {
+        /* cr2hdr has its own bad pixel, stripe and chroma filters, tuned for interlaced frames. on success, the job owns the plane */
+        if(frame_job_dual_iso(opts, job, plane))
+        {
+            return;
+        }
+
+        /* cr2hdr has worked on the plane, start over from the original frame */
+        raw_unpack_plane(plane);
+    }
+
+    if(opts->fix_vert_stripes)
+    {
+        fix_vertical_stripes(plane);
+    }
+
+    if(opts->fix_cold_pixels)
+    {
+        find_and_fix_cold_pixels(plane, opts->fix_cold_pixels == 2);
+    }
+
+    /* this is internal again */
+    chroma_smooth(opts->chroma_smooth_method, &raw_info, plane);
+
+    raw_pack_plane(plane);
+    free(plane);
+}
+
+/* write the frame into its output. chdk-dng keeps the tags in globals, so this must only run on one thread */
+int frame_job_write(void *ctx, void *arg)
+{
+    frame_job_opts_t *opts = ctx;
+    frame_job_t *job = arg;
+
+    if(!job->dng_filename)
+    {
+        file_set_pos(opts->raw_file, (uint64_t)job->frame_number * (uint64_t)job->frame_size, SEEK_SET);
+        if(fwrite(job->frame_buffer, job->frame_size, 1, opts->raw_file) != 1)
+        {
+            print_msg(MSG_ERROR, "VIDF: Failed writing into .RAW file\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    raw_info = job->raw_info;
+    raw_info.buffer = job->frame_buffer;
+
+    /* set MLV metadata into DNG tags */
+    dng_set_framerate_rational(job->fps_nom, job->fps_denom);
+    dng_set_shutter(1, (int)(1000000.0f/(float)job->expo_info.shutterValue));
+    dng_set_aperture(job->lens_info.aperture, 100);
+    dng_set_camname(job->camname);
+    dng_set_description(job->info_string);
+    dng_set_lensmodel((char*)job->lens_info.lensName);
+    dng_set_focal(job->lens_info.focalLength, 1);
+    dng_set_iso(job->expo_info.isoValue);
+
+    //dng_set_wbgain(1024, wbal_info.wbgain_r, 1024, wbal_info.wbgain_g, 1024, wbal_info.wbgain_b);
+    if(job->has_wbgain)
+    {
+        dng_set_wbgain(job->wbgain[0], job->wbgain[1], job->wbgain[2], job->wbgain[3], job->wbgain[4], job->wbgain[5]);
+    }
+
+    /* calculate the time this frame was taken at, i.e., the start time + the current timestamp. this can be off by a second but it's better than nothing */
+    int ms = 0.5 + job->timestamp / 1000.0;
+    int sec = ms / 1000;
+    ms %= 1000;
+    // FIXME: the struct tm doesn't have tm_gmtoff on Linux so the result might be wrong?
+    struct tm tm;
+    tm.tm_sec = job->rtci_info.tm_sec + sec;
+    tm.tm_min = job->rtci_info.tm_min;
+    tm.tm_hour = job->rtci_info.tm_hour;
+    tm.tm_mday = job->rtci_info.tm_mday;
+    tm.tm_mon = job->rtci_info.tm_mon;
+    tm.tm_year = job->rtci_info.tm_year;
+    tm.tm_wday = job->rtci_info.tm_wday;
+    tm.tm_yday = job->rtci_info.tm_yday;
+    tm.tm_isdst = job->rtci_info.tm_isdst;
+
+    if(mktime(&tm) != -1)
+    {
+        char datetime_str[32];
+        char subsec_str[8];
+        strftime(datetime_str, 20, "%Y:%m:%d %H:%M:%S", &tm);
+        snprintf(subsec_str, sizeof(subsec_str), "%03d", ms);
+        dng_set_datetime(datetime_str, subsec_str);
+    }
+    else
+    {
+        // soemthing went wrong. let's proceed anyway
+        print_msg(MSG_ERROR, "VIDF: [W] Failed calculating the DateTime from the timestamp\n");
+        dng_set_datetime("", "");
+    }
+
+    uint64_t serial = 0;
+    char *end;
+    serial = strtoull(job->serial, &end, 16);
+    if (serial && !*end)
+    {
+        char serial_str[64];
+
+        sprintf(serial_str, "%"PRIu64, serial);
+        dng_set_camserial((char*)serial_str);
+    }
+
+    /* finally save the DNG */
+    dng_set_compression(job->lj92_passthrough ? DNG_COMPRESSION_LJ92 : DNG_COMPRESSION_NONE);
+    int ret = save_dng(job->dng_filename, &raw_info);
+    dng_set_compression(DNG_COMPRESSION_NONE);
+
+    if(!ret)
+    {
+        print_msg(MSG_ERROR, "VIDF: Failed writing into .DNG file\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+#ifdef MLV_USE_THREADS
+int frame_job_write_pipeline(void *ctx, void *arg)
+{
+    int ret = frame_job_write(ctx, arg);
+    frame_job_free(arg);
+    return ret;
+}
+#endif
+
+/* frame format for compression and decompression */
+typedef struct
+{
+    int codec;
+    int lzma_level;
+    int width;
+    int height;
+    int depth;
+    /* LJ92 only: the clip is flagged MLV_VIDEO_CLASS_FLAG_STORED, full size frames are packed, not compressed */
+    int stored;
+} frame_codec_t;
+
+const char *frame_codec_name(frame_codec_t *codec)
+{
+    return (codec->codec == CODEC_LJ92) ? "LJ92" : "LZMA";
+}
+
+/* compress one packed raw frame. the result is allocated with malloc and has the layout of a compressed VIDF payload */
+int frame_compress(frame_codec_t *codec, uint8_t *in, uint32_t in_size, uint8_t **out, uint32_t *out_size)
+{
+    *out = NULL;
+    *out_size = 0;
+
+    if(codec->codec == CODEC_LJ92)
+    {
+        uint32_t pixels = codec->width * codec->height;
+        uint16_t *lj92_in = malloc(pixels * sizeof(uint16_t));
+
+        if(!lj92_in)
+        {
+            return LJ92_ERR_MALLOC;
+        }
+        raw_unpack_line(in, lj92_in, pixels, codec->depth);
+
+        /* code a bayer row as two components, so every pixel is predicted from its left neighbor of the same color */
+        int components = (codec->width % 2) ? 1 : 2;
+        int ret = lj92_encode(lj92_in, codec->width / components, codec->height, components, codec->depth, 1, out, out_size);
+        free(lj92_in);
+
+        return ret;
+    }
+
+#ifdef MLV_USE_LZMA
+    /* original frame size, LZMA properties, LZMA stream */
+    size_t lzma_out_size = 2 * in_size;
+    size_t lzma_props_size = LZMA_PROPS_SIZE;
+    uint8_t *lzma_out = malloc(4 + LZMA_PROPS_SIZE + lzma_out_size);
+
+    if(!lzma_out)
+    {
+        return SZ_ERROR_MEM;
+    }
+
+    /* every frame is a stream of its own, so a dictionary larger than the frame only costs memory */
+    uint32_t lzma_dict = MAX((uint32_t)1 << 12, MIN((uint32_t)LZMA_DICT, in_size));
+
+    int ret = LzmaCompress(
+        &lzma_out[4 + LZMA_PROPS_SIZE], &lzma_out_size,
+        in, in_size,
+        &lzma_out[4], &lzma_props_size,
+        codec->lzma_level, lzma_dict, LZMA_LC, LZMA_LP, LZMA_PB, LZMA_FB, LZMA_THREADS
+        );
+
+    if(ret != SZ_OK)
+    {
+        free(lzma_out);
+        return ret;
+    }
+
+    *(uint32_t *)lzma_out = in_size;
+    *out = lzma_out;
+    *out_size = 4 + LZMA_PROPS_SIZE + lzma_out_size;
+
+    return SZ_OK;
+#else
+    return -1;
+#endif
+}
+
+/* decompress one VIDF payload back into a packed raw frame, allocated with malloc */
+int frame_decompress(frame_codec_t *codec, uint8_t *in, uint32_t in_size, uint8_t **out, uint32_t *out_size)
+{
+    *out = NULL;
+    *out_size = 0;
+
+    if(codec->codec == CODEC_LJ92)
+    {
+        uint32_t pixels = codec->width * codec->height;
+        uint16_t *lj92_out = malloc(pixels * sizeof(uint16_t));
+        lj92_info_t lj92_info;
+
+        if(!lj92_out)
+        {
+            return LJ92_ERR_MALLOC;
+        }
+
+        /* mlv_lite stores the frames it couldn't compress as they are, those are never smaller than the packed frame */
+        if(codec->stored && in_size >= pixels * codec->depth / 8)
+        {
+            memcpy(lj92_out, in, pixels * codec->depth / 8);
+            *out = (uint8_t *)lj92_out;
+            *out_size = pixels * codec->depth / 8;
+
+            return LJ92_ERR_OK;
+        }
+
+        int ret = lj92_decode(in, in_size, lj92_out, pixels, &lj92_info);
+
+        if(ret == LJ92_ERR_OK && (uint32_t)(lj92_info.width * lj92_info.components * lj92_info.height) != pixels)
+        {
+            ret = LJ92_ERR_CORRUPT;
+        }
+
+        if(ret != LJ92_ERR_OK)
+        {
+            free(lj92_out);
+            return ret;
+        }
+
+        /* packing never overtakes the unpacked samples, so it can be done in place */
+        raw_pack_line(lj92_out, lj92_out, pixels, codec->depth);
+        *out = (uint8_t *)lj92_out;
+        *out_size = pixels * codec->depth / 8;
+
+        return LJ92_ERR_OK;
+    }
+
+#ifdef MLV_USE_LZMA
+    if(in_size < 4 + LZMA_PROPS_SIZE)
+    {
+        return SZ_ERROR_DATA;
+    }
+
+    size_t lzma_out_size = *(uint32_t *)in;
+    size_t lzma_in_size = in_size - LZMA_PROPS_SIZE - 4;
+    uint8_t *lzma_out = malloc(lzma_out_size);
+
+    if(!lzma_out)
+    {
+        return SZ_ERROR_MEM;
+    }
+
+    int ret = LzmaUncompress(
+        lzma_out, &lzma_out_size,
+        &in[4 + LZMA_PROPS_SIZE], &lzma_in_size,
+        &in[4], LZMA_PROPS_SIZE
+        );
+
+    if(ret != SZ_OK)
+    {
+        free(lzma_out);
+        return ret;
+    }
+
+    *out = lzma_out;
+    *out_size = lzma_out_size;
+
+    return SZ_OK;
+#else
+    return -1;
+#endif
+}
+
+/* settings shared by all (de)compression jobs of one pipeline */
+typedef struct
+{
+    frame_codec_t codec;
+    int verbose;
+    FILE *out_file;
+
+    /* decoding ahead, only used by the main thread */
+    mlv_reader_t *reader;
+    mlv_xref_hdr_t *block_xref;
+    uint32_t next_entry;
+    uint32_t queued;
+    uint32_t depth;
+    int skip_frames;
+    uint32_t frame_start;
+    uint32_t frame_end;
+    struct codec_job *pending;
+} codec_job_opts_t;
+
+/* one VIDF payload that gets compressed or decompressed on a worker thread */
+typedef struct codec_job
+{
+    uint32_t entry;
+    mlv_vidf_hdr_t block_hdr;
+    uint8_t *in;
+    uint32_t in_size;
+    uint8_t *out;
+    uint32_t out_size;
+    uint32_t prev_size;
+    int ret;
+} codec_job_t;
+
+void codec_job_free(codec_job_t *job)
+{
+    free(job->in);
+    free(job->out);
+    free(job);
+}
+
+void codec_job_compress(void *ctx, void *arg)
+{
+    codec_job_opts_t *opts = ctx;
+    codec_job_t *job = arg;
+
+    job->ret = frame_compress(&opts->codec, job->in, job->in_size, &job->out, &job->out_size);
+}
+
+void codec_job_decompress(void *ctx, void *arg)
+{
+    codec_job_opts_t *opts = ctx;
+    codec_job_t *job = arg;
+
+    job->ret = frame_decompress(&opts->codec, job->in, job->in_size, &job->out, &job->out_size);
+}
+
+#ifdef MLV_USE_THREADS
+/* write a compressed frame into the .MLV, jobs arrive here in the order they were read */
+int codec_job_write(void *ctx, void *arg)
+{
+    codec_job_opts_t *opts = ctx;
+    codec_job_t *job = arg;
+    int ret = 0;
+
+    if(job->ret)
+    {
+        print_msg(MSG_INFO, "    %s: Failed (%d)\n", frame_codec_name(&opts->codec), job->ret);
+        codec_job_free(job);
+        return 1;
+    }
+
+    if(opts->verbose)
+    {
+        print_msg(MSG_INFO, "    %s: %d -> %d  (%2.2f%%)\n", frame_codec_name(&opts->codec), job->in_size, job->out_size, ((float)job->out_size * 100.0f) / (float)job->in_size);
+    }
+
+    if(job->out_size != job->prev_size)
+    {
+        print_msg(MSG_INFO, "  saving: %d -> %d  (%2.2f%%)\n", job->prev_size, job->out_size, ((float)job->out_size * 100.0f) / (float)job->prev_size);
+    }
+
+    job->block_hdr.blockSize = sizeof(mlv_vidf_hdr_t) + job->out_size;
+
+    if(fwrite(&job->block_hdr, sizeof(mlv_vidf_hdr_t), 1, opts->out_file) != 1 ||
+       fwrite(job->out, job->out_size, 1, opts->out_file) != 1)
+    {
+        print_msg(MSG_ERROR, "VIDF: Failed writing into .MLV file\n");
+        ret = 1;
+    }
+
+    codec_job_free(job);
+    return ret;
+}
+
+/* queue the compressed frames following the given XREF entry, so the workers decode them while the current one gets processed */
+int codec_job_decode_ahead(mlv_pipeline_t *decoder, codec_job_opts_t *opts, uint32_t entry)
+{
+    mlv_xref_t *xrefs = (mlv_xref_t *)&opts->block_xref[1];
+
+    opts->next_entry = MAX(opts->next_entry, entry);
+
+    while(opts->queued < opts->depth && opts->next_entry < opts->block_xref->entryCount)
+    {
+        uint32_t current = opts->next_entry++;
+
+        if(xrefs[current].frameType != MLV_FRAME_VIDF)
+        {
+            continue;
+        }
+
+        mlv_vidf_hdr_t *vidf = (mlv_vidf_hdr_t *)mlv_reader_get_block(opts->reader, current);
+
+        if(!vidf || vidf->frameSpace > vidf->blockSize - sizeof(mlv_vidf_hdr_t))
+        {
+            continue;
+        }
+
+        /* same frames the main loop skips with -f */
+        if(opts->skip_frames && (vidf->frameNumber < opts->frame_start || vidf->frameNumber > opts->frame_end))
+        {
+            continue;
+        }
+
+        codec_job_t *job = calloc(1, sizeof(codec_job_t));
+        if(!job)
+        {
+            return ERR_MALLOC;
+        }
+
+        /* the mapping may move with the next access, so the job gets its own copy */
+        job->entry = current;
+        job->in_size = vidf->blockSize - sizeof(mlv_vidf_hdr_t) - vidf->frameSpace;
+        job->in = malloc(job->in_size);
+        if(!job->in)
+        {
+            codec_job_free(job);
+            return ERR_MALLOC;
+        }
+        memcpy(job->in, (uint8_t *)&vidf[1] + vidf->frameSpace, job->in_size);
+
+        if(mlv_pipeline_submit(decoder, job, MLV_PIPELINE_PROCESS))
+        {
+            codec_job_free(job);
+            return ERR_MALLOC;
+        }
+        opts->queued++;
+    }
+
+    return ERR_OK;
+}
+
+/* decoded frame of the given XREF entry, NULL if it was not decoded ahead */
+codec_job_t *codec_job_fetch(mlv_pipeline_t *decoder, codec_job_opts_t *opts, uint32_t entry)
+{
+    if(codec_job_decode_ahead(decoder, opts, entry))
+    {
+        return NULL;
+    }
+
+    while(1)
+    {
+        if(!opts->pending)
+        {
+            if(!opts->queued)
+            {
+                return NULL;
+            }
+            opts->pending = mlv_pipeline_fetch(decoder);
+            opts->queued--;
+        }
+
+        /* keep frames that come later, drop the ones the main loop didn't ask for */
+        if(opts->pending->entry > entry)
+        {
+            return NULL;
+        }
+
+        codec_job_t *job = opts->pending;
+        opts->pending = NULL;
+
+        if(job->entry == entry)
+        {
+            return job;
+        }
+        codec_job_free(job);
+    }
+}
+
+/* fetch and drop all frames still being decoded, then stop the pipeline */
+void codec_job_decoder_finish(mlv_pipeline_t *decoder, codec_job_opts_t *opts)
+{
+    if(!decoder)
+    {
+        return;
+    }
+
+    if(opts->pending)
+    {
+        codec_job_free(opts->pending);
+        opts->pending = NULL;
+    }
+
+    codec_job_t *job = NULL;
+    while((job = mlv_pipeline_fetch(decoder)))
+    {
+        codec_job_free(job);
+    }
+    opts->queued = 0;
+
+    mlv_pipeline_finish(decoder);
+}
+#endif
+
+/* --benchmark: the jobs belong to the benchmark, so nothing to do when they are done */
+int benchmark_job_done(void *ctx, void *arg)
+{
+    (void)ctx;
+    (void)arg;
+    return 0;
 }
 
-void save_index(char *base_filename, mlv_file_hdr_t *ref_file_hdr, int fileCount, frame_xref_t *index, int entries)
+/* run the given process callback on all jobs, returns the wall clock time in seconds */
+double benchmark_run(codec_job_opts_t *opts, codec_job_t *jobs, uint32_t count, void (*process)(void *, void *), int threads)
 {
-    int max_name_len = strlen(base_filename) + 16;
-    char *filename = malloc(max_name_len);
-    FILE *out_file = NULL;
-
-    strncpy(filename, base_filename, max_name_len);
+    struct timeval start;
+    struct timeval end;
 
-    strcpy(&filename[strlen(filename) - 3], "IDX");
+    gettimeofday(&start, NULL);
 
-    out_file = fopen(filename, "wb+");
+#ifdef MLV_USE_THREADS
+    mlv_pipeline_t *pipeline = (threads > 1) ? mlv_pipeline_create(threads, 2 * threads, process, &benchmark_job_done, opts) : NULL;
 
-    if(!out_file)
+    if(pipeline)
     {
-        free(filename);
-        print_msg(MSG_ERROR, "Failed writing into .IDX file\n");
-        return;
+        for(uint32_t pos = 0; pos < count; pos++)
+        {
+            mlv_pipeline_submit(pipeline, &jobs[pos], MLV_PIPELINE_PROCESS);
+        }
+        mlv_pipeline_finish(pipeline);
+    }
+    else
+#endif
+    {
+        for(uint32_t pos = 0; pos < count; pos++)
+        {
+            process(opts, &jobs[pos]);
+        }
     }
 
-    print_msg(MSG_INFO, "File %s opened for writing\n", filename);
+    gettimeofday(&end, NULL);
 
+    return (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_usec - start.tv_usec) / 1000000.0;
+}
 
-    /* first write MLVI header */
-    mlv_file_hdr_t file_hdr = *ref_file_hdr;
+/* compress the frames of a clip with all LZMA levels and LJ92, report speed and compression ratio */
+int benchmark(char *input_filename, int threads, int extract_frames, uint32_t frame_start, uint32_t frame_end)
+{
+    int ret = ERR_OK;
+    mlv_reader_t *reader = mlv_reader_open(input_filename);
+    codec_job_t *frames = NULL;
+    uint32_t frame_count = 0;
+    uint64_t total_size = 0;
+    codec_job_opts_t opts;
 
-    /* update fields */
-    file_hdr.blockSize = sizeof(mlv_file_hdr_t);
-    file_hdr.videoFrameCount = 0;
-    file_hdr.audioFrameCount = 0;
-    file_hdr.fileNum = fileCount + 1;
+    memset(&opts, 0x00, sizeof(opts));
 
-    if(fwrite(&file_hdr, sizeof(mlv_file_hdr_t), 1, out_file) != 1)
+    if(!reader)
     {
-        free(filename);
-        print_msg(MSG_ERROR, "Failed writing into .IDX file\n");
-        fclose(out_file);
-        return;
+        print_msg(MSG_ERROR, "Failed to open file '%s'\n", input_filename);
+        return ERR_FILE;
     }
 
-    /* now write XREF block */
-    mlv_xref_hdr_t hdr;
+    if(mlv_reader_load_index(reader) && mlv_reader_build_index(reader))
+    {
+        print_msg(MSG_ERROR, "Failed to build XREF table\n");
+        ret = ERR_INDEX_REQ;
+        goto benchmark_finish;
+    }
 
-    memset(&hdr, 0x00, sizeof(mlv_xref_hdr_t));
-    memcpy(hdr.blockType, "XREF", 4);
-    hdr.blockSize = sizeof(mlv_xref_hdr_t) + entries * sizeof(mlv_xref_t);
-    hdr.entryCount = entries;
+    mlv_xref_hdr_t *block_xref = mlv_reader_get_xref(reader);
+    mlv_file_hdr_t *file_hdr = mlv_reader_map(reader, 0, 0, sizeof(mlv_file_hdr_t));
+    uint16_t video_class = file_hdr ? file_hdr->videoClass : 0;
 
-    if(fwrite(&hdr, sizeof(mlv_xref_hdr_t), 1, out_file) != 1)
+    if(video_class & MLV_VIDEO_CLASS_FLAG_DELTA)
     {
-        free(filename);
-        print_msg(MSG_ERROR, "Failed writing into .IDX file\n");
-        fclose(out_file);
-        return;
+        print_msg(MSG_ERROR, "Delta encoded files are not supported\n");
+        ret = ERR_PARAM;
+        goto benchmark_finish;
     }
 
-    /* and then the single entries */
-    for(int entry = 0; entry < entries; entry++)
+    /* frame format from the RAWI block */
+    for(uint32_t entry = 0; entry < block_xref->entryCount; entry++)
     {
-        mlv_xref_t field;
-
-        memset(&field, 0x00, sizeof(mlv_xref_t));
+        mlv_rawi_hdr_t *rawi = (mlv_rawi_hdr_t *)mlv_reader_get_block(reader, entry);
 
-        field.frameOffset = index[entry].frameOffset;
-        field.fileNumber = index[entry].fileNumber;
-        field.frameType = index[entry].frameType;
-
-        if(fwrite(&field, sizeof(mlv_xref_t), 1, out_file) != 1)
+        if(rawi && !memcmp(rawi->blockType, "RAWI", 4))
         {
-            free(filename);
-            print_msg(MSG_ERROR, "Failed writing into .IDX file\n");
-            fclose(out_file);
-            return;
+            opts.codec.width = rawi->xRes;
+            opts.codec.height = rawi->yRes;
+            opts.codec.depth = rawi->raw_info.bits_per_pixel;
+            break;
         }
     }
 
-    free(filename);
-    fclose(out_file);
-}
-
-
-FILE **load_all_chunks(char *base_filename, int *entries)
-{
-    int seq_number = 0;
-    int max_name_len = strlen(base_filename) + 16;
-    char *filename = malloc(max_name_len);
-
-    strncpy(filename, base_filename, max_name_len - 1);
-    FILE **files = malloc(sizeof(FILE*));
+    if(!opts.codec.width || !opts.codec.height || !opts.codec.depth)
+    {
+        print_msg(MSG_ERROR, "No RAWI block found\n");
+        ret = ERR_FILE;
+        goto benchmark_finish;
+    }
 
-    files[0] = fopen(filename, "rb");
-    if(!files[0])
+    frames = calloc(block_xref->entryCount, sizeof(codec_job_t));
+    if(!frames)
     {
-        free(filename);
-        free(files);
-        return NULL;
+        ret = ERR_MALLOC;
+        goto benchmark_finish;
     }
 
-    print_msg(MSG_INFO, "File %s opened\n", filename);
+    /* load the frames into memory, decompressed if needed */
+    opts.codec.codec = (video_class & MLV_VIDEO_CLASS_FLAG_LJ92) ? CODEC_LJ92 : CODEC_LZMA;
+    opts.codec.stored = (video_class & MLV_VIDEO_CLASS_FLAG_LJ92) && (video_class & MLV_VIDEO_CLASS_FLAG_STORED);
+    mlv_xref_t *xrefs = (mlv_xref_t *)&block_xref[1];
 
-    /* get extension and check if it is a .MLV */
-    char *dot = strrchr(filename, '.');
-    if(dot)
+    for(uint32_t entry = 0; entry < block_xref->entryCount; entry++)
     {
-        dot++;
-        if(strcasecmp(dot, "mlv"))
+        if(xrefs[entry].frameType != MLV_FRAME_VIDF)
         {
-            seq_number = 100;
+            continue;
         }
-    }
-    
-    (*entries)++;
-    while(seq_number < 99)
-    {
-        FILE **realloc_files = realloc(files, (*entries + 1) * sizeof(FILE*));
 
-        if(!realloc_files)
+        mlv_vidf_hdr_t *vidf = (mlv_vidf_hdr_t *)mlv_reader_get_block(reader, entry);
+
+        if(!vidf || vidf->frameSpace > vidf->blockSize - sizeof(mlv_vidf_hdr_t))
         {
-            free(filename);
-            free(files);
-            return NULL;
+            continue;
         }
 
-        files = realloc_files;
-
-        /* check for the next file M00, M01 etc */
-        char seq_name[8];
-
-        sprintf(seq_name, "%02d", seq_number);
-        seq_number++;
+        if(extract_frames ? (vidf->frameNumber < frame_start || vidf->frameNumber > frame_end) : (total_size >= BENCHMARK_MAX_SIZE))
+        {
+            continue;
+        }
 
-        strcpy(&filename[strlen(filename) - 2], seq_name);
+        codec_job_t *frame = &frames[frame_count];
+        uint8_t *data = (uint8_t *)&vidf[1] + vidf->frameSpace;
+        uint32_t size = vidf->blockSize - sizeof(mlv_vidf_hdr_t) - vidf->frameSpace;
 
-        /* try to open */
-        files[*entries] = fopen(filename, "rb");
-        if(files[*entries])
+        if(video_class & (MLV_VIDEO_CLASS_FLAG_LZMA | MLV_VIDEO_CLASS_FLAG_LJ92))
         {
-            print_msg(MSG_INFO, "File %s opened\n", filename);
-            (*entries)++;
+            int err = frame_decompress(&opts.codec, data, size, &frame->in, &frame->in_size);
+            if(err)
+            {
+                print_msg(MSG_ERROR, "Frame %d: %s: Failed (%d)\n", vidf->frameNumber, frame_codec_name(&opts.codec), err);
+                ret = ERR_FILE;
+                goto benchmark_finish;
+            }
         }
         else
         {
-            print_msg(MSG_INFO, "File %s not existing.\n", filename);
-            break;
+            frame->in = malloc(size);
+            frame->in_size = size;
+            if(!frame->in)
+            {
+                ret = ERR_MALLOC;
+                goto benchmark_finish;
+            }
+            memcpy(frame->in, data, size);
         }
+
+        total_size += frame->in_size;
+        frame_count++;
     }
 
-    free(filename);
-    return files;
-}
+    if(!frame_count)
+    {
+        print_msg(MSG_ERROR, "No frames to benchmark\n");
+        ret = ERR_PARAM;
+        goto benchmark_finish;
+    }
 
+    print_msg(MSG_INFO, "Benchmark: %d frames, %dx%d, %d bpp, %" PRIu64 " MiB, %d thread(s)\n", frame_count, opts.codec.width, opts.codec.height, opts.codec.depth, total_size >> 20, MAX(1, threads));
+    print_msg(MSG_INFO, "\n");
+    print_msg(MSG_INFO, " codec  level   ratio     compress   decompress\n");
 
-#define EV_RESOLUTION 32768
+    /* LZMA levels 0-9, then LJ92 */
+    for(int level = 0; level <= 10; level++)
+    {
+        char level_str[8] = "-";
+        if(level < 10)
+        {
+            snprintf(level_str, sizeof(level_str), "%d", level);
+        }
 
-#define CHROMA_SMOOTH_2X2
-#include "../dual_iso/chroma_smooth.c"
-#undef CHROMA_SMOOTH_2X2
+        opts.codec.codec = (level < 10) ? CODEC_LZMA : CODEC_LJ92;
+        opts.codec.lzma_level = level;
 
-#define CHROMA_SMOOTH_3X3
-#include "../dual_iso/chroma_smooth.c"
-#undef CHROMA_SMOOTH_3X3
+        /* frames[].in -> frames[].out */
+        double compress_time = benchmark_run(&opts, frames, frame_count, &codec_job_compress, threads);
 
-#define CHROMA_SMOOTH_5X5
-#include "../dual_iso/chroma_smooth.c"
-#undef CHROMA_SMOOTH_5X5
+        /* decompress out of frames[].out into a separate set of jobs */
+        codec_job_t *decoded = calloc(frame_count, sizeof(codec_job_t));
+        uint64_t compressed_size = 0;
+        int failed = !decoded;
 
+        for(uint32_t pos = 0; pos < frame_count && decoded; pos++)
+        {
+            failed |= frames[pos].ret;
+            compressed_size += frames[pos].out_size;
+            decoded[pos].in = frames[pos].out;
+            decoded[pos].in_size = frames[pos].out_size;
+        }
 
-void chroma_smooth(int method, struct raw_info *info)
-{
-    int black = info->black_level;
-    static int raw2ev[16384];
-    static int _ev2raw[24*EV_RESOLUTION];
-    int* ev2raw = _ev2raw + 10*EV_RESOLUTION;
-    
-    if(!method)
-    {
-        return;
+        double decompress_time = failed ? 0 : benchmark_run(&opts, decoded, frame_count, &codec_job_decompress, threads);
+
+        for(uint32_t pos = 0; pos < frame_count && decoded; pos++)
+        {
+            /* every frame has to come back bit-exact */
+            failed |= decoded[pos].ret || decoded[pos].out_size != frames[pos].in_size || memcmp(decoded[pos].out, frames[pos].in, frames[pos].in_size);
+            free(decoded[pos].out);
+            free(frames[pos].out);
+            frames[pos].out = NULL;
+        }
+        free(decoded);
+
+        if(failed)
+        {
+            print_msg(MSG_INFO, " %s   %5s   FAILED\n", frame_codec_name(&opts.codec), level_str);
+            ret = ERR_FILE;
+            continue;
+        }
+
+        print_msg(MSG_INFO, " %s   %5s  %5.1f%%  %6.1f MB/s  %6.1f MB/s\n", frame_codec_name(&opts.codec), level_str,
+            (double)compressed_size * 100.0 / (double)total_size,
+            (double)total_size / 1000000.0 / MAX(compress_time, 0.000001),
+            (double)total_size / 1000000.0 / MAX(decompress_time, 0.000001));
     }
 
-    for(int i = 0; i < 16384; i++)
+benchmark_finish:
+    for(uint32_t pos = 0; pos < frame_count; pos++)
     {
-        raw2ev[i] = log2(MAX(1, i - black)) * EV_RESOLUTION;
+        free(frames[pos].in);
+        free(frames[pos].out);
     }
+    free(frames);
+    mlv_reader_close(reader);
 
-    for(int i = -10*EV_RESOLUTION; i < 14*EV_RESOLUTION; i++)
+    return ret;
+}
+
+/* grow all per-frame buffers so they can hold a frame of the given size */
+int frame_buffers_resize(uint32_t size, uint32_t *frame_buffer_size, uint8_t **frame_buffer, uint32_t **frame_arith_buffer, uint8_t **frame_sub_buffer, uint8_t **prev_frame_buffer)
+{
+    if(size <= *frame_buffer_size)
     {
-        ev2raw[i] = black + pow(2, (float)i / EV_RESOLUTION);
+        return ERR_OK;
     }
 
-    int w = info->width;
-    int h = info->height;
+    /* no, set new size */
+    *frame_buffer_size = size;
 
-    uint32_t * aux = malloc(w * h * sizeof(uint32_t));
-    uint32_t * aux2 = malloc(w * h * sizeof(uint32_t));
+    /* realloc buffers */
+    *frame_buffer = realloc(*frame_buffer, size);
+    if(!*frame_buffer)
+    {
+        print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", size);
+        return ERR_MALLOC;
+    }
 
-    int x,y;
-    for (y = 0; y < h; y++)
+    if(*frame_arith_buffer)
     {
-        for (x = 0; x < w; x++)
+        *frame_arith_buffer = realloc(*frame_arith_buffer, size * sizeof(uint32_t));
+        if(!*frame_arith_buffer)
         {
-            aux[x + y*w] = aux2[x + y*w] = raw_get_pixel(x, y);
+            print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", size);
+            return ERR_MALLOC;
         }
     }
 
-    switch(method)
+    if(*frame_sub_buffer)
     {
-        case 2:
-            chroma_smooth_2x2(aux, aux2, raw2ev, ev2raw);
-            break;
-        case 3:
-            chroma_smooth_3x3(aux, aux2, raw2ev, ev2raw);
-            break;
-        case 5:
-            chroma_smooth_5x5(aux, aux2, raw2ev, ev2raw);
-            break;
+        *frame_sub_buffer = realloc(*frame_sub_buffer, size);
+        if(!*frame_sub_buffer)
+        {
+            print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", size);
+            return ERR_MALLOC;
+        }
     }
 
-    for (y = 0; y < h; y++)
+    if(*prev_frame_buffer)
     {
-        for (x = 0; x < w; x++)
+        *prev_frame_buffer = realloc(*prev_frame_buffer, size);
+        if(!*prev_frame_buffer)
         {
-            raw_set_pixel(x, y, aux2[x + y*w]);
+            print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", size);
+            return ERR_MALLOC;
         }
     }
 
-    free(aux);
-    free(aux2);
+    return ERR_OK;
 }
 
 void show_usage(char *executable)
@@ -984,6 +2049,14 @@ void show_usage(char *executable)
     print_msg(MSG_INFO, " --no-fixcp          do not fix cold pixels\n");
     print_msg(MSG_INFO, " --fixcp2            fix non-static (moving) cold pixels (slow)\n");
     print_msg(MSG_INFO, " --no-stripes        do not fix vertical stripes in highlights\n");
+    print_msg(MSG_INFO, "                     LJ92 compressed frames are stored unchanged if no processing is enabled\n");
+    print_msg(MSG_INFO, " --dual-iso          merge the exposures of Dual ISO frames (DISO block) with cr2hdr's algorithm\n");
+    print_msg(MSG_INFO, "                     the first frame calibrates ISO matching and white balance for the whole clip\n");
+    print_msg(MSG_INFO, " --selftest          check the SIMD versions of the DNG filters and pixel packing against the reference code and exit\n");
+    print_msg(MSG_INFO, " --pack-benchmark    report pixels per second of the pixel packing code for 10 to 16 bpp and exit\n");
+#ifdef MLV_USE_THREADS
+    print_msg(MSG_INFO, " --threads=N         process N frames in parallel (DNG and RAW output, compression and decompression, not with --lua)\n");
+#endif
 
     print_msg(MSG_INFO, "\n");
     print_msg(MSG_INFO, "-- RAW output --\n");
@@ -1017,8 +2090,10 @@ void show_usage(char *executable)
     //print_msg(MSG_INFO, " -u lut_file         look-up table with 4 * xRes * yRes 16-bit words that is applied before bit depth conversion\n");
 #ifdef MLV_USE_LZMA
     print_msg(MSG_INFO, " -c                  (re-)compress video and audio frames using LZMA (set bpp to 16 to improve compression rate)\n");
-    print_msg(MSG_INFO, " -d                  decompress compressed video and audio frames using LZMA\n");
+    print_msg(MSG_INFO, " -d                  decompress compressed video and audio frames (LZMA or LJ92)\n");
     print_msg(MSG_INFO, " -l level            set compression level from 0=fastest to 9=best compression\n");
+    print_msg(MSG_INFO, " --codec=name        codec for -c: 'lzma' (default) or 'lj92' (lossless JPEG, fast, DNG compatible)\n");
+    print_msg(MSG_INFO, " --benchmark         compress the frames with every -l level and LJ92, report ratio and MB/s (use -f and --threads)\n");
 #else
     print_msg(MSG_INFO, " -c, -d, -l          NOT AVAILABLE: compression support was not compiled into this release\n");
 #endif
@@ -1130,22 +2205,13 @@ int main (int argc, char *argv[])
     int decompress_output = 0;
     int verbose = 0;
     int lzma_level = 5;
+    int compress_codec = CODEC_LZMA;
     int alter_fps = 0;
     char opt = ' ';
 
     int video_xRes = 0;
     int video_yRes = 0;
 
-#ifdef MLV_USE_LZMA
-    /* this may need some tuning */
-    int lzma_dict = 1<<27;
-    int lzma_lc = 0;
-    int lzma_lp = 1;
-    int lzma_pb = 1;
-    int lzma_fb = 16;
-    int lzma_threads = 8;
-#endif
-
     lua_State *lua_state = NULL;
 
     /* long options */
@@ -1158,6 +2224,11 @@ int main (int argc, char *argv[])
     int dump_xrefs = 0;
     int fix_cold_pixels = 1;
     int fix_vert_stripes = 1;
+    int dual_iso = 0;
+    int threads = 0;
+    int benchmark_mode = 0;
+    int selftest_mode = 0;
+    int pack_benchmark_mode = 0;
     
     const char * unique_camname = "(unknown)";
 
@@ -1165,8 +2236,13 @@ int main (int argc, char *argv[])
         {"lua",    required_argument, NULL,  'L' },
         {"black-fix",  optional_argument, NULL,  'B' },
         {"fix-bug",  required_argument, NULL,  'F' },
+        {"threads",  required_argument, NULL,  'T' },
+        {"codec",  required_argument, NULL,  'C' },
         {"batch",  no_argument, &batch_mode,  1 },
         {"dump-xrefs",   no_argument, &dump_xrefs,  1 },
+        {"benchmark",    no_argument, &benchmark_mode,  1 },
+        {"selftest",     no_argument, &selftest_mode,  1 },
+        {"pack-benchmark", no_argument, &pack_benchmark_mode,  1 },
         {"dng",    no_argument, &dng_output,  1 },
         {"no-cs",  no_argument, &chroma_smooth_method,  0 },
         {"cs2x2",  no_argument, &chroma_smooth_method,  2 },
@@ -1175,6 +2251,7 @@ int main (int argc, char *argv[])
         {"no-fixcp",  no_argument, &fix_cold_pixels,  0 },
         {"fixcp2",    no_argument, &fix_cold_pixels,  2 },
         {"no-stripes",  no_argument, &fix_vert_stripes,  0 },
+        {"dual-iso",    no_argument, &dual_iso,  1 },
         {"avg-vertical",  no_argument, &average_vert,  1 },
         {"avg-horizontal",  no_argument, &average_hor,  1 },
         {0,         0,                 0,  0 }
@@ -1191,7 +2268,7 @@ int main (int argc, char *argv[])
     }
 
     int index = 0;
-    while ((opt = getopt_long(argc, argv, "A:F:B:L:t:xz:emnas:X:I:uvrcdo:l:b:f:", long_options, &index)) != -1)
+    while ((opt = getopt_long(argc, argv, "A:F:B:L:T:t:xz:emnas:X:I:uvrcdo:l:b:f:", long_options, &index)) != -1)
     {
         switch (opt)
         {
@@ -1231,6 +2308,41 @@ int main (int argc, char *argv[])
                 }
                 break;
                 
+            case 'T':
+#ifdef MLV_USE_THREADS
+                if(!optarg)
+                {
+                    print_msg(MSG_ERROR, "Error: Missing number of threads\n");
+                    return ERR_PARAM;
+                }
+                threads = MIN(256, MAX(0, atoi(optarg)));
+                break;
+#else
+                print_msg(MSG_ERROR, "Error: Thread support was not compiled into this release\n");
+                return ERR_PARAM;
+#endif
+
+            case 'C':
+                if(!optarg)
+                {
+                    print_msg(MSG_ERROR, "Error: Missing codec name\n");
+                    return ERR_PARAM;
+                }
+                if(!strcasecmp(optarg, "lzma"))
+                {
+                    compress_codec = CODEC_LZMA;
+                }
+                else if(!strcasecmp(optarg, "lj92"))
+                {
+                    compress_codec = CODEC_LJ92;
+                }
+                else
+                {
+                    print_msg(MSG_ERROR, "Error: Unknown codec '%s'\n", optarg);
+                    return ERR_PARAM;
+                }
+                break;
+
             case 'A':
                 if(!optarg)
                 {
@@ -1434,6 +2546,18 @@ int main (int argc, char *argv[])
         }
     }
 
+    if(selftest_mode)
+    {
+        int errors = pack_selftest() + raw2dng_selftest() + chroma_smooth_selftest();
+        print_msg(errors ? MSG_ERROR : MSG_INFO, "Self test %s\n", errors ? "FAILED" : "passed");
+        return errors ? ERR_SELFTEST : ERR_OK;
+    }
+
+    if(pack_benchmark_mode)
+    {
+        return pack_benchmark();
+    }
+
     if(optind >= argc)
     {
         print_msg(MSG_ERROR, "Error: Missing input filename\n");
@@ -1451,6 +2575,11 @@ int main (int argc, char *argv[])
     /* get first file */
     input_filename = argv[optind];
 
+    if(benchmark_mode)
+    {
+        return benchmark(input_filename, threads, extract_frames, frame_start, frame_end);
+    }
+
     print_msg(MSG_INFO, "Mode of operation:\n");
     print_msg(MSG_INFO, "   - Input MLV file: '%s'\n", input_filename);
 
@@ -1492,6 +2621,10 @@ int main (int argc, char *argv[])
         if(dng_output)
         {
             print_msg(MSG_INFO, "   - Convert to DNG frames\n");
+            if(dual_iso)
+            {
+                print_msg(MSG_INFO, "   - Merge Dual ISO frames\n");
+            }
 
             delta_encode_mode = 0;
             compress_output = 0;
@@ -1533,7 +2666,7 @@ int main (int argc, char *argv[])
             }
             if(compress_output)
             {
-                print_msg(MSG_INFO, "   - Compress frame data\n");
+                print_msg(MSG_INFO, "   - Compress frame data (%s)\n", (compress_codec == CODEC_LJ92) ? "LJ92" : "LZMA");
             }
             if(average_mode)
             {
@@ -1586,13 +2719,41 @@ int main (int argc, char *argv[])
         print_msg(MSG_INFO, "   - Output .idx file for faster processing\n");
     }
 
+    if(threads && !(dng_output || raw_output || mlv_output))
+    {
+        threads = 0;
+    }
+
+    /* lossless JPEG frames can go into the DNG as they are, unless the pixel data has to be touched */
+    if(!dng_output)
+    {
+        dual_iso = 0;
+    }
+
+    int lj92_passthrough = dng_output && !fix_vert_stripes && !fix_cold_pixels && !chroma_smooth_method && !dual_iso &&
+                           !subtract_mode && !flatfield_mode && !bit_depth && !bit_zap && !lua_state;
+
+    if(threads && lua_state)
+    {
+        print_msg(MSG_INFO, "   - LUA scripts require sequential processing, ignoring --threads\n");
+        threads = 0;
+    }
+
+    if(threads)
+    {
+        print_msg(MSG_INFO, "   - Process frames using %d threads\n", threads);
+    }
+
     /* start processing */
     lv_rec_file_footer_t lv_rec_footer;
     mlv_file_hdr_t main_header;
+    /* compression flags as written into the output file */
+    uint16_t out_video_class = 0;
     mlv_lens_hdr_t lens_info;
     mlv_expo_hdr_t expo_info;
     mlv_idnt_hdr_t idnt_info;
     mlv_wbal_hdr_t wbal_info;
+    mlv_diso_hdr_t diso_info;
     mlv_wavi_hdr_t wavi_info;
     mlv_rtci_hdr_t rtci_info;
     mlv_vidf_hdr_t last_vidf;
@@ -1603,6 +2764,7 @@ int main (int argc, char *argv[])
     memset(&expo_info, 0x00, sizeof(mlv_expo_hdr_t));
     memset(&idnt_info, 0x00, sizeof(mlv_idnt_hdr_t));
     memset(&wbal_info, 0x00, sizeof(mlv_wbal_hdr_t));
+    memset(&diso_info, 0x00, sizeof(mlv_diso_hdr_t));
     memset(&wavi_info, 0x00, sizeof(mlv_wavi_hdr_t));
     memset(&rtci_info, 0x00, sizeof(mlv_rtci_hdr_t));
     memset(&main_header, 0x00, sizeof(mlv_file_hdr_t));
@@ -1610,9 +2772,11 @@ int main (int argc, char *argv[])
     char info_string[256] = "(MLV Video without INFO blocks)";
 
     /* this table contains the XREF chunk read from idx file, if existing */
+    mlv_reader_t *reader = NULL;
     mlv_xref_hdr_t *block_xref = NULL;
     mlv_xref_t *xrefs = NULL;
     uint32_t block_xref_pos = 0;
+    int decode_ahead = 0;
 
     uint32_t frame_buffer_size = 1*1024*1024;
     uint32_t subtract_frame_buffer_size = 0;
@@ -1624,6 +2788,10 @@ int main (int argc, char *argv[])
     uint8_t *frame_buffer = NULL;
     uint8_t *prev_frame_buffer = NULL;
 
+    /* one unpacked line of the current frame and one of the reference frame */
+    uint16_t *line_buffer = NULL;
+    uint32_t line_buffer_size = 0;
+
     FILE *out_file = NULL;
     FILE *out_file_wav = NULL;
     FILE **in_files = NULL;
@@ -1658,12 +2826,39 @@ int main (int argc, char *argv[])
 
     if(!xref_mode)
     {
-        block_xref = load_index(input_filename);
+        reader = mlv_reader_open(input_filename);
+
+        if(reader && mlv_reader_chunk_count(reader) != in_file_count)
+        {
+            print_msg(MSG_ERROR, "Failed to map all file chunks\n");
+            mlv_reader_close(reader);
+            reader = NULL;
+        }
+
+        /* compressed frames are decoded ahead on the worker threads, that needs the XREF table */
+        mlv_file_hdr_t *first_hdr = reader ? mlv_reader_map(reader, 0, 0, sizeof(mlv_file_hdr_t)) : NULL;
+        decode_ahead = threads && first_hdr && (first_hdr->videoClass & (MLV_VIDEO_CLASS_FLAG_LZMA | MLV_VIDEO_CLASS_FLAG_LJ92));
+
+        if(reader && !mlv_reader_load_index(reader))
+        {
+            print_msg(MSG_INFO, "File %.*sIDX opened (XREF)\n", (int)strlen(input_filename) - 3, input_filename);
+        }
+        else if(reader && (extract_frames || decode_ahead) && !fix_bug)
+        {
+            /* only the block headers are touched, so this is still a lot faster than processing all frames before the selected ones */
+            print_msg(MSG_INFO, "Building XREF table from block headers\n");
+            if(mlv_reader_build_index(reader))
+            {
+                print_msg(MSG_ERROR, "Failed to build XREF table\n");
+            }
+        }
+
+        block_xref = reader ? mlv_reader_get_xref(reader) : NULL;
 
         if(block_xref)
         {
             print_msg(MSG_INFO, "XREF table contains %d entries\n", block_xref->entryCount);
-            xrefs = (mlv_xref_t *)((uint32_t)block_xref + sizeof(mlv_xref_hdr_t));
+            xrefs = (mlv_xref_t *)&block_xref[1];
 
             if(dump_xrefs)
             {
@@ -1752,6 +2947,40 @@ int main (int argc, char *argv[])
         }
     }
 
+    frame_job_opts_t frame_job_opts;
+
+    frame_job_opts.fix_vert_stripes = fix_vert_stripes;
+    frame_job_opts.fix_cold_pixels = fix_cold_pixels;
+    frame_job_opts.chroma_smooth_method = chroma_smooth_method;
+    frame_job_opts.raw_file = out_file;
+    frame_job_opts.dual_iso_clip = dual_iso ? cr2hdr_clip_new() : NULL;
+
+    /* count frames handed to DNG processing. the first one determines the stripe/cold pixel correction for all following */
+    uint32_t dng_frames_processed = 0;
+
+#ifdef MLV_USE_THREADS
+    mlv_pipeline_t *pipeline = NULL;
+
+    /* compression of the MLV output and decoding of compressed input, started with the first frame */
+    mlv_pipeline_t *encoder = NULL;
+    mlv_pipeline_t *decoder = NULL;
+    codec_job_opts_t encoder_opts;
+    codec_job_opts_t decoder_opts;
+
+    memset(&encoder_opts, 0x00, sizeof(encoder_opts));
+    memset(&decoder_opts, 0x00, sizeof(decoder_opts));
+
+    if(threads && (dng_output || raw_output))
+    {
+        pipeline = mlv_pipeline_create(threads, 2 * threads, &frame_job_process, &frame_job_write_pipeline, &frame_job_opts);
+        if(!pipeline)
+        {
+            print_msg(MSG_ERROR, "Failed to start worker threads\n");
+            return ERR_MALLOC;
+        }
+    }
+#endif
+
     print_msg(MSG_INFO, "Processing...\n");
     uint64_t position_previous = 0;
     do
@@ -1765,6 +2994,27 @@ read_headers:
 
         if(block_xref)
         {
+            /* with -f, frames outside the range are skipped without reading them. not possible with delta coded or averaged frames */
+            if(extract_frames && !average_mode && !(main_header.videoClass & MLV_VIDEO_CLASS_FLAG_DELTA))
+            {
+                while(block_xref_pos < block_xref->entryCount && xrefs[block_xref_pos].frameType == MLV_FRAME_VIDF)
+                {
+                    mlv_vidf_hdr_t *vidf = mlv_reader_map(reader, xrefs[block_xref_pos].fileNumber, xrefs[block_xref_pos].frameOffset, sizeof(mlv_vidf_hdr_t));
+
+                    if(!vidf || (vidf->frameNumber >= frame_start && vidf->frameNumber <= frame_end))
+                    {
+                        break;
+                    }
+                    block_xref_pos++;
+                }
+
+                if(block_xref_pos >= block_xref->entryCount)
+                {
+                    print_msg(MSG_INFO, "Reached end of all files after %i blocks\n", blocks_processed);
+                    break;
+                }
+            }
+
             /* get the file and position of the next block */
             in_file_num = xrefs[block_xref_pos].fileNumber;
             position = xrefs[block_xref_pos].frameOffset;
@@ -1815,6 +3065,17 @@ read_headers:
             }
         }
 
+#ifdef MLV_USE_THREADS
+        /* all other blocks are written directly, so the frames before them have to be in the file already */
+        if(encoder && memcmp(buf.blockType, "VIDF", 4))
+        {
+            if(mlv_pipeline_drain(encoder))
+            {
+                goto abort;
+            }
+        }
+#endif
+
         /* file header */
         if(!memcmp(buf.blockType, "MLVI", 4))
         {
@@ -1874,6 +3135,18 @@ read_headers:
                 total_vidf_count = main_header.videoFrameCount;
                 total_audf_count = main_header.audioFrameCount;
 
+                if(dng_output && (main_header.videoClass & MLV_VIDEO_CLASS_FLAG_LJ92))
+                {
+                    if(lj92_passthrough && !(main_header.videoClass & MLV_VIDEO_CLASS_FLAG_DELTA))
+                    {
+                        print_msg(MSG_INFO, "   - Store LJ92 frames in DNG without decoding\n");
+                    }
+                    else
+                    {
+                        print_msg(MSG_INFO, "   - Decode LJ92 frames for processing (--no-stripes --no-fixcp store them as they are)\n");
+                    }
+                }
+
                 if(mlv_output)
                 {
                     if(average_mode)
@@ -1882,13 +3155,10 @@ read_headers:
                     }
 
                     /* set the output compression flag */
+                    file_hdr.videoClass &= ~(MLV_VIDEO_CLASS_FLAG_LZMA | MLV_VIDEO_CLASS_FLAG_LJ92 | MLV_VIDEO_CLASS_FLAG_STORED);
                     if(compress_output)
                     {
-                        file_hdr.videoClass |= MLV_VIDEO_CLASS_FLAG_LZMA;
-                    }
-                    else
-                    {
-                        file_hdr.videoClass &= ~MLV_VIDEO_CLASS_FLAG_LZMA;
+                        file_hdr.videoClass |= (compress_codec == CODEC_LJ92) ? MLV_VIDEO_CLASS_FLAG_LJ92 : MLV_VIDEO_CLASS_FLAG_LZMA;
                     }
 
                     if(delta_encode_mode)
@@ -1899,6 +3169,7 @@ read_headers:
                     {
                         file_hdr.videoClass &= ~MLV_VIDEO_CLASS_FLAG_DELTA;
                     }
+                    out_video_class = file_hdr.videoClass;
 
                     if(!extract_block || !strncasecmp(extract_block, (char*)file_hdr.fileMagic, 4))
                     {
@@ -2135,13 +3406,58 @@ read_headers:
                 if((raw_output || mlv_output || dng_output || lua_state) && !skip_block)
                 {
                     /* if already compressed, we have to decompress it first */
-                    int compressed = main_header.videoClass & MLV_VIDEO_CLASS_FLAG_LZMA;
+                    int lj92_compressed = main_header.videoClass & MLV_VIDEO_CLASS_FLAG_LJ92;
+                    int compressed = (main_header.videoClass & MLV_VIDEO_CLASS_FLAG_LZMA) || lj92_compressed;
                     int recompress = compressed && compress_output;
                     int decompress = compressed && decompress_output;
 
                     int frame_size = block_hdr.blockSize - sizeof(mlv_vidf_hdr_t) - block_hdr.frameSpace;
                     int prev_frame_size = frame_size;
 
+                    /* only clips flagged by mlv_lite have frames stored as they are. these can't go into the DNG as LJ92, frame_decompress just copies them */
+                    int stored_frames = lj92_compressed && (main_header.videoClass & MLV_VIDEO_CLASS_FLAG_STORED);
+                    int lj92_stored = stored_frames && frame_size >= video_xRes * video_yRes * lv_rec_footer.raw_info.bits_per_pixel / 8;
+                    int passthrough = lj92_compressed && !lj92_stored && lj92_passthrough && !(main_header.videoClass & MLV_VIDEO_CLASS_FLAG_DELTA);
+
+                    /* LJ92 is decoded for anything but DNG passthrough, LZMA only if the output needs it */
+                    int decode = lj92_compressed ? (!passthrough && (recompress || decompress || raw_output || dng_output || mlv_output))
+                                                 : (recompress || decompress || ((raw_output || dng_output) && compressed));
+
+                    frame_codec_t in_codec;
+                    in_codec.codec = lj92_compressed ? CODEC_LJ92 : CODEC_LZMA;
+                    in_codec.lzma_level = 0;
+                    in_codec.width = video_xRes;
+                    in_codec.height = video_yRes;
+                    in_codec.depth = lv_rec_footer.raw_info.bits_per_pixel;
+                    in_codec.stored = stored_frames;
+
+                    /* the frame may have been decoded ahead already */
+                    codec_job_t *decoded_job = NULL;
+
+#ifdef MLV_USE_THREADS
+                    if(decode && block_xref && decode_ahead && !fix_bug)
+                    {
+                        if(!decoder)
+                        {
+                            decoder_opts.codec = in_codec;
+                            decoder_opts.reader = reader;
+                            decoder_opts.block_xref = block_xref;
+                            decoder_opts.depth = 2 * threads;
+                            decoder_opts.skip_frames = extract_frames && !average_mode && !(main_header.videoClass & MLV_VIDEO_CLASS_FLAG_DELTA);
+                            decoder_opts.frame_start = frame_start;
+                            decoder_opts.frame_end = frame_end;
+
+                            decoder = mlv_pipeline_create(threads, decoder_opts.depth, &codec_job_decompress, NULL, &decoder_opts);
+                            if(!decoder)
+                            {
+                                print_msg(MSG_ERROR, "Failed to start worker threads\n");
+                                goto abort;
+                            }
+                        }
+                        decoded_job = codec_job_fetch(decoder, &decoder_opts, block_xref_pos);
+                    }
+#endif
+
                     uint64_t skipSize = block_hdr.frameSpace;
                     if(fix_bug == BUG_ID_FRAMEDATA_MISALIGN && (int)block_hdr.frameSpace >= fix_bug_2_offset)
                     {
@@ -2160,52 +3476,16 @@ read_headers:
                     }
                     
                     /* check if there is enough memory for that frame */
-                    if(frame_size > (int)frame_buffer_size)
+                    if(frame_buffers_resize(frame_size, &frame_buffer_size, &frame_buffer, &frame_arith_buffer, &frame_sub_buffer, &prev_frame_buffer))
                     {
-                        /* no, set new size */
-                        frame_buffer_size = frame_size;
-                        
-                        /* realloc buffers */
-                        frame_buffer = realloc(frame_buffer, frame_buffer_size);
-                        
-                        if(!frame_buffer)
-                        {
-                            print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", frame_buffer_size);
-                            goto abort;
-                        }
-                        
-                        if(frame_arith_buffer)
-                        {
-                            frame_arith_buffer = realloc(frame_arith_buffer, frame_buffer_size * sizeof(uint32_t));
-                            if(!frame_arith_buffer)
-                            {
-                                print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", frame_buffer_size);
-                                goto abort;
-                            }
-                        }
-                        
-                        if(frame_sub_buffer)
-                        {
-                            frame_sub_buffer = realloc(frame_sub_buffer, frame_buffer_size);
-                            if(!frame_sub_buffer)
-                            {
-                                print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", frame_buffer_size);
-                                goto abort;
-                            }
-                        }
-                        
-                        if(prev_frame_buffer)
-                        {
-                            prev_frame_buffer = realloc(prev_frame_buffer, frame_buffer_size);
-                            if(!prev_frame_buffer)
-                            {
-                                print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", frame_buffer_size);
-                                goto abort;
-                            }
-                        }
+                        goto abort;
                     }
                     
-                    if(fread(frame_buffer, frame_size, 1, in_file) != 1)
+                    if(decoded_job)
+                    {
+                        file_set_pos(in_file, frame_size, SEEK_CUR);
+                    }
+                    else if(fread(frame_buffer, frame_size, 1, in_file) != 1)
                     {
                         print_msg(MSG_ERROR, "VIDF: File ends in the middle of a block\n");
                         goto abort;
@@ -2218,38 +3498,46 @@ read_headers:
                     
                     lua_handle_hdr_data(lua_state, buf.blockType, "_data_read", &block_hdr, sizeof(block_hdr), frame_buffer, frame_size);
 
-                    if(recompress || decompress || ((raw_output || dng_output) && compressed))
+                    if(decode)
                     {
-#ifdef MLV_USE_LZMA
-                        size_t lzma_out_size = *(uint32_t *)frame_buffer;
-                        size_t lzma_in_size = frame_size - LZMA_PROPS_SIZE - 4;
-                        size_t lzma_props_size = LZMA_PROPS_SIZE;
-                        unsigned char *lzma_out = malloc(lzma_out_size);
-
-                        int ret = LzmaUncompress(
-                            lzma_out, &lzma_out_size,
-                            (unsigned char *)&frame_buffer[4 + LZMA_PROPS_SIZE], &lzma_in_size,
-                            (unsigned char *)&frame_buffer[4], lzma_props_size
-                            );
+                        uint8_t *decoded = NULL;
+                        uint32_t decoded_size = 0;
+                        int ret = 0;
 
-                        if(ret == SZ_OK)
+                        if(decoded_job)
                         {
-                            frame_size = lzma_out_size;
-                            memcpy(frame_buffer, lzma_out, frame_size);
-                            if(verbose)
-                            {
-                                print_msg(MSG_INFO, "    LZMA: "FMT_SIZE" -> "FMT_SIZE"  (%2.2f%%)\n", lzma_in_size, lzma_out_size, ((float)lzma_out_size * 100.0f) / (float)lzma_in_size);
-                            }
+                            ret = decoded_job->ret;
+                            decoded = decoded_job->out;
+                            decoded_size = decoded_job->out_size;
+                            decoded_job->out = NULL;
+                            codec_job_free(decoded_job);
                         }
                         else
                         {
-                            print_msg(MSG_INFO, "    LZMA: Failed (%d)\n", ret);
+                            ret = frame_decompress(&in_codec, frame_buffer, frame_size, &decoded, &decoded_size);
+                        }
+
+                        if(ret)
+                        {
+                            print_msg(MSG_INFO, "    %s: Failed (%d)\n", frame_codec_name(&in_codec), ret);
+                            free(decoded);
                             goto abort;
                         }
-#else
-                        print_msg(MSG_INFO, "    LZMA: not compiled into this release, aborting.\n");
-                        goto abort;
-#endif
+
+                        if(verbose)
+                        {
+                            print_msg(MSG_INFO, "    %s: %d -> %d  (%2.2f%%)\n", frame_codec_name(&in_codec), frame_size, decoded_size, ((float)decoded_size * 100.0f) / (float)frame_size);
+                        }
+
+                        if(frame_buffers_resize(decoded_size, &frame_buffer_size, &frame_buffer, &frame_arith_buffer, &frame_sub_buffer, &prev_frame_buffer))
+                        {
+                            free(decoded);
+                            goto abort;
+                        }
+
+                        frame_size = decoded_size;
+                        memcpy(frame_buffer, decoded, frame_size);
+                        free(decoded);
                     }
 
                     int old_depth = lv_rec_footer.raw_info.bits_per_pixel;
@@ -2258,6 +3546,20 @@ read_headers:
                     /* this value changes in this context */
                     int current_depth = old_depth;
 
+                    /* the per-pixel operations below unpack the frame line by line */
+                    if(line_buffer_size < 2 * video_xRes * sizeof(uint16_t))
+                    {
+                        line_buffer_size = 2 * video_xRes * sizeof(uint16_t);
+                        line_buffer = realloc(line_buffer, line_buffer_size);
+                        if(!line_buffer)
+                        {
+                            print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", line_buffer_size);
+                            goto abort;
+                        }
+                    }
+                    uint16_t *src_pixels = line_buffer;
+                    uint16_t *ref_pixels = &line_buffer[video_xRes];
+
                     /* in subtract mode, subtract reference frame. do that before averaging */
                     if(subtract_mode)
                     {
@@ -2274,17 +3576,22 @@ read_headers:
                             uint16_t *src_line = (uint16_t *)&frame_buffer[y * pitch];
                             uint16_t *sub_line = (uint16_t *)&frame_sub_buffer[y * pitch];
 
+                            raw_unpack_line(src_line, src_pixels, video_xRes, current_depth);
+                            raw_unpack_line(sub_line, ref_pixels, video_xRes, current_depth);
+
                             for(int x = 0; x < video_xRes; x++)
                             {
-                                int32_t value = bitextract(src_line, x, current_depth);
-                                int32_t sub_value = bitextract(sub_line, x, current_depth);
+                                int32_t value = src_pixels[x];
+                                int32_t sub_value = ref_pixels[x];
 
                                 value -= sub_value;
                                 value += lv_rec_footer.raw_info.black_level; /* should we really add it here? or better subtract it from averaged frame? */
                                 value = COERCE(value, 0, (1<<current_depth)-1);
 
-                                bitinsert(src_line, x, current_depth, value);
+                                src_pixels[x] = value;
                             }
+
+                            raw_pack_line(src_pixels, src_line, video_xRes, current_depth);
                         }
                     }
 
@@ -2376,15 +3683,18 @@ read_headers:
                             uint16_t *src_line = (uint16_t *)&frame_buffer[y * pitch];
                             uint16_t *flat_line = (uint16_t *)&frame_flat_buffer[y * pitch];
 
+                            raw_unpack_line(src_line, src_pixels, video_xRes, current_depth);
+                            raw_unpack_line(flat_line, ref_pixels, video_xRes, current_depth);
+
                             for(int x = 0; x < video_xRes; x++)
                             {
-                                int32_t value = bitextract(src_line, x, current_depth);
-                                int32_t flat_value = bitextract(flat_line, x, current_depth);
+                                int32_t value = src_pixels[x];
+                                int32_t flat_value = ref_pixels[x];
                                 
                                 if (flat_value - black <= 0)
                                 {
-                                    int left  = bitextract(flat_line, MAX(x-1,0), current_depth);
-                                    int right = bitextract(flat_line, MIN(x+1,video_xRes-1), current_depth);
+                                    int left  = ref_pixels[MAX(x-1,0)];
+                                    int right = ref_pixels[MIN(x+1,video_xRes-1)];
                                     flat_value = MAX(left, right);
                                 }
 
@@ -2396,8 +3706,10 @@ read_headers:
                                     value = COERCE(value, 0, (1<<current_depth)-1);
                                 }
 
-                                bitinsert(src_line, x, current_depth, value);
+                                src_pixels[x] = value;
                             }
+
+                            raw_pack_line(src_pixels, src_line, video_xRes, current_depth);
                         }
                     }
 
@@ -2410,11 +3722,11 @@ read_headers:
                         {
                             uint16_t *src_line = (uint16_t *)&frame_buffer[y * pitch];
 
+                            raw_unpack_line(src_line, src_pixels, video_xRes, current_depth);
+
                             for(int x = 0; x < video_xRes; x++)
                             {
-                                uint16_t value = bitextract(src_line, x, current_depth);
-
-                                frame_arith_buffer[y * video_xRes + x] += value;
+                                frame_arith_buffer[y * video_xRes + x] += src_pixels[x];
                             }
                         }
 
@@ -2447,9 +3759,11 @@ read_headers:
                             uint16_t *src_line = (uint16_t *)&frame_buffer[y * old_pitch];
                             uint16_t *dst_line = (uint16_t *)&new_buffer[y * new_pitch];
 
+                            raw_unpack_line(src_line, src_pixels, video_xRes, old_depth);
+
                             for(int x = 0; x < video_xRes; x++)
                             {
-                                uint16_t value = bitextract(src_line, x, old_depth);
+                                uint16_t value = src_pixels[x];
 
                                 /* normalize the old value to 16 bits */
                                 value <<= (16-old_depth);
@@ -2457,8 +3771,10 @@ read_headers:
                                 /* convert the old value to destination depth */
                                 value >>= (16-new_depth);
 
-                                bitinsert(dst_line, x, new_depth, value);
+                                src_pixels[x] = value;
                             }
+
+                            raw_pack_line(src_pixels, dst_line, video_xRes, new_depth);
                         }
 
                         frame_size = new_size;
@@ -2477,9 +3793,11 @@ read_headers:
                         {
                             uint16_t *src_line = (uint16_t *)&frame_buffer[y * pitch];
 
+                            raw_unpack_line(src_line, src_pixels, video_xRes, current_depth);
+
                             for(int x = 0; x < video_xRes; x++)
                             {
-                                int32_t value = bitextract(src_line, x, current_depth);
+                                int32_t value = src_pixels[x];
 
                                 /* normalize the old value to 16 bits */
                                 value <<= (16-current_depth);
@@ -2489,9 +3807,10 @@ read_headers:
                                 /* convert the old value to destination depth */
                                 value >>= (16-current_depth);
 
-
-                                bitinsert(src_line, x, current_depth, value);
+                                src_pixels[x] = value;
                             }
+
+                            raw_pack_line(src_pixels, src_line, video_xRes, current_depth);
                         }
                     }
 
@@ -2513,10 +3832,13 @@ read_headers:
                                 int32_t offset = 1 << (current_depth - 1);
                                 int32_t max_val = (1 << current_depth) - 1;
 
+                                raw_unpack_line(src_line, src_pixels, video_xRes, current_depth);
+                                raw_unpack_line(ref_line, ref_pixels, video_xRes, current_depth);
+
                                 for(int x = 0; x < video_xRes; x++)
                                 {
-                                    int32_t value = bitextract(src_line, x, current_depth);
-                                    int32_t ref_value = bitextract(ref_line, x, current_depth);
+                                    int32_t value = src_pixels[x];
+                                    int32_t ref_value = ref_pixels[x];
 
                                     /* when e.g. using 16 bit values:
                                            delta =  1      -> encode to 0x8001
@@ -2529,10 +3851,10 @@ read_headers:
                                     */
                                     int32_t delta = offset + value - ref_value;
 
-                                    uint16_t new_value = (uint16_t)(delta & max_val);
-
-                                    bitinsert(src_line, x, current_depth, new_value);
+                                    src_pixels[x] = (uint16_t)(delta & max_val);
                                 }
+
+                                raw_pack_line(src_pixels, src_line, video_xRes, current_depth);
                             }
 
                             /* save current original frame to prev buffer */
@@ -2554,10 +3876,13 @@ read_headers:
                                 int32_t offset = 1 << (current_depth - 1);
                                 int32_t max_val = (1 << current_depth) - 1;
 
+                                raw_unpack_line(src_line, src_pixels, video_xRes, current_depth);
+                                raw_unpack_line(ref_line, ref_pixels, video_xRes, current_depth);
+
                                 for(int x = 0; x < video_xRes; x++)
                                 {
-                                    int32_t value = bitextract(src_line, x, current_depth);
-                                    int32_t ref_value = bitextract(ref_line, x, current_depth);
+                                    int32_t value = src_pixels[x];
+                                    int32_t ref_value = ref_pixels[x];
 
                                     /* when e.g. using 16 bit values:
                                            delta =  1      -> encode to 0x8001
@@ -2570,10 +3895,10 @@ read_headers:
                                     */
                                     int32_t delta = offset + value + ref_value;
 
-                                    uint16_t new_value = (uint16_t)(delta & max_val);
-
-                                    bitinsert(src_line, x, current_depth, new_value);
+                                    src_pixels[x] = (uint16_t)(delta & max_val);
                                 }
+
+                                raw_pack_line(src_pixels, src_line, video_xRes, current_depth);
                             }
 
                             /* save current original frame to prev buffer */
@@ -2597,196 +3922,308 @@ read_headers:
 
                             lua_handle_hdr_data(lua_state, buf.blockType, "_data_write_raw", &block_hdr, sizeof(block_hdr), frame_buffer, frame_size);
 
-                            file_set_pos(out_file, (uint64_t)block_hdr.frameNumber * (uint64_t)frame_size, SEEK_SET);
-                            if(fwrite(frame_buffer, frame_size, 1, out_file) != 1)
+                            frame_job_t *job = calloc(1, sizeof(frame_job_t));
+                            if(!job)
                             {
-                                print_msg(MSG_ERROR, "VIDF: Failed writing into .RAW file\n");
+                                print_msg(MSG_ERROR, "VIDF: Failed to allocate frame job\n");
                                 goto abort;
                             }
+
+                            job->frame_number = block_hdr.frameNumber;
+                            job->frame_size = frame_size;
+                            job->frame_buffer = frame_buffer;
+
+#ifdef MLV_USE_THREADS
+                            if(pipeline)
+                            {
+                                /* the reader keeps using frame_buffer, so the job needs its own copy */
+                                job->frame_buffer = malloc(frame_size);
+                                job->own_buffer = 1;
+                                if(!job->frame_buffer)
+                                {
+                                    print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", frame_size);
+                                    frame_job_free(job);
+                                    goto abort;
+                                }
+                                memcpy(job->frame_buffer, frame_buffer, frame_size);
+
+                                if(mlv_pipeline_submit(pipeline, job, MLV_PIPELINE_PASS))
+                                {
+                                    frame_job_free(job);
+                                    goto abort;
+                                }
+                            }
+                            else
+#endif
+                            {
+                                int ret = frame_job_write(&frame_job_opts, job);
+                                frame_job_free(job);
+
+                                if(ret)
+                                {
+                                    goto abort;
+                                }
+                            }
                         }
 
                         if(dng_output)
                         {
-                            void fix_vertical_stripes();
-                            void find_and_fix_cold_pixels(int force_analysis);
-                            extern struct raw_info raw_info;
-
                             int frame_filename_len = strlen(output_filename) + 32;
                             char *frame_filename = malloc(frame_filename_len);
+                            if(!frame_filename)
+                            {
+                                print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", frame_filename_len);
+                                goto abort;
+                            }
                             snprintf(frame_filename, frame_filename_len, "%s%06d.dng", output_filename, block_hdr.frameNumber);
 
                             lua_handle_hdr_data(lua_state, buf.blockType, "_data_write_dng", &block_hdr, sizeof(block_hdr), frame_buffer, frame_size);
 
-                            raw_info = lv_rec_footer.raw_info;
-                            raw_info.frame_size = frame_size;
-                            raw_info.buffer = frame_buffer;
+                            frame_job_t *job = calloc(1, sizeof(frame_job_t));
+                            if(!job)
+                            {
+                                print_msg(MSG_ERROR, "VIDF: Failed to allocate frame job\n");
+                                free(frame_filename);
+                                goto abort;
+                            }
+
+                            job->frame_number = block_hdr.frameNumber;
+                            job->frame_size = frame_size;
+                            job->frame_buffer = frame_buffer;
+                            job->dng_filename = frame_filename;
+                            job->lj92_passthrough = passthrough;
+                            job->dual_iso = dual_iso && diso_info.dualMode;
+
+                            job->raw_info = lv_rec_footer.raw_info;
+                            job->raw_info.frame_size = frame_size;
 
                             /* override the resolution from raw_info with the one from lv_rec_footer, if they don't match */
-                            if (lv_rec_footer.xRes != raw_info.width)
+                            if (lv_rec_footer.xRes != job->raw_info.width)
                             {
-                                raw_info.width = lv_rec_footer.xRes;
-                                raw_info.pitch = raw_info.width * 14/8;
-                                raw_info.active_area.x1 = 0;
-                                raw_info.active_area.x2 = raw_info.width;
-                                raw_info.jpeg.x = 0;
-                                raw_info.jpeg.width = raw_info.width;
+                                job->raw_info.width = lv_rec_footer.xRes;
+                                job->raw_info.pitch = job->raw_info.width * 14/8;
+                                job->raw_info.active_area.x1 = 0;
+                                job->raw_info.active_area.x2 = job->raw_info.width;
+                                job->raw_info.jpeg.x = 0;
+                                job->raw_info.jpeg.width = job->raw_info.width;
                             }
 
-                            if (lv_rec_footer.yRes != raw_info.height)
+                            if (lv_rec_footer.yRes != job->raw_info.height)
                             {
-                                raw_info.height = lv_rec_footer.yRes;
-                                raw_info.active_area.y1 = 0;
-                                raw_info.active_area.y2 = raw_info.height;
-                                raw_info.jpeg.y = 0;
-                                raw_info.jpeg.height = raw_info.height;
+                                job->raw_info.height = lv_rec_footer.yRes;
+                                job->raw_info.active_area.y1 = 0;
+                                job->raw_info.active_area.y2 = job->raw_info.height;
+                                job->raw_info.jpeg.y = 0;
+                                job->raw_info.jpeg.height = job->raw_info.height;
                             }
 
-                            /* call raw2dng code */
-                            if (fix_vert_stripes)
+                            /* raw2dng's filters, cr2hdr and save_dng expect 14 bit frames; bring frames from -b back to that layout */
+                            if(current_depth != 14)
                             {
-                                fix_vertical_stripes();
+                                int old_pitch = video_xRes * current_depth / 8;
+                                int new_pitch = video_xRes * 14 / 8;
+
+                                job->frame_size = new_pitch * video_yRes;
+                                job->frame_buffer = malloc(job->frame_size);
+                                job->own_buffer = 1;
+                                if(!job->frame_buffer)
+                                {
+                                    print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", job->frame_size);
+                                    frame_job_free(job);
+                                    goto abort;
+                                }
+
+                                for(int y = 0; y < video_yRes; y++)
+                                {
+                                    raw_unpack_line((uint16_t *)&frame_buffer[y * old_pitch], src_pixels, video_xRes, current_depth);
+
+                                    for(int x = 0; x < video_xRes; x++)
+                                    {
+                                        uint32_t value = src_pixels[x];
+                                        src_pixels[x] = (value << (16 - current_depth)) >> 2;
+                                    }
+
+                                    raw_pack_line(src_pixels, (uint16_t *)&job->frame_buffer[y * new_pitch], video_xRes, 14);
+                                }
+
+                                job->raw_info.width = video_xRes;
+                                job->raw_info.height = video_yRes;
+                                job->raw_info.pitch = new_pitch;
+                                job->raw_info.frame_size = job->frame_size;
                             }
-                            
-                            if (fix_cold_pixels)
+                            job->raw_info.bits_per_pixel = 14;
+
+                            /* snapshot the metadata, the blocks may change until the frame gets written */
+                            job->timestamp = buf.timestamp;
+                            job->fps_nom = main_header.sourceFpsNom;
+                            job->fps_denom = main_header.sourceFpsDenom;
+                            job->lens_info = lens_info;
+                            job->expo_info = expo_info;
+                            job->rtci_info = rtci_info;
+                            /* cameraSerial is not necessarily terminated, copy at most its size */
+                            snprintf(job->camname, sizeof(job->camname), "%s", unique_camname);
+                            snprintf(job->serial, sizeof(job->serial), "%.*s", (int)sizeof(idnt_info.cameraSerial), (char *)idnt_info.cameraSerial);
+                            snprintf(job->info_string, sizeof(job->info_string), "%s", info_string);
+
+#ifdef MLV_USE_THREADS
+                            if(pipeline)
                             {
-                                find_and_fix_cold_pixels(fix_cold_pixels == 2);
-                            }
+                                /* the reader keeps using frame_buffer, so the job needs its own copy */
+                                if(!job->own_buffer)
+                                {
+                                    job->frame_buffer = malloc(frame_size);
+                                    job->own_buffer = 1;
+                                    if(!job->frame_buffer)
+                                    {
+                                        print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", frame_size);
+                                        frame_job_free(job);
+                                        goto abort;
+                                    }
+                                    memcpy(job->frame_buffer, frame_buffer, frame_size);
+                                }
 
-                            /* this is internal again */
-                            chroma_smooth(chroma_smooth_method, &raw_info);
-
-                            /* set MLV metadata into DNG tags */
-                            dng_set_framerate_rational(main_header.sourceFpsNom, main_header.sourceFpsDenom);
-                            dng_set_shutter(1, (int)(1000000.0f/(float)expo_info.shutterValue));
-                            dng_set_aperture(lens_info.aperture, 100);
-                            dng_set_camname((char*)unique_camname);
-                            dng_set_description((char*)info_string);
-                            dng_set_lensmodel((char*)lens_info.lensName);
-                            dng_set_focal(lens_info.focalLength, 1);
-                            dng_set_iso(expo_info.isoValue);
-
-                            //dng_set_wbgain(1024, wbal_info.wbgain_r, 1024, wbal_info.wbgain_g, 1024, wbal_info.wbgain_b);
-
-                            /* calculate the time this frame was taken at, i.e., the start time + the current timestamp. this can be off by a second but it's better than nothing */
-                            int ms = 0.5 + buf.timestamp / 1000.0;
-                            int sec = ms / 1000;
-                            ms %= 1000;
-                            // FIXME: the struct tm doesn't have tm_gmtoff on Linux so the result might be wrong?
-                            struct tm tm;
-                            tm.tm_sec = rtci_info.tm_sec + sec;
-                            tm.tm_min = rtci_info.tm_min;
-                            tm.tm_hour = rtci_info.tm_hour;
-                            tm.tm_mday = rtci_info.tm_mday;
-                            tm.tm_mon = rtci_info.tm_mon;
-                            tm.tm_year = rtci_info.tm_year;
-                            tm.tm_wday = rtci_info.tm_wday;
-                            tm.tm_yday = rtci_info.tm_yday;
-                            tm.tm_isdst = rtci_info.tm_isdst;
-
-                            if(mktime(&tm) != -1)
-                            {
-                                char datetime_str[32];
-                                char subsec_str[8];
-                                strftime(datetime_str, 20, "%Y:%m:%d %H:%M:%S", &tm);
-                                snprintf(subsec_str, sizeof(subsec_str), "%03d", ms);
-                                dng_set_datetime(datetime_str, subsec_str);
+                                /* the first frame calibrates stripe and cold pixel correction, so it must be done before the others start */
+                                /* same for Dual ISO frames, until one of them has calibrated the clip */
+                                int mode = passthrough ? MLV_PIPELINE_PASS : MLV_PIPELINE_PROCESS;
+                                if(!dng_frames_processed || (job->dual_iso && !cr2hdr_clip_calibrated(frame_job_opts.dual_iso_clip)))
+                                {
+                                    frame_job_process(&frame_job_opts, job);
+                                    mode = MLV_PIPELINE_PASS;
+                                }
+                                dng_frames_processed++;
+
+                                if(mlv_pipeline_submit(pipeline, job, mode))
+                                {
+                                    frame_job_free(job);
+                                    goto abort;
+                                }
                             }
                             else
+#endif
                             {
-                                // soemthing went wrong. let's proceed anyway
-                                print_msg(MSG_ERROR, "VIDF: [W] Failed calculating the DateTime from the timestamp\n");
-                                dng_set_datetime("", "");
-                            }
+                                /* call raw2dng code */
+                                frame_job_process(&frame_job_opts, job);
+                                dng_frames_processed++;
 
+                                if(frame_job_write(&frame_job_opts, job))
+                                {
+                                    frame_job_free(job);
+                                    goto abort;
+                                }
 
-                            uint64_t serial = 0;
-                            char *end;
-                            serial = strtoull((char *)idnt_info.cameraSerial, &end, 16);
-                            if (serial && !*end)
-                            {
-                                char serial_str[64];
+                                /* callout for a saved dng file */
+                                lua_call_va(lua_state, "dng_saved", "si", frame_filename, block_hdr.frameNumber);
 
-                                sprintf(serial_str, "%"PRIu64, serial);
-                                dng_set_camserial((char*)serial_str);
+                                frame_job_free(job);
                             }
+                        }
+
+                        if(mlv_output && !only_metadata_mode && !average_mode && (!extract_block || !strncasecmp(extract_block, (char*)block_hdr.blockType, 4)))
+                        {
+                            /* delete free space and correct header size if needed */
+                            block_hdr.frameSpace = 0;
+                            block_hdr.frameNumber -= frame_start;
 
-                            /* finally save the DNG */
-                            if(!save_dng(frame_filename, &raw_info))
+#ifdef MLV_USE_THREADS
+                            /* compress several frames in parallel, the writer puts them into the file in order */
+                            if(compress_output && threads && !encoder)
                             {
-                                print_msg(MSG_ERROR, "VIDF: Failed writing into .DNG file\n");
-                                goto abort;
+                                encoder_opts.codec.codec = compress_codec;
+                                encoder_opts.codec.lzma_level = lzma_level;
+                                encoder_opts.codec.width = video_xRes;
+                                encoder_opts.codec.height = video_yRes;
+                                encoder_opts.codec.depth = current_depth;
+                                encoder_opts.verbose = verbose;
+                                encoder_opts.out_file = out_file;
+
+                                encoder = mlv_pipeline_create(threads, 2 * threads, &codec_job_compress, &codec_job_write, &encoder_opts);
+                                if(!encoder)
+                                {
+                                    print_msg(MSG_ERROR, "Failed to start worker threads\n");
+                                    goto abort;
+                                }
                             }
 
-                            /* callout for a saved dng file */
-                            lua_call_va(lua_state, "dng_saved", "si", frame_filename, block_hdr.frameNumber);
+                            if(encoder)
+                            {
+                                lua_handle_hdr_data(lua_state, buf.blockType, "_data_write_mlv", &block_hdr, sizeof(block_hdr), frame_buffer, frame_size);
 
-                            free(frame_filename);
-                        }
+                                codec_job_t *job = calloc(1, sizeof(codec_job_t));
+                                if(!job)
+                                {
+                                    print_msg(MSG_ERROR, "VIDF: Failed to allocate frame job\n");
+                                    goto abort;
+                                }
 
-                        if(mlv_output && !only_metadata_mode && !average_mode && (!extract_block || !strncasecmp(extract_block, (char*)block_hdr.blockType, 4)))
-                        {
-                            if(compress_output)
-                            {
-#ifdef MLV_USE_LZMA
-                                size_t lzma_out_size = 2 * frame_size;
-                                size_t lzma_in_size = frame_size;
-                                size_t lzma_props_size = LZMA_PROPS_SIZE;
-                                unsigned char *lzma_out = malloc(lzma_out_size + LZMA_PROPS_SIZE);
-
-                                int ret = LzmaCompress(
-                                    &lzma_out[LZMA_PROPS_SIZE], &lzma_out_size,
-                                    (unsigned char *)frame_buffer, lzma_in_size,
-                                    &lzma_out[0], &lzma_props_size,
-                                    lzma_level, lzma_dict, lzma_lc, lzma_lp, lzma_pb, lzma_fb, lzma_threads
-                                    );
-
-                                if(ret == SZ_OK)
+                                job->block_hdr = block_hdr;
+                                job->prev_size = prev_frame_size;
+                                job->in_size = frame_size;
+                                job->in = malloc(frame_size);
+                                if(!job->in)
+                                {
+                                    print_msg(MSG_ERROR, "VIDF: Failed to allocate %d byte\n", frame_size);
+                                    codec_job_free(job);
+                                    goto abort;
+                                }
+                                memcpy(job->in, frame_buffer, frame_size);
+
+                                if(mlv_pipeline_submit(encoder, job, MLV_PIPELINE_PROCESS))
                                 {
-                                    /* store original frame size */
-                                    *(uint32_t *)frame_buffer = frame_size;
+                                    codec_job_free(job);
+                                    goto abort;
+                                }
+                            }
+                            else
+#endif
+                            {
+                                /* usually frame_buffer, unless the compressor made a new buffer */
+                                uint8_t *write_buffer = frame_buffer;
+                                uint8_t *compressed_buffer = NULL;
 
-                                    /* set new compressed size and copy buffers */
-                                    frame_size = lzma_out_size + LZMA_PROPS_SIZE + 4;
-                                    memcpy(&frame_buffer[4], lzma_out, frame_size - 4);
+                                if(compress_output)
+                                {
+                                    frame_codec_t out_codec;
+                                    uint32_t compressed_size = 0;
+
+                                    out_codec.codec = compress_codec;
+                                    out_codec.lzma_level = lzma_level;
+                                    out_codec.width = video_xRes;
+                                    out_codec.height = video_yRes;
+                                    out_codec.depth = current_depth;
+                                    out_codec.stored = 0;
+
+                                    int ret = frame_compress(&out_codec, frame_buffer, frame_size, &compressed_buffer, &compressed_size);
+                                    if(ret)
+                                    {
+                                        print_msg(MSG_INFO, "    %s: Failed (%d)\n", frame_codec_name(&out_codec), ret);
+                                        goto abort;
+                                    }
 
                                     if(verbose)
                                     {
-                                        print_msg(MSG_INFO, "    LZMA: "FMT_SIZE" -> "FMT_SIZE"  (%2.2f%%)\n", lzma_in_size, frame_size, ((float)lzma_out_size * 100.0f) / (float)lzma_in_size);
+                                        print_msg(MSG_INFO, "    %s: %d -> %d  (%2.2f%%)\n", frame_codec_name(&out_codec), frame_size, compressed_size, ((float)compressed_size * 100.0f) / (float)frame_size);
                                     }
+                                    frame_size = compressed_size;
+                                    write_buffer = compressed_buffer;
                                 }
-                                else
+
+                                if(frame_size != prev_frame_size)
                                 {
-                                    print_msg(MSG_INFO, "    LZMA: Failed (%d)\n", ret);
-                                    goto abort;
+                                    print_msg(MSG_INFO, "  saving: %d -> %d  (%2.2f%%)\n", prev_frame_size, frame_size, ((float)frame_size * 100.0f) / (float)prev_frame_size);
                                 }
-                                free(lzma_out);
-#else
-                                print_msg(MSG_INFO, "    LZMA: not compiled into this release, aborting.\n");
-                                goto abort;
-#endif
-                            }
-
-                            if(frame_size != prev_frame_size)
-                            {
-                                print_msg(MSG_INFO, "  saving: "FMT_SIZE" -> "FMT_SIZE"  (%2.2f%%)\n", prev_frame_size, frame_size, ((float)frame_size * 100.0f) / (float)prev_frame_size);
-                            }
 
-                            lua_handle_hdr_data(lua_state, buf.blockType, "_data_write_mlv", &block_hdr, sizeof(block_hdr), frame_buffer, frame_size);
+                                lua_handle_hdr_data(lua_state, buf.blockType, "_data_write_mlv", &block_hdr, sizeof(block_hdr), write_buffer, frame_size);
 
-                            /* delete free space and correct header size if needed */
-                            block_hdr.blockSize = sizeof(mlv_vidf_hdr_t) + frame_size;
-                            block_hdr.frameSpace = 0;
-                            block_hdr.frameNumber -= frame_start;
+                                block_hdr.blockSize = sizeof(mlv_vidf_hdr_t) + frame_size;
 
-                            if(fwrite(&block_hdr, sizeof(mlv_vidf_hdr_t), 1, out_file) != 1)
-                            {
-                                print_msg(MSG_ERROR, "VIDF: Failed writing into .MLV file\n");
-                                goto abort;
-                            }
-                            if(fwrite(frame_buffer, frame_size, 1, out_file) != 1)
-                            {
-                                print_msg(MSG_ERROR, "VIDF: Failed writing into .MLV file\n");
-                                goto abort;
+                                if(fwrite(&block_hdr, sizeof(mlv_vidf_hdr_t), 1, out_file) != 1 ||
+                                   fwrite(write_buffer, frame_size, 1, out_file) != 1)
+                                {
+                                    print_msg(MSG_ERROR, "VIDF: Failed writing into .MLV file\n");
+                                    free(compressed_buffer);
+                                    goto abort;
+                                }
+                                free(compressed_buffer);
                             }
                         }
                     }
@@ -2874,7 +4311,8 @@ read_headers:
                         goto abort;
                     }
 
-                    strncpy(info_string, buf, sizeof(info_string));
+                    strncpy(info_string, buf, sizeof(info_string) - 1);
+                    info_string[sizeof(info_string) - 1] = '\000';
 
                     if(verbose)
                     {
@@ -3128,6 +4566,38 @@ read_headers:
                     }
                 }
             }
+            else if(!memcmp(buf.blockType, "DISO", 4))
+            {
+                uint32_t hdr_size = MIN(sizeof(mlv_diso_hdr_t), buf.blockSize);
+
+                if(fread(&diso_info, hdr_size, 1, in_file) != 1)
+                {
+                    print_msg(MSG_ERROR, "File ends in the middle of a block\n");
+                    goto abort;
+                }
+
+                /* skip remaining data, if there is any */
+                file_set_pos(in_file, position + diso_info.blockSize, SEEK_SET);
+
+                lua_handle_hdr(lua_state, buf.blockType, &diso_info, sizeof(diso_info));
+
+                if(verbose)
+                {
+                    print_msg(MSG_INFO, "     Mode:   %d\n", diso_info.dualMode);
+                    print_msg(MSG_INFO, "     ISO:    %d\n", diso_info.isoValue);
+                }
+
+                if(mlv_output && !no_metadata_mode && (!extract_block || !strncasecmp(extract_block, (char*)diso_info.blockType, 4)))
+                {
+                    /* correct header size if needed */
+                    diso_info.blockSize = sizeof(mlv_diso_hdr_t);
+                    if(fwrite(&diso_info, diso_info.blockSize, 1, out_file) != 1)
+                    {
+                        print_msg(MSG_ERROR, "Failed writing into .MLV file\n");
+                        goto abort;
+                    }
+                }
+            }
             else if(!memcmp(buf.blockType, "IDNT", 4))
             {
                 uint32_t hdr_size = MIN(sizeof(mlv_idnt_hdr_t), buf.blockSize);
@@ -3534,6 +5004,19 @@ read_headers:
 
 abort:
 
+#ifdef MLV_USE_THREADS
+    /* wait until all frames still in the pipeline are written */
+    int pipeline_ret = mlv_pipeline_finish(pipeline);
+    pipeline_ret |= mlv_pipeline_finish(encoder);
+    if(pipeline_ret)
+    {
+        print_msg(MSG_ERROR, "Failed writing some of the frames\n");
+    }
+    codec_job_decoder_finish(decoder, &decoder_opts);
+#endif
+
+    cr2hdr_clip_free(frame_job_opts.dual_iso_clip);
+
     print_msg(MSG_INFO, "Processed %d video frames\n", vidf_frames_processed);
 
     /* in average mode, finalize average calculation and output the resulting average */
@@ -3584,6 +5067,7 @@ abort:
                 }
             }
             
+            /* frames were summed up, so the line buffer is large enough */
             for(int y = 0; y < video_yRes; y++)
             {
                 uint16_t *dst_line = (uint16_t *)&frame_buffer[y * new_pitch];
@@ -3592,8 +5076,9 @@ abort:
                     uint32_t value = frame_arith_buffer[y * video_xRes + x];
 
                     value /= average_samples;
-                    bitinsert(dst_line, x, lv_rec_footer.raw_info.bits_per_pixel, value);
+                    line_buffer[x] = value;
                 }
+                raw_pack_line(line_buffer, dst_line, video_xRes, lv_rec_footer.raw_info.bits_per_pixel);
             }
             
 
@@ -3654,6 +5139,7 @@ abort:
         
         main_header.videoFrameCount = vidf_frames_processed;
         main_header.audioFrameCount = audf_frames_processed;
+        main_header.videoClass = out_video_class;
 
         fseek(out_file, 0L, SEEK_SET);
         
@@ -3701,7 +5187,8 @@ abort:
     free(output_filename);
     free(prev_frame_buffer);
     free(frame_arith_buffer);
-    free(block_xref);
+    free(line_buffer);
+    mlv_reader_close(reader);
 
     print_msg(MSG_INFO, "Done\n");
     print_msg(MSG_INFO, "\n");
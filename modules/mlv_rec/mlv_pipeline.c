@@ -0,0 +1,295 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "mlv_pipeline.h"
+
+#define SLOT_FREE       0
+#define SLOT_QUEUED     1
+#define SLOT_BUSY       2
+#define SLOT_DONE       3
+
+typedef struct
+{
+    void *job;
+    uint32_t state;
+} pipeline_slot_t;
+
+struct mlv_pipeline
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    pthread_t *workers;
+    pthread_t writer;
+    int threads;
+
+    /* ring of 'depth' slots, indexed by the job sequence number */
+    pipeline_slot_t *slots;
+    uint32_t depth;
+
+    uint32_t next_submit;
+    uint32_t next_process;
+    uint32_t next_write;
+
+    int finishing;
+    int error;
+
+    mlv_pipeline_process_t process;
+    mlv_pipeline_write_t write;
+    void *ctx;
+};
+
+static void *pipeline_worker(void *arg)
+{
+    mlv_pipeline_t *p = arg;
+
+    pthread_mutex_lock(&p->lock);
+    while(1)
+    {
+        /* skip over jobs that were passed through without processing */
+        if(p->next_process < p->next_write)
+        {
+            p->next_process = p->next_write;
+        }
+        while(p->next_process != p->next_submit && p->slots[p->next_process % p->depth].state != SLOT_QUEUED)
+        {
+            p->next_process++;
+        }
+
+        if(p->next_process == p->next_submit)
+        {
+            if(p->finishing)
+            {
+                break;
+            }
+            pthread_cond_wait(&p->changed, &p->lock);
+            continue;
+        }
+
+        pipeline_slot_t *slot = &p->slots[p->next_process % p->depth];
+        slot->state = SLOT_BUSY;
+        p->next_process++;
+        pthread_mutex_unlock(&p->lock);
+
+        p->process(p->ctx, slot->job);
+
+        pthread_mutex_lock(&p->lock);
+        slot->state = SLOT_DONE;
+        pthread_cond_broadcast(&p->changed);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+static void *pipeline_writer(void *arg)
+{
+    mlv_pipeline_t *p = arg;
+
+    pthread_mutex_lock(&p->lock);
+    while(1)
+    {
+        if(p->next_write == p->next_submit)
+        {
+            if(p->finishing)
+            {
+                break;
+            }
+            pthread_cond_wait(&p->changed, &p->lock);
+            continue;
+        }
+
+        pipeline_slot_t *slot = &p->slots[p->next_write % p->depth];
+
+        /* strictly in order: wait for exactly this job, even if later ones are done already */
+        if(slot->state != SLOT_DONE)
+        {
+            pthread_cond_wait(&p->changed, &p->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&p->lock);
+
+        int ret = p->write(p->ctx, slot->job);
+
+        pthread_mutex_lock(&p->lock);
+        if(ret)
+        {
+            p->error = ret;
+        }
+        slot->job = NULL;
+        slot->state = SLOT_FREE;
+        p->next_write++;
+        pthread_cond_broadcast(&p->changed);
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    return NULL;
+}
+
+mlv_pipeline_t *mlv_pipeline_create(int threads, int depth, mlv_pipeline_process_t process, mlv_pipeline_write_t write, void *ctx)
+{
+    mlv_pipeline_t *p = calloc(1, sizeof(mlv_pipeline_t));
+
+    if(!p)
+    {
+        return NULL;
+    }
+
+    p->threads = threads < 1 ? 1 : threads;
+    p->depth = depth < p->threads ? p->threads : depth;
+    p->process = process;
+    p->write = write;
+    p->ctx = ctx;
+
+    p->slots = calloc(p->depth, sizeof(pipeline_slot_t));
+    p->workers = calloc(p->threads, sizeof(pthread_t));
+
+    if(!p->slots || !p->workers)
+    {
+        free(p->slots);
+        free(p->workers);
+        free(p);
+        return NULL;
+    }
+
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->changed, NULL);
+
+    for(int thread = 0; thread < p->threads; thread++)
+    {
+        pthread_create(&p->workers[thread], NULL, pipeline_worker, p);
+    }
+
+    /* without write callback, the caller picks up the results with mlv_pipeline_fetch */
+    if(p->write)
+    {
+        pthread_create(&p->writer, NULL, pipeline_writer, p);
+    }
+
+    return p;
+}
+
+int mlv_pipeline_submit(mlv_pipeline_t *p, void *job, int mode)
+{
+    pthread_mutex_lock(&p->lock);
+
+    pipeline_slot_t *slot = &p->slots[p->next_submit % p->depth];
+
+    while(slot->state != SLOT_FREE && !p->error)
+    {
+        pthread_cond_wait(&p->changed, &p->lock);
+    }
+
+    if(p->error)
+    {
+        int ret = p->error;
+        pthread_mutex_unlock(&p->lock);
+        return ret;
+    }
+
+    slot->job = job;
+    slot->state = (mode == MLV_PIPELINE_PROCESS) ? SLOT_QUEUED : SLOT_DONE;
+    p->next_submit++;
+
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+
+    return 0;
+}
+
+void *mlv_pipeline_fetch(mlv_pipeline_t *p)
+{
+    pthread_mutex_lock(&p->lock);
+
+    if(p->next_write == p->next_submit)
+    {
+        pthread_mutex_unlock(&p->lock);
+        return NULL;
+    }
+
+    pipeline_slot_t *slot = &p->slots[p->next_write % p->depth];
+
+    while(slot->state != SLOT_DONE)
+    {
+        pthread_cond_wait(&p->changed, &p->lock);
+    }
+
+    void *job = slot->job;
+    slot->job = NULL;
+    slot->state = SLOT_FREE;
+    p->next_write++;
+
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+
+    return job;
+}
+
+int mlv_pipeline_drain(mlv_pipeline_t *p)
+{
+    pthread_mutex_lock(&p->lock);
+
+    while(p->next_write != p->next_submit)
+    {
+        pthread_cond_wait(&p->changed, &p->lock);
+    }
+
+    int ret = p->error;
+    pthread_mutex_unlock(&p->lock);
+
+    return ret;
+}
+
+int mlv_pipeline_finish(mlv_pipeline_t *p)
+{
+    if(!p)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    p->finishing = 1;
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+
+    for(int thread = 0; thread < p->threads; thread++)
+    {
+        pthread_join(p->workers[thread], NULL);
+    }
+    if(p->write)
+    {
+        pthread_join(p->writer, NULL);
+    }
+
+    int ret = p->error;
+
+    pthread_cond_destroy(&p->changed);
+    pthread_mutex_destroy(&p->lock);
+    free(p->workers);
+    free(p->slots);
+    free(p);
+
+    return ret;
+}
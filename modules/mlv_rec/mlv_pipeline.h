@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __MLV_PIPELINE_H__
+#define __MLV_PIPELINE_H__
+
+/*
+ * reader -> N workers -> ordered writer pipeline for the host tools.
+ *
+ * the reader (caller) submits jobs in file order. jobs flagged for processing
+ * are handed to one of the worker threads, all others are passed straight on.
+ * the writer thread always receives the jobs in the order they were submitted,
+ * so output files are identical to a single threaded run.
+ *
+ * the write callback owns the job afterwards and has to release it.
+ * without a write callback there is no writer thread, the caller gets the
+ * processed jobs back in submission order with mlv_pipeline_fetch instead.
+ */
+
+#define MLV_PIPELINE_PASS      0
+#define MLV_PIPELINE_PROCESS   1
+
+typedef struct mlv_pipeline mlv_pipeline_t;
+
+typedef void (*mlv_pipeline_process_t)(void *ctx, void *job);
+typedef int (*mlv_pipeline_write_t)(void *ctx, void *job);
+
+/* threads: number of worker threads, depth: max number of jobs in flight */
+mlv_pipeline_t *mlv_pipeline_create(int threads, int depth, mlv_pipeline_process_t process, mlv_pipeline_write_t write, void *ctx);
+
+/* blocks while the pipeline is full. returns non-zero if the writer failed, the job is not queued then */
+int mlv_pipeline_submit(mlv_pipeline_t *pipeline, void *job, int mode);
+
+/* next processed job in submission order, blocks until it is done. NULL if nothing is queued. only without write callback */
+void *mlv_pipeline_fetch(mlv_pipeline_t *pipeline);
+
+/* wait until all submitted jobs are written. returns the writer status */
+int mlv_pipeline_drain(mlv_pipeline_t *pipeline);
+
+/* wait until all submitted jobs are written, stop the threads and free the pipeline. returns the writer status.
+   without write callback, all jobs have to be fetched before */
+int mlv_pipeline_finish(mlv_pipeline_t *pipeline);
+
+#endif
@@ -0,0 +1,608 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#if defined(__WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "../../src/raw.h"
+#include "mlv.h"
+#include "mlv_reader.h"
+
+/* mappings start at a multiple of this, it covers the page size and the windows allocation granularity */
+#define MLV_READER_ALIGN    0x10000ULL
+
+/* window size per chunk if the whole chunk can't be mapped */
+#define MLV_READER_WINDOW   (64ULL * 1024 * 1024)
+
+#define MLV_READER_MAX_CHUNKS   101
+
+#define NO_ENTRY    0xFFFFFFFF
+
+/* not declared in strict c99 mode */
+char *strdup(const char *s);
+
+typedef struct
+{
+#if defined(__WIN32)
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+    uint64_t size;
+
+    /* currently mapped range */
+    uint8_t *window;
+    uint64_t window_offset;
+    uint64_t window_size;
+} mlv_chunk_t;
+
+struct mlv_reader
+{
+    char *filename;
+    mlv_chunk_t chunks[MLV_READER_MAX_CHUNKS];
+    int chunk_count;
+
+    /* XREF block in the same layout as stored in .IDX files */
+    mlv_xref_hdr_t *xref;
+    mlv_xref_t *xrefs;
+
+    /* XREF entry for every VIDF frame number, built on first use */
+    uint32_t *frame_entries;
+    uint32_t frame_entry_count;
+};
+
+/* used to sort the XREF table */
+typedef struct
+{
+    uint64_t timestamp;
+    mlv_xref_t xref;
+} mlv_reader_sort_t;
+
+static int chunk_open(mlv_chunk_t *chunk, const char *filename)
+{
+    memset(chunk, 0x00, sizeof(mlv_chunk_t));
+
+#if defined(__WIN32)
+    LARGE_INTEGER size;
+
+    chunk->file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if(chunk->file == INVALID_HANDLE_VALUE)
+    {
+        return MLV_READER_ERR_FILE;
+    }
+
+    if(!GetFileSizeEx(chunk->file, &size))
+    {
+        CloseHandle(chunk->file);
+        return MLV_READER_ERR_FILE;
+    }
+    chunk->size = size.QuadPart;
+
+    if(chunk->size)
+    {
+        chunk->mapping = CreateFileMapping(chunk->file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+        if(!chunk->mapping)
+        {
+            CloseHandle(chunk->file);
+            return MLV_READER_ERR_FILE;
+        }
+    }
+#else
+    struct stat st;
+
+    chunk->fd = open(filename, O_RDONLY);
+    if(chunk->fd < 0)
+    {
+        return MLV_READER_ERR_FILE;
+    }
+
+    if(fstat(chunk->fd, &st))
+    {
+        close(chunk->fd);
+        return MLV_READER_ERR_FILE;
+    }
+    chunk->size = st.st_size;
+#endif
+
+    return MLV_READER_OK;
+}
+
+static void chunk_unmap(mlv_chunk_t *chunk)
+{
+    if(!chunk->window)
+    {
+        return;
+    }
+
+#if defined(__WIN32)
+    UnmapViewOfFile(chunk->window);
+#else
+    munmap(chunk->window, chunk->window_size);
+#endif
+
+    chunk->window = NULL;
+    chunk->window_offset = 0;
+    chunk->window_size = 0;
+}
+
+static void chunk_close(mlv_chunk_t *chunk)
+{
+    chunk_unmap(chunk);
+
+#if defined(__WIN32)
+    if(chunk->mapping)
+    {
+        CloseHandle(chunk->mapping);
+    }
+    CloseHandle(chunk->file);
+#else
+    close(chunk->fd);
+#endif
+}
+
+static void *chunk_map(mlv_chunk_t *chunk, uint64_t offset, uint32_t size)
+{
+    if(offset + size > chunk->size || !size)
+    {
+        return NULL;
+    }
+
+    /* already mapped? */
+    if(chunk->window && offset >= chunk->window_offset && offset + size <= chunk->window_offset + chunk->window_size)
+    {
+        return &chunk->window[offset - chunk->window_offset];
+    }
+
+    chunk_unmap(chunk);
+
+    uint64_t start = 0;
+    uint64_t length = chunk->size;
+
+    if(sizeof(void *) < 8)
+    {
+        start = offset & ~(MLV_READER_ALIGN - 1);
+        length = offset + size - start;
+        if(length < MLV_READER_WINDOW)
+        {
+            length = MLV_READER_WINDOW;
+        }
+        if(start + length > chunk->size)
+        {
+            length = chunk->size - start;
+        }
+    }
+
+    /* private mapping, callers may process the data in place without touching the file */
+#if defined(__WIN32)
+    void *window = MapViewOfFile(chunk->mapping, FILE_MAP_COPY, (DWORD)(start >> 32), (DWORD)(start & 0xFFFFFFFF), (SIZE_T)length);
+    if(!window)
+    {
+        return NULL;
+    }
+#else
+    void *window = mmap(NULL, (size_t)length, PROT_READ | PROT_WRITE, MAP_PRIVATE, chunk->fd, (off_t)start);
+    if(window == MAP_FAILED)
+    {
+        return NULL;
+    }
+#endif
+
+    chunk->window = window;
+    chunk->window_offset = start;
+    chunk->window_size = length;
+
+    return &chunk->window[offset - start];
+}
+
+mlv_reader_t *mlv_reader_open(const char *filename)
+{
+    mlv_reader_t *reader = calloc(1, sizeof(mlv_reader_t));
+
+    if(!reader)
+    {
+        return NULL;
+    }
+
+    reader->filename = strdup(filename);
+    if(!reader->filename)
+    {
+        free(reader);
+        return NULL;
+    }
+
+    if(chunk_open(&reader->chunks[0], filename))
+    {
+        free(reader->filename);
+        free(reader);
+        return NULL;
+    }
+    reader->chunk_count = 1;
+
+    /* only .MLV files have .M00, .M01 etc chunks */
+    const char *dot = strrchr(filename, '.');
+    if(dot && !strcasecmp(dot + 1, "mlv"))
+    {
+        char *chunk_name = strdup(filename);
+
+        if(!chunk_name)
+        {
+            mlv_reader_close(reader);
+            return NULL;
+        }
+
+        for(int seq_number = 0; seq_number < 99 && reader->chunk_count < MLV_READER_MAX_CHUNKS; seq_number++)
+        {
+            char seq_name[8];
+
+            sprintf(seq_name, "%02d", seq_number);
+            strcpy(&chunk_name[strlen(chunk_name) - 2], seq_name);
+
+            if(chunk_open(&reader->chunks[reader->chunk_count], chunk_name))
+            {
+                break;
+            }
+            reader->chunk_count++;
+        }
+        free(chunk_name);
+    }
+
+    return reader;
+}
+
+void mlv_reader_close(mlv_reader_t *reader)
+{
+    if(!reader)
+    {
+        return;
+    }
+
+    for(int chunk = 0; chunk < reader->chunk_count; chunk++)
+    {
+        chunk_close(&reader->chunks[chunk]);
+    }
+
+    free(reader->frame_entries);
+    free(reader->xref);
+    free(reader->filename);
+    free(reader);
+}
+
+int mlv_reader_chunk_count(mlv_reader_t *reader)
+{
+    return reader->chunk_count;
+}
+
+void *mlv_reader_map(mlv_reader_t *reader, uint32_t chunk, uint64_t offset, uint32_t size)
+{
+    if(chunk >= (uint32_t)reader->chunk_count)
+    {
+        return NULL;
+    }
+
+    return chunk_map(&reader->chunks[chunk], offset, size);
+}
+
+static void reader_set_xref(mlv_reader_t *reader, mlv_xref_hdr_t *xref)
+{
+    free(reader->frame_entries);
+    reader->frame_entries = NULL;
+    reader->frame_entry_count = 0;
+
+    free(reader->xref);
+    reader->xref = xref;
+    reader->xrefs = (mlv_xref_t *)&xref[1];
+}
+
+int mlv_reader_load_index(mlv_reader_t *reader)
+{
+    mlv_chunk_t idx;
+    char *filename = strdup(reader->filename);
+    int ret = MLV_READER_ERR_INDEX;
+
+    if(!filename)
+    {
+        return MLV_READER_ERR_MALLOC;
+    }
+
+    if(strlen(filename) < 3)
+    {
+        free(filename);
+        return MLV_READER_ERR_INDEX;
+    }
+    strcpy(&filename[strlen(filename) - 3], "IDX");
+
+    if(chunk_open(&idx, filename))
+    {
+        free(filename);
+        return MLV_READER_ERR_INDEX;
+    }
+    free(filename);
+
+    uint64_t offset = 0;
+    while(offset + sizeof(mlv_hdr_t) <= idx.size)
+    {
+        mlv_hdr_t *hdr = chunk_map(&idx, offset, sizeof(mlv_hdr_t));
+
+        if(!hdr || hdr->blockSize < sizeof(mlv_hdr_t))
+        {
+            break;
+        }
+
+        if(!memcmp(hdr->blockType, "XREF", 4))
+        {
+            uint32_t block_size = hdr->blockSize;
+            mlv_xref_hdr_t *block = chunk_map(&idx, offset, block_size);
+
+            if(!block || block_size < sizeof(mlv_xref_hdr_t) + (uint64_t)block->entryCount * sizeof(mlv_xref_t))
+            {
+                break;
+            }
+
+            mlv_xref_hdr_t *xref = malloc(block_size);
+            if(!xref)
+            {
+                ret = MLV_READER_ERR_MALLOC;
+                break;
+            }
+            memcpy(xref, block, block_size);
+
+            /* an index that refers to missing chunks belongs to some other file */
+            mlv_xref_t *xrefs = (mlv_xref_t *)&xref[1];
+            ret = MLV_READER_OK;
+            for(uint32_t entry = 0; entry < xref->entryCount; entry++)
+            {
+                if(xrefs[entry].fileNumber >= reader->chunk_count)
+                {
+                    ret = MLV_READER_ERR_INDEX;
+                    break;
+                }
+            }
+
+            if(ret == MLV_READER_OK)
+            {
+                reader_set_xref(reader, xref);
+            }
+            else
+            {
+                free(xref);
+            }
+            break;
+        }
+
+        offset += hdr->blockSize;
+    }
+
+    chunk_close(&idx);
+
+    return ret;
+}
+
+static int xref_compare(const void *a, const void *b)
+{
+    const mlv_reader_sort_t *entry_a = a;
+    const mlv_reader_sort_t *entry_b = b;
+
+    /* keep the file order for blocks with the same timestamp, like xref_sort in mlv_dump */
+    if(entry_a->timestamp != entry_b->timestamp)
+    {
+        return entry_a->timestamp < entry_b->timestamp ? -1 : 1;
+    }
+    if(entry_a->xref.fileNumber != entry_b->xref.fileNumber)
+    {
+        return entry_a->xref.fileNumber < entry_b->xref.fileNumber ? -1 : 1;
+    }
+    if(entry_a->xref.frameOffset != entry_b->xref.frameOffset)
+    {
+        return entry_a->xref.frameOffset < entry_b->xref.frameOffset ? -1 : 1;
+    }
+    return 0;
+}
+
+int mlv_reader_build_index(mlv_reader_t *reader)
+{
+    mlv_reader_sort_t *entries = NULL;
+    uint32_t entry_count = 0;
+    uint32_t allocated = 0;
+
+    for(int chunk = 0; chunk < reader->chunk_count; chunk++)
+    {
+        uint64_t offset = 0;
+        uint64_t size = reader->chunks[chunk].size;
+
+        /* only the block headers get touched, the frame data is never read */
+        while(offset + sizeof(mlv_hdr_t) <= size)
+        {
+            mlv_hdr_t *hdr = mlv_reader_map(reader, chunk, offset, sizeof(mlv_hdr_t));
+
+            /* a truncated or broken block ends this chunk */
+            if(!hdr || hdr->blockSize < sizeof(mlv_hdr_t) || offset + hdr->blockSize > size)
+            {
+                break;
+            }
+
+            if(memcmp(hdr->blockType, "NULL", 4) && memcmp(hdr->blockType, "BKUP", 4))
+            {
+                if(entry_count >= allocated)
+                {
+                    allocated = allocated ? allocated * 2 : 1024;
+                    mlv_reader_sort_t *new_entries = realloc(entries, allocated * sizeof(mlv_reader_sort_t));
+                    if(!new_entries)
+                    {
+                        free(entries);
+                        return MLV_READER_ERR_MALLOC;
+                    }
+                    entries = new_entries;
+                }
+
+                mlv_reader_sort_t *entry = &entries[entry_count++];
+                memset(entry, 0x00, sizeof(mlv_reader_sort_t));
+
+                entry->timestamp = !memcmp(hdr->blockType, "MLVI", 4) ? 0 : hdr->timestamp;
+                entry->xref.fileNumber = chunk;
+                entry->xref.frameOffset = offset;
+                entry->xref.frameType =
+                    !memcmp(hdr->blockType, "VIDF", 4) ? MLV_FRAME_VIDF :
+                    !memcmp(hdr->blockType, "AUDF", 4) ? MLV_FRAME_AUDF :
+                    MLV_FRAME_UNSPECIFIED;
+            }
+
+            offset += hdr->blockSize;
+        }
+    }
+
+    qsort(entries, entry_count, sizeof(mlv_reader_sort_t), &xref_compare);
+
+    uint32_t block_size = sizeof(mlv_xref_hdr_t) + entry_count * sizeof(mlv_xref_t);
+    mlv_xref_hdr_t *xref = malloc(block_size);
+    if(!xref)
+    {
+        free(entries);
+        return MLV_READER_ERR_MALLOC;
+    }
+
+    memset(xref, 0x00, sizeof(mlv_xref_hdr_t));
+    memcpy(xref->blockType, "XREF", 4);
+    xref->blockSize = block_size;
+    xref->entryCount = entry_count;
+
+    mlv_xref_t *xrefs = (mlv_xref_t *)&xref[1];
+    for(uint32_t entry = 0; entry < entry_count; entry++)
+    {
+        xrefs[entry] = entries[entry].xref;
+    }
+    free(entries);
+
+    reader_set_xref(reader, xref);
+
+    return MLV_READER_OK;
+}
+
+mlv_xref_hdr_t *mlv_reader_get_xref(mlv_reader_t *reader)
+{
+    return reader->xref;
+}
+
+mlv_hdr_t *mlv_reader_get_block(mlv_reader_t *reader, uint32_t entry)
+{
+    if(!reader->xref || entry >= reader->xref->entryCount)
+    {
+        return NULL;
+    }
+
+    mlv_xref_t *xref = &reader->xrefs[entry];
+    mlv_hdr_t *hdr = mlv_reader_map(reader, xref->fileNumber, xref->frameOffset, sizeof(mlv_hdr_t));
+    if(!hdr)
+    {
+        return NULL;
+    }
+
+    return mlv_reader_map(reader, xref->fileNumber, xref->frameOffset, hdr->blockSize);
+}
+
+static int reader_build_frame_table(mlv_reader_t *reader)
+{
+    uint32_t max_frame = 0;
+    uint32_t count = 0;
+
+    for(uint32_t entry = 0; entry < reader->xref->entryCount; entry++)
+    {
+        mlv_xref_t *xref = &reader->xrefs[entry];
+
+        if(xref->frameType == MLV_FRAME_VIDF)
+        {
+            mlv_vidf_hdr_t *vidf = mlv_reader_map(reader, xref->fileNumber, xref->frameOffset, sizeof(mlv_vidf_hdr_t));
+            if(vidf && vidf->frameNumber >= max_frame)
+            {
+                max_frame = vidf->frameNumber;
+                count = max_frame + 1;
+            }
+        }
+    }
+
+    /* at least one entry, so an empty table is not mistaken for "not built yet" */
+    uint32_t allocated = count ? count : 1;
+
+    reader->frame_entries = malloc(allocated * sizeof(uint32_t));
+    if(!reader->frame_entries)
+    {
+        return MLV_READER_ERR_MALLOC;
+    }
+    memset(reader->frame_entries, 0xFF, allocated * sizeof(uint32_t));
+    reader->frame_entry_count = count;
+
+    for(uint32_t entry = 0; entry < reader->xref->entryCount; entry++)
+    {
+        mlv_xref_t *xref = &reader->xrefs[entry];
+
+        if(xref->frameType == MLV_FRAME_VIDF)
+        {
+            mlv_vidf_hdr_t *vidf = mlv_reader_map(reader, xref->fileNumber, xref->frameOffset, sizeof(mlv_vidf_hdr_t));
+
+            /* in case of duplicates, the first one in timestamp order wins */
+            if(vidf && reader->frame_entries[vidf->frameNumber] == NO_ENTRY)
+            {
+                reader->frame_entries[vidf->frameNumber] = entry;
+            }
+        }
+    }
+
+    return MLV_READER_OK;
+}
+
+mlv_vidf_hdr_t *mlv_reader_get_frame(mlv_reader_t *reader, uint32_t frame_number)
+{
+    if(!reader->xref)
+    {
+        return NULL;
+    }
+
+    if(!reader->frame_entries && reader_build_frame_table(reader))
+    {
+        return NULL;
+    }
+
+    if(frame_number >= reader->frame_entry_count || reader->frame_entries[frame_number] == NO_ENTRY)
+    {
+        return NULL;
+    }
+
+    mlv_vidf_hdr_t *vidf = (mlv_vidf_hdr_t *)mlv_reader_get_block(reader, reader->frame_entries[frame_number]);
+
+    /* make sure the header tells the truth about the frame data */
+    if(!vidf || vidf->blockSize < sizeof(mlv_vidf_hdr_t) || vidf->frameSpace > vidf->blockSize - sizeof(mlv_vidf_hdr_t))
+    {
+        return NULL;
+    }
+
+    return vidf;
+}
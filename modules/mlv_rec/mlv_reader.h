@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#ifndef __MLV_READER_H__
+#define __MLV_READER_H__
+
+/*
+ * random access reader for (multi-chunk) MLV files on the host.
+ *
+ * all chunks (.MLV, .M00, .M01, ...) are memory mapped, so blocks are served as
+ * pointers into the mapping without copying. the XREF table is either loaded
+ * from the .IDX file or built once by walking the block headers.
+ *
+ * on 64 bit hosts every chunk is mapped as a whole. 32 bit hosts don't have the
+ * address space for that, there every chunk gets a sliding window instead.
+ * so a returned pointer is only valid until the next call for the same chunk.
+ *
+ * include mlv.h before this file.
+ */
+
+#define MLV_READER_OK            0
+#define MLV_READER_ERR_FILE     -1
+#define MLV_READER_ERR_MALLOC   -2
+#define MLV_READER_ERR_INDEX    -3
+
+typedef struct mlv_reader mlv_reader_t;
+
+/* open the given file and all of its chunks. returns NULL if the first file can't be opened */
+mlv_reader_t *mlv_reader_open(const char *filename);
+void mlv_reader_close(mlv_reader_t *reader);
+
+int mlv_reader_chunk_count(mlv_reader_t *reader);
+
+/* load the XREF table from the .IDX file. returns MLV_READER_ERR_INDEX if there is none */
+int mlv_reader_load_index(mlv_reader_t *reader);
+
+/* build the XREF table by walking the block headers of all chunks */
+int mlv_reader_build_index(mlv_reader_t *reader);
+
+/* XREF block (header followed by entryCount mlv_xref_t) in timestamp order, NULL without index */
+mlv_xref_hdr_t *mlv_reader_get_xref(mlv_reader_t *reader);
+
+/* map 'size' bytes at 'offset' of the given chunk, NULL if out of range */
+void *mlv_reader_map(mlv_reader_t *reader, uint32_t chunk, uint64_t offset, uint32_t size);
+
+/* whole block of the given XREF entry */
+mlv_hdr_t *mlv_reader_get_block(mlv_reader_t *reader, uint32_t entry);
+
+/* VIDF block with the given frame number, NULL if there is no such frame. the frame data is at frameSpace after the header */
+mlv_vidf_hdr_t *mlv_reader_get_frame(mlv_reader_t *reader, uint32_t frame_number);
+
+#endif
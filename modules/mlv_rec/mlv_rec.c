@@ -208,10 +208,11 @@ static int32_t fullsize_buffer_pos = 0;               /* which of the full size
 
 static struct frame_slot slots[512];              /* frame slots */
 static struct frame_slot_group slot_groups[512];
-static int32_t slot_count = 0;                        /* how many frame slots we have */
-static int32_t slot_group_count = 0;
-static int32_t capture_slot = -1;                     /* in what slot are we capturing now (index) */
-static volatile int32_t force_new_buffer = 0;         /* if some other task decides it's better to search for a new buffer */
+static struct mlv_rec_sched sched = {               /* slot allocator and write scheduler state, see mlv_rec_sched.c */
+    .slots = slots,
+    .groups = slot_groups,
+    .capture_slot = -1,
+};
 
 static int32_t frame_count = 0;                       /* how many frames we have processed */
 static int32_t frame_skips = 0;                       /* how many frames were dropped/skipped */
@@ -653,24 +654,7 @@ static char* guess_aspect_ratio(int32_t res_x, int32_t res_y)
 static int32_t predict_frames(int32_t write_speed)
 {
     int32_t slot_size = frame_size + 64 + raw_rec_edmac_align + raw_rec_write_align;
-    int32_t fps = fps_get_current_x1000();
-    int32_t capture_speed = slot_size / 1000 * fps;
-    int32_t buffer_fill_speed = capture_speed - write_speed;
-
-    if (buffer_fill_speed <= 0)
-    {
-        return INT_MAX;
-    }
-
-    int32_t write_size = 0;
-    for (int32_t group = 0; group < slot_group_count; group++)
-    {
-        write_size += slot_groups[group].size;
-    }
-
-    float buffer_fill_time = write_size / (float) buffer_fill_speed;
-    int32_t frames = buffer_fill_time * fps / 1000;
-    return frames;
+    return mlv_rec_sched_predict_frames(&sched, slot_size, fps_get_current_x1000(), write_speed);
 }
 
 /* how many frames can we record with current settings, without dropping? */
@@ -887,7 +871,7 @@ static void setup_chunk(uint32_t ptr, uint32_t size)
     uint32_t max_slot_size = raw_rec_write_align + sizeof(mlv_vidf_hdr_t) + raw_rec_edmac_align + frame_size + raw_rec_write_align;
 
     /* fit as many frames as we can */
-    while (size >= max_slot_size && (slot_count < COUNT(slots)))
+    while (size >= max_slot_size && (sched.slot_count < COUNT(slots)))
     {
         /* align slots so that they start at a write align boundary */
         uint32_t pre_align = calc_padding(ptr, raw_rec_write_align);
@@ -919,27 +903,27 @@ static void setup_chunk(uint32_t ptr, uint32_t size)
         }
 
         /* store this slot */
-        slots[slot_count].ptr = (void*)(ptr + pre_align);
-        slots[slot_count].status = SLOT_FREE;
-        slots[slot_count].size = vidf_hdr->blockSize + write_size_align;
-        slots[slot_count].blockSize = vidf_hdr->blockSize;
-        slots[slot_count].frameSpace = vidf_hdr->frameSpace;
+        slots[sched.slot_count].ptr = (void*)(ptr + pre_align);
+        slots[sched.slot_count].status = SLOT_FREE;
+        slots[sched.slot_count].size = vidf_hdr->blockSize + write_size_align;
+        slots[sched.slot_count].blockSize = vidf_hdr->blockSize;
+        slots[sched.slot_count].frameSpace = vidf_hdr->frameSpace;
 
         trace_write(raw_rec_trace_ctx, "  slot %3d: base 0x%08X, end 0x%08X, aligned 0x%08X, data 0x%08X, size 0x%X (pre 0x%08X, edmac 0x%04X, write 0x%04X)",
-            slot_count, ptr, (slots[slot_count].ptr + slots[slot_count].size), slots[slot_count].ptr, dataStart + vidf_hdr->frameSpace, slots[slot_count].size, pre_align, edmac_size_align, write_size_align);
+            sched.slot_count, ptr, (slots[sched.slot_count].ptr + slots[sched.slot_count].size), slots[sched.slot_count].ptr, dataStart + vidf_hdr->frameSpace, slots[sched.slot_count].size, pre_align, edmac_size_align, write_size_align);
 
-        if(slots[slot_count].size > (int32_t)max_slot_size)
+        if(slots[sched.slot_count].size > (int32_t)max_slot_size)
         {
-            trace_write(raw_rec_trace_ctx, "  slot %3d: ERROR - size too large", slot_count);
+            trace_write(raw_rec_trace_ctx, "  slot %3d: ERROR - size too large", sched.slot_count);
             beep(4);
         }
 
         /* update counters and pointers */
-        ptr += slots[slot_count].size;
+        ptr += slots[sched.slot_count].size;
         ptr += pre_align;
-        size -= slots[slot_count].size;
+        size -= slots[sched.slot_count].size;
         size -= pre_align;
-        slot_count++;
+        sched.slot_count++;
     }
 
     trace_flush(raw_rec_trace_ctx);
@@ -1070,8 +1054,8 @@ static int32_t setup_buffers()
 {
     uint32_t total_size = 0;
     
-    slot_count = 0;
-    slot_group_count = 0;
+    sched.slot_count = 0;
+    sched.group_count = 0;
 
     /* allocate memory for double buffering */
     /* (we need a single large contiguous chunk) */
@@ -1110,91 +1094,23 @@ static int32_t setup_buffers()
 
     if(DISPLAY_REC_INFO_DEBUG)
     {
-        bmp_printf(FONT_MED, 30, 90, "buffer size: %d frames", slot_count);
+        bmp_printf(FONT_MED, 30, 90, "buffer size: %d frames", sched.slot_count);
     }
 
     /* we need at least 3 slots */
-    if (slot_count < 3)
+    if (sched.slot_count < 3)
     {
         return 0;
     }
 
     trace_write(raw_rec_trace_ctx, "Building a group list...");
-    uint32_t block_start = 0;
-    uint32_t block_len = 0;
-    uint32_t block_size = 0;
-    uint32_t last_slot_end = 0;
-
-    /* this loop goes one slot behind the end */
-    for(int32_t slot = 0; slot <= slot_count; slot++)
-    {
-        uint32_t slot_start = 0;
-        uint32_t slot_end = 0;
-
-        if(slot < slot_count)
-        {
-            slot_start = (uint32_t) slots[slot].ptr;
-            slot_end = slot_start + slots[slot].size;
-        }
-
-        /* the first time, on a non contiguous area or the last frame (its == slot_count) reset all counters */
-        uint32_t non_contig = slot_start != last_slot_end;
-        uint32_t last_iteration = slot == slot_count;
-
-        if((block_len != 0) && (non_contig || last_iteration))
-        {
-            slot_groups[slot_group_count].slot = block_start;
-            slot_groups[slot_group_count].len = block_len;
-            slot_groups[slot_group_count].size = block_size;
-
-            trace_write(raw_rec_trace_ctx, "group: %d block_len: %d block_start: %d", slot_group_count, block_len, block_start);
-            slot_group_count++;
-
-            if(slot == slot_count)
-            {
-                break;
-            }
-            block_len = 0;
-        }
-
-        if(slot < slot_count)
-        {
-            if(block_len == 0)
-            {
-                block_len = 1;
-                block_start = slot;
-                block_size = slots[slot].size;
-            }
-            else
-            {
-                /* its a contiguous area, increase counters */
-                block_len++;
-                block_size += slots[slot].size;
-            }
-        }
-        last_slot_end = slot_end;
-    }
-
-    /* hackish bubble sort group list */
-    trace_write(raw_rec_trace_ctx, "Sorting group list...");
-    int n = slot_group_count;
-    do
-    {
-        int newn = 1;
-        for(int i = 0; i < n-1; ++i)
-        {
-            if(slot_groups[i].len < slot_groups[i+1].len)
-            {
-                struct frame_slot_group tmp = slot_groups[i+1];
-                slot_groups[i+1] = slot_groups[i];
-                slot_groups[i] = tmp;
-                newn = i + 1;
-            }
-        }
-        n = newn;
-    } while (n > 1);
+    sched.buffer_fill_method = buffer_fill_method;
+    sched.fast_card_buffers = fast_card_buffers;
+    sched.allow_frame_skip = allow_frame_skip;
+    mlv_rec_sched_reset_speed(&sched);
+    mlv_rec_sched_build_groups(&sched);
 
-    for(int group = 0; group < slot_group_count; group++)
+    for(int group = 0; group < sched.group_count; group++)
     {
         trace_write(raw_rec_trace_ctx, "group: %d length: %d slot: %d", group, slot_groups[group].len, slot_groups[group].slot);
     }
@@ -1207,28 +1123,15 @@ static int32_t setup_buffers()
     return 1;
 }
 
-static int32_t get_free_slots()
-{
-    int32_t free_slots = 0;
-    for (int32_t i = 0; i < slot_count; i++)
-    {
-        if (slots[i].status == SLOT_FREE)
-        {
-            free_slots++;
-        }
-    }
-    return free_slots;
-}
-
 static void show_buffer_status()
 {
     if (!liveview_display_idle()) return;
     
-    int32_t scale = MAX(1, (300 / slot_count + 1) & ~1);
+    int32_t scale = MAX(1, (300 / sched.slot_count + 1) & ~1);
     int32_t x = 30;
     int32_t y = 50;
 
-    for (int32_t group = 0; group < slot_group_count; group++)
+    for (int32_t group = 0; group < sched.group_count; group++)
     {
         for (int32_t slot = slot_groups[group].slot; slot < (slot_groups[group].slot + slot_groups[group].len); slot++)
         {
@@ -1285,11 +1188,11 @@ static void show_buffer_status()
 
     if(show_graph && (!frame_skips || allow_frame_skip))
     {
-        int32_t free = get_free_slots();
+        int32_t free = mlv_rec_sched_free_slots(&sched);
         int32_t ymin = 190;
         int32_t ymax = 400;
         int32_t x = frame_count % 720;
-        int32_t y_fill = ymin + free * (ymax - ymin) / slot_count;
+        int32_t y_fill = ymin + free * (ymax - ymin) / sched.slot_count;
         int32_t y_rate_0 = ymin + (ymax - ymin) - (current_write_speed[0] * (ymax - ymin) / 11000);
         int32_t y_rate_1 = ymin + (ymax - ymin) - (current_write_speed[1] * (ymax - ymin) / 11000);
 
@@ -1784,68 +1687,13 @@ void mlv_rec_set_rel_timestamp(mlv_hdr_t *hdr, uint64_t timestamp)
 /* this can be called from anywhere to get a free memory slot. must be submitted using mlv_rec_release_slot() */
 int32_t mlv_rec_get_free_slot()
 {
-    uint32_t retries = 0;
-    int32_t allocated_slot = -1;
-
-retry_find:
-    allocated_slot = -1;
-
-    /* find a slot in the smallest groups first */
-    for(int32_t group = slot_group_count - 1; group >= 0 ; group--)
-    {
-        for (int32_t slot = slot_groups[group].slot; slot < (slot_groups[group].slot + slot_groups[group].len); slot++)
-        {
-            /* check for the slot being ready for saving */
-            if(slots[slot].status == SLOT_FREE)
-            {
-                allocated_slot = slot;
-                break;
-            }
-        }
-
-        /* already found one? */
-        if(allocated_slot >= 0)
-        {
-            break;
-        }
-    }
-
-    /* now try to mark this slot as being used */
-    if(allocated_slot >= 0)
-    {
-        uint32_t old_int = cli();
-        if(slots[allocated_slot].status == SLOT_FREE)
-        {
-            slots[allocated_slot].status = SLOT_LOCKED;
-        }
-        else
-        {
-            allocated_slot = -1;
-        }
-        sei(old_int);
-    }
-
-    /* ok now check if allocation was successful and retry */
-    if(allocated_slot < 0)
-    {
-        retries++;
-        if(retries < 5)
-        {
-            goto retry_find;
-        }
-        else
-        {
-            return -1;
-        }
-    }
-
-    return allocated_slot;
+    return mlv_rec_sched_get_free_slot(&sched);
 }
 
 
 void mlv_rec_get_slot_info(int32_t slot, uint32_t *size, void **address)
 {
-    if(slot < 0 || slot >= slot_count)
+    if(slot < 0 || slot >= sched.slot_count)
     {
         *address = NULL;
         *size = 0;
@@ -1876,7 +1724,7 @@ void mlv_rec_get_slot_info(int32_t slot, uint32_t *size, void **address)
 /* mark a previously with mlv_rec_get_free_slot() allocated slot for being reused or written into the file */
 void mlv_rec_release_slot(int32_t slot, uint32_t write)
 {
-    if(slot < 0 || slot >= slot_count)
+    if(slot < 0 || slot >= sched.slot_count)
     {
         return;
     }
@@ -1891,159 +1739,6 @@ void mlv_rec_release_slot(int32_t slot, uint32_t write)
     }
 }
 
-static int32_t FAST choose_next_capture_slot()
-{
-    uint32_t retries = 0;
-    int32_t allocated_slot = -1;
-
-retry_find:
-    allocated_slot = -1;
-
-    switch(buffer_fill_method)
-    {
-        case 0:
-            /* new: return next free slot for out-of-order writing */
-            for(int32_t slot = 0; slot < slot_count; slot++)
-            {
-                if(slots[slot].status == SLOT_FREE)
-                {
-                    allocated_slot = slot;
-                    break;
-                }
-            }
-            break;
-
-        case 4:
-        case 1:
-            /* new method: first fill largest group */
-            for (int32_t group = 0; group < slot_group_count; group++)
-            {
-                for (int32_t slot = slot_groups[group].slot; slot < (slot_groups[group].slot + slot_groups[group].len); slot++)
-                {
-                    if (slots[slot].status == SLOT_FREE)
-                    {
-                        allocated_slot = slot;
-                        break;
-                    }
-                }
-
-                /* already found one? */
-                if(allocated_slot >= 0)
-                {
-                    break;
-                }
-            }
-            break;
-
-        case 3:
-            /* new method: first fill largest groups */
-            for (int32_t group = 0; group < fast_card_buffers; group++)
-            {
-                for (int32_t slot = slot_groups[group].slot; slot < (slot_groups[group].slot + slot_groups[group].len); slot++)
-                {
-                    if (slots[slot].status == SLOT_FREE)
-                    {
-                        allocated_slot = slot;
-                        break;
-                    }
-                }
-
-                /* already found one? */
-                if(allocated_slot >= 0)
-                {
-                    break;
-                }
-            }
-
-            /* fall through */
-
-        case 2:
-        default:
-            /* keep on rolling? */
-            /* O(1) */
-            if (capture_slot >= 0 && capture_slot + 1 < slot_count)
-            {
-                if(slots[capture_slot + 1].ptr == slots[capture_slot].ptr + slots[capture_slot].size &&
-                   slots[capture_slot + 1].status == SLOT_FREE && !force_new_buffer )
-                return capture_slot + 1;
-            }
-
-            /* choose a new buffer? */
-            /* choose the largest contiguous free section */
-            /* O(n), n = slot_count */
-            int32_t len = 0;
-            void* prev_ptr = PTR_INVALID;
-            int32_t prev_blockSize = 0;
-            int32_t best_len = 0;
-            for (int32_t i = 0; i < slot_count; i++)
-            {
-                if (slots[i].status == SLOT_FREE)
-                {
-                    if (slots[i].ptr == prev_ptr + prev_blockSize)
-                    {
-                        len++;
-                        prev_ptr = slots[i].ptr;
-                        prev_blockSize = slots[i].size;
-                        if (len > best_len)
-                        {
-                            best_len = len;
-                            allocated_slot = i - len + 1;
-                        }
-                    }
-                    else
-                    {
-                        len = 1;
-                        prev_ptr = slots[i].ptr;
-                        prev_blockSize = slots[i].size;
-                        if (len > best_len)
-                        {
-                            best_len = len;
-                            allocated_slot = i;
-                        }
-                    }
-                }
-                else
-                {
-                    len = 0;
-                    prev_ptr = PTR_INVALID;
-                }
-            }
-
-            break;
-    }
-
-    /* now try to mark this slot as being used */
-    if(allocated_slot >= 0)
-    {
-        uint32_t old_int = cli();
-        if(slots[allocated_slot].status == SLOT_FREE)
-        {
-            slots[allocated_slot].status = SLOT_LOCKED;
-        }
-        else
-        {
-            allocated_slot = -1;
-        }
-        sei(old_int);
-    }
-
-    /* ok now check if allocation was successful and retry */
-    if(allocated_slot < 0)
-    {
-        retries++;
-        if(retries < 5)
-        {
-            goto retry_find;
-        }
-        else
-        {
-            return -1;
-        }
-    }
-
-    return allocated_slot;
-}
-
 /* this function uses the frameSpace area in a VIDF that was meant for padding to insert some other block before */
 static int32_t mlv_prepend_block(uint32_t slot, mlv_hdr_t *block)
 {
@@ -2138,7 +1833,7 @@ static int32_t mlv_prepend_block(uint32_t slot, mlv_hdr_t *block)
 static void mlv_rec_dma_cbr_r(void *ctx)
 {
     /* now mark the last filled buffer as being ready to transfer */
-    slots[capture_slot].status = SLOT_FULL;
+    slots[sched.capture_slot].status = SLOT_FULL;
     mlv_rec_dma_active = 0;
     
     mlv_rec_dma_end = get_us_clock();
@@ -2161,9 +1856,9 @@ static int32_t FAST process_frame()
     }
 
     /* where to save the next frame? */
-    capture_slot = choose_next_capture_slot(capture_slot);
+    mlv_rec_sched_next_capture_slot(&sched);
 
-    if(capture_slot < 0)
+    if(sched.capture_slot < 0)
     {
         /* card too slow */
         frame_skips++;
@@ -2171,12 +1866,12 @@ static int32_t FAST process_frame()
     }
 
     /* restore VIDF header */
-    mlv_vidf_hdr_t *hdr = slots[capture_slot].ptr;
+    mlv_vidf_hdr_t *hdr = slots[sched.capture_slot].ptr;
     mlv_set_type((mlv_hdr_t *)hdr, "VIDF");
     mlv_set_timestamp((mlv_hdr_t *)hdr, mlv_start_timestamp);
     
-    hdr->blockSize = slots[capture_slot].blockSize;
-    hdr->frameSpace = slots[capture_slot].frameSpace;
+    hdr->blockSize = slots[sched.capture_slot].blockSize;
+    hdr->frameSpace = slots[sched.capture_slot].frameSpace;
     /* frame number in file is off by one. nobody needs to know we skipped the first frame */
     hdr->frameNumber = frame_count - 1;
     hdr->cropPosX = (skip_x + 7) & ~7;
@@ -2201,9 +1896,9 @@ static int32_t FAST process_frame()
     mlv_rec_dma_start = get_us_clock();
 
     /* copy current frame to our buffer and crop it to its final size */
-    slots[capture_slot].frame_number = frame_count;
+    slots[sched.capture_slot].frame_number = frame_count;
 
-    trace_write(raw_rec_trace_ctx, "==> enqueue frame %d in slot %d DMA: %d us", frame_count, capture_slot, mlv_rec_dma_duration);
+    trace_write(raw_rec_trace_ctx, "==> enqueue frame %d in slot %d DMA: %d us", frame_count, sched.capture_slot, mlv_rec_dma_duration);
 
     /* advance to next frame */
     frame_count++;
@@ -2450,91 +2145,6 @@ static int32_t mlv_write_rawc(FILE* f)
     return mlv_write_hdr(f, (mlv_hdr_t *)&rawc);
 }
 
-static uint32_t find_largest_buffer(uint32_t start_group, write_job_t *write_job, uint32_t max_size)
-{
-    write_job_t job;
-    uint32_t get_partial = 0;
-
-retry_find:
-
-    /* initialize write job */
-    memset(&job, 0x00, sizeof(write_job_t));
-    *write_job = job;
-
-    for (int32_t group = start_group; group < slot_group_count; group++)
-    {
-        uint32_t block_len = 0;
-        uint32_t block_start = 0;
-        uint32_t block_size = 0;
-
-        uint32_t group_full = 1;
-
-        for (int32_t slot = slot_groups[group].slot; slot < (slot_groups[group].slot + slot_groups[group].len); slot++)
-        {
-            /* check for the slot being ready for saving */
-            if(slots[slot].status == SLOT_FULL)
-            {
-                /* the first time or on a non contiguous area reset all counters */
-                if(block_len == 0)
-                {
-                    block_start = slot;
-                }
-
-                block_len++;
-                block_size += slots[slot].size;
-
-                /* we have a new candidate */
-                if(block_len > job.block_len)
-                {
-                    job.block_start = block_start;
-                    job.block_len = block_len;
-                    job.block_size = block_size;
-                    job.block_ptr = slots[block_start].ptr;
-                }
-            }
-            else
-            {
-                group_full = 0;
-                block_len = 0;
-                block_size = 0;
-                block_start = 0;
-            }
-            
-            /* already over the maximum write block size? then break now */
-            if(max_size && job.block_size >= max_size)
-            {
-                break;
-            }
-        }
-
-        /* methods 3 and 4 want the "fast card" buffers to fill before queueing */
-        if(buffer_fill_method == 3 || buffer_fill_method == 4)
-        {
-            /* the queued group is not ready to be queued yet, reset */
-            if(!group_full && (group < fast_card_buffers) && !get_partial)
-            {
-                memset(&job, 0x00, sizeof(write_job_t));
-            }
-        }
-
-        /* if the current group has more frames, use it */
-        if(job.block_len > write_job->block_len)
-        {
-            *write_job = job;
-        }
-    }
-
-    /* if nothing was found, even a partially filled buffer is better than nothing */
-    if(write_job->block_len == 0 && !get_partial)
-    {
-        get_partial = 1;
-        goto retry_find;
-    }
-
-    /* if we were able to locate blocks for writing, return 1 */
-    return (write_job->block_len > 0);
-}
-
 static uint32_t raw_get_next_filenum()
 {
     uint32_t fileNum = 0;
@@ -2917,33 +2527,9 @@ abort:
 static void enqueue_buffer(uint32_t writer, write_job_t *write_job)
 {
     /* if we are about to overflow, save a smaller number of frames, so they can be freed quicker */
-    if (measured_write_speed)
-    {
-        int32_t fps = fps_get_current_x1000();
-        /* measured_write_speed unit: 0.01 MB/s */
-        /* FPS unit: 0.001 Hz */
-        /* overflow time unit: 0.1 seconds */
-        int32_t free_slots = get_free_slots();
-        int32_t overflow_time = free_slots * 1000 * 10 / fps;
-        /* better underestimate write speed a little */
-        int32_t frame_limit = overflow_time * 1024 / 10 * (measured_write_speed * 9 / 100) * 1024 / (write_job->block_size / write_job->block_len) / 10;
-
-        /* do not decrease write size if skipping is allowed */
-        if (!allow_frame_skip && frame_limit >= 0 && frame_limit < (int32_t)write_job->block_len)
-        {
-            //trace_write(raw_rec_trace_ctx, "<-- careful, will overflow in %d.%d seconds, better write only %d frames", overflow_time/10, overflow_time%10, frame_limit);
-            write_job->block_len = MAX(1, frame_limit - 1);
-            write_job->block_size = 0;
+    mlv_rec_sched_limit_job(&sched, writer, write_job, measured_write_speed, fps_get_current_x1000());
 
-            /* now fix the buffer size to write */
-            for(uint32_t slot = write_job->block_start; slot < write_job->block_start + write_job->block_len; slot++)
-            {
-                write_job->block_size += slots[slot].size;
-            }
-        }
-    }
-
-    /* mark slots to be written */
+    /* embed queued blocks into the slots to be written */
     for(uint32_t slot = write_job->block_start; slot < (write_job->block_start + write_job->block_len); slot++)
     {
         /* write blocks if some were queued */
@@ -2984,10 +2570,11 @@ static void enqueue_buffer(uint32_t writer, write_job_t *write_job)
                 }
             }
         }
-        slots[slot].status = SLOT_WRITING;
-        slots[slot].writer = writer;
     }
 
+    /* mark slots to be written */
+    mlv_rec_sched_start_job(&sched, write_job, writer);
+
     /* enqueue the configured block */
     write_job_t *queue_job = NULL;
     msg_queue_receive(mlv_job_alloc_queue, &queue_job, 0);
@@ -3223,7 +2810,7 @@ static void raw_video_rec_task()
         frame_count = 0;
         frame_skips = 0;
         mlv_file_count = 0;
-        capture_slot = -1;
+        sched.capture_slot = -1;
         fullsize_buffer_pos = 0;
 
         /* setup MLV stuff */
@@ -3366,7 +2953,7 @@ static void raw_video_rec_task()
                 //trace_write(raw_rec_trace_ctx, "<-- No jobs in fast-card queue");
 
                 /* in case there is something to write... */
-                if(find_largest_buffer(0, &write_job, 16 * 1024 * 1024))
+                if(mlv_rec_sched_find_largest_buffer(&sched, 0, &write_job, 16 * 1024 * 1024))
                 {
                     enqueue_buffer(0, &write_job);
                     util_atomic_inc(&writer_job_count[0]);
@@ -3385,7 +2972,7 @@ static void raw_video_rec_task()
                 //trace_write(raw_rec_trace_ctx, "<-- No jobs in slow-card queue");
 
                 /* in case there is something to write... SD must not use the two largest buffers */
-                if(find_largest_buffer(fast_card_buffers, &write_job, 4 * 1024 * 1024))
+                if(mlv_rec_sched_find_largest_buffer(&sched, fast_card_buffers, &write_job, 4 * 1024 * 1024))
                 {
                     enqueue_buffer(1, &write_job);
                     util_atomic_inc(&writer_job_count[1]);
@@ -3403,11 +2990,7 @@ static void raw_video_rec_task()
                 {
                     //trace_write(raw_rec_trace_ctx, "<-- processing returned_job 0x%08X from %d", returned_job, returned_job->writer);
                     /* set all slots as free again */
-                    for(uint32_t slot = returned_job->block_start; slot < (returned_job->block_start + returned_job->block_len); slot++)
-                    {
-                        slots[slot].status = SLOT_FREE;
-                        //trace_write(raw_rec_trace_ctx, "<-- WRITER#%d: free slot %d", returned_job->writer, slot);
-                    }
+                    mlv_rec_sched_finish_job(&sched, returned_job);
 
                     /* calc writing and idle time */
                     int32_t write_time = (uint32_t)(returned_job->time_after - returned_job->time_before);
@@ -3428,6 +3011,7 @@ static void raw_video_rec_task()
                         returned_job->writer, write_time, rate, returned_job->block_size, returned_job->block_len, returned_job->block_start, mgmt_time, returned_job->file_offset);
 
                     /* update statistics */
+                    mlv_rec_sched_write_done(&sched, returned_job->writer, returned_job->block_size, write_time);
                     writing_time[returned_job->writer] += write_time / 1000;
                     idle_time[returned_job->writer] += mgmt_time / 1000;
                     written[returned_job->writer] += returned_job->block_size / 1024;
@@ -3490,7 +3074,7 @@ static void raw_video_rec_task()
 
             used_slots = 0;
             writing_slots = 0;
-            for(int32_t slot = 0; slot < slot_count; slot++)
+            for(int32_t slot = 0; slot < sched.slot_count; slot++)
             {
                 if(slots[slot].status != SLOT_FREE)
                 {
@@ -3558,7 +3142,7 @@ static void raw_video_rec_task()
 
             /* wait until all writers wrote their data */
             has_data = 0;
-            for(int32_t slot = 0; slot < slot_count; slot++)
+            for(int32_t slot = 0; slot < sched.slot_count; slot++)
             {
                 if(slots[slot].status == SLOT_WRITING)
                 {
@@ -3968,9 +3552,9 @@ static struct menu_entry raw_video_menu[] =
             {
                 .name = "Buffer Fill Method",
                 .priv = &buffer_fill_method,
-                .max = 4,
+                .max = 5,
                 .help = "Method for filling buffers. Will affect write speed.",
-                .help2 = "Try different options for the best performance.",
+                .help2 = "5: adapts write sizes to the measured card speed.",
             },
             {
                 .name = "CF-only Buffers",
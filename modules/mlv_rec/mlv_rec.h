@@ -21,6 +21,8 @@
 #ifndef __MLV_REC_H__
 #define __MLV_REC_H__
 
+#include "mlv_rec_sched.h"
+
 #define DEBUG_REDRAW_INTERVAL      100
 #define MLV_RTCI_BLOCK_INTERVAL   2000
 #define MLV_INFO_BLOCK_INTERVAL  60000
@@ -65,44 +67,6 @@
 #define MLV_METADATA_ALL      0xFF
 
 
-/* one video frame */
-struct frame_slot
-{
-    void *ptr;
-    int32_t frame_number;   /* from 0 to n */
-    int32_t size;
-    int32_t writer;
-    enum {SLOT_FREE, SLOT_FULL, SLOT_LOCKED, SLOT_WRITING} status;
-    uint32_t blockSize;
-    uint32_t frameSpace;
-};
-
-struct frame_slot_group
-{
-    int32_t slot;
-    int32_t len;
-    int32_t size;
-};
-
-/* this job type is Manager -> Writer for telling which blocks to write */
-typedef struct
-{
-    uint32_t job_type;
-    uint32_t writer;
-
-    uint32_t file_offset;
-    
-    uint32_t block_len;
-    uint32_t block_start;
-    uint32_t block_size;
-    void *block_ptr;
-
-    /* filled by writer */
-    int64_t time_before;
-    int64_t time_after;
-    int64_t last_time_after;
-} write_job_t;
-
 /* if a file reaches the 4GiB border, writer will queue a file close command for the manager */
 typedef struct
 {
@@ -0,0 +1,592 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#ifdef CONFIG_MAGICLANTERN
+#include <dryos.h>
+#else // if we compile it for desktop
+#include <stdint.h>
+
+#define FAST
+#define PTR_INVALID ((void *)0xFFFFFFFF)
+
+#define MIN(a,b) ((a) < (b) ? (a) : (b))
+#define MAX(a,b) ((a) > (b) ? (a) : (b))
+
+/* the simulator is single threaded, nothing can interrupt us */
+static inline uint32_t cli() { return 0; }
+static inline void sei(uint32_t old) { (void)old; }
+#endif
+
+#include <string.h>
+#include <limits.h>
+#include "mlv_rec_sched.h"
+
+void mlv_rec_sched_build_groups(struct mlv_rec_sched *sched)
+{
+    struct frame_slot *slots = sched->slots;
+    struct frame_slot_group *slot_groups = sched->groups;
+    int32_t slot_count = sched->slot_count;
+
+    uint32_t block_start = 0;
+    uint32_t block_len = 0;
+    uint32_t block_size = 0;
+    uintptr_t last_slot_end = 0;
+
+    sched->group_count = 0;
+
+    /* this loop goes one slot behind the end */
+    for(int32_t slot = 0; slot <= slot_count; slot++)
+    {
+        uintptr_t slot_start = 0;
+        uintptr_t slot_end = 0;
+
+        if(slot < slot_count)
+        {
+            slot_start = (uintptr_t) slots[slot].ptr;
+            slot_end = slot_start + slots[slot].size;
+        }
+
+        /* the first time, on a non contiguous area or the last frame (its == slot_count) reset all counters */
+        uint32_t non_contig = slot_start != last_slot_end;
+        uint32_t last_iteration = slot == slot_count;
+
+        if((block_len != 0) && (non_contig || last_iteration))
+        {
+            slot_groups[sched->group_count].slot = block_start;
+            slot_groups[sched->group_count].len = block_len;
+            slot_groups[sched->group_count].size = block_size;
+            sched->group_count++;
+
+            if(slot == slot_count)
+            {
+                break;
+            }
+            block_len = 0;
+        }
+
+        if(slot < slot_count)
+        {
+            if(block_len == 0)
+            {
+                block_len = 1;
+                block_start = slot;
+                block_size = slots[slot].size;
+            }
+            else
+            {
+                /* its a contiguous area, increase counters */
+                block_len++;
+                block_size += slots[slot].size;
+            }
+        }
+        last_slot_end = slot_end;
+    }
+
+    /* hackish bubble sort group list */
+    int n = sched->group_count;
+    do
+    {
+        int newn = 1;
+        for(int i = 0; i < n-1; ++i)
+        {
+            if(slot_groups[i].len < slot_groups[i+1].len)
+            {
+                struct frame_slot_group tmp = slot_groups[i+1];
+                slot_groups[i+1] = slot_groups[i];
+                slot_groups[i] = tmp;
+                newn = i + 1;
+            }
+        }
+        n = newn;
+    } while (n > 1);
+}
+
+int32_t mlv_rec_sched_free_slots(struct mlv_rec_sched *sched)
+{
+    int32_t free_slots = 0;
+    for (int32_t i = 0; i < sched->slot_count; i++)
+    {
+        if (sched->slots[i].status == SLOT_FREE)
+        {
+            free_slots++;
+        }
+    }
+    return free_slots;
+}
+
+int32_t mlv_rec_sched_predict_frames(struct mlv_rec_sched *sched, int32_t slot_size, int32_t fps, int32_t write_speed)
+{
+    int32_t capture_speed = slot_size / 1000 * fps;
+    int32_t buffer_fill_speed = capture_speed - write_speed;
+
+    if (buffer_fill_speed <= 0)
+    {
+        return INT_MAX;
+    }
+
+    int32_t write_size = 0;
+    for (int32_t group = 0; group < sched->group_count; group++)
+    {
+        write_size += sched->groups[group].size;
+    }
+
+    float buffer_fill_time = write_size / (float) buffer_fill_speed;
+    int32_t frames = buffer_fill_time * fps / 1000;
+    return frames;
+}
+
+/* try to mark the slot as being used, fails if someone else was faster */
+static int32_t FAST lock_slot(struct mlv_rec_sched *sched, int32_t slot)
+{
+    uint32_t old_int = cli();
+    if(sched->slots[slot].status == SLOT_FREE)
+    {
+        sched->slots[slot].status = SLOT_LOCKED;
+    }
+    else
+    {
+        slot = -1;
+    }
+    sei(old_int);
+
+    return slot;
+}
+
+/* first free slot in the given groups */
+static int32_t FAST find_free_slot_in_groups(struct mlv_rec_sched *sched, int32_t first_group, int32_t end_group)
+{
+    for (int32_t group = first_group; group < end_group; group++)
+    {
+        struct frame_slot_group *g = &sched->groups[group];
+
+        for (int32_t slot = g->slot; slot < (g->slot + g->len); slot++)
+        {
+            if (sched->slots[slot].status == SLOT_FREE)
+            {
+                return slot;
+            }
+        }
+    }
+
+    return -1;
+}
+
+int32_t FAST mlv_rec_sched_next_capture_slot(struct mlv_rec_sched *sched)
+{
+    struct frame_slot *slots = sched->slots;
+    int32_t slot_count = sched->slot_count;
+    int32_t capture_slot = sched->capture_slot;
+    uint32_t retries = 0;
+    int32_t allocated_slot = -1;
+
+retry_find:
+    allocated_slot = -1;
+
+    switch(sched->buffer_fill_method)
+    {
+        case 0:
+            /* new: return next free slot for out-of-order writing */
+            for(int32_t slot = 0; slot < slot_count; slot++)
+            {
+                if(slots[slot].status == SLOT_FREE)
+                {
+                    allocated_slot = slot;
+                    break;
+                }
+            }
+            break;
+
+        case 5:
+        case 4:
+        case 1:
+            /* new method: first fill largest group */
+            allocated_slot = find_free_slot_in_groups(sched, 0, sched->group_count);
+            break;
+
+        case 3:
+            /* new method: first fill largest groups */
+            allocated_slot = find_free_slot_in_groups(sched, 0, MIN((int32_t)sched->fast_card_buffers, sched->group_count));
+
+            /* fall through */
+
+        case 2:
+        default:
+            /* keep on rolling? */
+            /* O(1) */
+            if (capture_slot >= 0 && capture_slot + 1 < slot_count)
+            {
+                if(slots[capture_slot + 1].ptr == slots[capture_slot].ptr + slots[capture_slot].size &&
+                   slots[capture_slot + 1].status == SLOT_FREE && !sched->force_new_buffer )
+                {
+                    allocated_slot = capture_slot + 1;
+                    break;
+                }
+            }
+
+            /* choose a new buffer? */
+            /* choose the largest contiguous free section */
+            /* O(n), n = slot_count */
+            int32_t len = 0;
+            void* prev_ptr = PTR_INVALID;
+            int32_t prev_blockSize = 0;
+            int32_t best_len = 0;
+            for (int32_t i = 0; i < slot_count; i++)
+            {
+                if (slots[i].status == SLOT_FREE)
+                {
+                    if (slots[i].ptr == prev_ptr + prev_blockSize)
+                    {
+                        len++;
+                        prev_ptr = slots[i].ptr;
+                        prev_blockSize = slots[i].size;
+                        if (len > best_len)
+                        {
+                            best_len = len;
+                            allocated_slot = i - len + 1;
+                        }
+                    }
+                    else
+                    {
+                        len = 1;
+                        prev_ptr = slots[i].ptr;
+                        prev_blockSize = slots[i].size;
+                        if (len > best_len)
+                        {
+                            best_len = len;
+                            allocated_slot = i;
+                        }
+                    }
+                }
+                else
+                {
+                    len = 0;
+                    prev_ptr = PTR_INVALID;
+                }
+            }
+
+            break;
+    }
+
+    /* now try to mark this slot as being used */
+    if(allocated_slot >= 0)
+    {
+        allocated_slot = lock_slot(sched, allocated_slot);
+    }
+
+    /* ok now check if allocation was successful and retry */
+    if(allocated_slot < 0)
+    {
+        retries++;
+        if(retries < 5)
+        {
+            goto retry_find;
+        }
+    }
+
+    sched->capture_slot = allocated_slot;
+    return allocated_slot;
+}
+
+int32_t mlv_rec_sched_get_free_slot(struct mlv_rec_sched *sched)
+{
+    for(uint32_t retries = 0; retries < 5; retries++)
+    {
+        /* find a slot in the smallest groups first */
+        for(int32_t group = sched->group_count - 1; group >= 0 ; group--)
+        {
+            int32_t slot = find_free_slot_in_groups(sched, group, group + 1);
+
+            if(slot >= 0)
+            {
+                if(lock_slot(sched, slot) >= 0)
+                {
+                    return slot;
+                }
+                break;
+            }
+        }
+    }
+
+    return -1;
+}
+
+static uint32_t speed_bucket(uint32_t size)
+{
+    uint32_t bucket = 0;
+
+    size >>= MLV_SCHED_SPEED_MIN_BITS;
+    while(size > 1 && bucket < MLV_SCHED_SPEED_BUCKETS - 1)
+    {
+        size >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+/* expected KiB/s for a write of that size, from the nearest bucket that saw some writes. 0 if nothing is known yet */
+static uint32_t predicted_speed(struct mlv_rec_sched_speed *model, uint32_t size)
+{
+    int32_t bucket = speed_bucket(size);
+
+    for(int32_t dist = 0; dist < MLV_SCHED_SPEED_BUCKETS; dist++)
+    {
+        /* prefer the smaller neighbor, better underestimate */
+        if(bucket - dist >= 0 && model->samples[bucket - dist])
+        {
+            return model->speed[bucket - dist];
+        }
+        if(bucket + dist < MLV_SCHED_SPEED_BUCKETS && model->samples[bucket + dist])
+        {
+            return model->speed[bucket + dist];
+        }
+    }
+
+    return 0;
+}
+
+uint32_t mlv_rec_sched_find_largest_buffer(struct mlv_rec_sched *sched, uint32_t start_group, write_job_t *write_job, uint32_t max_size)
+{
+    struct frame_slot *slots = sched->slots;
+    write_job_t job;
+    uint32_t get_partial = 0;
+
+retry_find:
+
+    /* initialize write job */
+    memset(&job, 0x00, sizeof(write_job_t));
+    *write_job = job;
+
+    for (int32_t group = start_group; group < sched->group_count; group++)
+    {
+        struct frame_slot_group *g = &sched->groups[group];
+        uint32_t block_len = 0;
+        uint32_t block_start = 0;
+        uint32_t block_size = 0;
+
+        uint32_t group_full = 1;
+
+        for (int32_t slot = g->slot; slot < (g->slot + g->len); slot++)
+        {
+            /* check for the slot being ready for saving */
+            if(slots[slot].status == SLOT_FULL)
+            {
+                /* the first time or on a non contiguous area reset all counters */
+                if(block_len == 0)
+                {
+                    block_start = slot;
+                }
+
+                block_len++;
+                block_size += slots[slot].size;
+
+                /* we have a new candidate */
+                if(block_len > job.block_len)
+                {
+                    job.block_start = block_start;
+                    job.block_len = block_len;
+                    job.block_size = block_size;
+                    job.block_ptr = slots[block_start].ptr;
+                }
+            }
+            else
+            {
+                group_full = 0;
+                block_len = 0;
+                block_size = 0;
+                block_start = 0;
+            }
+
+            /* already over the maximum write block size? then break now */
+            if(max_size && job.block_size >= max_size)
+            {
+                break;
+            }
+        }
+
+        /* methods 3 and 4 want the "fast card" buffers to fill before queueing */
+        if(sched->buffer_fill_method == 3 || sched->buffer_fill_method == 4)
+        {
+            /* the queued group is not ready to be queued yet, reset */
+            if(!group_full && ((uint32_t)group < sched->fast_card_buffers) && !get_partial)
+            {
+                memset(&job, 0x00, sizeof(write_job_t));
+            }
+        }
+
+        /* if the current group has more frames, use it */
+        if(job.block_len > write_job->block_len)
+        {
+            *write_job = job;
+        }
+    }
+
+    /* if nothing was found, even a partially filled buffer is better than nothing */
+    if(write_job->block_len == 0 && !get_partial)
+    {
+        get_partial = 1;
+        goto retry_find;
+    }
+
+    /* if we were able to locate blocks for writing, return 1 */
+    return (write_job->block_len > 0);
+}
+
+/* set the job to its first len slots */
+static void shorten_job(struct mlv_rec_sched *sched, write_job_t *write_job, uint32_t len)
+{
+    write_job->block_len = len;
+    write_job->block_size = 0;
+
+    for(uint32_t slot = write_job->block_start; slot < write_job->block_start + write_job->block_len; slot++)
+    {
+        write_job->block_size += sched->slots[slot].size;
+    }
+}
+
+/* adaptive method: the longest part of the job that is written before the free slots run out, at the speed
+ * the card showed for writes of that size. if no part makes it in time, the one that frees the most slots
+ * compared to the frames arriving meanwhile. on cards that are slow with small writes, that is not the shortest.
+ * returns 0 while the model knows nothing about the card */
+static uint32_t adaptive_limit_job(struct mlv_rec_sched *sched, uint32_t writer, write_job_t *write_job, int32_t fps)
+{
+    if(writer >= MLV_SCHED_WRITERS || !predicted_speed(&sched->speed[writer], write_job->block_size))
+    {
+        return 0;
+    }
+
+    struct mlv_rec_sched_speed *model = &sched->speed[writer];
+    int32_t free_slots = mlv_rec_sched_free_slots(sched);
+    uint32_t fit_len = 0;
+    uint32_t best_len = 1;
+    int64_t best_gain = INT64_MIN;
+    uint32_t size = 0;
+
+    for(uint32_t len = 1; len <= write_job->block_len; len++)
+    {
+        size += sched->slots[write_job->block_start + len - 1].size;
+
+        /* frames captured while this gets written, x1000 */
+        uint32_t speed = predicted_speed(model, size);
+        int64_t arriving = (int64_t)(size / 1024) * fps / MAX(speed, 1);
+        int64_t gain = (int64_t)len * 1000 - arriving;
+
+        /* one frame as margin for the other writer and for jitter */
+        if(arriving + 1000 < (int64_t)free_slots * 1000)
+        {
+            fit_len = len;
+        }
+
+        if(gain >= best_gain)
+        {
+            best_len = len;
+            best_gain = gain;
+        }
+    }
+
+    if(!fit_len)
+    {
+        fit_len = best_len;
+    }
+
+    if(fit_len < write_job->block_len)
+    {
+        shorten_job(sched, write_job, fit_len);
+    }
+
+    return 1;
+}
+
+void mlv_rec_sched_limit_job(struct mlv_rec_sched *sched, uint32_t writer, write_job_t *write_job, int32_t measured_write_speed, int32_t fps)
+{
+    /* do not decrease write size if skipping is allowed */
+    if(sched->allow_frame_skip || !fps)
+    {
+        return;
+    }
+
+    if(sched->buffer_fill_method == 5 && adaptive_limit_job(sched, writer, write_job, fps))
+    {
+        return;
+    }
+
+    if (!measured_write_speed)
+    {
+        return;
+    }
+
+    /* measured_write_speed unit: 0.01 MB/s */
+    /* FPS unit: 0.001 Hz */
+    /* overflow time unit: 0.1 seconds */
+    int32_t free_slots = mlv_rec_sched_free_slots(sched);
+    int32_t overflow_time = free_slots * 1000 * 10 / fps;
+    /* better underestimate write speed a little */
+    int32_t frame_limit = overflow_time * 1024 / 10 * (measured_write_speed * 9 / 100) * 1024 / (write_job->block_size / write_job->block_len) / 10;
+
+    if (frame_limit >= 0 && frame_limit < (int32_t)write_job->block_len)
+    {
+        shorten_job(sched, write_job, MAX(1, frame_limit - 1));
+    }
+}
+
+void mlv_rec_sched_start_job(struct mlv_rec_sched *sched, write_job_t *write_job, uint32_t writer)
+{
+    for(uint32_t slot = write_job->block_start; slot < (write_job->block_start + write_job->block_len); slot++)
+    {
+        sched->slots[slot].status = SLOT_WRITING;
+        sched->slots[slot].writer = writer;
+    }
+}
+
+void mlv_rec_sched_finish_job(struct mlv_rec_sched *sched, write_job_t *write_job)
+{
+    for(uint32_t slot = write_job->block_start; slot < (write_job->block_start + write_job->block_len); slot++)
+    {
+        sched->slots[slot].status = SLOT_FREE;
+    }
+}
+
+void mlv_rec_sched_write_done(struct mlv_rec_sched *sched, uint32_t writer, uint32_t size, uint32_t write_time)
+{
+    if(writer >= MLV_SCHED_WRITERS || !write_time)
+    {
+        return;
+    }
+
+    struct mlv_rec_sched_speed *model = &sched->speed[writer];
+    uint32_t bucket = speed_bucket(size);
+    uint32_t speed = (uint32_t)((uint64_t)size * 1000000ULL / write_time / 1024);
+
+    /* moving average, the card may slow down when it gets warm or its cache is full */
+    if(model->samples[bucket])
+    {
+        model->speed[bucket] = (model->speed[bucket] * 3 + speed) / 4;
+    }
+    else
+    {
+        model->speed[bucket] = speed;
+    }
+    model->samples[bucket]++;
+}
+
+void mlv_rec_sched_reset_speed(struct mlv_rec_sched *sched)
+{
+    memset(sched->speed, 0x00, sizeof(sched->speed));
+}
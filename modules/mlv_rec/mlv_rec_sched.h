@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/* frame slot allocator and write scheduler of mlv_rec.
+ * no camera dependencies, so the very same code runs in mlv_rec_sim on the host. */
+
+#ifndef __MLV_REC_SCHED_H__
+#define __MLV_REC_SCHED_H__
+
+#include <stdint.h>
+
+/* one video frame */
+struct frame_slot
+{
+    void *ptr;
+    int32_t frame_number;   /* from 0 to n */
+    int32_t size;
+    int32_t writer;
+    enum {SLOT_FREE, SLOT_FULL, SLOT_LOCKED, SLOT_WRITING} status;
+    uint32_t blockSize;
+    uint32_t frameSpace;
+};
+
+struct frame_slot_group
+{
+    int32_t slot;
+    int32_t len;
+    int32_t size;
+};
+
+/* this job type is Manager -> Writer for telling which blocks to write */
+typedef struct
+{
+    uint32_t job_type;
+    uint32_t writer;
+
+    uint32_t file_offset;
+
+    uint32_t block_len;
+    uint32_t block_start;
+    uint32_t block_size;
+    void *block_ptr;
+
+    /* filled by writer */
+    int64_t time_before;
+    int64_t time_after;
+    int64_t last_time_after;
+} write_job_t;
+
+/* write speed buckets of the adaptive method (buffer_fill_method 5): powers of two from 64 KiB up to 64 MiB */
+#define MLV_SCHED_WRITERS          2
+#define MLV_SCHED_SPEED_MIN_BITS  16
+#define MLV_SCHED_SPEED_BUCKETS   11
+
+/* online model of one card: how fast are writes of a given size */
+struct mlv_rec_sched_speed
+{
+    uint32_t speed[MLV_SCHED_SPEED_BUCKETS];    /* KiB/s, moving average of the writes in that size range */
+    uint32_t samples[MLV_SCHED_SPEED_BUCKETS];
+};
+
+/* the slot and group tables plus the settings that decide how they are filled and emptied */
+struct mlv_rec_sched
+{
+    struct frame_slot *slots;
+    struct frame_slot_group *groups;
+    int32_t slot_count;                 /* how many frame slots we have */
+    int32_t group_count;
+    int32_t capture_slot;               /* in what slot are we capturing now (index) */
+    volatile int32_t force_new_buffer;  /* if some other task decides it's better to search for a new buffer */
+
+    uint32_t buffer_fill_method;        /* 0..5, see mlv_rec_sched_next_capture_slot(), mlv_rec_sched_find_largest_buffer() and mlv_rec_sched_limit_job() */
+    uint32_t fast_card_buffers;         /* how many of the largest groups are reserved for writer 0 */
+    uint32_t allow_frame_skip;
+
+    /* used by the adaptive method */
+    struct mlv_rec_sched_speed speed[MLV_SCHED_WRITERS];
+};
+
+/* build the group list from contiguous slots, largest groups first */
+void mlv_rec_sched_build_groups(struct mlv_rec_sched *sched);
+
+/* number of slots in SLOT_FREE state */
+int32_t mlv_rec_sched_free_slots(struct mlv_rec_sched *sched);
+
+/* how many frames can be recorded until the buffers are full, INT_MAX if the card keeps up.
+ * slot_size in bytes, fps x1000, write_speed in bytes/s */
+int32_t mlv_rec_sched_predict_frames(struct mlv_rec_sched *sched, int32_t slot_size, int32_t fps, int32_t write_speed);
+
+/* pick and lock the slot the next frame gets captured into, according to buffer_fill_method.
+ * updates capture_slot, returns -1 if all slots are busy (card too slow) */
+int32_t mlv_rec_sched_next_capture_slot(struct mlv_rec_sched *sched);
+
+/* pick and lock any free slot, preferring the smallest groups (for blocks other than VIDF) */
+int32_t mlv_rec_sched_get_free_slot(struct mlv_rec_sched *sched);
+
+/* find the longest run of full slots in the groups from start_group on, up to max_size bytes (0: no limit).
+ * returns 1 and fills write_job if there is something to write */
+uint32_t mlv_rec_sched_find_largest_buffer(struct mlv_rec_sched *sched, uint32_t start_group, write_job_t *write_job, uint32_t max_size);
+
+/* shorten the job if the buffers would overflow before it is written, so the slots can be freed quicker.
+ * the adaptive method predicts the write time from the speed model of the writer's card, and does not shorten
+ * the job when even a short write would not make it in time.
+ * measured_write_speed unit: 0.01 MB/s, fps x1000 */
+void mlv_rec_sched_limit_job(struct mlv_rec_sched *sched, uint32_t writer, write_job_t *write_job, int32_t measured_write_speed, int32_t fps);
+
+/* mark the slots of a job as being written by the given writer */
+void mlv_rec_sched_start_job(struct mlv_rec_sched *sched, write_job_t *write_job, uint32_t writer);
+
+/* a writer returned the job, its slots are free again */
+void mlv_rec_sched_finish_job(struct mlv_rec_sched *sched, write_job_t *write_job);
+
+/* feed the duration of a completed write (in microseconds) into the speed model of the writer's card */
+void mlv_rec_sched_write_done(struct mlv_rec_sched *sched, uint32_t writer, uint32_t size, uint32_t write_time);
+
+/* forget the speed model, e.g. when the card may have changed */
+void mlv_rec_sched_reset_speed(struct mlv_rec_sched *sched);
+
+#endif
@@ -0,0 +1,572 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/* runs mlv_rec's slot allocator and write scheduler (mlv_rec_sched.c) against simulated cards,
+ * to see how many frames each buffer_fill_method keeps before the buffers overflow.
+ * unlike speedsim.py, this runs the very code the camera runs, including the second writer. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <getopt.h>
+
+#include "mlv_rec_sched.h"
+
+#define MAX_WRITERS      2
+#define MAX_SLOTS      512
+#define MAX_CHUNKS      64
+#define MAX_POINTS      64
+
+/* same alignment mlv_rec uses for slots (raw_rec_edmac_align, raw_rec_write_align) */
+#define SLOT_ALIGN  0x1000
+
+/* a card is described by the time a write call needs, depending on its size */
+struct card_profile
+{
+    char name[64];
+    double latency;                 /* seconds spent in every write call */
+    double nominal_speed;           /* bytes/s, for the speed model when there are no measured points */
+    int points;                     /* measured curve: write size -> throughput */
+    double size[MAX_POINTS];        /* bytes, ascending */
+    double speed[MAX_POINTS];       /* bytes/s */
+};
+
+struct sim_writer
+{
+    struct card_profile *card;
+    uint32_t busy;
+    double done_time;
+    double write_time;
+    write_job_t job;
+
+    /* statistics like the manager task keeps them */
+    uint32_t written;               /* KiB */
+    uint32_t writing_time;          /* msec */
+    uint32_t jobs;
+};
+
+struct sim_result
+{
+    uint32_t frames;
+    uint32_t skipped;
+    double duration;
+    uint32_t written[MAX_WRITERS];
+    uint32_t writing_time[MAX_WRITERS];
+    uint32_t jobs[MAX_WRITERS];
+};
+
+static int verbose = 0;
+
+/* model fitted from benchmarks on a 5D3 in movie mode, favors large buffers (see speedsim.py) */
+static double card_speed_model(double nominal_speed, double size)
+{
+    static const double pfit[] = { -8.5500e-01, 4.5050e-09, 8.7998e-02, -8.5642e-05 };
+
+    double speed_factor = pfit[0] + pfit[1] * size + pfit[2] * log2(size) + pfit[3] * sqrt(size);
+    if(speed_factor < 0.01) speed_factor = 0.01;
+    if(speed_factor > 1) speed_factor = 1;
+
+    return nominal_speed * speed_factor;
+}
+
+/* throughput for a single write call of the given size, interpolated on a log scale between measured points */
+static double card_speed(struct card_profile *card, double size)
+{
+    if(!card->points)
+    {
+        return card_speed_model(card->nominal_speed, size);
+    }
+
+    if(size <= card->size[0])
+    {
+        return card->speed[0];
+    }
+
+    for(int pos = 1; pos < card->points; pos++)
+    {
+        if(size <= card->size[pos])
+        {
+            double frac = (log2(size) - log2(card->size[pos - 1])) / (log2(card->size[pos]) - log2(card->size[pos - 1]));
+            return card->speed[pos - 1] + frac * (card->speed[pos] - card->speed[pos - 1]);
+        }
+    }
+
+    return card->speed[card->points - 1];
+}
+
+static double card_write_time(struct card_profile *card, double size)
+{
+    return card->latency + size / card_speed(card, size);
+}
+
+/* profile files are plain text:
+ *   # comment
+ *   latency <msec>
+ *   <write size in KiB> <speed in MiB/s>
+ */
+static int card_load_profile(struct card_profile *card, const char *filename)
+{
+    FILE *in_file = fopen(filename, "r");
+    char line[256];
+
+    if(!in_file)
+    {
+        fprintf(stderr, "[E] Failed to open card profile '%s'\n", filename);
+        return 0;
+    }
+
+    memset(card, 0x00, sizeof(struct card_profile));
+    strncpy(card->name, filename, sizeof(card->name) - 1);
+
+    while(fgets(line, sizeof(line), in_file))
+    {
+        double size = 0;
+        double speed = 0;
+        double latency = 0;
+
+        if(line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+        {
+            continue;
+        }
+
+        if(sscanf(line, "latency %lf", &latency) == 1)
+        {
+            card->latency = latency / 1000.0;
+        }
+        else if(sscanf(line, "%lf %lf", &size, &speed) == 2)
+        {
+            if(card->points >= MAX_POINTS || size <= 0 || speed <= 0 || (card->points && size * 1024.0 <= card->size[card->points - 1]))
+            {
+                fprintf(stderr, "[E] Card profile '%s': invalid or unsorted point '%s'\n", filename, line);
+                fclose(in_file);
+                return 0;
+            }
+            card->size[card->points] = size * 1024.0;
+            card->speed[card->points] = speed * 1024.0 * 1024.0;
+            card->points++;
+        }
+        else
+        {
+            fprintf(stderr, "[E] Card profile '%s': cannot parse '%s'\n", filename, line);
+            fclose(in_file);
+            return 0;
+        }
+    }
+
+    fclose(in_file);
+
+    if(!card->points)
+    {
+        fprintf(stderr, "[E] Card profile '%s' has no speed points\n", filename);
+        return 0;
+    }
+
+    return 1;
+}
+
+/* an argument is either a profile file or a nominal speed in MiB/s for the speed model */
+static int card_setup(struct card_profile *card, const char *arg)
+{
+    char *end = NULL;
+    double speed = strtod(arg, &end);
+
+    if(end != arg && *end == '\0')
+    {
+        memset(card, 0x00, sizeof(struct card_profile));
+        snprintf(card->name, sizeof(card->name), "model %.1f MiB/s", speed);
+        card->nominal_speed = speed * 1024.0 * 1024.0;
+        return speed > 0;
+    }
+
+    return card_load_profile(card, arg);
+}
+
+/* lay out the slots like add_mem_suite() does: each memory chunk is split into contiguous slots */
+static void sim_setup_slots(struct mlv_rec_sched *sched, uint32_t *chunks, int chunk_count, uint32_t slot_size)
+{
+    uintptr_t ptr = 0x10000000;
+
+    sched->slot_count = 0;
+
+    for(int chunk = 0; chunk < chunk_count; chunk++)
+    {
+        uint32_t size = chunks[chunk];
+
+        while(size >= slot_size && sched->slot_count < MAX_SLOTS)
+        {
+            struct frame_slot *slot = &sched->slots[sched->slot_count];
+
+            memset(slot, 0x00, sizeof(struct frame_slot));
+            slot->ptr = (void *)ptr;
+            slot->size = slot_size;
+            slot->status = SLOT_FREE;
+
+            ptr += slot_size;
+            size -= slot_size;
+            sched->slot_count++;
+        }
+
+        /* leave a gap, so chunks are never contiguous */
+        ptr += size + SLOT_ALIGN;
+    }
+
+    sched->capture_slot = -1;
+    mlv_rec_sched_build_groups(sched);
+}
+
+/* measured_write_speed as the manager task computes it: 0.01 MiB/s */
+static int32_t sim_measured_speed(struct sim_writer *writers, int writer_count)
+{
+    int32_t speed = 0;
+
+    for(int writer = 0; writer < writer_count; writer++)
+    {
+        if(writers[writer].writing_time)
+        {
+            speed += (int32_t)((float)writers[writer].written / (float)writers[writer].writing_time * (1000.0f / 1024.0f * 100.0f));
+        }
+    }
+
+    return speed;
+}
+
+/* the manager loop of raw_video_rec_task(): give idle writers the largest buffer they may write */
+static void sim_manage(struct mlv_rec_sched *sched, struct sim_writer *writers, int writer_count, int32_t fps_x1000, double now)
+{
+    static const uint32_t max_size[MAX_WRITERS] = { 16 * 1024 * 1024, 4 * 1024 * 1024 };
+
+    for(int writer = 0; writer < writer_count; writer++)
+    {
+        struct sim_writer *w = &writers[writer];
+        uint32_t start_group = writer ? sched->fast_card_buffers : 0;
+
+        if(w->busy || !mlv_rec_sched_find_largest_buffer(sched, start_group, &w->job, max_size[writer]))
+        {
+            continue;
+        }
+
+        mlv_rec_sched_limit_job(sched, writer, &w->job, sim_measured_speed(writers, writer_count), fps_x1000);
+        mlv_rec_sched_start_job(sched, &w->job, writer);
+
+        double write_time = card_write_time(w->card, w->job.block_size);
+        w->busy = 1;
+        w->write_time = write_time;
+        w->done_time = now + write_time;
+
+        if(verbose)
+        {
+            printf("[%8.3f] writer %d: %3d frames at slot %3d, %6d KiB, %6.1f ms (%5.1f MiB/s)\n",
+                now, writer, w->job.block_len, w->job.block_start, w->job.block_size / 1024,
+                write_time * 1000.0, w->job.block_size / write_time / 1024.0 / 1024.0);
+        }
+    }
+}
+
+static void sim_run(struct mlv_rec_sched *sched, struct sim_writer *writers, int writer_count, double fps, uint32_t max_frames, struct sim_result *result)
+{
+    int32_t fps_x1000 = (int32_t)(fps * 1000.0 + 0.5);
+    double frame_time = 1.0 / fps;
+    double next_frame = 0;
+    double now = 0;
+
+    memset(result, 0x00, sizeof(struct sim_result));
+
+    while(result->frames < max_frames)
+    {
+        /* advance to the next event: a frame arrives or a write finishes */
+        int finished = -1;
+        now = next_frame;
+
+        for(int writer = 0; writer < writer_count; writer++)
+        {
+            if(writers[writer].busy && writers[writer].done_time <= now)
+            {
+                now = writers[writer].done_time;
+                finished = writer;
+            }
+        }
+
+        if(finished >= 0)
+        {
+            struct sim_writer *w = &writers[finished];
+
+            mlv_rec_sched_finish_job(sched, &w->job);
+            mlv_rec_sched_write_done(sched, finished, w->job.block_size, (uint32_t)(w->write_time * 1000000.0));
+            w->busy = 0;
+            w->written += w->job.block_size / 1024;
+            w->writing_time += (uint32_t)(w->write_time * 1000.0);
+            w->jobs++;
+        }
+        else
+        {
+            /* the vsync handler: capture into the next slot, the EDMAC copy is done before the next frame */
+            int32_t slot = mlv_rec_sched_next_capture_slot(sched);
+
+            next_frame += frame_time;
+
+            if(slot < 0)
+            {
+                result->skipped++;
+                if(!sched->allow_frame_skip)
+                {
+                    if(verbose)
+                    {
+                        printf("[%8.3f] frame skipped, stopping\n", now);
+                    }
+                    break;
+                }
+            }
+            else
+            {
+                sched->slots[slot].frame_number = result->frames;
+                sched->slots[slot].status = SLOT_FULL;
+                result->frames++;
+            }
+        }
+
+        sim_manage(sched, writers, writer_count, fps_x1000, now);
+    }
+
+    result->duration = now;
+    for(int writer = 0; writer < writer_count; writer++)
+    {
+        result->written[writer] = writers[writer].written;
+        result->writing_time[writer] = writers[writer].writing_time;
+        result->jobs[writer] = writers[writer].jobs;
+    }
+}
+
+static uint32_t parse_chunks(const char *arg, uint32_t *chunks)
+{
+    char buf[512];
+    uint32_t count = 0;
+
+    strncpy(buf, arg, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    for(char *tok = strtok(buf, ","); tok && count < MAX_CHUNKS; tok = strtok(NULL, ","))
+    {
+        double size = atof(tok);
+        if(size <= 0)
+        {
+            return 0;
+        }
+        chunks[count++] = (uint32_t)(size * 1024.0 * 1024.0);
+    }
+
+    return count;
+}
+
+static void show_usage(char *executable)
+{
+    fprintf(stderr, "Usage: %s [-options]\n", executable);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, " -b <chunks>      memory chunks in MiB, comma separated (default: 32,32,32,32 as on 5D3)\n");
+    fprintf(stderr, " -r <w>x<h>       resolution (default: 1920x1080)\n");
+    fprintf(stderr, " -f <fps>         frame rate (default: 23.976)\n");
+    fprintf(stderr, " -m <method>      buffer_fill_method 0-5 (default: run all of them)\n");
+    fprintf(stderr, " -c <count>       fast_card_buffers (default: 1)\n");
+    fprintf(stderr, " -w <card>        card of writer 0: profile file or nominal MiB/s for the speed model (default: 40)\n");
+    fprintf(stderr, " -W <card>        card of writer 1, enables the second writer (card spanning)\n");
+    fprintf(stderr, " -n <frames>      stop after that many frames (default: 10000)\n");
+    fprintf(stderr, " -k               allow frame skipping, keep on recording and count skipped frames\n");
+    fprintf(stderr, " -e <frames>      expect at least that many frames from every method, exit code 1 otherwise\n");
+    fprintf(stderr, " -v               print every write job\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Card profiles are text files with 'latency <msec>' and '<write size KiB> <speed MiB/s>' lines.\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static struct frame_slot slots[MAX_SLOTS];
+    static struct frame_slot_group slot_groups[MAX_SLOTS];
+    struct mlv_rec_sched sched;
+    struct card_profile cards[MAX_WRITERS];
+    struct sim_writer writers[MAX_WRITERS];
+    uint32_t chunks[MAX_CHUNKS] = { 32 << 20, 32 << 20, 32 << 20, 32 << 20 };
+    uint32_t chunk_count = 4;
+    uint32_t res_x = 1920;
+    uint32_t res_y = 1080;
+    double fps = 23.976;
+    int method = -1;
+    uint32_t fast_card_buffers = 1;
+    uint32_t allow_frame_skip = 0;
+    uint32_t max_frames = 10000;
+    uint32_t expected_frames = 0;
+    int writer_count = 1;
+    int failed = 0;
+    int opt;
+
+    card_setup(&cards[0], "40");
+
+    while((opt = getopt(argc, argv, "b:r:f:m:c:w:W:n:ke:vh")) != -1)
+    {
+        switch(opt)
+        {
+            case 'b':
+                chunk_count = parse_chunks(optarg, chunks);
+                if(!chunk_count)
+                {
+                    fprintf(stderr, "[E] Invalid memory chunk list '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'r':
+                if(sscanf(optarg, "%ux%u", &res_x, &res_y) != 2 || !res_x || !res_y)
+                {
+                    fprintf(stderr, "[E] Invalid resolution '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'f':
+                fps = atof(optarg);
+                if(fps <= 0)
+                {
+                    fprintf(stderr, "[E] Invalid frame rate '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+
+            case 'm':
+                method = atoi(optarg);
+                if(method < 0 || method > 5)
+                {
+                    fprintf(stderr, "[E] buffer_fill_method must be 0-5\n");
+                    return 1;
+                }
+                break;
+
+            case 'c':
+                fast_card_buffers = atoi(optarg);
+                break;
+
+            case 'w':
+            case 'W':
+                if(!card_setup(&cards[opt == 'W'], optarg))
+                {
+                    fprintf(stderr, "[E] Invalid card '%s'\n", optarg);
+                    return 1;
+                }
+                if(opt == 'W')
+                {
+                    writer_count = 2;
+                }
+                break;
+
+            case 'n':
+                max_frames = atoi(optarg);
+                break;
+
+            case 'k':
+                allow_frame_skip = 1;
+                break;
+
+            case 'e':
+                expected_frames = atoi(optarg);
+                break;
+
+            case 'v':
+                verbose = 1;
+                break;
+
+            default:
+                show_usage(argv[0]);
+                return 1;
+        }
+    }
+
+    /* VIDF header, EDMAC and write alignment as in setup_chunk() */
+    uint32_t frame_size = res_x * res_y * 14 / 8;
+    uint32_t slot_size = (frame_size + 64 + 2 * SLOT_ALIGN) & ~(SLOT_ALIGN - 1);
+    uint32_t total = 0;
+
+    for(uint32_t chunk = 0; chunk < chunk_count; chunk++)
+    {
+        total += chunks[chunk] / 1024;
+    }
+
+    printf("Frame size:   %.2f MiB (%dx%d), %.3f fps, needs %.1f MiB/s\n",
+        frame_size / 1024.0 / 1024.0, res_x, res_y, fps, frame_size * fps / 1024.0 / 1024.0);
+    printf("Memory:       %d chunks, %d MiB\n", chunk_count, total / 1024);
+    for(int writer = 0; writer < writer_count; writer++)
+    {
+        printf("Writer %d:     %s, 1 frame: %.1f MiB/s, 16 MiB: %.1f MiB/s\n", writer, cards[writer].name,
+            slot_size / card_write_time(&cards[writer], slot_size) / 1024.0 / 1024.0,
+            (16 << 20) / card_write_time(&cards[writer], 16 << 20) / 1024.0 / 1024.0);
+    }
+    printf("\n");
+
+    for(int fill_method = 0; fill_method <= 5; fill_method++)
+    {
+        struct sim_result result;
+
+        if(method >= 0 && fill_method != method)
+        {
+            continue;
+        }
+
+        memset(&sched, 0x00, sizeof(sched));
+        sched.slots = slots;
+        sched.groups = slot_groups;
+        sched.buffer_fill_method = fill_method;
+        sched.fast_card_buffers = fast_card_buffers;
+        sched.allow_frame_skip = allow_frame_skip;
+        sim_setup_slots(&sched, chunks, chunk_count, slot_size);
+
+        if(sched.slot_count < 3)
+        {
+            fprintf(stderr, "[E] Only %d slots, mlv_rec needs at least 3\n", sched.slot_count);
+            return 1;
+        }
+
+        memset(writers, 0x00, sizeof(writers));
+        for(int writer = 0; writer < writer_count; writer++)
+        {
+            writers[writer].card = &cards[writer];
+        }
+
+        sim_run(&sched, writers, writer_count, fps, max_frames, &result);
+
+        printf("Method %d: %6d frames, %4d skipped, %7.2f s%s\n", fill_method, result.frames, result.skipped,
+            result.duration, (result.frames >= max_frames && !result.skipped) ? " (continuous)" : "");
+
+        for(int writer = 0; writer < writer_count; writer++)
+        {
+            if(result.jobs[writer])
+            {
+                printf("   writer %d: %5d writes, avg %6d KiB, %5.1f MiB/s\n", writer, result.jobs[writer],
+                    result.written[writer] / result.jobs[writer],
+                    result.writing_time[writer] ? result.written[writer] * 1000.0 / 1024.0 / result.writing_time[writer] : 0.0);
+            }
+        }
+
+        if(result.frames < expected_frames)
+        {
+            printf("   [FAIL] expected at least %d frames\n", expected_frames);
+            failed = 1;
+        }
+    }
+
+    return failed;
+}
@@ -6,6 +6,7 @@ OUT_FILE=$MLV_PATH/OUT
 FRAMES=5
 BIT_DEPTH=12
 LZMA_LEVEL=9
+THREADS=4
 
 echo ""
 echo "WARNING: This script is meant for internal testing."
@@ -39,11 +40,24 @@ echo "[i] Original size: $ORIG_FILESIZE --> $LOW_FILESIZE (shrinked to $PCT_LOW%
 echo ""
 echo ""
 
+# worker threads must not change the output, also with reduced bit depth
+echo "[4] Comparing single and multithreaded DNG output..."
+for OPTS in "" "-b $BIT_DEPTH" "-b $BIT_DEPTH --fixcp2 --cs2x2"; do
+    rm -f $OUT_FILE.st_* $OUT_FILE.mt_*
+    ./mlv_dump --dng $OPTS -o $OUT_FILE.st_ $OUT_FILE.snap > /dev/null
+    ./mlv_dump --dng $OPTS --threads=$THREADS -o $OUT_FILE.mt_ $OUT_FILE.snap > /dev/null
+    for DNG in $OUT_FILE.st_*.dng; do
+        cmp -s $DNG ${DNG/.st_/.mt_} || echo "[E] '$OPTS': $(basename ${DNG/.st_/.mt_}) differs"
+    done
+done
+rm -f $OUT_FILE.st_* $OUT_FILE.mt_*
+echo ""
+
 # feed to legacy converter
-echo "[4] Running raw2dng..."
+echo "[5] Running raw2dng..."
 ./raw2dng $OUT_FILE.raw $MLV_PATH
 
-echo "[5] Converting to JPEG"
+echo "[6] Converting to JPEG"
 ufraw-batch --out-type=jpg $MLV_PATH/*.dng > /dev/null 2>&1
 
 # cleanup
@@ -11,6 +11,7 @@
 
 
 #include "trace.h"
+#include "trace_bin.h"
 
 static trace_entry_t trace_contexts[TRACE_MAX_CONTEXT];
 
@@ -24,7 +25,10 @@ static void *trace_alloc(uint32_t size)
 
 static void trace_free(void *data)
 {
-    free(data);
+    if(data)
+    {
+        free(data);
+    }
 }
 
 static void trace_task(volatile trace_entry_t *ctx)
@@ -73,7 +77,9 @@ static void trace_task(volatile trace_entry_t *ctx)
                 {
                     FIO_CloseFile(ctx->file_handle);
                     trace_free(ctx->buffer);
+                    trace_free(ctx->bin_formats);
                     trace_free(write_buf);
+                    ctx->bin_formats = NULL;
                     ctx->task_state = TRACE_TASK_STATE_DEAD;
                     return;
                 }
@@ -89,10 +95,12 @@ static void trace_task(volatile trace_entry_t *ctx)
     /* we are doing the cleanup in this task */
     FIO_CloseFile(ctx->file_handle);
     trace_free(ctx->buffer);
+    trace_free(ctx->bin_formats);
     trace_free(write_buf);
     
     ctx->file_handle = NULL;
     ctx->buffer = NULL;
+    ctx->bin_formats = NULL;
     ctx->task_state = TRACE_TASK_STATE_DEAD;
     ctx->used = 0;
 }
@@ -129,6 +137,7 @@ uint32_t trace_start(char *name, char *file_name)
     ctx->buffer_written = 0;
     ctx->max_entries = 1000000;
     ctx->cur_entries = 0;
+    ctx->bin_formats = NULL;
 
     /* copy strings */
     strncpy((char *)ctx->name, name, sizeof(ctx->name));
@@ -209,15 +218,53 @@ uint32_t trace_stop(uint32_t context, uint32_t wait)
     /* try to clean up as much as possible */
     FIO_CloseFile(ctx->file_handle);
     trace_free(ctx->buffer);
+    trace_free(ctx->bin_formats);
 
     ctx->file_handle = NULL;
     ctx->buffer = NULL;
+    ctx->bin_formats = NULL;
     ctx->used = 0;
 
     /* we cannot handle this. is the task dead or not? */
     return TRACE_ERROR;
 }
 
+/* copy data into the ring buffer. call with interrupts disabled, the writer task must not see a partial entry */
+static uint32_t trace_buffer_put(trace_entry_t *ctx, void *data, uint32_t length)
+{
+    uint32_t read_pos = ctx->buffer_read_pos;
+    uint32_t write_pos = ctx->buffer_write_pos;
+    uint32_t available = 0;
+
+    if(write_pos >= read_pos)
+    {
+        available = ctx->buffer_size - (write_pos - read_pos) - 1;
+    }
+    else
+    {
+        available = read_pos - write_pos - 1;
+    }
+
+    if(length > available)
+    {
+        return TRACE_ERROR;
+    }
+
+    /* the entry may wrap around at the buffer end */
+    uint32_t commit_size = MIN(length, ctx->buffer_size - write_pos);
+
+    memcpy(&ctx->buffer[write_pos], data, commit_size);
+    if(commit_size < length)
+    {
+        memcpy(ctx->buffer, (char *)data + commit_size, length - commit_size);
+    }
+
+    ctx->buffer_write_pos = (write_pos + length) % ctx->buffer_size;
+    ctx->buffer_written += length;
+
+    return TRACE_OK;
+}
+
 /* setup some custom format options. when separator is a null byte, it will be omitted */
 uint32_t trace_format(uint32_t context, uint32_t format, char separator)
 {
@@ -228,6 +275,44 @@ uint32_t trace_format(uint32_t context, uint32_t format, char separator)
         return TRACE_ERROR;
     }
 
+    if(format & TRACE_FMT_BINARY)
+    {
+        if(!ctx->bin_formats)
+        {
+            uint32_t *bin_formats = trace_alloc(TRACE_BIN_FORMATS * sizeof(uint32_t));
+            
+            if(!bin_formats)
+            {
+                return TRACE_ERROR;
+            }
+            memset(bin_formats, 0x00, TRACE_BIN_FORMATS * sizeof(uint32_t));
+            ctx->bin_formats = bin_formats;
+        }
+        
+        /* tell the decoder how the text should look like */
+        trace_bin_file_t file;
+        
+        memset(&file, 0x00, sizeof(file));
+        file.hdr.type = TRACE_BIN_FILE;
+        file.hdr.length = sizeof(file);
+        memcpy(file.magic, TRACE_BIN_MAGIC, sizeof(TRACE_BIN_MAGIC));
+        file.version = TRACE_BIN_VERSION;
+        file.format = format;
+        file.separator = (uint8_t)separator;
+        file.max_line_length = TRACE_MAX_LINE_LENGTH;
+        file.start_tsc_low = (uint32_t)ctx->start_tsc;
+        file.start_tsc_high = (uint32_t)(ctx->start_tsc >> 32);
+        
+        uint32_t old_int = cli();
+        uint32_t ret = trace_buffer_put(ctx, &file, sizeof(file));
+        sei(old_int);
+        
+        if(ret != TRACE_OK)
+        {
+            return ret;
+        }
+    }
+
     ctx->format = format;
     ctx->separator = separator;
 
@@ -311,7 +396,179 @@ static uint32_t trace_write_timestamp(trace_entry_t *ctx, uint32_t type, tsc_t t
     return TRACE_OK;
 }
 
-uint32_t trace_vwrite(uint32_t context, tsc_t tsc, char *string, va_list ap)
+/* after an entry was put into the buffer */
+static void trace_entry_done(trace_entry_t *ctx)
+{
+    /* wake up writer if buffer is getting full */
+    if(ctx->buffer_written > ctx->buffer_size / 2)
+    {
+        ctx->buffer_written = 0;
+        msg_queue_post(ctx->queue, (uint32_t)ctx);
+    }
+    
+    /* reached the maximum allowed number of entries? */
+    ctx->cur_entries++;
+    if(ctx->cur_entries >= ctx->max_entries)
+    {
+        /* finish trace */
+        ctx->task_state = TRACE_TASK_STATE_SHUTDOWN;
+        msg_queue_post(ctx->queue, (uint32_t)ctx);
+    }
+}
+
+/* check if the format string was already stored, else remember it. call with interrupts disabled. */
+static uint32_t trace_bin_format_known(trace_entry_t *ctx, uint32_t address)
+{
+    uint32_t slot = (address >> 2) % TRACE_BIN_FORMATS;
+    
+    /* short linear probing, when there is no free slot the string just gets stored again */
+    for(uint32_t probe = 0; probe < 8; probe++)
+    {
+        uint32_t *entry = &ctx->bin_formats[(slot + probe) % TRACE_BIN_FORMATS];
+        
+        if(*entry == address)
+        {
+            return 1;
+        }
+        if(!*entry)
+        {
+            *entry = address;
+            return 0;
+        }
+    }
+    
+    return 0;
+}
+
+/* binary format: no formatting here, just copy the raw arguments (see trace_bin.h) */
+static uint32_t trace_vwrite_binary(trace_entry_t *ctx, tsc_t tsc, uint32_t caller, char *string, va_list ap)
+{
+    /* the format string definition is only built with interrupts disabled, so it can be static */
+    static uint32_t format_record[(sizeof(trace_bin_format_t) + TRACE_MAX_LINE_LENGTH + 4) / 4];
+    uint32_t record[(sizeof(trace_bin_entry_t) + TRACE_MAX_LINE_LENGTH) / 4];
+    trace_bin_entry_t *entry = (trace_bin_entry_t *)record;
+    uint32_t max_words = TRACE_MAX_LINE_LENGTH / 4;
+    uint32_t words = 0;
+    
+    entry->hdr.type = TRACE_BIN_ENTRY;
+    entry->hdr.reserved = 0;
+    entry->format = (uint32_t)string;
+    entry->caller = caller;
+    entry->tsc_low = (uint32_t)tsc;
+    entry->tsc_high = (uint32_t)(tsc >> 32);
+    
+    const char *fmt = string;
+    const char *conversion = NULL;
+    int stars = 0;
+    int type = 0;
+    
+    while(fmt && (fmt = trace_bin_next_conversion(fmt, &conversion, &stars, &type)))
+    {
+        /* more arguments than we can store, the decoder prints what it has */
+        if(words + stars + 2 > max_words)
+        {
+            break;
+        }
+        
+        while(stars--)
+        {
+            entry->args[words++] = va_arg(ap, uint32_t);
+        }
+        
+        switch(type)
+        {
+            case TRACE_ARG_INT:
+            {
+                entry->args[words++] = va_arg(ap, uint32_t);
+                break;
+            }
+            case TRACE_ARG_LONG:
+            {
+                uint64_t value = va_arg(ap, uint64_t);
+                memcpy(&entry->args[words], &value, sizeof(value));
+                words += 2;
+                break;
+            }
+            case TRACE_ARG_DOUBLE:
+            {
+                double value = va_arg(ap, double);
+                memcpy(&entry->args[words], &value, sizeof(value));
+                words += 2;
+                break;
+            }
+            case TRACE_ARG_STRING:
+            {
+                char *text = va_arg(ap, char *);
+                uint32_t length = 0;
+                uint32_t space = (max_words - words - 1) * 4;
+                
+                if(!text)
+                {
+                    text = "(null)";
+                }
+                while(text[length] && length < TRACE_BIN_MAX_STRING && length < space)
+                {
+                    length++;
+                }
+                
+                entry->args[words++] = length;
+                if(length)
+                {
+                    /* clear the padding bytes */
+                    entry->args[words + (length - 1) / 4] = 0;
+                    memcpy(&entry->args[words], text, length);
+                }
+                words += (length + 3) / 4;
+                break;
+            }
+            case TRACE_ARG_IGNORE:
+            {
+                (void)va_arg(ap, void *);
+                break;
+            }
+        }
+    }
+    
+    entry->hdr.length = sizeof(trace_bin_entry_t) + words * 4;
+    
+    uint32_t old_int = cli();
+    
+    /* first use of this format string? store it before the entry that needs it */
+    if(string && !trace_bin_format_known(ctx, (uint32_t)string))
+    {
+        trace_bin_format_t *format = (trace_bin_format_t *)format_record;
+        uint32_t length = MIN(strlen(string), TRACE_MAX_LINE_LENGTH);
+        
+        format->hdr.type = TRACE_BIN_FORMAT;
+        format->hdr.reserved = 0;
+        format->hdr.length = sizeof(trace_bin_format_t) + ((length + 4) & ~3);
+        format->address = (uint32_t)string;
+        memset(&format->text[length & ~3], 0x00, 4);
+        memcpy(format->text, string, length);
+        
+        if(trace_buffer_put(ctx, format, format->hdr.length) != TRACE_OK)
+        {
+            ctx->task_state = TRACE_TASK_STATE_SHUTDOWN;
+            sei(old_int);
+            return TRACE_ERROR;
+        }
+    }
+    
+    if(trace_buffer_put(ctx, entry, entry->hdr.length) != TRACE_OK)
+    {
+        /* abort trace as data will be lost */
+        ctx->task_state = TRACE_TASK_STATE_SHUTDOWN;
+        sei(old_int);
+        return TRACE_ERROR;
+    }
+    
+    sei(old_int);
+    
+    trace_entry_done(ctx);
+    return TRACE_OK;
+}
+
+static uint32_t trace_vwrite_caller(uint32_t context, tsc_t tsc, uint32_t caller, char *string, va_list ap)
 {
     uint32_t linebuffer_pos = 0;
     trace_entry_t *ctx = &trace_contexts[context];
@@ -322,6 +579,11 @@ uint32_t trace_vwrite(uint32_t context, tsc_t tsc, char *string, va_list ap)
         return TRACE_OK;
     }
     
+    if(ctx->format & TRACE_FMT_BINARY)
+    {
+        return trace_vwrite_binary(ctx, tsc, caller, string, ap);
+    }
+    
     /* build timestamp string */
     uint32_t max_len = TRACE_MAX_LINE_LENGTH;
     char *linebuffer = malloc(max_len + 1);
@@ -386,9 +648,10 @@ uint32_t trace_vwrite(uint32_t context, tsc_t tsc, char *string, va_list ap)
         len = vsnprintf(&linebuffer[linebuffer_pos], max_len - linebuffer_pos, string, ap);
     }
     
+    /* vsnprintf returns the untruncated length */
     if(len > 0)
     {
-        linebuffer_pos += len;
+        linebuffer_pos += MIN(len, max_len - linebuffer_pos - 1);
     }
     
     /* attach a newline */
@@ -396,29 +659,9 @@ uint32_t trace_vwrite(uint32_t context, tsc_t tsc, char *string, va_list ap)
     
     /* check and reserve memory in ringbuffer - use interrupt disabling as mutex */
     uint32_t old_int = cli();
-    uint32_t read_pos = ctx->buffer_read_pos;
-    uint32_t write_pos = ctx->buffer_write_pos;
-    uint32_t available = 0;
-
-    /*  */
-    if(write_pos > read_pos)
-    {
-        available = ctx->buffer_size - (write_pos - read_pos) - 1;
-    }
-    else
-    {
-        available = read_pos - write_pos - 1;
-    }
-    
-    if(linebuffer_pos < available)
-    {
-        ctx->buffer_write_pos += linebuffer_pos;
-        ctx->buffer_write_pos %= ctx->buffer_size;
-        ctx->buffer_written += linebuffer_pos;
-    }
     
     /* seems the string was too long */
-    if(linebuffer_pos > available)
+    if(trace_buffer_put(ctx, linebuffer, linebuffer_pos) != TRACE_OK)
     {
         /* abort trace as data will be lost */
         ctx->task_state = TRACE_TASK_STATE_SHUTDOWN;
@@ -426,56 +669,27 @@ uint32_t trace_vwrite(uint32_t context, tsc_t tsc, char *string, va_list ap)
         free(linebuffer);
         return TRACE_ERROR;
     }
-
-    /* successful, commit the buffer content */
-    uint32_t commit_size = 0;
-    
-    if(write_pos > read_pos)
-    {
-        commit_size = ctx->buffer_size - write_pos;
-    }
-    else
-    {
-        commit_size = read_pos - write_pos - 1;
-    }
-    commit_size = MIN(linebuffer_pos,commit_size);
-    
-    memcpy(&ctx->buffer[write_pos], linebuffer, commit_size);
-    
-    if(commit_size < linebuffer_pos)
-    {
-        memcpy(ctx->buffer, &linebuffer[commit_size], linebuffer_pos - commit_size);
-    }
     
     sei(old_int);
     
-    /* wake up writer if buffer is getting full */
-    if(ctx->buffer_written > ctx->buffer_size / 2)
-    {
-        ctx->buffer_written = 0;
-        msg_queue_post(ctx->queue, (uint32_t)ctx);
-    }
-    
-    /* reached the maximum allowed number of entries? */
-    ctx->cur_entries++;
-    if(ctx->cur_entries >= ctx->max_entries)
-    {
-        /* finish trace */
-        ctx->task_state = TRACE_TASK_STATE_SHUTDOWN;
-        msg_queue_post(ctx->queue, (uint32_t)ctx);
-    }
+    trace_entry_done(ctx);
 
     free(linebuffer);
     return TRACE_OK;
 }
 
+uint32_t trace_vwrite(uint32_t context, tsc_t tsc, char *string, va_list ap)
+{
+    return trace_vwrite_caller(context, tsc, (uint32_t)__builtin_return_address(0), string, ap);
+}
+
 /* write some string into specified trace */
 uint32_t trace_write(uint32_t context, char *string, ...)
 {
     va_list ap;
     
     va_start(ap, string);
-    uint32_t ret = trace_vwrite(context, get_us_clock(), string, ap);
+    uint32_t ret = trace_vwrite_caller(context, get_us_clock(), (uint32_t)__builtin_return_address(0), string, ap);
     va_end(ap);
     
     return ret;
@@ -486,7 +700,7 @@ uint32_t trace_write_tsc(uint32_t context, tsc_t tsc, char *string, ...)
     va_list ap;
     
     va_start(ap, string);
-    uint32_t ret = trace_vwrite(context, tsc, string, ap);
+    uint32_t ret = trace_vwrite_caller(context, tsc, (uint32_t)__builtin_return_address(0), string, ap);
     va_end(ap);
     
     return ret;
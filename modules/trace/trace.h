@@ -20,6 +20,7 @@
 #define TRACE_FMT_TIME_DELTA      0x0020 /* write the relative time as hh:mm:ss.msec since last entry*/
 #define TRACE_FMT_TIME_DATE       0x0040 /* write the time of day */
 #define TRACE_FMT_COMMENT         0x1000 /* headers are C like comments */
+#define TRACE_FMT_BINARY          0x2000 /* store format string address, TSC and arguments only, decode on PC (trace_decode) */
 
 #define TRACE_FMT_META            0x0100 /* on start and stop write some metadata (e.g. day, time, ...) */
 
@@ -63,6 +64,9 @@ typedef struct
     tsc_t start_tsc;
     tsc_t last_tsc;
     
+    /* format strings already stored in binary format */
+    uint32_t *bin_formats;
+    
     /* task status */
     uint32_t task_state;
     uint32_t task;
@@ -0,0 +1,143 @@
+#ifndef __trace_bin_h__
+#define __trace_bin_h__
+
+/* binary trace records (TRACE_FMT_BINARY), shared with the trace_decode host tool
+ *
+ * instead of formatting the text in the caller's context, trace_vwrite only stores
+ * the address of the format string, the TSC and the raw arguments. every format
+ * string is stored once per trace (TRACE_BIN_FORMAT) the first time it is used,
+ * so the file can be decoded without the camera memory.
+ *
+ * all records are little endian, 4 byte aligned and start with trace_bin_hdr_t.
+ * 64 bit values are split into two words, so the layout has no padding on any ABI.
+ */
+
+#define TRACE_BIN_MAGIC      "MLTRACE"
+#define TRACE_BIN_VERSION    1
+
+#define TRACE_BIN_FILE       1  /* format options, written when binary format is selected */
+#define TRACE_BIN_FORMAT     2  /* format string definition */
+#define TRACE_BIN_ENTRY      3  /* one trace_write call */
+
+/* a single %s argument is stored with at most this many characters */
+#define TRACE_BIN_MAX_STRING 64
+
+/* format strings we remember per trace, the others get stored again with every entry */
+#define TRACE_BIN_FORMATS    256
+
+typedef struct
+{
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t length;            /* whole record, including this header */
+} trace_bin_hdr_t;
+
+typedef struct
+{
+    trace_bin_hdr_t hdr;
+    char magic[8];              /* TRACE_BIN_MAGIC */
+    uint32_t version;
+    uint32_t format;            /* TRACE_FMT_* options the text would have been written with */
+    uint32_t separator;
+    uint32_t max_line_length;
+    uint32_t start_tsc_low;
+    uint32_t start_tsc_high;
+} trace_bin_file_t;
+
+typedef struct
+{
+    trace_bin_hdr_t hdr;
+    uint32_t address;           /* address of the format string on the camera */
+    char text[];                /* null terminated, padded to 4 bytes */
+} trace_bin_format_t;
+
+/* arguments follow as 32 bit words in the order of the conversions:
+ *  '*' width or precision: 1 word
+ *  32 bit integers, chars and pointers: 1 word
+ *  64 bit integers (ll, j, q) and floating point: 2 words, low word first
+ *  strings: 1 word with the length, then the characters (not terminated), padded to 4 bytes
+ */
+typedef struct
+{
+    trace_bin_hdr_t hdr;
+    uint32_t format;            /* address of the format string */
+    uint32_t caller;            /* return address into the code that called trace_write */
+    uint32_t tsc_low;
+    uint32_t tsc_high;
+    uint32_t args[];
+} trace_bin_entry_t;
+
+/* argument types of printf conversions */
+#define TRACE_ARG_NONE       0  /* %% */
+#define TRACE_ARG_INT        1
+#define TRACE_ARG_LONG       2
+#define TRACE_ARG_DOUBLE     3
+#define TRACE_ARG_STRING     4
+#define TRACE_ARG_IGNORE     5  /* %n, takes a pointer but prints nothing */
+
+/* find the next conversion in a format string, starting at fmt.
+ * returns a pointer right after the conversion or NULL if there is none.
+ * start is set to the '%', stars to the number of '*' arguments, type to TRACE_ARG_* */
+static inline const char *trace_bin_next_conversion(const char *fmt, const char **start, int *stars, int *type)
+{
+    while(*fmt && *fmt != '%')
+    {
+        fmt++;
+    }
+
+    if(!*fmt)
+    {
+        return NULL;
+    }
+
+    *start = fmt++;
+    *stars = 0;
+
+    /* flags, width, precision */
+    while((*fmt >= '0' && *fmt <= '9') || *fmt == '-' || *fmt == '+' || *fmt == ' ' || *fmt == '#' || *fmt == '.' || *fmt == '*' || *fmt == '\'')
+    {
+        if(*fmt == '*')
+        {
+            (*stars)++;
+        }
+        fmt++;
+    }
+
+    /* length modifiers */
+    int longs = 0;
+    while(*fmt == 'h' || *fmt == 'l' || *fmt == 'L' || *fmt == 'q' || *fmt == 'j' || *fmt == 'z' || *fmt == 't')
+    {
+        if(*fmt == 'l' || *fmt == 'L' || *fmt == 'q' || *fmt == 'j')
+        {
+            longs += (*fmt == 'l') ? 1 : 2;
+        }
+        fmt++;
+    }
+
+    switch(*fmt)
+    {
+        case '%':
+            *type = TRACE_ARG_NONE;
+            break;
+        case 's':
+            *type = TRACE_ARG_STRING;
+            break;
+        case 'n':
+            *type = TRACE_ARG_IGNORE;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            *type = TRACE_ARG_DOUBLE;
+            break;
+        case 0:
+            /* incomplete conversion at the end */
+            *type = TRACE_ARG_NONE;
+            return fmt;
+        default:
+            *type = (longs >= 2) ? TRACE_ARG_LONG : TRACE_ARG_INT;
+            break;
+    }
+
+    return fmt + 1;
+}
+
+#endif
@@ -0,0 +1,550 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/* decode a trace written with TRACE_FMT_BINARY into the text trace_vwrite would have written
+ *
+ * usage: trace_decode [-s magiclantern.sym] trace.bin > trace.txt
+ *
+ * with a symbol file, every line is prefixed with the function that called trace_write
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+
+/* the format options are shared with the module */
+#define TRACE_FMT_TIME_CTR        0x0001
+#define TRACE_FMT_TIME_CTR_REL    0x0002
+#define TRACE_FMT_TIME_CTR_DELTA  0x0004
+#define TRACE_FMT_TIME_ABS        0x0008
+#define TRACE_FMT_TIME_REL        0x0010
+#define TRACE_FMT_TIME_DELTA      0x0020
+#define TRACE_FMT_TIME_DATE       0x0040
+#define TRACE_FMT_COMMENT         0x1000
+
+#include "trace_bin.h"
+
+typedef struct
+{
+    uint32_t address;
+    char *text;
+} format_def_t;
+
+typedef struct
+{
+    uint32_t address;
+    char *name;
+} symbol_t;
+
+static format_def_t *formats = NULL;
+static uint32_t format_count = 0;
+
+static symbol_t *symbols = NULL;
+static uint32_t symbol_count = 0;
+
+static void format_define(uint32_t address, const char *text)
+{
+    for(uint32_t pos = 0; pos < format_count; pos++)
+    {
+        if(formats[pos].address == address)
+        {
+            free(formats[pos].text);
+            formats[pos].text = strdup(text);
+            return;
+        }
+    }
+
+    formats = realloc(formats, (format_count + 1) * sizeof(format_def_t));
+    formats[format_count].address = address;
+    formats[format_count].text = strdup(text);
+    format_count++;
+}
+
+static const char *format_lookup(uint32_t address)
+{
+    for(uint32_t pos = 0; pos < format_count; pos++)
+    {
+        if(formats[pos].address == address)
+        {
+            return formats[pos].text;
+        }
+    }
+
+    return NULL;
+}
+
+static int symbol_compare(const void *a, const void *b)
+{
+    const symbol_t *sa = a;
+    const symbol_t *sb = b;
+
+    return (sa->address > sb->address) - (sa->address < sb->address);
+}
+
+/* magiclantern.sym: "address name" per line. sorted by address after loading, for symbol_name */
+static int symbols_load(const char *filename)
+{
+    FILE *f = fopen(filename, "r");
+    char line[256];
+
+    if(!f)
+    {
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), f))
+    {
+        char name[200];
+        uint32_t address = 0;
+
+        if(sscanf(line, "%x %199s", &address, name) != 2)
+        {
+            continue;
+        }
+
+        symbols = realloc(symbols, (symbol_count + 1) * sizeof(symbol_t));
+        symbols[symbol_count].address = address;
+        symbols[symbol_count].name = strdup(name);
+        symbol_count++;
+    }
+
+    fclose(f);
+
+    qsort(symbols, symbol_count, sizeof(symbol_t), symbol_compare);
+    return 0;
+}
+
+static void symbol_name(uint32_t address, char *buf, uint32_t size)
+{
+    symbol_t *best = NULL;
+    uint32_t low = 0;
+    uint32_t high = symbol_count;
+
+    /* binary search for the last symbol at or below the address */
+    while(low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+
+        if(symbols[mid].address <= address)
+        {
+            best = &symbols[mid];
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+
+    /* module code is loaded at runtime, it's not in the symbol file */
+    if(!best || address - best->address > 0x10000)
+    {
+        snprintf(buf, size, "0x%08X", address);
+        return;
+    }
+
+    snprintf(buf, size, "%s+0x%X", best->name, address - best->address);
+}
+
+/* same as trace_write_timestamp in trace.c */
+static uint32_t write_timestamp(char *line, uint32_t pos, uint32_t type, uint64_t tsc, char separator)
+{
+    char tmp[32];
+
+    switch(type)
+    {
+        case TRACE_FMT_TIME_CTR:
+        {
+            snprintf(tmp, sizeof(tmp), "%08X%08X", (uint32_t)(tsc >> 32), (uint32_t)tsc);
+            memcpy(&line[pos], tmp, 16);
+            pos += 16;
+            break;
+        }
+        case TRACE_FMT_TIME_ABS:
+        {
+            uint32_t usec = tsc % 1000000ULL;
+            uint32_t sec_total = tsc / 1000000ULL;
+            uint32_t sec = sec_total % 60;
+            uint32_t min = (sec_total / 60) % 60;
+            uint32_t hrs = (sec_total / 3600) % 60;
+
+            snprintf(tmp, sizeof(tmp), "%02d:%02d:%02d.%06d", hrs, min, sec, usec);
+            memcpy(&line[pos], tmp, 15);
+            pos += 15;
+            break;
+        }
+    }
+
+    line[pos++] = separator;
+    return pos;
+}
+
+/* copy a conversion spec, replacing the length modifiers with the ones the host needs */
+static void host_spec(char *spec, const char *start, const char *end, int type)
+{
+    uint32_t pos = 0;
+
+    for(const char *c = start; c < end - 1; c++)
+    {
+        if(!strchr("hlLqjzt", *c))
+        {
+            spec[pos++] = *c;
+        }
+    }
+
+    if(type == TRACE_ARG_LONG)
+    {
+        spec[pos++] = 'l';
+        spec[pos++] = 'l';
+    }
+
+    /* camera pointers are 32 bit */
+    if(end[-1] == 'p')
+    {
+        memmove(&spec[2], spec, pos);
+        spec[0] = '0';
+        spec[1] = 'x';
+        pos += 2;
+        spec[pos++] = 'x';
+    }
+    else
+    {
+        spec[pos++] = end[-1];
+    }
+
+    spec[pos] = '\000';
+}
+
+/* format the message like vsnprintf would have done on the camera */
+static uint32_t format_message(char *out, uint32_t size, const char *fmt, uint32_t *args, uint32_t words)
+{
+    uint32_t pos = 0;
+    uint32_t word = 0;
+    const char *start = NULL;
+    const char *next = NULL;
+    int stars = 0;
+    int type = 0;
+
+    #define OUT_APPEND(...) do { if(pos < size) { int ret = snprintf(&out[pos], size - pos, __VA_ARGS__); if(ret > 0) { pos += ret; } } } while(0)
+
+    while((next = trace_bin_next_conversion(fmt, &start, &stars, &type)))
+    {
+        /* literal text before the conversion */
+        OUT_APPEND("%.*s", (int)(start - fmt), fmt);
+        fmt = next;
+
+        if(type == TRACE_ARG_NONE)
+        {
+            if(next[-1] == '%')
+            {
+                OUT_APPEND("%%");
+            }
+            continue;
+        }
+
+        int star_args[2] = { 0, 0 };
+        for(int star = 0; star < stars; star++)
+        {
+            if(word >= words)
+            {
+                return pos;
+            }
+            if(star < 2)
+            {
+                star_args[star] = (int)args[word];
+            }
+            word++;
+        }
+
+        char spec[64];
+        host_spec(spec, start, next, type);
+
+        #define OUT_CONVERSION(value) do { \
+            if(stars == 0) OUT_APPEND(spec, value); \
+            else if(stars == 1) OUT_APPEND(spec, star_args[0], value); \
+            else OUT_APPEND(spec, star_args[0], star_args[1], value); \
+        } while(0)
+
+        switch(type)
+        {
+            case TRACE_ARG_INT:
+            {
+                if(word + 1 > words)
+                {
+                    return pos;
+                }
+                OUT_CONVERSION(args[word]);
+                word++;
+                break;
+            }
+            case TRACE_ARG_LONG:
+            {
+                uint64_t value;
+
+                if(word + 2 > words)
+                {
+                    return pos;
+                }
+                memcpy(&value, &args[word], sizeof(value));
+                OUT_CONVERSION((unsigned long long)value);
+                word += 2;
+                break;
+            }
+            case TRACE_ARG_DOUBLE:
+            {
+                double value;
+
+                if(word + 2 > words)
+                {
+                    return pos;
+                }
+                memcpy(&value, &args[word], sizeof(value));
+                OUT_CONVERSION(value);
+                word += 2;
+                break;
+            }
+            case TRACE_ARG_STRING:
+            {
+                char text[TRACE_BIN_MAX_STRING + 1];
+
+                if(word + 1 > words)
+                {
+                    return pos;
+                }
+                uint32_t length = args[word++];
+                if(length > TRACE_BIN_MAX_STRING || word + (length + 3) / 4 > words)
+                {
+                    return pos;
+                }
+                memcpy(text, &args[word], length);
+                text[length] = '\000';
+                OUT_CONVERSION(text);
+                word += (length + 3) / 4;
+                break;
+            }
+        }
+        #undef OUT_CONVERSION
+    }
+
+    /* the rest of the format string */
+    OUT_APPEND("%s", fmt);
+    #undef OUT_APPEND
+
+    return (pos < size) ? pos : size - 1;
+}
+
+int main(int argc, char *argv[])
+{
+    char *sym_file = NULL;
+    int opt;
+
+    while((opt = getopt(argc, argv, "s:")) != -1)
+    {
+        switch(opt)
+        {
+            case 's':
+                sym_file = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-s magiclantern.sym] trace.bin\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if(optind >= argc)
+    {
+        fprintf(stderr, "usage: %s [-s magiclantern.sym] trace.bin\n", argv[0]);
+        return 1;
+    }
+
+    if(sym_file && symbols_load(sym_file))
+    {
+        fprintf(stderr, "Could not read '%s'\n", sym_file);
+        return 1;
+    }
+
+    FILE *in_file = fopen(argv[optind], "rb");
+    if(!in_file)
+    {
+        fprintf(stderr, "Could not open '%s'\n", argv[optind]);
+        return 1;
+    }
+
+    uint32_t format = 0;
+    char separator = ' ';
+    uint32_t max_len = 256;
+    uint64_t start_tsc = 0;
+    uint64_t last_tsc = 0;
+    int have_header = 0;
+    uint32_t offset = 0;
+
+    uint32_t record[65536 / 4];
+    char line[65536];
+
+    while(1)
+    {
+        trace_bin_hdr_t *hdr = (trace_bin_hdr_t *)record;
+
+        if(fread(hdr, 1, sizeof(trace_bin_hdr_t), in_file) != sizeof(trace_bin_hdr_t))
+        {
+            break;
+        }
+
+        if(hdr->length < sizeof(trace_bin_hdr_t) || (hdr->length & 3))
+        {
+            fprintf(stderr, "Invalid record at offset 0x%08X\n", offset);
+            return 1;
+        }
+
+        uint32_t remain = hdr->length - sizeof(trace_bin_hdr_t);
+        if(fread(&record[1], 1, remain, in_file) != remain)
+        {
+            fprintf(stderr, "Trace truncated at offset 0x%08X\n", offset);
+            break;
+        }
+        offset += hdr->length;
+
+        switch(hdr->type)
+        {
+            case TRACE_BIN_FILE:
+            {
+                trace_bin_file_t *file = (trace_bin_file_t *)record;
+
+                if(memcmp(file->magic, TRACE_BIN_MAGIC, sizeof(TRACE_BIN_MAGIC)) || file->version != TRACE_BIN_VERSION)
+                {
+                    fprintf(stderr, "Not a binary trace or unsupported version\n");
+                    return 1;
+                }
+
+                format = file->format;
+                separator = (char)file->separator;
+                max_len = file->max_line_length;
+                if(!have_header)
+                {
+                    start_tsc = ((uint64_t)file->start_tsc_high << 32) | file->start_tsc_low;
+                    last_tsc = start_tsc;
+                    have_header = 1;
+                }
+                break;
+            }
+
+            case TRACE_BIN_FORMAT:
+            {
+                trace_bin_format_t *def = (trace_bin_format_t *)record;
+
+                ((char *)record)[hdr->length - 1] = '\000';
+                format_define(def->address, def->text);
+                break;
+            }
+
+            case TRACE_BIN_ENTRY:
+            {
+                trace_bin_entry_t *entry = (trace_bin_entry_t *)record;
+                uint32_t words = (hdr->length - sizeof(trace_bin_entry_t)) / 4;
+                uint64_t tsc = ((uint64_t)entry->tsc_high << 32) | entry->tsc_low;
+                uint32_t pos = 0;
+
+                if(!have_header)
+                {
+                    fprintf(stderr, "Not a binary trace\n");
+                    return 1;
+                }
+
+                if(format & TRACE_FMT_COMMENT)
+                {
+                    memcpy(&line[pos], "/* ", 3);
+                    pos += 3;
+                }
+                if(format & TRACE_FMT_TIME_CTR)
+                {
+                    pos = write_timestamp(line, pos, TRACE_FMT_TIME_CTR, tsc, separator);
+                }
+                if(format & TRACE_FMT_TIME_CTR_REL)
+                {
+                    pos = write_timestamp(line, pos, TRACE_FMT_TIME_CTR, tsc - start_tsc, separator);
+                }
+                if(format & TRACE_FMT_TIME_CTR_DELTA)
+                {
+                    pos = write_timestamp(line, pos, TRACE_FMT_TIME_CTR, tsc - last_tsc, separator);
+                }
+                if(format & TRACE_FMT_TIME_ABS)
+                {
+                    pos = write_timestamp(line, pos, TRACE_FMT_TIME_ABS, tsc, separator);
+                }
+                if(format & TRACE_FMT_TIME_REL)
+                {
+                    pos = write_timestamp(line, pos, TRACE_FMT_TIME_ABS, tsc - start_tsc, separator);
+                }
+                if(format & TRACE_FMT_TIME_DELTA)
+                {
+                    pos = write_timestamp(line, pos, TRACE_FMT_TIME_ABS, tsc - last_tsc, separator);
+                }
+                if(format & TRACE_FMT_TIME_DATE)
+                {
+                    pos = write_timestamp(line, pos, TRACE_FMT_TIME_DATE, tsc, separator);
+                }
+                if(format & TRACE_FMT_COMMENT)
+                {
+                    memcpy(&line[pos], " */ ", 4);
+                    pos += 4;
+                }
+                last_tsc = tsc;
+
+                if(sym_file)
+                {
+                    char name[256];
+                    symbol_name(entry->caller, name, sizeof(name));
+                    fprintf(stdout, "[%s] ", name);
+                }
+
+                if(entry->format)
+                {
+                    const char *fmt = format_lookup(entry->format);
+
+                    if(fmt)
+                    {
+                        /* lines are limited to max_len on the camera */
+                        uint32_t size = (max_len > pos) ? (max_len - pos) : 1;
+                        pos += format_message(&line[pos], size, fmt, entry->args, words);
+                    }
+                    else
+                    {
+                        pos += sprintf(&line[pos], "<unknown format string 0x%08X>", entry->format);
+                    }
+                }
+
+                line[pos++] = '\n';
+                fwrite(line, 1, pos, stdout);
+                break;
+            }
+
+            default:
+            {
+                fprintf(stderr, "Unknown record type %d at offset 0x%08X\n", hdr->type, offset - hdr->length);
+                return 1;
+            }
+        }
+    }
+
+    fclose(in_file);
+    return 0;
+}
@@ -172,6 +172,14 @@ void dng_set_thumbnail_size(int width, int height)
     dng_th_height = height;
 }
 
+static int dng_compression = DNG_COMPRESSION_NONE;
+
+/* warning: not thread safe */
+void dng_set_compression(int compression)
+{
+    dng_compression = compression;
+}
+
 struct dir_entry{unsigned short tag; unsigned short type; unsigned int count; unsigned int offset;};
 
 #define T_BYTE      1
@@ -199,6 +207,9 @@ static char cam_name[32]                    = "Canikon";
 static char cam_serial[64]                  = "";
 static char dng_artist_name[64]             = "";
 static char dng_copyright[64]               = "";
+static const char* dng_xmp                  = 0;
+static int dng_xmp_size                     = 0;
+static int dng_orientation                  = 1;
 static const short cam_PreviewBitsPerSample[]  = {8,8,8};
 static const int cam_Resolution[]              = {180,1};
 static int cam_AsShotNeutral[6]         = {473635,1000000,1000000,1000000,624000,1000000}; // wbgain default: daylight
@@ -275,6 +286,7 @@ static int find_tag_index(struct dir_entry * ifd, int num, unsigned short tag)
 #define CHDK_VER_INDEX              find_tag_index(ifd0, DIR_SIZE(ifd0), 0x131)
 #define ARTIST_NAME_INDEX           find_tag_index(ifd0, DIR_SIZE(ifd0), 0x13B)
 #define SUBIFDS_INDEX               find_tag_index(ifd0, DIR_SIZE(ifd0), 0x14A)
+#define XMP_INDEX                   find_tag_index(ifd0, DIR_SIZE(ifd0), 0x2BC)
 #define COPYRIGHT_INDEX             find_tag_index(ifd0, DIR_SIZE(ifd0), 0x8298)
 #define EXIF_IFD_INDEX              find_tag_index(ifd0, DIR_SIZE(ifd0), 0x8769)
 #define DNG_VERSION_INDEX           find_tag_index(ifd0, DIR_SIZE(ifd0), 0xC612)
@@ -284,6 +296,7 @@ static int find_tag_index(struct dir_entry * ifd, int num, unsigned short tag)
 
 
 // Index of specific entries in ifd1 below.
+#define COMPRESSION_INDEX           find_tag_index(ifd1, DIR_SIZE(ifd1), 0x103)
 #define RAW_DATA_INDEX              find_tag_index(ifd1, DIR_SIZE(ifd1), 0x111)
 #define BADPIXEL_OPCODE_INDEX       find_tag_index(ifd1, DIR_SIZE(ifd1), 0xC740)
 
@@ -406,6 +419,36 @@ void dng_set_datetime(char *datetime, char *subsectime)
     strncpy(cam_subsectime, subsectime, sizeof(cam_subsectime));
 }
 
+void dng_set_artist(char *str)
+{
+    strncpy(dng_artist_name, str, sizeof(dng_artist_name));
+    dng_artist_name[sizeof(dng_artist_name)-1] = 0;
+}
+
+void dng_set_copyright(char *str)
+{
+    strncpy(dng_copyright, str, sizeof(dng_copyright));
+    dng_copyright[sizeof(dng_copyright)-1] = 0;
+}
+
+void dng_set_exposure_bias(int nom, int denom)
+{
+    cam_exp_bias[0] = nom;
+    cam_exp_bias[1] = denom;
+}
+
+void dng_set_orientation(int orientation)
+{
+    dng_orientation = orientation;
+}
+
+/* XMP packet, stored as is; the buffer must stay valid until save_dng returns. NULL to remove it */
+void dng_set_xmp(const char *xmp, int size)
+{
+    dng_xmp = xmp;
+    dng_xmp_size = xmp ? size : 0;
+}
+
 
 static void create_dng_header(struct raw_info * raw_info){
     int i,j;
@@ -432,6 +475,7 @@ static void create_dng_header(struct raw_info * raw_info){
         {0x132,  T_ASCII,      20, (int)cam_datetime},                 // DateTime
         {0x13B,  T_ASCII|T_PTR,64, (int)dng_artist_name},              // Artist: Filled at header generation.
         {0x14A,  T_LONG,       1,  0},                                 // SubIFDs offset
+        {0x2BC,  T_BYTE|T_SKIP,0,  0},                                 // XMP packet (only if dng_set_xmp was called)
         {0x8298, T_ASCII|T_PTR,64, (int)dng_copyright},                // Copyright
         {0x8769, T_LONG,       1,  0},                                 // EXIF_IFD offset
         {0x9216, T_BYTE,       4,  0x00000001},                        // TIFF/EPStandardID: 1.0.0.0
@@ -457,7 +501,7 @@ static void create_dng_header(struct raw_info * raw_info){
         {0x100,  T_LONG|T_PTR, 1,  (int)&camera_sensor.raw_rowpix},    // ImageWidth
         {0x101,  T_LONG|T_PTR, 1,  (int)&camera_sensor.raw_rows},      // ImageLength
         {0x102,  T_SHORT|T_PTR,1,  (int)&camera_sensor.bits_per_pixel},// BitsPerSample
-        {0x103,  T_SHORT,      1,  1},                                 // Compression: Uncompressed
+        {0x103,  T_SHORT,      1,  1},                                 // Compression: Uncompressed or lossless JPEG
         {0x106,  T_SHORT,      1,  0x8023},                            // PhotometricInterpretation: CFA
         {0x111,  T_LONG,       1,  0},                                 // StripOffsets: Offset
         {0x115,  T_SHORT,      1,  1},                                 // SamplesPerPixel: 1
@@ -509,6 +553,7 @@ static void create_dng_header(struct raw_info * raw_info){
     };
 
     ifd0[DNG_VERSION_INDEX].offset = BE(0x01030000);
+    ifd1[COMPRESSION_INDEX].offset = dng_compression;
     
     ifd1[BADPIXEL_OPCODE_INDEX].type &= ~T_SKIP;
         // Set CFAPattern value
@@ -537,8 +582,25 @@ static void create_dng_header(struct raw_info * raw_info){
     ifd0[CHDK_VER_INDEX].count = strlen(software_ver) + 1;
     ifd0[ARTIST_NAME_INDEX].count = strlen(dng_artist_name) + 1;
     ifd0[COPYRIGHT_INDEX].count = strlen(dng_copyright) + 1;
+    ifd0[ORIENTATION_INDEX].offset = dng_orientation;
     //~ ifd0[ORIENTATION_INDEX].offset = get_orientation_for_exif(exif_data.orientation);
 
+    if (dng_xmp_size)
+    {
+        ifd0[XMP_INDEX].type &= ~T_SKIP;
+        ifd0[XMP_INDEX].count = dng_xmp_size;
+        ifd0[XMP_INDEX].offset = (int)dng_xmp;
+    }
+
+    // skipped entries are not saved
+    for (j=0;j<ifd_count;j++)
+    {
+        ifd_list[j].count = 0;
+        for(i=0; i<ifd_list[j].entry_count; i++)
+            if ((ifd_list[j].entry[i].type & T_SKIP) == 0)
+                ifd_list[j].count++;
+    }
+
     //~ exif_ifd[EXPOSURE_PROGRAM_INDEX].offset = get_exp_program_for_exif(exif_data.exp_program);
     //~ exif_ifd[METERING_MODE_INDEX].offset = get_metering_mode_for_exif(exif_data.metering_mode);
     //~ exif_ifd[FLASH_MODE_INDEX].offset = get_flash_mode_for_exif(exif_data.flash_mode, exif_data.flash_fired);
@@ -723,11 +785,23 @@ static int write_dng(FILE* fd, struct raw_info * raw_info)
 
     if (dng_header_buf)
     {
-        create_thumbnail(raw_info);
+        if (dng_compression == DNG_COMPRESSION_NONE)
+        {
+            create_thumbnail(raw_info);
+        }
+        else
+        {
+            /* compressed image data can't be sampled for a preview */
+            memset(thumbnail_buf, 0, dng_th_width*dng_th_height*3);
+        }
         if (write(fd, dng_header_buf, dng_header_buf_size) != dng_header_buf_size) return 0;
         if (write(fd, thumbnail_buf, dng_th_width*dng_th_height*3) != dng_th_width*dng_th_height*3) return 0;
 
-        reverse_bytes_order(UNCACHEABLE(rawadr), camera_sensor.raw_size);
+        /* lossless JPEG is a byte stream already */
+        if (dng_compression == DNG_COMPRESSION_NONE)
+        {
+            reverse_bytes_order(UNCACHEABLE(rawadr), camera_sensor.raw_size);
+        }
         if (write(fd, UNCACHEABLE(rawadr), camera_sensor.raw_size) != camera_sensor.raw_size) return 0;
 
         free_dng_header();
@@ -1,8 +1,12 @@
 #ifndef __CHDK_DNG_H_
 #define __CHDK_DNG_H_
 
+#define DNG_COMPRESSION_NONE    1
+#define DNG_COMPRESSION_LJ92    7
+
 void dng_set_framerate(int fpsx1000);
 void dng_set_thumbnail_size(int width, int height);
+void dng_set_compression(int compression);
 
 void dng_set_framerate_rational(int nom, int denom);
 void dng_set_shutter(int nom, int denom);
@@ -15,5 +19,10 @@ void dng_set_focal(int nom, int denom);
 void dng_set_iso(int value);
 void dng_set_wbgain(int gain_r_n, int gain_r_d, int gain_g_n, int gain_g_d, int gain_b_n, int gain_b_d);
 void dng_set_datetime(char *datetime, char *subsectime);
+void dng_set_artist(char *str);
+void dng_set_copyright(char *str);
+void dng_set_exposure_bias(int nom, int denom);
+void dng_set_orientation(int orientation);
+void dng_set_xmp(const char *xmp, int size);
 
 #endif // __CHDK_DNG_H_
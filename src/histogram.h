@@ -1,32 +1,10 @@
 #ifndef _histogram_h_
 #define _histogram_h_
 
-// those colors will not be considered for histogram (so they should be very unlikely to appear in real situations)
-#define MZ_WHITE 0xFE12FE34
-#define MZ_BLACK 0x00120034
-#define MZ_GREEN 0xB68DB69E
+/* struct Histogram, HIST_WIDTH and the magic zoom colors (MZ_*) */
+#include "zebra_kernels.h"
 
 #define hist_height         54
-#define HIST_WIDTH          128
-
-struct Histogram
-{
-/** Store the histogram data for each of the "HIST_WIDTH" bins */
-    uint32_t hist[HIST_WIDTH];
-    uint32_t hist_r[HIST_WIDTH];
-    uint32_t hist_g[HIST_WIDTH];
-    uint32_t hist_b[HIST_WIDTH];
-
-    /** Maximum value in the histogram so that at least one entry fills
-     * the box */
-    uint32_t max;
-
-    /** total number of pixels analyzed by histogram */
-    uint32_t total_px;
-
-    int is_rgb;
-    int is_raw;
-};
 
 extern struct Histogram histogram;
 
@@ -4,6 +4,10 @@
 #include "console.h"
 #include "libtcc.h"
 #include "module.h"
+#include "module_symbols.h"
+#include "module_cache.h"
+#include "crc32.h"
+#include "version.h"
 #include "config.h"
 #include "string.h"
 #include "property.h"
@@ -17,10 +21,19 @@
 #endif
 #define MAGIC_SYMBOLS                 "ML/MODULES/"CONFIG_MODULES_MODEL_SYM
 
+#ifdef CONFIG_MODULES_MODEL_SYB
+#define MAGIC_SYMBOLS_BIN             "ML/MODULES/"CONFIG_MODULES_MODEL_SYB
+#endif
+
 /* unloads TCC after linking the modules */
 /* note: this breaks module_exec and ETTR */
 #define CONFIG_TCC_UNLOAD
 
+#ifdef CONFIG_TCC_UNLOAD
+/* all enabled modules, already linked; reused until ML, the symbols or a module change */
+#define MODULE_CACHE_FILE             MODULE_PATH"PRELINK.BIN"
+#endif
+
 extern int sscanf(const char *str, const char *format, ...);
 
 
@@ -46,6 +59,51 @@ static struct msg_queue * module_mq = 0;
 #define MSG_MODULE_LOAD_OFFLINE_STRINGS 3 /* argument: module index in high half (FFFF0000) */
 #define MSG_MODULE_UNLOAD_OFFLINE_STRINGS 4 /* same argument */
 
+#ifdef MAGIC_SYMBOLS_BIN
+/* precompiled symbol table, goes straight into the TCC symbol table without parsing or hashing */
+static int module_load_symbols_bin(TCCState *s, char *filename, char *text, uint32_t text_size)
+{
+    uint32_t size = 0;
+    FILE* file = NULL;
+    module_symbols_hdr_t *hdr = NULL;
+    int ret = -1;
+
+    if( FIO_GetFileSize( filename, &size ) != 0 )
+    {
+        return -1;
+    }
+    hdr = fio_malloc(size);
+    if(!hdr)
+    {
+        return -1;
+    }
+
+    file = FIO_OpenFile(filename, O_RDONLY | O_SYNC);
+    if (!file)
+    {
+        fio_free(hdr);
+        return -1;
+    }
+    int read_size = FIO_ReadFile(file, hdr, size);
+    FIO_CloseFile(file);
+
+    /* generated from a different .sym? then the text file is the right one */
+    /* the crc is still much cheaper than parsing the text and hashing every symbol */
+    crc32_init();
+    uint32_t text_crc = crc32(text, text_size, CRC32_DEFAULT_SEED);
+
+    if(read_size == (int)size && module_symbols_valid(hdr, size, text_size, text_crc))
+    {
+        ret = tcc_add_symbol_table(s, MODULE_SYMBOLS_SYMS(hdr), hdr->sym_count,
+                                   MODULE_SYMBOLS_STRTAB(hdr), hdr->strtab_size,
+                                   MODULE_SYMBOLS_HASH(hdr));
+    }
+
+    fio_free(hdr);
+    return ret;
+}
+#endif
+
 static int module_load_symbols(TCCState *s, char *filename)
 {
     uint32_t size = 0;
@@ -59,6 +117,7 @@ static int module_load_symbols(TCCState *s, char *filename)
         printf("Error loading '%s': File does not exist\n", filename);
         return -1;
     }
+
     buf = fio_malloc(size);
     if(!buf)
     {
@@ -76,52 +135,26 @@ static int module_load_symbols(TCCState *s, char *filename)
     FIO_ReadFile(file, buf, size);
     FIO_CloseFile(file);
 
-    while(pos < size && buf[pos])
+#ifdef MAGIC_SYMBOLS_BIN
+    /* the binary table is only used if it was generated from exactly this text */
+    if(module_load_symbols_bin(s, MAGIC_SYMBOLS_BIN, buf, size) == 0)
     {
-        char address_buf[16];
-        char symbol_buf[128];
-        uint32_t length = 0;
-        uint32_t address = 0;
-
-        while (pos + length < size &&
-               buf[pos + length] &&
-               buf[pos + length] != ' ' &&
-               length < sizeof(address_buf))
-        {
-            address_buf[length] = buf[pos + length];
-            length++;
-        }
-        address_buf[length] = '\000';
-
-        pos += length + 1;
-        length = 0;
-
-        while (pos + length < size &&
-               buf[pos + length] &&
-               buf[pos + length] != '\r' &&
-               buf[pos + length] != '\n' &&
-               length < sizeof(symbol_buf))
-        {
-            symbol_buf[length] = buf[pos + length];
-            length++;
-        }
-        symbol_buf[length] = '\000';
+        fio_free(buf);
+        return 0;
+    }
+#endif
 
-        pos += length + 1;
-        length = 0;
+    char symbol_buf[MODULE_SYMBOLS_NAME_MAX + 1];
+    uint32_t address = 0;
+    int ret;
 
-        while (pos + length < size &&
-               buf[pos + length] &&
-              (buf[pos + length] == '\r' ||
-               buf[pos + length] == '\n'))
+    while((ret = module_symbols_parse_line(buf, size, &pos, &address, symbol_buf)) >= 0)
+    {
+        if(ret)
         {
-            pos++;
+            tcc_add_symbol(s, symbol_buf, (void*)address);
+            count++;
         }
-        //~ sscanf(address_buf, "%x", &address);
-        address = strtoul(address_buf, NULL, 16);
-
-        tcc_add_symbol(s, symbol_buf, (void*)address);
-        count++;
     }
     
     fio_free(buf);
@@ -146,19 +179,33 @@ static int module_valid_filename(char* filename)
     return 0;
 }
 
+extern struct module_symbol_entry _module_symbols_start[];
+extern struct module_symbol_entry _module_symbols_end[];
+
+static uint32_t module_core_symbol_count()
+{
+    return _module_symbols_end - _module_symbols_start;
+}
+
+/* values of the MODULE_SYMBOL entries in ML, as exported by the modules */
 /* must be called before unloading TCC */
-static void module_update_core_symbols(TCCState* state)
+static void module_get_core_symbols(TCCState* state, uint32_t* values)
 {
-    printf("Updating symbols...\n");
+    for(uint32_t pos = 0; pos < module_core_symbol_count(); pos++)
+    {
+        values[pos] = (uint32_t) tcc_get_symbol(state, (char*) _module_symbols_start[pos].name);
+    }
+}
 
-    extern struct module_symbol_entry _module_symbols_start[];
-    extern struct module_symbol_entry _module_symbols_end[];
-    struct module_symbol_entry * module_symbol_entry = _module_symbols_start;
+static void module_update_core_symbols(uint32_t* values)
+{
+    printf("Updating symbols...\n");
 
-    for( ; module_symbol_entry < _module_symbols_end ; module_symbol_entry++ )
+    for(uint32_t pos = 0; pos < module_core_symbol_count(); pos++)
     {
+        struct module_symbol_entry * module_symbol_entry = &_module_symbols_start[pos];
         void* old_address = *(module_symbol_entry->address);
-        void* new_address = (void*) tcc_get_symbol(state, (char*) module_symbol_entry->name);
+        void* new_address = (void*) values[pos];
         if (new_address)
         {
             if (new_address != module_symbol_entry->address)
@@ -181,6 +228,23 @@ static void module_update_core_symbols(TCCState* state)
     }
 }
 
+/* must be called before unloading TCC */
+static void module_get_symbols(TCCState* state, module_entry_t* module)
+{
+    char module_info_name[32];
+
+    snprintf(module_info_name, sizeof(module_info_name), "%s%s", STR(MODULE_INFO_PREFIX), module->name);
+    module->info = tcc_get_symbol(state, module_info_name);
+    snprintf(module_info_name, sizeof(module_info_name), "%s%s", STR(MODULE_STRINGS_PREFIX), module->name);
+    module->strings = tcc_get_symbol(state, module_info_name);
+    snprintf(module_info_name, sizeof(module_info_name), "%s%s", STR(MODULE_PROPHANDLERS_PREFIX), module->name);
+    module->prop_handlers = tcc_get_symbol(state, module_info_name);
+    snprintf(module_info_name, sizeof(module_info_name), "%s%s", STR(MODULE_CBR_PREFIX), module->name);
+    module->cbr = tcc_get_symbol(state, module_info_name);
+    snprintf(module_info_name, sizeof(module_info_name), "%s%s", STR(MODULE_CONFIG_PREFIX), module->name);
+    module->config = tcc_get_symbol(state, module_info_name);
+}
+
 // SJE ML doesn't include the struct definition for TCCState in libtcc.h, which means
 // you can't access members by name.  Either this gets resolved somehow during the
 // build (if so, don't know how), or ML code never uses struct members?
@@ -473,10 +537,425 @@ struct TCCState {
 
 #endif
 
-static void _module_load_all(uint32_t list_only)
+#ifdef MODULE_CACHE_FILE
+/* what a cached image must match: ML build, size and date of the symbol file and of every enabled module, in load order */
+/* the contents aren't hashed, reading all the modules is what the cache avoids */
+static int module_cache_keys(module_cache_hdr_t *keys, module_cache_entry_t *entries, uint32_t module_cnt)
+{
+    struct fio_file file;
+    uint32_t found = 0;
+
+    memset(keys, 0x00, sizeof(module_cache_hdr_t));
+    keys->build_crc = module_cache_crc(build_version, strlen(build_version), CRC32_DEFAULT_SEED);
+    keys->build_crc = module_cache_crc(build_id, strlen(build_id), keys->build_crc);
+    keys->build_crc = module_cache_crc(build_date, strlen(build_date), keys->build_crc);
+    keys->core_count = module_core_symbol_count();
+
+    for (uint32_t mod = 0; mod < module_cnt; mod++)
+    {
+        if(module_list[mod].enabled)
+        {
+            module_cache_entry_t *entry = &entries[keys->module_count++];
+
+            memset(entry, 0x00, sizeof(module_cache_entry_t));
+            strncpy(entry->name, module_list[mod].filename, sizeof(entry->name));
+        }
+    }
+
+    struct fio_dirent * dirent = FIO_FindFirstEx( MODULE_PATH, &file );
+    if( IS_ERROR(dirent) )
+    {
+        return -1;
+    }
+
+    do
+    {
+        if (file.mode & ATTR_DIRECTORY) continue;
+
+        if(!strcasecmp(file.name, CONFIG_MODULES_MODEL_SYM))
+        {
+            keys->symbols_size = file.size;
+            keys->symbols_time = file.timestamp;
+            found++;
+        }
+
+        for(uint32_t pos = 0; pos < keys->module_count; pos++)
+        {
+            if(strlen(file.name) <= sizeof(entries[pos].name) && !strncmp(file.name, entries[pos].name, sizeof(entries[pos].name)))
+            {
+                entries[pos].file_size = file.size;
+                entries[pos].file_time = file.timestamp;
+                found++;
+            }
+        }
+    } while( FIO_FindNextEx( dirent, &file ) == 0);
+    FIO_FindClose(dirent);
+
+    return (found == keys->module_count + 1) ? 0 : -1;
+}
+
+/* one read, one checksum and the fixups instead of linking; returns the code buffer or NULL on a miss */
+/* uncacheable is set if the file says these modules can't be cached, so there's no point in trying again */
+static void* module_cache_load(module_cache_hdr_t *keys, module_cache_entry_t *entries, uint32_t module_cnt, uint32_t *core_values, int *uncacheable)
+{
+    uint32_t size = 0;
+    FILE* file = NULL;
+    module_cache_hdr_t *hdr = NULL;
+    void* code = NULL;
+
+    *uncacheable = 0;
+
+    if( FIO_GetFileSize( MODULE_CACHE_FILE, &size ) != 0 )
+    {
+        return NULL;
+    }
+    hdr = fio_malloc(size);
+    if(!hdr)
+    {
+        return NULL;
+    }
+
+    file = FIO_OpenFile(MODULE_CACHE_FILE, O_RDONLY | O_SYNC);
+    if (!file)
+    {
+        fio_free(hdr);
+        return NULL;
+    }
+    int read_size = FIO_ReadFile(file, hdr, size);
+    FIO_CloseFile(file);
+
+    if(read_size != (int)size || !module_cache_valid(hdr, size))
+    {
+        printf("  [i] module cache invalid\n");
+        goto end;
+    }
+
+    if(hdr->build_crc != keys->build_crc || hdr->symbols_size != keys->symbols_size || hdr->symbols_time != keys->symbols_time ||
+       hdr->module_count != keys->module_count || hdr->core_count != keys->core_count)
+    {
+        printf("  [i] module cache outdated\n");
+        goto end;
+    }
+
+    module_cache_entry_t *cached = MODULE_CACHE_ENTRIES(hdr);
+    for(uint32_t pos = 0; pos < hdr->module_count; pos++)
+    {
+        if(strncmp(cached[pos].name, entries[pos].name, sizeof(cached[pos].name)) ||
+           cached[pos].file_size != entries[pos].file_size || cached[pos].file_time != entries[pos].file_time)
+        {
+            printf("  [i] module cache outdated\n");
+            goto end;
+        }
+    }
+
+    if(!hdr->image_size)
+    {
+        printf("  [i] modules can't be cached\n");
+        *uncacheable = 1;
+        goto end;
+    }
+
+    code = malloc(hdr->image_size + 15);
+    if(!code)
+    {
+        goto end;
+    }
+
+    /* 16-byte aligned, like the image was linked */
+    uint8_t *image = (uint8_t *)(((uint32_t)code + 15) & ~15);
+    uint32_t base = (uint32_t)image;
+    memcpy(image, MODULE_CACHE_IMAGE(hdr), hdr->image_size);
+
+    if(module_cache_relocate(image, hdr->image_size, hdr->image_base, base, MODULE_CACHE_FIXUPS(hdr), hdr->fixup_count) < 0)
+    {
+        printf("  [i] module cache can't be moved to 0x%08X\n", base);
+        free(code);
+        code = NULL;
+        goto end;
+    }
+
+    uint32_t pos = 0;
+    for (uint32_t mod = 0; mod < module_cnt; mod++)
+    {
+        if(module_list[mod].enabled)
+        {
+            printf("  [i] prelinked: %s\n", module_list[mod].filename);
+            module_list[mod].valid = 1;
+            module_list[mod].info = (void*) module_cache_address(cached[pos].info, hdr->image_base, hdr->image_size, base);
+            module_list[mod].strings = (void*) module_cache_address(cached[pos].strings, hdr->image_base, hdr->image_size, base);
+            module_list[mod].prop_handlers = (void*) module_cache_address(cached[pos].prop_handlers, hdr->image_base, hdr->image_size, base);
+            module_list[mod].cbr = (void*) module_cache_address(cached[pos].cbr, hdr->image_base, hdr->image_size, base);
+            module_list[mod].config = (void*) module_cache_address(cached[pos].config, hdr->image_base, hdr->image_size, base);
+            pos++;
+        }
+    }
+
+    for(uint32_t core = 0; core < hdr->core_count; core++)
+    {
+        core_values[core] = module_cache_address(MODULE_CACHE_CORE(hdr)[core], hdr->image_base, hdr->image_size, base);
+    }
+
+end:
+    fio_free(hdr);
+    return code;
+}
+
+/* link the same files a second time at a different address; whatever changed between the two images
+ * are the fixups needed to move it. must be called before the modules run and modify their data. */
+static void module_cache_save(module_cache_hdr_t *keys, module_cache_entry_t *entries, uint32_t module_cnt, uint8_t *image, uint32_t size, uint32_t *core_values)
 {
     TCCState *state = NULL;
+    void *code = NULL;
+    module_cache_hdr_t *hdr = NULL;
+    int fixup_count = -1;
+
+    for (uint32_t mod = 0; mod < module_cnt; mod++)
+    {
+        if(module_list[mod].enabled && module_list[mod].error)
+        {
+            return;
+        }
+    }
+
+    printf("Caching modules...\n");
+
+    state = tcc_new();
+    tcc_set_options(state, "-nostdlib");
+    if(module_load_symbols(state, MAGIC_SYMBOLS) < 0)
+    {
+        goto end;
+    }
+
+    for (uint32_t mod = 0; mod < module_cnt; mod++)
+    {
+        if(module_list[mod].enabled && tcc_add_file(state, module_list[mod].long_filename) < 0)
+        {
+            goto end;
+        }
+    }
+
+    if(tcc_relocate(state, NULL) != (int32_t)size)
+    {
+        goto end;
+    }
+
+    code = malloc(size + 15);
+    if(!code)
+    {
+        goto end;
+    }
+
+    uint8_t *image_b = (uint8_t *)(((uint32_t)code + 15) & ~15);
+    memset(image_b, 0x00, size);
+    if(tcc_relocate(state, image_b) < 0)
+    {
+        goto end;
+    }
+
+    /* if they can't be cached, save the keys anyway, so the next boots don't link twice just to find out again */
+    uint32_t image_size = size;
+    fixup_count = module_cache_find_fixups(image, (uint32_t)image, image_b, (uint32_t)image_b, size, NULL);
+    if(fixup_count < 0)
+    {
+        printf("  [E] modules can't be cached\n");
+        fixup_count = 0;
+        image_size = 0;
+    }
+
+    uint32_t file_size = module_cache_size(keys->module_count, keys->core_count, fixup_count, image_size);
+    hdr = fio_malloc(file_size);
+    if(!hdr)
+    {
+        goto end;
+    }
+
+    memcpy(hdr, keys, sizeof(module_cache_hdr_t));
+    hdr->fixup_count = fixup_count;
+    hdr->image_size = image_size;
+    hdr->image_base = (uint32_t)image;
+
+    module_cache_entry_t *cached = MODULE_CACHE_ENTRIES(hdr);
+    memcpy(cached, entries, keys->module_count * sizeof(module_cache_entry_t));
+
+    uint32_t pos = 0;
+    for (uint32_t mod = 0; mod < module_cnt; mod++)
+    {
+        if(module_list[mod].enabled)
+        {
+            cached[pos].info = (uint32_t) module_list[mod].info;
+            cached[pos].strings = (uint32_t) module_list[mod].strings;
+            cached[pos].prop_handlers = (uint32_t) module_list[mod].prop_handlers;
+            cached[pos].cbr = (uint32_t) module_list[mod].cbr;
+            cached[pos].config = (uint32_t) module_list[mod].config;
+            pos++;
+        }
+    }
+
+    memcpy(MODULE_CACHE_CORE(hdr), core_values, keys->core_count * sizeof(uint32_t));
+    if(image_size)
+    {
+        module_cache_find_fixups(image, (uint32_t)image, image_b, (uint32_t)image_b, size, MODULE_CACHE_FIXUPS(hdr));
+        memset(MODULE_CACHE_IMAGE(hdr), 0x00, (size + 3) & ~3);
+        memcpy(MODULE_CACHE_IMAGE(hdr), image, size);
+    }
+    module_cache_seal(hdr);
+
+    FILE* file = FIO_CreateFile(MODULE_CACHE_FILE);
+    if(file)
+    {
+        int written = FIO_WriteFile(file, hdr, file_size);
+        FIO_CloseFile(file);
+
+        if(written != (int)file_size)
+        {
+            FIO_RemoveFile(MODULE_CACHE_FILE);
+        }
+    }
+
+end:
+    tcc_delete(state);
+    if(code)
+    {
+        free(code);
+    }
+    if(hdr)
+    {
+        fio_free(hdr);
+    }
+}
+#endif
+
+/* link all enabled modules with TCC; fills in their symbols and the values for module_update_core_symbols */
+static int module_link_all(uint32_t module_cnt, uint32_t *core_values, module_cache_hdr_t *cache_keys, module_cache_entry_t *cache_entries)
+{
+    TCCState *state = NULL;
+
+    /* initialize linker */
+    state = tcc_new();
+    tcc_set_options(state, "-nostdlib");
+    if(module_load_symbols(state, MAGIC_SYMBOLS) < 0)
+    {
+        NotifyBox(2000, "Missing symbol file: " MAGIC_SYMBOLS );
+        tcc_delete(state);
+        return -1;
+    }
+
+    /* load modules */
+    printf("Load modules...\n");
+    for (uint32_t mod = 0; mod < module_cnt; mod++)
+    {
+        if(module_list[mod].enabled)
+        {
+            printf("  [i] load: %s\n", module_list[mod].filename);
+
+            int32_t ret = tcc_add_file(state, module_list[mod].long_filename);
+
+            // SJE FIXME trying to determine module base address
+            // so I can use addr2line.  The listed address seems wrong,
+            // don't know why.  Instead I am dumping some function address
+            // from whatever module I'm testing, which is annoyingly module
+            // specific
+#if 0
+            int size = 0;
+            void *data_addr = NULL;
+            data_addr = tcc_get_section_ptr(state, ".text", &size);
+            DryosDebugMsg(0, 15, "loading module: %s", module_list[mod].filename);
+            DryosDebugMsg(0, 15, "module priv: 0x%x", module_list[mod].cbr);
+            DryosDebugMsg(0, 15, "module .text: 0x%x", data_addr);
+            DryosDebugMsg(0, 15, "module text_addr: 0x%x", state->text_addr);
+//            DryosDebugMsg(0, 15, "sections: %d", state->nb_sections);
+//            for (int ii = 1; ii < state->nb_sections; ii++)
+//            {
+//                Section *s = state->sections[ii];
+//                DryosDebugMsg(0, 15, "section: %s", s->name);
+//                DryosDebugMsg(0, 15, "section sh_addr: 0x%x", s->sh_addr);
+//                DryosDebugMsg(0, 15, "section data_offset: 0x%x", s->data_offset);
+//                DryosDebugMsg(0, 15, "section data: 0x%x", s->data);
+//            }
+#endif
+
+            module_list[mod].valid = 1;
+
+            /* seems bad, disable it */
+            if(ret < 0)
+            {
+                module_list[mod].error = 1;
+                snprintf(module_list[mod].status, sizeof(module_list[mod].status), "FileErr");
+                snprintf(module_list[mod].long_status, sizeof(module_list[mod].long_status), "Load failed: %s, ret 0x%02X");
+                printf("  [E] %s\n", module_list[mod].long_status);
+            }
+        }
+    }
+
+    printf("Linking..\n");
+#ifdef CONFIG_TCC_UNLOAD
+    int32_t size = tcc_relocate(state, NULL);
+    int32_t reloc_status = -1;
+    uint8_t* image = NULL;
+    
+    if (size > 0)
+    {
+        void* buf = (void*) malloc(size + 15);
+        
+        if (buf)
+        {
+            /* 16-byte aligned and zeroed, so the same image can be cached (see module_cache.h) */
+            image = (uint8_t*)(((uint32_t)buf + 15) & ~15);
+            memset(image, 0x00, size);
+            reloc_status = tcc_relocate(state, image);
+        }
+        module_code = buf;
+    }
+    if(size < 0 || reloc_status < 0)
+#else
+    int32_t ret = tcc_relocate(state, TCC_RELOCATE_AUTO);
+    if(ret < 0)
+#endif
+    {
+        printf("  [E] failed to link modules\n");
+        for (uint32_t mod = 0; mod < module_cnt; mod++)
+        {
+            if(module_list[mod].enabled)
+            {
+                module_list[mod].error = 1;
+                snprintf(module_list[mod].status, sizeof(module_list[mod].status), "Err");
+                snprintf(module_list[mod].long_status, sizeof(module_list[mod].long_status), "Linking failed");
+            }
+        }
+        tcc_delete(state);
+        return -1;
+    }
+    
+    for (uint32_t mod = 0; mod < module_cnt; mod++)
+    {
+        if(module_list[mod].valid && module_list[mod].enabled && !module_list[mod].error)
+        {
+            module_get_symbols(state, &module_list[mod]);
+        }
+    }
+    module_get_core_symbols(state, core_values);
+
+#ifdef CONFIG_TCC_UNLOAD
+    tcc_delete(state);
+
+#ifdef MODULE_CACHE_FILE
+    if(cache_keys)
+    {
+        module_cache_save(cache_keys, cache_entries, module_cnt, image, size, core_values);
+    }
+#endif
+#else
+    module_state = state;
+#endif
+
+    return 0;
+}
+
+static void _module_load_all(uint32_t list_only)
+{
     uint32_t module_cnt = 0;
+    uint32_t symbols_size = 0;
+    uint32_t *core_values = NULL;
     struct fio_file file;
     uint32_t update_properties = 0;
 
@@ -500,13 +979,10 @@ static void _module_load_all(uint32_t list_only)
         return;
     }
 
-    /* initialize linker */
-    state = tcc_new();
-    tcc_set_options(state, "-nostdlib");
-    if(module_load_symbols(state, MAGIC_SYMBOLS) < 0)
+    if( FIO_GetFileSize( MAGIC_SYMBOLS, &symbols_size ) != 0 )
     {
         NotifyBox(2000, "Missing symbol file: " MAGIC_SYMBOLS );
-        tcc_delete(state); console_show();
+        console_show();
         return;
     }
 
@@ -515,7 +991,7 @@ static void _module_load_all(uint32_t list_only)
     if( IS_ERROR(dirent) )
     {
         NotifyBox(2000, "Module dir missing" );
-        tcc_delete(state); console_show();
+        console_show();
         return;
     }
 
@@ -613,86 +1089,50 @@ static void _module_load_all(uint32_t list_only)
     /* dont load anything, just return */
     if(list_only)
     {
-        tcc_delete(state);
         return;
     }
     
-    /* load modules */
-    printf("Load modules...\n");
-    for (uint32_t mod = 0; mod < module_cnt; mod++)
+    core_values = malloc((module_core_symbol_count() + 1) * sizeof(uint32_t));
+    if(!core_values)
     {
-        if(module_list[mod].enabled)
-        {
-            printf("  [i] load: %s\n", module_list[mod].filename);
+        console_show();
+        return;
+    }
 
-            int32_t ret = tcc_add_file(state, module_list[mod].long_filename);
+    int linked = 0;
+#ifdef MODULE_CACHE_FILE
+    module_cache_hdr_t cache_keys;
+    module_cache_entry_t *cache_entries = malloc(MODULE_COUNT_MAX * sizeof(module_cache_entry_t));
 
-            // SJE FIXME trying to determine module base address
-            // so I can use addr2line.  The listed address seems wrong,
-            // don't know why.  Instead I am dumping some function address
-            // from whatever module I'm testing, which is annoyingly module
-            // specific
-#if 0
-            int size = 0;
-            void *data_addr = NULL;
-            data_addr = tcc_get_section_ptr(state, ".text", &size);
-            DryosDebugMsg(0, 15, "loading module: %s", module_list[mod].filename);
-            DryosDebugMsg(0, 15, "module priv: 0x%x", module_list[mod].cbr);
-            DryosDebugMsg(0, 15, "module .text: 0x%x", data_addr);
-            DryosDebugMsg(0, 15, "module text_addr: 0x%x", state->text_addr);
-//            DryosDebugMsg(0, 15, "sections: %d", state->nb_sections);
-//            for (int ii = 1; ii < state->nb_sections; ii++)
-//            {
-//                Section *s = state->sections[ii];
-//                DryosDebugMsg(0, 15, "section: %s", s->name);
-//                DryosDebugMsg(0, 15, "section sh_addr: 0x%x", s->sh_addr);
-//                DryosDebugMsg(0, 15, "section data_offset: 0x%x", s->data_offset);
-//                DryosDebugMsg(0, 15, "section data: 0x%x", s->data);
-//            }
-#endif
+    if(cache_entries && module_cache_keys(&cache_keys, cache_entries, module_cnt) == 0)
+    {
+        int uncacheable = 0;
 
-            module_list[mod].valid = 1;
+        printf("Load prelinked modules...\n");
+        module_code = module_cache_load(&cache_keys, cache_entries, module_cnt, core_values, &uncacheable);
+        linked = (module_code != NULL);
 
-            /* seems bad, disable it */
-            if(ret < 0)
-            {
-                module_list[mod].error = 1;
-                snprintf(module_list[mod].status, sizeof(module_list[mod].status), "FileErr");
-                snprintf(module_list[mod].long_status, sizeof(module_list[mod].long_status), "Load failed: %s, ret 0x%02X");
-                printf("  [E] %s\n", module_list[mod].long_status);
-            }
+        /* known not to be cacheable: link below, once */
+        if(!linked && !uncacheable)
+        {
+            linked = module_link_all(module_cnt, core_values, &cache_keys, cache_entries) < 0 ? -1 : 1;
         }
     }
-
-    printf("Linking..\n");
-#ifdef CONFIG_TCC_UNLOAD
-    int32_t size = tcc_relocate(state, NULL);
-    int32_t reloc_status = -1;
-    
-    if (size > 0)
+    if(cache_entries)
     {
-        void* buf = (void*) malloc(size);
-        
-        reloc_status = tcc_relocate(state, buf);
-        module_code = buf;
+        free(cache_entries);
     }
-    if(size < 0 || reloc_status < 0)
-#else
-    int32_t ret = tcc_relocate(state, TCC_RELOCATE_AUTO);
-    if(ret < 0)
 #endif
+
+    if(!linked)
     {
-        printf("  [E] failed to link modules\n");
-        for (uint32_t mod = 0; mod < module_cnt; mod++)
-        {
-            if(module_list[mod].enabled)
-            {
-                module_list[mod].error = 1;
-                snprintf(module_list[mod].status, sizeof(module_list[mod].status), "Err");
-                snprintf(module_list[mod].long_status, sizeof(module_list[mod].long_status), "Linking failed");
-            }
-        }
-        tcc_delete(state); console_show();
+        linked = module_link_all(module_cnt, core_values, NULL, NULL) < 0 ? -1 : 1;
+    }
+
+    if(linked < 0)
+    {
+        free(core_values);
+        console_show();
         return;
     }
     
@@ -702,20 +1142,6 @@ static void _module_load_all(uint32_t list_only)
     {
         if(module_list[mod].valid && module_list[mod].enabled && !module_list[mod].error)
         {
-            char module_info_name[32];
-
-            /* now check for info structure */
-            snprintf(module_info_name, sizeof(module_info_name), "%s%s", STR(MODULE_INFO_PREFIX), module_list[mod].name);
-            module_list[mod].info = tcc_get_symbol(state, module_info_name);
-            snprintf(module_info_name, sizeof(module_info_name), "%s%s", STR(MODULE_STRINGS_PREFIX), module_list[mod].name);
-            module_list[mod].strings = tcc_get_symbol(state, module_info_name);
-            snprintf(module_info_name, sizeof(module_info_name), "%s%s", STR(MODULE_PROPHANDLERS_PREFIX), module_list[mod].name);
-            module_list[mod].prop_handlers = tcc_get_symbol(state, module_info_name);
-            snprintf(module_info_name, sizeof(module_info_name), "%s%s", STR(MODULE_CBR_PREFIX), module_list[mod].name);
-            module_list[mod].cbr = tcc_get_symbol(state, module_info_name);
-            snprintf(module_info_name, sizeof(module_info_name), "%s%s", STR(MODULE_CONFIG_PREFIX), module_list[mod].name);
-            module_list[mod].config = tcc_get_symbol(state, module_info_name);
-
             /* check if the module symbol is defined. simple check for valid memory address just in case. */
             if((uint32_t)module_list[mod].info > 0x1000)
             {
@@ -853,13 +1279,8 @@ static void _module_load_all(uint32_t list_only)
         prop_update_registration();
     }
 
-    module_update_core_symbols(state);
-    
-    #ifdef CONFIG_TCC_UNLOAD
-    tcc_delete(state);
-    #else
-    module_state = state;
-    #endif
+    module_update_core_symbols(core_values);
+    free(core_values);
     
     printf("Modules loaded\n");
 }
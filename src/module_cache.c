@@ -0,0 +1,218 @@
+/* Prelinked module cache, see module_cache.h
+ * No camera dependencies, so contrib/module_bench can test it on the host.
+ */
+
+#include "module_cache.h"
+#include "crc32.h"
+
+uint32_t module_cache_crc(const void *data, uint32_t length, uint32_t seed)
+{
+    static int initialized = 0;
+
+    if(!initialized)
+    {
+        crc32_init();
+        initialized = 1;
+    }
+
+    return crc32((void *)data, length, seed);
+}
+
+/* which fixup explains the change of this word when moving by delta; -1 if none or ambiguous */
+static int module_cache_classify(uint32_t word_a, uint32_t word_b, uint32_t delta)
+{
+    int type = -1;
+    int matches = 0;
+
+    if(word_b - word_a == delta)
+    {
+        type = MODULE_CACHE_FIXUP_ABS;
+        matches++;
+    }
+
+    if(word_a - word_b == delta)
+    {
+        type = MODULE_CACHE_FIXUP_REL;
+        matches++;
+    }
+
+    /* branch offset to a fixed target: the 24-bit word offset moves the other way */
+    if(((word_a ^ word_b) & 0xFF000000) == 0 && ((word_b - word_a) & 0x00FFFFFF) == ((0 - (delta >> 2)) & 0x00FFFFFF))
+    {
+        type = MODULE_CACHE_FIXUP_BL;
+        matches++;
+    }
+
+    return (matches == 1) ? type : -1;
+}
+
+int module_cache_find_fixups(const uint8_t *image_a, uint32_t base_a, const uint8_t *image_b, uint32_t base_b, uint32_t size, uint32_t *fixups)
+{
+    const uint32_t *words_a = (const uint32_t *)image_a;
+    const uint32_t *words_b = (const uint32_t *)image_b;
+    uint32_t delta = base_b - base_a;
+    int count = 0;
+
+    /* tcc_relocate aligns sections to 16 bytes in memory, so the layout only matches for such moves */
+    if(!delta || (delta & 15))
+    {
+        return -1;
+    }
+
+    /* a trailing partial word can't hold a fixup */
+    for(uint32_t pos = size & ~3; pos < size; pos++)
+    {
+        if(image_a[pos] != image_b[pos])
+        {
+            return -1;
+        }
+    }
+
+    for(uint32_t word = 0; word < size / 4; word++)
+    {
+        if(words_a[word] == words_b[word])
+        {
+            continue;
+        }
+
+        int type = module_cache_classify(words_a[word], words_b[word], delta);
+        if(type < 0)
+        {
+            return -1;
+        }
+
+        if(fixups)
+        {
+            fixups[count] = MODULE_CACHE_FIXUP(type, word);
+        }
+        count++;
+    }
+
+    return count;
+}
+
+int module_cache_relocate(uint8_t *image, uint32_t size, uint32_t old_base, uint32_t new_base, const uint32_t *fixups, uint32_t fixup_count)
+{
+    uint32_t *words = (uint32_t *)image;
+    uint32_t delta = new_base - old_base;
+
+    if(delta & 15)
+    {
+        return -1;
+    }
+
+    for(uint32_t pos = 0; pos < fixup_count; pos++)
+    {
+        uint32_t word = MODULE_CACHE_FIXUP_WORD(fixups[pos]);
+
+        if(word >= size / 4)
+        {
+            return -1;
+        }
+
+        switch(MODULE_CACHE_FIXUP_TYPE(fixups[pos]))
+        {
+            case MODULE_CACHE_FIXUP_ABS:
+                words[word] += delta;
+                break;
+
+            case MODULE_CACHE_FIXUP_REL:
+                words[word] -= delta;
+                break;
+
+            case MODULE_CACHE_FIXUP_BL:
+            {
+                int32_t offset = words[word] & 0x00FFFFFF;
+                if(offset & 0x00800000)
+                {
+                    offset -= 0x01000000;
+                }
+
+                /* +/- 32 MiB, beyond that TCC would have used a veneer */
+                int64_t moved = (int64_t)offset - ((int64_t)(int32_t)delta >> 2);
+                if(moved < -0x00800000 || moved >= 0x00800000)
+                {
+                    return -1;
+                }
+
+                words[word] = (words[word] & 0xFF000000) | ((uint32_t)moved & 0x00FFFFFF);
+                break;
+            }
+
+            default:
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+uint32_t module_cache_address(uint32_t value, uint32_t old_base, uint32_t size, uint32_t new_base)
+{
+    /* end of the image included, for symbols that mark the end of a section */
+    if(value >= old_base && value - old_base <= size)
+    {
+        return value - old_base + new_base;
+    }
+
+    return value;
+}
+
+uint32_t module_cache_size(uint32_t module_count, uint32_t core_count, uint32_t fixup_count, uint32_t image_size)
+{
+    return sizeof(module_cache_hdr_t)
+         + module_count * sizeof(module_cache_entry_t)
+         + core_count * sizeof(uint32_t)
+         + fixup_count * sizeof(uint32_t)
+         + ((image_size + 3) & ~3);
+}
+
+void module_cache_seal(module_cache_hdr_t *hdr)
+{
+    const char magic[8] = MODULE_CACHE_MAGIC;
+    uint32_t size = module_cache_size(hdr->module_count, hdr->core_count, hdr->fixup_count, hdr->image_size);
+
+    for(int pos = 0; pos < 8; pos++)
+    {
+        hdr->magic[pos] = magic[pos];
+    }
+    hdr->version = MODULE_CACHE_VERSION;
+    hdr->data_crc = module_cache_crc((uint8_t *)hdr + sizeof(module_cache_hdr_t), size - sizeof(module_cache_hdr_t), CRC32_DEFAULT_SEED);
+}
+
+int module_cache_valid(module_cache_hdr_t *hdr, uint32_t size)
+{
+    const char magic[8] = MODULE_CACHE_MAGIC;
+
+    if(size < sizeof(module_cache_hdr_t))
+    {
+        return 0;
+    }
+
+    for(int pos = 0; pos < 8; pos++)
+    {
+        if(hdr->magic[pos] != magic[pos])
+        {
+            return 0;
+        }
+    }
+
+    if(hdr->version != MODULE_CACHE_VERSION)
+    {
+        return 0;
+    }
+
+    /* 64 bit math, a broken header must not wrap around */
+    uint64_t total = (uint64_t)sizeof(module_cache_hdr_t)
+                   + (uint64_t)hdr->module_count * sizeof(module_cache_entry_t)
+                   + (uint64_t)hdr->core_count * sizeof(uint32_t)
+                   + (uint64_t)hdr->fixup_count * sizeof(uint32_t)
+                   + (((uint64_t)hdr->image_size + 3) & ~3ULL);
+
+    if(total != size)
+    {
+        return 0;
+    }
+
+    return module_cache_crc((uint8_t *)hdr + sizeof(module_cache_hdr_t), size - sizeof(module_cache_hdr_t), CRC32_DEFAULT_SEED) == hdr->data_crc;
+}
@@ -0,0 +1,92 @@
+#ifndef _module_cache_h_
+#define _module_cache_h_
+
+/* prelinked module cache (ML/MODULES/PRELINK.BIN)
+ *
+ * holds the image TCC produced for all enabled modules on the last cache miss,
+ * plus a list of fixups that move it to a different load address. the fixups
+ * are found by linking twice at different addresses and comparing the images.
+ * all these addresses must be 16-byte aligned, like tcc_relocate lays out the sections.
+ *
+ * the key is the ML build plus size and date of the symbol file and of each module,
+ * all known from the directory listing, so a cache hit reads nothing but this file.
+ *
+ * layout: header, module entries, core symbol values, fixups, image (padded to 4 bytes).
+ * everything after the header is covered by data_crc.
+ *
+ * a file without image (image_size 0) records that these keys can't be cached, e.g. because
+ * some difference between the two links can't be explained; the modules are then linked once,
+ * without the second link, until the keys change.
+ */
+
+#include <stdint.h>
+
+#define MODULE_CACHE_MAGIC            "MLPRELNK"
+#define MODULE_CACHE_VERSION          1
+
+/* fixup word: type in the top 2 bits, word index into the image in the rest */
+#define MODULE_CACHE_FIXUP_ABS        0   /* address inside the image (R_ARM_ABS32) */
+#define MODULE_CACHE_FIXUP_REL        1   /* PC-relative to an address outside the image (R_ARM_REL32) */
+#define MODULE_CACHE_FIXUP_BL         2   /* B/BL/BLX to an address outside the image */
+
+#define MODULE_CACHE_FIXUP(type, word)    (((uint32_t)(type) << 30) | (word))
+#define MODULE_CACHE_FIXUP_TYPE(fixup)    ((fixup) >> 30)
+#define MODULE_CACHE_FIXUP_WORD(fixup)    ((fixup) & 0x3FFFFFFF)
+
+typedef struct
+{
+    char name[12];
+    uint32_t file_size;
+    uint32_t file_time;
+
+    /* symbols looked up after linking, as linked for image_base */
+    uint32_t info;
+    uint32_t strings;
+    uint32_t prop_handlers;
+    uint32_t cbr;
+    uint32_t config;
+} module_cache_entry_t;
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t build_crc;     /* ML build this was linked against */
+    uint32_t symbols_size;  /* symbol file */
+    uint32_t symbols_time;
+    uint32_t module_count;  /* enabled modules, in load order */
+    uint32_t core_count;    /* MODULE_SYMBOL entries in ML */
+    uint32_t fixup_count;
+    uint32_t image_size;
+    uint32_t image_base;    /* address the image was linked for */
+    uint32_t data_crc;
+} module_cache_hdr_t;
+
+#define MODULE_CACHE_ENTRIES(hdr)     ((module_cache_entry_t *)((uint8_t *)(hdr) + sizeof(module_cache_hdr_t)))
+#define MODULE_CACHE_CORE(hdr)        ((uint32_t *)(MODULE_CACHE_ENTRIES(hdr) + (hdr)->module_count))
+#define MODULE_CACHE_FIXUPS(hdr)      (MODULE_CACHE_CORE(hdr) + (hdr)->core_count)
+#define MODULE_CACHE_IMAGE(hdr)       ((uint8_t *)(MODULE_CACHE_FIXUPS(hdr) + (hdr)->fixup_count))
+
+/* crc32 with the table set up on first use */
+uint32_t module_cache_crc(const void *data, uint32_t length, uint32_t seed);
+
+/* compare two links of the same modules, image_a linked for base_a and image_b for base_b.
+ * fills fixups (if not NULL) and returns their count, or -1 if some difference can't be explained */
+int module_cache_find_fixups(const uint8_t *image_a, uint32_t base_a, const uint8_t *image_b, uint32_t base_b, uint32_t size, uint32_t *fixups);
+
+/* move an image linked for old_base to new_base. returns -1 if it can't be moved there (misaligned, branch out of range) */
+int module_cache_relocate(uint8_t *image, uint32_t size, uint32_t old_base, uint32_t new_base, const uint32_t *fixups, uint32_t fixup_count);
+
+/* symbol values: addresses inside the image move with it, everything else stays */
+uint32_t module_cache_address(uint32_t value, uint32_t old_base, uint32_t size, uint32_t new_base);
+
+/* total file size for the given counts */
+uint32_t module_cache_size(uint32_t module_count, uint32_t core_count, uint32_t fixup_count, uint32_t image_size);
+
+/* fill in magic, version and data_crc once everything else is in place */
+void module_cache_seal(module_cache_hdr_t *hdr);
+
+/* returns 1 if the buffer holds a complete cache with a valid checksum */
+int module_cache_valid(module_cache_hdr_t *hdr, uint32_t size);
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef _module_symbols_h_
+#define _module_symbols_h_
+
+/* binary symbol table (e.g. 5D3_123.syb), generated from magiclantern.sym
+ * at build time by build_tools/sym2bin and loaded with tcc_add_symbol_table.
+ *
+ * layout: header, symbols (Elf32_Sym, the first one is the null symbol),
+ * hash table (TCC .hashtab layout: nbuckets, nsyms, buckets, chains),
+ * string table. all little endian, all parts 4-byte aligned.
+ */
+
+#include <stdint.h>
+
+#define MODULE_SYMBOLS_MAGIC          "MLSYMTAB"
+#define MODULE_SYMBOLS_VERSION        2
+
+/* same layout as Elf32_Sym */
+typedef struct
+{
+    uint32_t name;
+    uint32_t value;
+    uint32_t size;
+    uint8_t info;
+    uint8_t other;
+    uint16_t shndx;
+} module_symbol_t;
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t text_size;     /* size of the .sym file this was generated from, to detect stale files */
+    uint32_t sym_count;     /* including the null symbol */
+    uint32_t hash_words;    /* 2 + nbuckets + sym_count */
+    uint32_t strtab_size;
+    uint32_t text_crc;      /* crc32 of the .sym file (CRC32_DEFAULT_SEED), a rebuild may not change its size */
+} module_symbols_hdr_t;
+
+#define MODULE_SYMBOLS_SYMS(hdr)      ((module_symbol_t *)((uint8_t *)(hdr) + sizeof(module_symbols_hdr_t)))
+#define MODULE_SYMBOLS_HASH(hdr)      ((int *)(MODULE_SYMBOLS_SYMS(hdr) + (hdr)->sym_count))
+#define MODULE_SYMBOLS_STRTAB(hdr)    ((char *)(MODULE_SYMBOLS_HASH(hdr) + (hdr)->hash_words))
+
+/* symbols from magiclantern.sym are added like tcc_add_symbol does: weak, no type, absolute */
+#define MODULE_SYMBOLS_INFO           0x20      /* ELF32_ST_INFO(STB_WEAK, STT_NOTYPE) */
+#define MODULE_SYMBOLS_SHNDX          0xFFF1    /* SHN_ABS */
+
+/* longest symbol name taken from magiclantern.sym, longer ones are cut */
+#define MODULE_SYMBOLS_NAME_MAX       127
+
+/* parses the "address name" line of magiclantern.sym at *pos. module.c, sym2bin and module_bench all use this,
+ * so the .syb always has the symbols the text would give. the address is hex (strtoul-like, up to the first space),
+ * the name is the rest of the line, spaces included, cut to MODULE_SYMBOLS_NAME_MAX characters.
+ * name must hold MODULE_SYMBOLS_NAME_MAX + 1 bytes. *pos moves to the next line.
+ * returns 1 for a symbol, 0 for a line without a name, -1 at the end of the text */
+static inline int module_symbols_parse_line(const char *buf, uint32_t size, uint32_t *pos, uint32_t *address, char *name)
+{
+    uint32_t p = *pos;
+    uint32_t length = 0;
+    int hex = 1;
+
+    /* skip line ends */
+    while(p < size && (buf[p] == '\r' || buf[p] == '\n'))
+    {
+        p++;
+    }
+
+    if(p >= size || !buf[p])
+    {
+        *pos = p;
+        return -1;
+    }
+
+    *address = 0;
+    if(p + 1 < size && buf[p] == '0' && (buf[p + 1] == 'x' || buf[p + 1] == 'X'))
+    {
+        p += 2;
+    }
+
+    while(p < size && buf[p] && buf[p] != ' ' && buf[p] != '\r' && buf[p] != '\n')
+    {
+        char c = buf[p++];
+
+        /* like strtoul, the address ends at the first character that is not a hex digit */
+        if(hex && c >= '0' && c <= '9')
+        {
+            *address = (*address << 4) | (c - '0');
+        }
+        else if(hex && ((c | 0x20) >= 'a' && (c | 0x20) <= 'f'))
+        {
+            *address = (*address << 4) | ((c | 0x20) - 'a' + 10);
+        }
+        else
+        {
+            hex = 0;
+        }
+    }
+
+    if(p < size && buf[p] == ' ')
+    {
+        p++;
+    }
+
+    while(p < size && buf[p] && buf[p] != '\r' && buf[p] != '\n')
+    {
+        if(length < MODULE_SYMBOLS_NAME_MAX)
+        {
+            name[length++] = buf[p];
+        }
+        p++;
+    }
+    name[length] = '\0';
+
+    *pos = p;
+    return length > 0;
+}
+
+/* returns 1 if the buffer holds a complete symbol table generated from the .sym file with the given size and crc32 */
+static inline int module_symbols_valid(module_symbols_hdr_t *hdr, uint32_t size, uint32_t text_size, uint32_t text_crc)
+{
+    if(size < sizeof(module_symbols_hdr_t))
+    {
+        return 0;
+    }
+
+    for(int pos = 0; pos < 8; pos++)
+    {
+        if(hdr->magic[pos] != MODULE_SYMBOLS_MAGIC[pos])
+        {
+            return 0;
+        }
+    }
+
+    if(hdr->version != MODULE_SYMBOLS_VERSION || hdr->text_size != text_size || hdr->text_crc != text_crc || !hdr->sym_count)
+    {
+        return 0;
+    }
+
+    /* 64 bit math, a broken header must not wrap around */
+    uint64_t total = (uint64_t)sizeof(module_symbols_hdr_t)
+                   + (uint64_t)hdr->sym_count * sizeof(module_symbol_t)
+                   + (uint64_t)hdr->hash_words * sizeof(int)
+                   + hdr->strtab_size;
+
+    if(total != size || hdr->hash_words < 3 || hdr->hash_words != 2 + (uint32_t)MODULE_SYMBOLS_HASH(hdr)[0] + hdr->sym_count)
+    {
+        return 0;
+    }
+
+    return 1;
+}
+
+#endif
@@ -202,7 +202,12 @@ struct raw_info {
     int32_t dynamic_range;          // EV x100, from analyzing black level and noise (very close to DxO)
 };
 
+#ifdef MLV_USE_THREADS
+/* mlv_dump runs the raw2dng filters on several threads, each one with its own raw_info */
+extern __thread struct raw_info raw_info;
+#else
 extern struct raw_info raw_info;
+#endif
 
 /* image capture parameters */
 struct raw_capture_info {
@@ -0,0 +1,565 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/* packing and unpacking of raw pixel lines, see raw_pack.h */
+
+#include <string.h>
+#include "raw_pack.h"
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RAW_PACK_NEON
+#endif
+
+static inline uint32_t read_word(const uint8_t * p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline void write_word(uint8_t * p, uint32_t w)
+{
+    p[0] = w;
+    p[1] = w >> 8;
+}
+
+void raw_unpack_line_ref(const void * src, uint16_t * dst, uint32_t count, int depth)
+{
+    const uint8_t * s = src;
+    uint32_t mask = (1 << depth) - 1;
+    uint32_t acc = 0;
+    int bits = 0;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        if (bits < depth)
+        {
+            acc = (acc << 16) | read_word(s);
+            s += 2;
+            bits += 16;
+        }
+        bits -= depth;
+        dst[i] = (acc >> bits) & mask;
+    }
+}
+
+void raw_pack_line_ref(const uint16_t * src, void * dst, uint32_t count, int depth)
+{
+    uint8_t * d = dst;
+    uint32_t mask = (1 << depth) - 1;
+    uint32_t acc = 0;
+    int bits = 0;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        acc = (acc << depth) | (src[i] & mask);
+        bits += depth;
+        if (bits >= 16)
+        {
+            bits -= 16;
+            write_word(d, acc >> bits);
+            d += 2;
+        }
+    }
+
+    /* last word: only replace the bits of the last pixel(s) */
+    if (bits)
+    {
+        uint32_t keep = (1 << (16 - bits)) - 1;
+        write_word(d, ((acc << (16 - bits)) & ~keep) | (read_word(d) & keep));
+    }
+}
+
+/**
+ * Group path: one group is the smallest number of pixels that fills whole words
+ * (8 pixels / 5 words at 10 bits, 4 / 3 at 12 bits, 8 / 7 at 14 bits, 16 / depth for odd depths).
+ * The group is loaded into a small word array once, then each pixel is a single shift
+ * of two neighbouring words. Called with a constant depth (see below), word index and shift
+ * of every pixel are compile time constants and the loops over the group are unrolled.
+ */
+static inline int raw_pack_group_pixels(const int depth)
+{
+    int pixels = 16;
+    while (pixels % 2 == 0 && (pixels / 2) * depth % 16 == 0)
+    {
+        pixels /= 2;
+    }
+    return pixels;
+}
+
+/* returns the number of pixels done */
+static inline uint32_t raw_unpack_groups_depth(const uint8_t * src, uint16_t * dst, uint32_t count, const int depth)
+{
+    const int pixels = raw_pack_group_pixels(depth);
+    const int words = pixels * depth / 16;
+    uint32_t mask = (1 << depth) - 1;
+    uint32_t groups = count / pixels;
+
+    for (uint32_t n = 0; n < groups; n++)
+    {
+        /* one extra word, so the last pixel can always read a "next" word */
+        uint32_t w[17];
+        for (int i = 0; i < words; i++)
+        {
+            w[i] = read_word(src + 2*i);
+        }
+        w[words] = 0;
+
+        for (int k = 0; k < pixels; k++)
+        {
+            int i = k * depth / 16;
+            int shift = 32 - (k * depth) % 16 - depth;
+            dst[k] = ((w[i] << 16 | w[i+1]) >> shift) & mask;
+        }
+
+        src += 2 * words;
+        dst += pixels;
+    }
+
+    return groups * pixels;
+}
+
+static inline uint32_t raw_pack_groups_depth(const uint16_t * src, uint8_t * dst, uint32_t count, const int depth)
+{
+    const int pixels = raw_pack_group_pixels(depth);
+    const int words = pixels * depth / 16;
+    uint32_t mask = (1 << depth) - 1;
+    uint32_t groups = count / pixels;
+
+    for (uint32_t n = 0; n < groups; n++)
+    {
+        uint32_t w[17];
+        for (int i = 0; i <= words; i++)
+        {
+            w[i] = 0;
+        }
+
+        for (int k = 0; k < pixels; k++)
+        {
+            int i = k * depth / 16;
+            int shift = 32 - (k * depth) % 16 - depth;
+            uint32_t v = (src[k] & mask) << shift;
+            w[i] |= v >> 16;
+            w[i+1] |= v & 0xFFFF;
+        }
+
+        /* src may be the same buffer, all of the group is read by now */
+        for (int i = 0; i < words; i++)
+        {
+            write_word(dst + 2*i, w[i]);
+        }
+
+        src += pixels;
+        dst += 2 * words;
+    }
+
+    return groups * pixels;
+}
+
+/* one copy of the group code for each depth */
+#define RAW_PACK_DEPTH_CASES(call) \
+    switch (depth) \
+    { \
+        case 1:  return call(1);  case 2:  return call(2);  case 3:  return call(3);  \
+        case 4:  return call(4);  case 5:  return call(5);  case 6:  return call(6);  \
+        case 7:  return call(7);  case 8:  return call(8);  case 9:  return call(9);  \
+        case 10: return call(10); case 11: return call(11); case 12: return call(12); \
+        case 13: return call(13); case 14: return call(14); case 15: return call(15); \
+    } \
+    return 0;
+
+static uint32_t raw_unpack_groups(const uint8_t * src, uint16_t * dst, uint32_t count, int depth)
+{
+    #define UNPACK_GROUPS(d) raw_unpack_groups_depth(src, dst, count, d)
+    RAW_PACK_DEPTH_CASES(UNPACK_GROUPS)
+    #undef UNPACK_GROUPS
+}
+
+static uint32_t raw_pack_groups(const uint16_t * src, uint8_t * dst, uint32_t count, int depth)
+{
+    #define PACK_GROUPS(d) raw_pack_groups_depth(src, dst, count, d)
+    RAW_PACK_DEPTH_CASES(PACK_GROUPS)
+    #undef PACK_GROUPS
+}
+
+#if defined(__SSSE3__)
+/**
+ * SSSE3 path for any depth from 10 to 15: units of 16 pixels (always 'depth' whole words),
+ * processed as two halves of 8 pixels, one vector each.
+ *
+ * Unpacking: pshufb picks, for every lane, the word where the pixel starts (hi) and the next one (lo).
+ * With 'off' the bit position of the pixel in its first word:
+ *   pixel = ((hi << off) | (lo >> (16 - off))) >> (16 - depth)
+ * where x << off is mullo(x, 1 << off) and x >> (16 - off) is mulhi(x, 1 << off).
+ *
+ * Packing: with x = pixel << (16 - depth), x >> off goes into the first word (mulhi by 1 << (16 - off))
+ * and x << (16 - off) into the next one (mullo). These partial words are moved to their place
+ * with pshufb and ORed together. At 10 bits and more, at most two pixels start in the same word
+ * and only one continues into it, so two shuffles per source and output vector are enough.
+ */
+struct raw_pack_ssse3
+{
+    int base[2];            /* byte offset of the second half for unpacking */
+    int pad[2];             /* align the vectors without implicit padding (-Wpadded) */
+    __m128i hi[2];
+    __m128i lo[2];
+    __m128i mul[2];
+
+    /* packing: shuffle for each output vector, source vector (A0, B0, A1, B1) and slot */
+    __m128i shuffle[2][4][2];
+    __m128i pack_mul[2];
+    __m128i pack_keep[2];
+};
+
+static void raw_pack_ssse3_init(struct raw_pack_ssse3 * t, int depth)
+{
+    uint8_t hi[2][16];
+    uint8_t lo[2][16];
+    uint16_t mul[2][8];
+    uint16_t pack_mul[2][8];
+    uint16_t pack_keep[2][8];
+
+    uint8_t shuffle[2][4][2][16];
+    uint8_t used[2][4][16];
+    memset(shuffle, 0x80, sizeof(shuffle));
+    memset(used, 0, sizeof(used));
+
+    t->base[0] = 0;
+    t->base[1] = (8 * depth / 16) * 2;
+
+    for (int h = 0; h < 2; h++)
+    {
+        for (int k = 0; k < 8; k++)
+        {
+            /* unpacking, relative to the load address of this half */
+            int bit = (8*h + k) * depth - t->base[h] * 8;
+            int i = bit / 16;
+            int off = bit % 16;
+            int split = (off + depth > 16);
+            hi[h][2*k]   = 2*i;
+            hi[h][2*k+1] = 2*i + 1;
+            lo[h][2*k]   = split ? 2*i + 2 : 0x80;
+            lo[h][2*k+1] = split ? 2*i + 3 : 0x80;
+            mul[h][k] = 1 << off;
+
+            /* packing, relative to the unit */
+            bit = (8*h + k) * depth;
+            i = bit / 16;
+            off = bit % 16;
+            pack_mul[h][k] = off ? 1 << (16 - off) : 0;
+            pack_keep[h][k] = off ? 0 : 0xFFFF;
+
+            for (int part = 0; part < 1 + split; part++)
+            {
+                int word = i + part;
+                int o = word / 8;
+                int s = 2*h + part;
+                int slot = used[o][s][word % 8]++;
+                shuffle[o][s][slot][2 * (word % 8)]     = 2*k;
+                shuffle[o][s][slot][2 * (word % 8) + 1] = 2*k + 1;
+            }
+        }
+
+        t->hi[h] = _mm_loadu_si128((__m128i *) hi[h]);
+        t->lo[h] = _mm_loadu_si128((__m128i *) lo[h]);
+        t->mul[h] = _mm_loadu_si128((__m128i *) mul[h]);
+        t->pack_mul[h] = _mm_loadu_si128((__m128i *) pack_mul[h]);
+        t->pack_keep[h] = _mm_loadu_si128((__m128i *) pack_keep[h]);
+    }
+
+    for (int o = 0; o < 2; o++)
+    {
+        for (int s = 0; s < 4; s++)
+        {
+            for (int slot = 0; slot < 2; slot++)
+            {
+                t->shuffle[o][s][slot] = _mm_loadu_si128((__m128i *) shuffle[o][s][slot]);
+            }
+        }
+    }
+}
+
+/* reads up to base[1] + 16 bytes from the start of each unit */
+static uint32_t raw_unpack_ssse3(const uint8_t * src, uint16_t * dst, uint32_t count, uint32_t bytes, int depth)
+{
+    struct raw_pack_ssse3 t;
+    raw_pack_ssse3_init(&t, depth);
+    __m128i shift = _mm_cvtsi32_si128(16 - depth);
+
+    uint32_t units = count / 16;
+    while (units && 2 * depth * (units - 1) + t.base[1] + 16 > bytes)
+    {
+        units--;
+    }
+
+    for (uint32_t u = 0; u < units; u++)
+    {
+        for (int h = 0; h < 2; h++)
+        {
+            __m128i v  = _mm_loadu_si128((__m128i *)(src + t.base[h]));
+            __m128i hi = _mm_shuffle_epi8(v, t.hi[h]);
+            __m128i lo = _mm_shuffle_epi8(v, t.lo[h]);
+            __m128i px = _mm_or_si128(_mm_mullo_epi16(hi, t.mul[h]), _mm_mulhi_epu16(lo, t.mul[h]));
+            _mm_storeu_si128((__m128i *)(dst + 8*h), _mm_srl_epi16(px, shift));
+        }
+        src += 2 * depth;
+        dst += 16;
+    }
+
+    return units * 16;
+}
+
+/* writes 32 bytes per unit, the part after the 'depth' words of the unit is overwritten by the next one */
+static uint32_t raw_pack_ssse3(const uint16_t * src, uint8_t * dst, uint32_t count, uint32_t bytes, int depth)
+{
+    struct raw_pack_ssse3 t;
+    raw_pack_ssse3_init(&t, depth);
+    __m128i shift = _mm_cvtsi32_si128(16 - depth);
+    __m128i mask = _mm_set1_epi16((1 << depth) - 1);
+
+    uint32_t units = count / 16;
+    while (units && 2 * depth * (units - 1) + 32 > bytes)
+    {
+        units--;
+    }
+
+    for (uint32_t u = 0; u < units; u++)
+    {
+        __m128i part[4];
+        for (int h = 0; h < 2; h++)
+        {
+            __m128i x = _mm_sll_epi16(_mm_and_si128(_mm_loadu_si128((__m128i *)(src + 8*h)), mask), shift);
+            part[2*h]   = _mm_or_si128(_mm_mulhi_epu16(x, t.pack_mul[h]), _mm_and_si128(x, t.pack_keep[h]));
+            part[2*h+1] = _mm_mullo_epi16(x, t.pack_mul[h]);
+        }
+
+        /* both source halves are read, so this also works in place */
+        for (int o = 0; o < 2; o++)
+        {
+            __m128i out = _mm_setzero_si128();
+            for (int s = 0; s < 4; s++)
+            {
+                out = _mm_or_si128(out, _mm_shuffle_epi8(part[s], t.shuffle[o][s][0]));
+                out = _mm_or_si128(out, _mm_shuffle_epi8(part[s], t.shuffle[o][s][1]));
+            }
+            _mm_storeu_si128((__m128i *)(dst + 16*o), out);
+        }
+
+        src += 16;
+        dst += 2 * depth;
+    }
+
+    return units * 16;
+}
+
+#endif
+
+#if defined(__SSE2__) || defined(RAW_PACK_NEON)
+/**
+ * 14 bits only: one pixel block (8 pixels, 7 words) per vector.
+ * Pixel k starts in word k-1 at bit o = (16 - 2*k) % 16, so
+ *   pixel = ((word[k-1] << o) | (word[k] >> (16 - o))) >> 2
+ * and word k = (pixel[k] << (2k+2)) | (pixel[k+1] >> (12-2k)).
+ */
+static inline void raw_unpack_block14(const uint8_t * src, uint16_t * dst)
+{
+#if defined(__SSE2__)
+    const __m128i lane0 = _mm_set_epi16(0, 0, 0, 0, 0, 0, 0, -1);
+    const __m128i mul   = _mm_set_epi16(1<<2, 1<<4, 1<<6, 1<<8, 1<<10, 1<<12, 1<<14, 1);
+
+    /* reads 8 words, one past the block */
+    __m128i v  = _mm_loadu_si128((__m128i *)src);
+    __m128i hi = _mm_or_si128(_mm_slli_si128(v, 2), _mm_and_si128(v, lane0));                          /* w0 w0 w1 ... w6 */
+    __m128i lo = _mm_or_si128(_mm_andnot_si128(lane0, v), _mm_and_si128(_mm_srli_si128(v, 2), lane0)); /* w1 w1 w2 ... w7 */
+
+    /* x << o is mullo(x, 1<<o), x >> (16-o) is mulhi(x, 1<<o) */
+    __m128i px = _mm_or_si128(_mm_mullo_epi16(hi, mul), _mm_mulhi_epu16(lo, mul));
+    _mm_storeu_si128((__m128i *)dst, _mm_srli_epi16(px, 2));
+#else
+    static const int16_t shl[8] = {   0,  14,  12,  10,   8,   6,   4,   2 };
+    static const int16_t shr[8] = { -16,  -2,  -4,  -6,  -8, -10, -12, -14 };
+
+    uint16x8_t v  = vreinterpretq_u16_u8(vld1q_u8(src));
+    uint16x8_t hi = vsetq_lane_u16(vgetq_lane_u16(v, 0), vextq_u16(v, v, 7), 0);
+    uint16x8_t lo = vsetq_lane_u16(vgetq_lane_u16(v, 1), v, 0);
+
+    uint16x8_t px = vorrq_u16(vshlq_u16(hi, vld1q_s16(shl)), vshlq_u16(lo, vld1q_s16(shr)));
+    vst1q_u16(dst, vshrq_n_u16(px, 2));
+#endif
+}
+
+/* writes 8 words, one past the block */
+static inline void raw_pack_block14(const uint16_t * src, uint8_t * dst)
+{
+#if defined(__SSE2__)
+    const __m128i mask  = _mm_set1_epi16(0x3FFF);
+    const __m128i lane6 = _mm_set_epi16(0, -1, 0, 0, 0, 0, 0, 0);
+    const __m128i mul_a = _mm_set_epi16(0, 1<<14, 1<<12, 1<<10, 1<<8, 1<<6, 1<<4, 1<<2);
+    const __m128i mul_b = _mm_set_epi16(0, 0,     1<<14, 1<<12, 1<<10, 1<<8, 1<<6, 1<<4);
+
+    __m128i a = _mm_and_si128(_mm_loadu_si128((__m128i *)src), mask);
+    __m128i b = _mm_srli_si128(a, 2);
+
+    /* word 6 takes pixel 7 without shifting, mulhi can't do that */
+    __m128i w = _mm_or_si128(_mm_mullo_epi16(a, mul_a), _mm_mulhi_epu16(b, mul_b));
+    w = _mm_or_si128(w, _mm_and_si128(b, lane6));
+    _mm_storeu_si128((__m128i *)dst, w);
+#else
+    static const int16_t shl[8] = {   2,   4,   6,   8,  10,  12,  14,  16 };
+    static const int16_t shr[8] = { -12, -10,  -8,  -6,  -4,  -2,   0, -16 };
+
+    uint16x8_t a = vandq_u16(vld1q_u16(src), vdupq_n_u16(0x3FFF));
+    uint16x8_t b = vextq_u16(a, vdupq_n_u16(0), 1);
+
+    uint16x8_t w = vorrq_u16(vshlq_u16(a, vld1q_s16(shl)), vshlq_u16(b, vld1q_s16(shr)));
+    vst1q_u8(dst, vreinterpretq_u8_u16(w));
+#endif
+}
+
+static uint32_t raw_unpack_blocks14(const uint8_t * src, uint16_t * dst, uint32_t count, uint32_t bytes)
+{
+    uint32_t blocks = count / 8;
+    while (blocks && 14 * (blocks - 1) + 16 > bytes)
+    {
+        blocks--;
+    }
+
+    for (uint32_t b = 0; b < blocks; b++)
+    {
+        raw_unpack_block14(src + 14*b, dst + 8*b);
+    }
+
+    return blocks * 8;
+}
+
+static uint32_t raw_pack_blocks14(const uint16_t * src, uint8_t * dst, uint32_t count, uint32_t bytes)
+{
+    uint32_t blocks = count / 8;
+    while (blocks && 14 * (blocks - 1) + 16 > bytes)
+    {
+        blocks--;
+    }
+
+    /* the extra word written past each block is overwritten by the next one */
+    for (uint32_t b = 0; b < blocks; b++)
+    {
+        raw_pack_block14(src + 8*b, dst + 14*b);
+    }
+
+    return blocks * 8;
+}
+#endif
+
+void raw_unpack_line(const void * src, uint16_t * dst, uint32_t count, int depth)
+{
+    const uint8_t * s = src;
+    uint32_t done = 0;
+
+    if (depth == 16)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            dst[i] = read_word(s + 2*i);
+        }
+        return;
+    }
+
+#if defined(__SSE2__) || defined(RAW_PACK_NEON)
+    if (depth == 14)
+    {
+        done = raw_unpack_blocks14(s, dst, count, raw_pack_line_size(count, depth));
+    }
+#endif
+#if defined(__SSSE3__)
+    if (depth >= 10 && depth != 14)
+    {
+        done = raw_unpack_ssse3(s, dst, count, raw_pack_line_size(count, depth), depth);
+    }
+#endif
+
+    /* the SIMD paths stop at a group boundary, so the rest starts at a whole word */
+    s += done * depth / 8;
+    done += raw_unpack_groups(s, dst + done, count - done, depth);
+    s = (const uint8_t *) src + done * depth / 8;
+    raw_unpack_line_ref(s, dst + done, count - done, depth);
+}
+
+void raw_pack_line(const uint16_t * src, void * dst, uint32_t count, int depth)
+{
+    uint8_t * d = dst;
+    uint32_t done = 0;
+
+    if (depth == 16)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            write_word(d + 2*i, src[i]);
+        }
+        return;
+    }
+
+    /* the SIMD paths must not write into a partially used last word */
+#if defined(__SSE2__) || defined(RAW_PACK_NEON)
+    if (depth == 14)
+    {
+        done = raw_pack_blocks14(src, d, count, count * depth / 16 * 2);
+    }
+#endif
+#if defined(__SSSE3__)
+    if (depth >= 10 && depth != 14)
+    {
+        done = raw_pack_ssse3(src, d, count, count * depth / 16 * 2, depth);
+    }
+#endif
+
+    d += done * depth / 8;
+    done += raw_pack_groups(src + done, d, count - done, depth);
+    d = (uint8_t *) dst + done * depth / 8;
+    raw_pack_line_ref(src + done, d, count - done, depth);
+}
+
+const char * raw_pack_method(int depth)
+{
+    if (depth == 16)
+    {
+        return "copy";
+    }
+#if defined(__SSE2__)
+    if (depth == 14)
+    {
+        return "sse2";
+    }
+#elif defined(RAW_PACK_NEON)
+    if (depth == 14)
+    {
+        return "neon";
+    }
+#endif
+#if defined(__SSSE3__)
+    if (depth >= 10)
+    {
+        return "ssse3";
+    }
+#endif
+    return "groups";
+}
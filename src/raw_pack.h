@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2013 Magic Lantern Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _raw_pack_h_
+#define _raw_pack_h_
+
+#include <stdint.h>
+
+/**
+ * Packed raw pixels, as in Canon raw buffers (struct raw_pixblock for 14 bits) and MLV frames:
+ * pixels of 'depth' bits stored back to back, MSB first, in consecutive little-endian 16-bit words.
+ *
+ *   depth 14:  word 0 = a13..a0 b13 b12,  word 1 = b11..b0 c13 c12, ...  (8 pixels in 7 words)
+ *   depth 12:  word 0 = a11..a0 b11..b8,  word 1 = b7..b0 c11..c4, ...   (4 pixels in 3 words)
+ *
+ * Any depth from 1 to 16 works. The line functions pick the fastest code path for the given depth:
+ * SIMD for 10...15 bits (SSE2 or NEON kernel for 14 bits, SSSE3 shuffle tables built per depth for the others),
+ * otherwise an unrolled loop, specialized for each depth, that decodes one group of words
+ * (e.g. 7 words = 8 pixels at 14 bits) at a time. 16 bits is a plain copy.
+ * The _ref versions decode bit by bit and are kept as reference.
+ *
+ * Line pointers don't have to be aligned. Only the words covering 'count' pixels are accessed,
+ * and the bits behind the last pixel are left untouched (like raw_pack_set_pixel does),
+ * so lines that don't end on a word boundary can be packed one after another, or in place.
+ */
+
+#define RAW_PACK_MAX_DEPTH 16
+
+/* single pixel access, for random access (same as mlv_dump's bitextract/bitinsert) */
+static inline int raw_pack_get_pixel(const void * line, int x, int depth)
+{
+    const uint8_t * p = (const uint8_t *) line + (x * depth / 16) * 2;
+    int bit = (x * depth) % 16;
+
+    /* the next word is only read if the pixel continues there */
+    uint32_t w = (uint32_t)(p[0] | (p[1] << 8)) << 16;
+    if (bit + depth > 16)
+    {
+        w |= p[2] | (p[3] << 8);
+    }
+    return (w >> (32 - bit - depth)) & ((1 << depth) - 1);
+}
+
+static inline void raw_pack_set_pixel(void * line, int x, int depth, int value)
+{
+    uint8_t * p = (uint8_t *) line + (x * depth / 16) * 2;
+    int bit = (x * depth) % 16;
+    int shift = 32 - bit - depth;
+    uint32_t mask = (uint32_t)((1 << depth) - 1) << shift;
+    uint32_t v = ((uint32_t)value << shift) & mask;
+
+    uint32_t w = (uint32_t)(p[0] | (p[1] << 8)) << 16;
+    w = (w & ~(mask & 0xFFFF0000)) | (v & 0xFFFF0000);
+    p[0] = w >> 16;
+    p[1] = w >> 24;
+
+    if (bit + depth > 16)
+    {
+        uint32_t w2 = p[2] | (p[3] << 8);
+        w2 = (w2 & ~(mask & 0xFFFF)) | (v & 0xFFFF);
+        p[2] = w2;
+        p[3] = w2 >> 8;
+    }
+}
+
+/* bytes needed for 'count' pixels (whole 16-bit words) */
+static inline uint32_t raw_pack_line_size(uint32_t count, int depth)
+{
+    return ((count * depth + 15) / 16) * 2;
+}
+
+/* 'count' pixels from the packed line 'src' into one uint16_t per pixel */
+void raw_unpack_line(const void * src, uint16_t * dst, uint32_t count, int depth);
+
+/* 'count' pixels into the packed line 'dst', values are truncated to 'depth' bits. src == dst is allowed */
+void raw_pack_line(const uint16_t * src, void * dst, uint32_t count, int depth);
+
+/* bit by bit reference implementations */
+void raw_unpack_line_ref(const void * src, uint16_t * dst, uint32_t count, int depth);
+void raw_pack_line_ref(const uint16_t * src, void * dst, uint32_t count, int depth);
+
+/* name of the code path raw_unpack_line / raw_pack_line use for this depth ("sse2", "neon", "ssse3", "groups" or "copy") */
+const char * raw_pack_method(int depth);
+
+#endif
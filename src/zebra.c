@@ -488,53 +488,21 @@ static uint8_t* waveform = 0;
  */
 
 #if defined(FEATURE_HISTOGRAM) || defined(FEATURE_WAVEFORM) || defined(FEATURE_VECTORSCOPE)
-#ifdef FEATURE_HISTOGRAM
-static void hist_add_pixel(uint32_t pixel, int Y)
-{
-    if (histogram.is_rgb)
-    {
-        int R, G, B;
-        //~ uyvy2yrgb(pixel, &Y, &R, &G, &B);
-        COMPUTE_UYVY2YRGB(pixel, Y, R, G, B);
-        // YRGB range: 0-255
-        uint32_t R_level = (R * HIST_WIDTH) >> 8;
-        uint32_t G_level = (G * HIST_WIDTH) >> 8;
-        uint32_t B_level = (B * HIST_WIDTH) >> 8;
-        
-        histogram.hist_r[R_level & (HIST_WIDTH-1)]++;
-        histogram.hist_g[G_level & (HIST_WIDTH-1)]++;
-        histogram.hist_b[B_level & (HIST_WIDTH-1)]++;
-    }
-    
-    /* luma component is always computed, since we need histogram.max */
-    /* and it's much less expensive than RGB anyway */
-    histogram.total_px++;
-    uint32_t hist_level = (Y * HIST_WIDTH) >> 8;
-
-    // Ignore the 0 bin.  It generates too much noise
-    unsigned count = ++ (histogram.hist[ hist_level & (HIST_WIDTH-1)]);
-    if( hist_level && count > histogram.max )
-        histogram.max = count;
-}
-#endif
 
-#ifdef FEATURE_WAVEFORM
-static inline void waveform_add_pixel(int x, int Y)
+/* what has to be computed from the YUV buffer (see hist_begin) */
+static struct
 {
-    uint8_t* w = &WAVEFORM(((x-os.x0) * WAVEFORM_WIDTH) / os.x_ex, (Y * WAVEFORM_HEIGHT) >> 8);
-    if ((*w) < 250) (*w)++;
-}
-#endif
-
-static void
-hist_build()
+    int hist;
+    int waveform;
+    int vectorscope;
+    int mz;             /* skip magic zoom borders */
+} hist_scan;
+
+/* reset the histogram, waveform and vectorscope
+ * returns 1 if the YUV buffer has to be scanned (with hist_scan_row) */
+static int
+hist_begin()
 {
-    struct vram_info * lv = get_yuv422_vram();
-    uint32_t* buf = (uint32_t*)lv->vram;
-    if (!buf) return;
-
-    int x,y;
-
     #ifdef FEATURE_HISTOGRAM
     memset(&histogram, 0, sizeof(histogram));
     #endif
@@ -553,6 +521,8 @@ hist_build()
     {
         vectorscope_start();
     }
+    #else
+    int vectorscope_draw = 0;
     #endif
     
     #ifdef FEATURE_RAW_HISTOGRAM
@@ -568,50 +538,71 @@ hist_build()
           hist_type == 2) &&   /* Fall back to YUV RGB if we can't use the RAW RGB histogram */
          !EXT_MONITOR_RCA);    /* However, we cannot use YUV RGB histogram on RCA monitors, because they use YUV411 instead of YUV422 */
     
-    if (!waveform_draw && !vectorscope_draw && (!hist_draw || histogram.is_raw))
+    hist_scan.hist = hist_draw && !histogram.is_raw;
+    hist_scan.waveform = waveform_draw;
+    hist_scan.vectorscope = vectorscope_draw;
+    hist_scan.mz = nondigic_zoom_overlay_enabled();
+
+    /* optimization: no YUV-based histogram/waveform/scope enabled
+     * => no need to scan the entire image */
+    return hist_scan.hist || hist_scan.waveform || hist_scan.vectorscope;
+}
+
+/* one line of the YUV buffer (y in BM coords), sampled every x_step BM pixels */
+static inline void FAST
+hist_scan_row(uint32_t * buf, int y, int x_step)
+{
+    for (int x = os.x0 ; x < os.x_max ; x += x_step )
+    {
+        uint32_t pixel = buf[BM2LV(x,y) >> 2];
+
+        // ignore magic zoom borders
+        if (hist_scan.mz && (pixel == MZ_WHITE || pixel == MZ_BLACK || pixel == MZ_GREEN))
+            continue;
+
+        int Y = UYVY_GET_AVG_Y(pixel);
+        
+        #ifdef FEATURE_HISTOGRAM
+        if (hist_scan.hist)
+        {
+            hist_add_pixel(&histogram, pixel, Y);
+        }
+        #endif
+        
+        #ifdef FEATURE_WAVEFORM
+        if (hist_scan.waveform) 
+        {
+            waveform_add_pixel(waveform, WAVEFORM_WIDTH, WAVEFORM_HEIGHT, ((x-os.x0) * WAVEFORM_WIDTH) / os.x_ex, Y);
+        }
+        #endif
+        
+        #ifdef FEATURE_VECTORSCOPE
+        if (hist_scan.vectorscope)
+        {
+            int8_t U = (pixel >>  0) & 0xFF;
+            int8_t V = (pixel >> 16) & 0xFF;
+            vectorscope_addpixel(Y, U, V);
+        }
+        #endif
+    }
+}
+
+static void
+hist_build()
+{
+    struct vram_info * lv = get_yuv422_vram();
+    uint32_t* buf = (uint32_t*)lv->vram;
+    if (!buf) return;
+
+    if (!hist_begin())
     {
-        /* optimization: no YUV-based histogram/waveform/scope enabled
-         * => no need to scan the entire image */
         return;
     }
     
-    int mz = nondigic_zoom_overlay_enabled();
     int off = get_y_skip_offset_for_histogram();
-    for( y = os.y0 + off; y < os.y_max - off; y += 2 )
+    for(int y = os.y0 + off; y < os.y_max - off; y += 2 )
     {
-        for( x = os.x0 ; x < os.x_max ; x += 2 )
-        {
-            uint32_t pixel = buf[BM2LV(x,y) >> 2];
-
-            // ignore magic zoom borders
-            if (mz && (pixel == MZ_WHITE || pixel == MZ_BLACK || pixel == MZ_GREEN))
-                continue;
-
-            int Y = UYVY_GET_AVG_Y(pixel);
-            
-            #ifdef FEATURE_HISTOGRAM
-            if (hist_draw && !histogram.is_raw)
-            {
-                hist_add_pixel(pixel, Y);
-            }
-            #endif
-            
-            #ifdef FEATURE_WAVEFORM
-            if (waveform_draw) 
-            {
-                waveform_add_pixel(x, Y);
-            }
-            #endif
-            
-            #ifdef FEATURE_VECTORSCOPE
-            if (vectorscope_draw)
-            {
-                int8_t U = (pixel >>  0) & 0xFF;
-                int8_t V = (pixel >> 16) & 0xFF;
-                vectorscope_addpixel(Y, U, V);
-            }
-            #endif
-        }
+        hist_scan_row(buf, y, 2);
     }
 }
 #endif
@@ -1171,7 +1162,19 @@ static void zebra_update_lut()
 static int zebra_digic_dirty = 0;
 #endif
 
-static void draw_zebras( int Z )
+/* YUV zebras are drawn row by row (zebra_draw_row), with these settings */
+static struct
+{
+    uint8_t * lvram;
+    uint8_t * bvram;
+    int zlh;
+    int zll;
+    int rgb;
+} zebra_scan;
+
+/* draws raw and fast (DIGIC) zebras right away;
+ * returns 1 if YUV zebras should be drawn (with zebra_draw_row) */
+static int zebra_begin( int Z )
 {
     uint8_t * const bvram = bmp_vram_real();
     int zd = Z && zebra_draw && (lv_luma_is_accurate() || PLAY_OR_QR_MODE) && (zebra_rec || NOT_RECORDING); // when to draw zebras
@@ -1182,7 +1185,7 @@ static void draw_zebras( int Z )
         {
             if (lv) draw_zebras_raw_lv();
             else draw_zebras_raw();
-            return;
+            return 0;
         }
         #endif
         int zlh = zebra_level_hi * 255 / 100 - 1;
@@ -1225,7 +1228,7 @@ static void draw_zebras( int Z )
             
             static int last_s = 0;
             int s = get_seconds_clock();
-            if (s == last_s) return;
+            if (s == last_s) return 0;
             last_s = s;
             
             alter_bitmap_palette_entry(FAST_ZEBRA_GRID_COLOR, 0, 256, 256);
@@ -1256,166 +1259,109 @@ static void draw_zebras( int Z )
                 }
             }
 
-            return;
+            return 0;
         }
         #endif
         
         uint8_t * lvram = get_yuv422_vram()->vram;
-        if (!lvram) return;
+        if (!lvram) return 0;
+
+        zebra_scan.lvram = lvram;
+        zebra_scan.bvram = bvram;
+        zebra_scan.zlh = zlh;
+        zebra_scan.zll = zll;
+        zebra_scan.rgb = zebra_colorspace == 1 && !EXT_MONITOR_RCA;
+        return 1;
+    }
+    return 0;
+}
 
-        int zlr = zlh;
-        int zlg = zlh;
-        int zlb = zlh;
+/* zebras for BM rows y and y+1 */
+static inline void FAST zebra_draw_row( int y )
+{
+    uint8_t * const lvram = zebra_scan.lvram;
+    uint8_t * const bvram = zebra_scan.bvram;
+    const int zlh = zebra_scan.zlh;
+    const int zll = zebra_scan.zll;
+
+    #define color_over           zebra_color_word_row(COLOR_RED,  y)
+    #define color_under          zebra_color_word_row(COLOR_BLUE, y)
+    #define color_over_2         zebra_color_word_row(COLOR_RED,  y+1)
+    #define color_under_2        zebra_color_word_row(COLOR_BLUE, y+1)
+    
+    uint32_t * const v_row = (uint32_t*)( lvram        + BM2LV_R(y)    );  // 2 pixels
+    uint32_t * const b_row = (uint32_t*)( bvram        + BM_R(y)       );  // 4 pixels
+    uint32_t * const m_row = (uint32_t*)( bvram_mirror + BM_R(y)       );  // 4 pixels
+    
+    uint32_t* lvp; // that's a moving pointer through lv vram
+    uint32_t* bp;  // through bmp vram
+    uint32_t* mp;  // through mirror
 
-        // draw zebra in 16:9 frame
-        // y is in BM coords
-        int off = get_y_skip_offset_for_overlays();
-        for(int y = os.y0 + off; y < os.y_max - off; y += 2 )
+    for (int x = os.x0; x < os.x_max; x += 4)
+    {
+        lvp = v_row + (BM2LV_X(x) >> 1);
+        bp = b_row + (x >> 2);
+        mp = m_row + (x >> 2);
+        #define BP (*bp)
+        #define MP (*mp)
+        #define BN (*(bp + BMPPITCH/4))
+        #define MN (*(mp + BMPPITCH/4))
+        if (BP != 0 && BP != MP) { little_cleanup(bp, mp); continue; }
+        if (BN != 0 && BN != MN) { little_cleanup(bp + (BMPPITCH >> 2), mp + (BMPPITCH >> 2)); continue; }
+        if ((MP & 0x80808080) || (MN & 0x80808080)) continue;
+        
+        if (zebra_scan.rgb)
         {
-            #define color_over           zebra_color_word_row(COLOR_RED,  y)
-            #define color_under          zebra_color_word_row(COLOR_BLUE, y)
-            #define color_over_2         zebra_color_word_row(COLOR_RED,  y+1)
-            #define color_under_2        zebra_color_word_row(COLOR_BLUE, y+1)
-            
-            #define color_rgb_under      zebra_rgb_color(1, 0, 0, 0, y)
-            #define color_rgb_under_2    zebra_rgb_color(1, 0, 0, 0, y+1)
-            
-            #define color_rgb_clipR      zebra_rgb_color(0, 1, 0, 0, y)
-            #define color_rgb_clipR_2    zebra_rgb_color(0, 1, 0, 0, y+1)
-            #define color_rgb_clipG      zebra_rgb_color(0, 0, 1, 0, y)
-            #define color_rgb_clipG_2    zebra_rgb_color(0, 0, 1, 0, y+1)
-            #define color_rgb_clipB      zebra_rgb_color(0, 0, 0, 1, y)
-            #define color_rgb_clipB_2    zebra_rgb_color(0, 0, 0, 1, y+1)
-            
-            #define color_rgb_clipRG     zebra_rgb_color(0, 1, 1, 0, y)
-            #define color_rgb_clipRG_2   zebra_rgb_color(0, 1, 1, 0, y+1)
-            #define color_rgb_clipGB     zebra_rgb_color(0, 0, 1, 1, y)
-            #define color_rgb_clipGB_2   zebra_rgb_color(0, 0, 1, 1, y+1)
-            #define color_rgb_clipRB     zebra_rgb_color(0, 1, 0, 1, y)
-            #define color_rgb_clipRB_2   zebra_rgb_color(0, 1, 0, 1, y+1)
-            
-            #define color_rgb_clipRGB    zebra_rgb_color(0, 1, 1, 1, y)
-            #define color_rgb_clipRGB_2  zebra_rgb_color(0, 1, 1, 1, y+1)
-
-            uint32_t * const v_row = (uint32_t*)( lvram        + BM2LV_R(y)    );  // 2 pixels
-            uint32_t * const b_row = (uint32_t*)( bvram        + BM_R(y)       );  // 4 pixels
-            uint32_t * const m_row = (uint32_t*)( bvram_mirror + BM_R(y)       );  // 4 pixels
+            int z = zebra_classify_rgb(*lvp, zlh, zll);
+            int under = z & ZEBRA_UNDER;
+            int clipR = z & ZEBRA_CLIP_R;
+            int clipG = z & ZEBRA_CLIP_G;
+            int clipB = z & ZEBRA_CLIP_B;
+            BP = MP = zebra_rgb_color(under, clipR, clipG, clipB, y);
+            BN = MN = zebra_rgb_color(under, clipR, clipG, clipB, y+1);
+        }
+        else // luma
+        {
+            int z = zebra_classify_luma(*lvp, zlh, zll);
+            if (unlikely(z == ZEBRA_OVER))
+            {
+                BP = MP = color_over;
+                BN = MN = color_over_2;
+            }
+            else if (unlikely(z == ZEBRA_UNDER))
+            {
+                BP = MP = color_under;
+                BN = MN = color_under_2;
+            }
+            else
+                BN = MN = BP = MP = 0;
+        }
             
-            uint32_t* lvp; // that's a moving pointer through lv vram
-            uint32_t* bp;  // through bmp vram
-            uint32_t* mp;  // through mirror
+        #undef MP
+        #undef BP
+        #undef BN
+        #undef MN
+    }
 
-            for (int x = os.x0; x < os.x_max; x += 4)
-            {
-                lvp = v_row + (BM2LV_X(x) >> 1);
-                bp = b_row + (x >> 2);
-                mp = m_row + (x >> 2);
-                #define BP (*bp)
-                #define MP (*mp)
-                #define BN (*(bp + BMPPITCH/4))
-                #define MN (*(mp + BMPPITCH/4))
-                if (BP != 0 && BP != MP) { little_cleanup(bp, mp); continue; }
-                if (BN != 0 && BN != MN) { little_cleanup(bp + (BMPPITCH >> 2), mp + (BMPPITCH >> 2)); continue; }
-                if ((MP & 0x80808080) || (MN & 0x80808080)) continue;
-                
-                if (zebra_colorspace == 1 && !EXT_MONITOR_RCA) // rgb
-                {
-                    int Y, R, G, B;
-                    //~ uyvy2yrgb(*lvp, &Y, &R, &G, &B);
-                    COMPUTE_UYVY2YRGB(*lvp, Y, R, G, B);
+    #undef color_over
+    #undef color_under
+    #undef color_over_2
+    #undef color_under_2
+}
 
-                    if(unlikely(Y < zll)) // underexposed
-                    {
-                        BP = MP = color_rgb_under;
-                        BN = MN = color_rgb_under_2;
-                    }
-                    else
-                    {
-                        //~ BP = MP = zebra_rgb_color(Y < zll, R > zlh, G > zlh, B > zlh, y);
-                        //~ BN = MN = zebra_rgb_color(Y < zll, R > zlh, G > zlh, B > zlh, y+1);
+static void draw_zebras( int Z )
+{
+    if (!zebra_begin(Z))
+    {
+        return;
+    }
 
-                        if (unlikely(R > zlr)) // R clipped
-                        {
-                            if (unlikely(G > zlg)) // RG clipped
-                            {
-                                if (B > zlb) // RGB clipped (all of them)
-                                {
-                                    BP = MP = color_rgb_clipRGB;
-                                    BN = MN = color_rgb_clipRGB_2;
-                                }
-                                else // only R and G clipped
-                                {
-                                    BP = MP = color_rgb_clipRG;
-                                    BN = MN = color_rgb_clipRG_2;
-                                }
-                            }
-                            else // R clipped, G not clipped
-                            {
-                                if (unlikely(B > zlb)) // only R and B clipped
-                                {
-                                    BP = MP = color_rgb_clipRB;
-                                    BN = MN = color_rgb_clipRB_2;
-                                }
-                                else // only R clipped
-                                {
-                                    BP = MP = color_rgb_clipR;
-                                    BN = MN = color_rgb_clipR_2;
-                                }
-                            }
-                        }
-                        else // R not clipped
-                        {
-                            if (unlikely(G > zlg)) // R not clipped, G clipped
-                            {
-                                if (unlikely(B > zlb)) // only G and B clipped
-                                {
-                                    BP = MP = color_rgb_clipGB;
-                                    BN = MN = color_rgb_clipGB_2;
-                                }
-                                else // only G clipped
-                                {
-                                    BP = MP = color_rgb_clipG;
-                                    BN = MN = color_rgb_clipG_2;
-                                }
-                            }
-                            else // R not clipped, G not clipped
-                            {
-                                if (unlikely(B > zlb)) // only B clipped
-                                {
-                                    BP = MP = color_rgb_clipB;
-                                    BN = MN = color_rgb_clipB_2;
-                                }
-                                else // nothing clipped
-                                {
-                                    BN = MN = BP = MP = 0;
-                                }
-                            }
-                        }
-                    }
-                }
-                else // luma
-                {
-                    int p0 = (*lvp) >> 8 & 0xFF;
-                    if (unlikely(p0 > zlh))
-                    {
-                        BP = MP = color_over;
-                        BN = MN = color_over_2;
-                    }
-                    else if (unlikely(p0 < zll))
-                    {
-                        BP = MP = color_under;
-                        BN = MN = color_under_2;
-                    }
-                    else
-                        BN = MN = BP = MP = 0;
-                }
-                    
-                #undef MP
-                #undef BP
-                #undef BN
-                #undef MN
-            }
-        }
+    // draw zebra in 16:9 frame
+    // y is in BM coords
+    int off = get_y_skip_offset_for_overlays();
+    for(int y = os.y0 + off; y < os.y_max - off; y += 2 )
+    {
+        zebra_draw_row(y);
     }
 }
 #endif
@@ -1436,79 +1382,8 @@ static inline int peak_d1xy(uint8_t* p8)
     return peak_scaling[MIN(e, 255)];
 }*/
 
-static inline int peak_d2xy_sharpen(uint8_t* p8)
-{
-    int orig = (int)(*p8);
-    int diff = orig * 4 - (int)(*(p8 + 2));
-    diff -= (int)(*(p8 - 2));
-    diff -= (int)(*(p8 + vram_lv.pitch));
-    diff -= (int)(*(p8 - vram_lv.pitch));
-    int v = orig + (diff << 2);
-    return COERCE(v, 0, 255);
-}
-
-static inline int FAST calc_peak(const uint8_t* p8, const int pitch)
-{
-    // approximate second derivative with a Laplacian kernel:
-    //     -1
-    //  -1  4 -1
-    //     -1
-    const int p8_xmin1 = (int)(*(p8 - 2));
-    const int p8_xplus1 = (int)(*(p8 + 2));
-    const int p8_ymin1 = (int)(*(p8 - pitch));
-    const int p8_yplus1 = (int)(*(p8 + pitch));
-
-    int result = ((int)(*p8) * 4);
-    result -= p8_xplus1 + p8_xmin1 + p8_yplus1 + p8_ymin1;
-
-    int e = ABS(result);
-
-    if (focus_peaking_filter_edges)
-    {
-        // filter out strong edges where first derivative is strong
-        // as these are usually false positives
-        int d1x = ABS(p8_xplus1 - p8_xmin1);
-        int d1y = ABS(p8_yplus1 - p8_ymin1);
-        int d1 = MAX(d1x, d1y);
-        e = MAX(e - ((d1 << focus_peaking_filter_edges) >> 2), 0) * 2;
-    }
-    return e;
-}
-
-static inline int FAST peak_d2xy(const uint8_t* p8)
-{
-    return calc_peak(p8, vram_lv.pitch);
-}
-
 #ifdef FEATURE_FOCUS_PEAK_DISP_FILTER
 
-//~ static inline int peak_blend_solid(uint32_t* s, int e, int thr) { return 0x4C7F4CD5; }
-//~ static inline int peak_blend_raw(uint32_t* s, int e) { return (e << 8) | (e << 24); }
-static inline int peak_blend_alpha(uint32_t* s, int e)
-{
-    // e=0 => cold (original color)
-    // e=255 => hot (red)
-    
-    uint8_t* s8u = (uint8_t*)s;
-    int8_t*  s8s = (int8_t*)s;
-
-    int y_cold = *(s8u+1);
-    int u_cold = *(s8s);
-    int v_cold = *(s8s+2);
-    
-    // red (255,0,0)
-    const int y_hot = 76;
-    const int u_hot = -43;
-    const int v_hot = 127;
-    
-    int er = 255-e;
-    int y = (y_cold * er + y_hot * e) >> 8;
-    int u = (u_cold * er + u_hot * e) >> 8;
-    int v = (v_cold * er + v_hot * e) >> 8;
-    
-    return UYVY_PACK(u,y,v,y);
-}
-
 static int peak_scaling[256];
 
 void FAST peak_disp_filter()
@@ -1538,107 +1413,18 @@ void FAST peak_disp_filter()
     static int thr_increment = 1;
     static int thr_delta = 0;
     
-    #define FOCUSED_THR 64
     // the percentage selected in menu represents how many pixels are considered in focus
     // let's say above some FOCUSED_THR
     // so, let's scale edge value so that e=thr maps to e=FOCUSED_THR
     for (int i = 0, i_fthr = 0; i < 255; i++, i_fthr += FOCUSED_THR)
         peak_scaling[i] = MIN(i_fthr / thr, 255);
     
-    int n_over = 0;
     int n_total = 720 * (os.y_max - os.y0) / 2;
-
-    #define PEAK_LOOP for (int i = 720 * (os.y0/2), max = 720 * (os.y_max/2); i < max; i++)
-    // generic loop:
-    //~ for (int i = 720 * (os.y0/2); i < 720 * (os.y_max/2); i++)
-    //~ {
-        //~ int e = peak_compute((uint8_t*)&src_buf[i] + 1);
-        //~ dst_buf[i] = peak_blend(&src_buf[i], e, blend_thr);
-        //~ if (unlikely(e > FOCUSED_THR)) n_over++;
-    //~ }
-    
-    if (focus_peaking_disp == 4) // raw
-    {
-        PEAK_LOOP
-        {
-            int e = peak_d2xy((uint8_t*)&src_buf[i] + 1);
-            e = MIN(e * 4, 255);
-            dst_buf[i] = (e << 8) | (e << 24);
-        }
-    }
-    
-    else if (focus_peaking_grayscale)
-    {
-        if (focus_peaking_disp == 1) 
-        {
-            PEAK_LOOP
-            {
-                int e = peak_d2xy((uint8_t*)&src_buf[i] + 1);
-                e = peak_scaling[MIN(e, 255)];
-                if (likely(e < FOCUSED_THR)) dst_buf[i] = src_buf[i] & 0xFF00FF00;
-                else 
-                { 
-                    dst_buf[i] = 0x4C7F4CD5; // red
-                    n_over++;
-                }
-            }
-        }
-        else if (focus_peaking_disp == 2) // alpha
-        {
-            PEAK_LOOP
-            {
-                int e = peak_d2xy((uint8_t*)&src_buf[i] + 1);
-                e = peak_scaling[MIN(e, 255)];
-                if (likely(e < 20)) dst_buf[i] = src_buf[i] & 0xFF00FF00;
-                else dst_buf[i] = peak_blend_alpha(&src_buf[i], e);
-                if (unlikely(e > FOCUSED_THR)) n_over++;
-            }
-        }
-        else if (focus_peaking_disp == 3) // sharp
-        {
-            PEAK_LOOP
-            {
-                int e = peak_d2xy_sharpen((uint8_t*)&src_buf[i] + 1);
-                dst_buf[i] = (src_buf[i] & 0xFF000000) | ((e & 0xFF) << 8);
-            }
-        }
-    }
-    else // color
-    {
-        if (focus_peaking_disp == 1) 
-        {
-            PEAK_LOOP
-            {
-                int e = peak_d2xy((uint8_t*)&src_buf[i] + 1);
-                e = peak_scaling[MIN(e, 255)];
-                if (likely(e < FOCUSED_THR)) dst_buf[i] = src_buf[i];
-                else 
-                { 
-                    dst_buf[i] = 0x4C7F4CD5; // red
-                    n_over++;
-                }
-            }
-        }
-        else if (focus_peaking_disp == 2) // alpha
-        {
-            PEAK_LOOP
-            {
-                int e = peak_d2xy((uint8_t*)&src_buf[i] + 1);
-                e = peak_scaling[MIN(e, 255)];
-                if (likely(e < 20)) dst_buf[i] = src_buf[i];
-                else dst_buf[i] = peak_blend_alpha(&src_buf[i], e);
-                if (unlikely(e > FOCUSED_THR)) n_over++;
-            }
-        }
-        else if (focus_peaking_disp == 3) // sharp
-        {
-            PEAK_LOOP
-            {
-                int e = peak_d2xy_sharpen((uint8_t*)&src_buf[i] + 1);
-                dst_buf[i] = (src_buf[i] & 0xFFFF00FF) | ((e & 0xFF) << 8);
-            }
-        }
-    }
+    int n_over = peak_disp_filter_range(
+        src_buf, dst_buf, 720 * (os.y0/2), 720 * (os.y_max/2), vram_lv.pitch,
+        focus_peaking_disp, focus_peaking_grayscale, focus_peaking_filter_edges,
+        peak_scaling
+    );
 
     // update threshold for next iteration
     if (1000 * n_over / n_total > (int)focus_peaking_pthr)
@@ -1713,6 +1499,322 @@ static void focus_found_pixel_playback(int x, int y, int e, int thr, uint8_t * c
 }
 #endif
 
+#ifdef FEATURE_FOCUS_PEAK
+static int peak_thr = 50;
+static int peak_thr_increment = 1;
+static int peak_prev_thr = 50;
+static int peak_thr_delta = 0;
+
+/* clear the previously drawn peaking dots
+ * returns the LiveView buffer to scan, 0 if none, or -1 on error */
+static int peak_begin( uint8_t * const bvram )
+{
+    if (unlikely(!dirty_pixels)) dirty_pixels = malloc(MAX_DIRTY_PIXELS * sizeof(int));
+    if (unlikely(!dirty_pixels)) return -1;
+    if (unlikely(!dirty_pixel_values)) dirty_pixel_values = malloc(MAX_DIRTY_PIXELS * sizeof(int));
+    if (unlikely(!dirty_pixel_values)) return -1;
+    int i;
+    for (i = 0; i < dirty_pixels_num; i++)
+    {
+        #define B1 *(uint16_t*)(bvram + dirty_pixels[i])
+        #define B2 *(uint16_t*)(bvram + dirty_pixels[i] + BMPPITCH)
+        #define M1 *(uint16_t*)(bvram_mirror + dirty_pixels[i])
+        #define M2 *(uint16_t*)(bvram_mirror + dirty_pixels[i] + BMPPITCH)
+
+        if (likely((B1 == 0 || B1 == M1)) && likely((B2 == 0 || B2 == M2)))
+        {
+            B1 = M1 = dirty_pixel_values[i] & 0xFFFF;
+            B2 = M2 = dirty_pixel_values[i] >> 16;
+        }
+        #undef B1
+        #undef B2
+        #undef M1
+        #undef M2
+    }
+    dirty_pixels_num = 0;
+    
+    zebra_update_lut();
+
+    return (uint32_t)CACHEABLE(YUV422_LV_BUFFER_DISPLAY_ADDR);
+}
+
+/** simple Laplacian filter
+ *     -1
+ *  -1  4 -1
+ *     -1
+ * 
+ * Big endian:
+ *  uyvy uyvy uyvy
+ *  uyvy uYvy uyvy
+ *  uyvy uyvy uyvy
+ *
+ * One BM row, sampled every x_step pixels; returns how many pixels are above threshold.
+ */
+static inline int FAST peak_scan_row( uint32_t vram, uint8_t * const bvram, int y, int xStart, int xEnd, int x_step, int playback )
+{
+    uint32_t row = vram + BM2LV_R(y);
+    int n_over = 0;
+
+    for (int x = xStart; x < xEnd; x += x_step)
+    {
+        const uint8_t* p8 = (uint8_t *)(row + bm_lv_x_cache[x - BMP_W_MINUS]);
+        int e = peak_d2xy(p8, vram_lv.pitch, focus_peaking_filter_edges);
+        
+        /* executed for 1% of pixels */
+        if (unlikely(e >= peak_thr))
+        {
+            n_over++;
+
+            if (unlikely(dirty_pixels_num >= MAX_DIRTY_PIXELS)) // threshold too low, abort
+                break;
+
+            if (playback)
+            {
+                if (playback == 1) focus_found_pixel_playback(x, y, e, peak_thr, bvram);
+            }
+            else
+            {
+                focus_found_pixel(x, y, e, peak_thr, bvram);
+            }
+        }
+    }
+
+    return n_over;
+}
+
+// returns how the focus peaking threshold changed
+static int peak_update_threshold( int n_over, int n_total )
+{
+    //~ bmp_printf(FONT_LARGE, 10, 50, "%d ", peak_thr);
+    
+    if (1000 * n_over / MAX(n_total, 1) > (int)focus_peaking_pthr)
+    {
+        if (peak_thr_delta > 0) peak_thr_increment++; else peak_thr_increment = 1;
+        peak_thr += peak_thr_increment;
+    }
+    else
+    {
+        if (peak_thr_delta < 0) peak_thr_increment++; else peak_thr_increment = 1;
+        peak_thr -= peak_thr_increment;
+    }
+
+    peak_thr_increment = COERCE(peak_thr_increment, -5, 5);
+    int thr_min = 15;
+    peak_thr = COERCE(peak_thr, thr_min, 255);
+
+    peak_thr_delta = peak_thr - peak_prev_thr;
+    peak_prev_thr = peak_thr;
+
+    return peak_thr_delta;
+}
+#endif
+
+/* Fused LiveView analysis
+ * 
+ * Zebras, focus peaking dots and the histogram/waveform/vectorscope
+ * are computed in a single top-to-bottom sweep over the LiveView buffer,
+ * so each LV row is used by all of them while it's still in the cache.
+ * 
+ * The histogram/waveform/vectorscope are requested by whoever draws them
+ * (hist_update), which does not wait for the result, but draws the last finished one.
+ * 
+ * If a sweep takes longer than the time budget, peaking and histogram sampling
+ * get sparser (up to 8x), so the overlays degrade instead of the LiveView refresh rate.
+ */
+static CONFIG_INT( "lv.analysis.stride", lv_analysis_stride, 1 );   /* histogram/waveform/scope: use every Nth pixel in each direction */
+static CONFIG_INT( "lv.analysis.budget", lv_analysis_budget, 15 );  /* milliseconds per sweep; 0 = no limit */
+
+static int lv_analysis_level = 0;       /* extra decimation when over budget: 2^level */
+static int lv_analysis_last_ms = 0;     /* when we did the last sweep */
+
+#if defined(FEATURE_HISTOGRAM) || defined(FEATURE_WAVEFORM) || defined(FEATURE_VECTORSCOPE)
+/* histogram/waveform/scope requests from hist_update to the sweep;
+ * every transition is done with interrupts disabled, as more than one task may draw the histogram */
+#define HIST_FUSED_IDLE      0
+#define HIST_FUSED_REQUESTED 1
+#define HIST_FUSED_SCANNING  2
+static volatile int hist_fused_state = HIST_FUSED_IDLE;
+static int hist_fused_request_ms = 0;           /* when the pending request was posted */
+
+/* called before drawing the histogram, waveform or vectorscope; does not wait for the LiveView task
+ * with the sweeps running, it asks for a new result and the caller draws the last finished one */
+static void hist_update()
+{
+    /* is the LiveView task running its sweeps? */
+    int fused = lv && get_ms_clock() - lv_analysis_last_ms < 500;
+
+    #ifdef FEATURE_RAW_HISTOGRAM
+    /* the raw histogram is slow; keep it out of the LiveView task */
+    if (RAW_HISTOGRAM_ENABLED && can_use_raw_overlays()) fused = 0;
+    #endif
+
+    uint32_t old = cli();
+    int state = hist_fused_state;
+    int build = 0;
+
+    if (state == HIST_FUSED_SCANNING)
+    {
+        /* a sweep is filling the buffers right now; draw what's there, it will be complete next time */
+    }
+    else if (fused && state == HIST_FUSED_IDLE)
+    {
+        hist_fused_state = HIST_FUSED_REQUESTED;
+        hist_fused_request_ms = get_ms_clock();
+    }
+    else if (!fused || get_ms_clock() - hist_fused_request_ms > 200)
+    {
+        /* no sweeps, or the request was not picked up in time? compute it here */
+        hist_fused_state = HIST_FUSED_IDLE;
+        build = 1;
+    }
+    sei(old);
+
+    if (build)
+    {
+        hist_build();
+    }
+}
+#endif
+
+static int FAST lv_analysis_sweep( int zebras, int peak, uint8_t * const bvram )
+{
+    /* each consumer walks its own rows; the sweep visits them in order */
+    const int big = 1 << 30;
+    int z_y = big, z_end = 0;
+    int p_y = big, p_end = 0;
+    int h_y = big, h_end = 0;
+    
+    #ifdef FEATURE_ZEBRA
+    if (zebras)
+    {
+        int off = get_y_skip_offset_for_overlays();
+        z_y = os.y0 + off;
+        z_end = os.y_max - off;
+    }
+    #endif
+
+    #ifdef FEATURE_FOCUS_PEAK
+    uint32_t vram = 0;
+    int xStart = os.x0 + 8;
+    int xEnd = os.x_max - 8;
+    int n_over = 0;
+    int n_total = 0;
+
+    if (peak)
+    {
+        int r = peak_begin(bvram);
+        if (r < 0) return -1;
+        vram = r;
+    }
+
+    if (vram)
+    {
+        int off = get_y_skip_offset_for_overlays();
+        p_y = os.y0 + off + 8;
+        p_end = os.y_max - off - 8;
+
+        #ifdef FEATURE_ANAMORPHIC_PREVIEW
+        p_y   = anamorphic_squeeze_bmp_y(p_y);
+        p_end = anamorphic_squeeze_bmp_y(p_end);
+        #endif
+    }
+    #endif
+
+    #if defined(FEATURE_HISTOGRAM) || defined(FEATURE_WAVEFORM) || defined(FEATURE_VECTORSCOPE)
+    uint32_t * hist_buf = 0;
+    int h_step = 2 * MAX(lv_analysis_stride, 1) << lv_analysis_level;
+    uint32_t old = cli();
+    int hist_requested = (hist_fused_state == HIST_FUSED_REQUESTED);
+    if (hist_requested) hist_fused_state = HIST_FUSED_SCANNING;
+    sei(old);
+
+    if (hist_requested)
+    {
+        hist_buf = (uint32_t*) get_yuv422_vram()->vram;
+        if (hist_buf && hist_begin())
+        {
+            int off = get_y_skip_offset_for_histogram();
+            h_y = os.y0 + off;
+            h_end = os.y_max - off;
+        }
+    }
+    #endif
+
+    lv_analysis_last_ms = get_ms_clock();
+
+    uint64_t t0 = get_us_clock();
+
+    int y_start = MIN(MIN(z_y, p_y), h_y);
+    int y_end = MAX(MAX(z_end, p_end), h_end);
+
+    for (int y = y_start; y < y_end; y++)
+    {
+        #ifdef FEATURE_ZEBRA
+        if (y == z_y && y < z_end)
+        {
+            zebra_draw_row(y);
+            z_y += 2;
+        }
+        #endif
+
+        #ifdef FEATURE_FOCUS_PEAK
+        if (y == p_y && y < p_end)
+        {
+            n_over += peak_scan_row(vram, bvram, y, xStart, xEnd, 2, 0);
+            n_total += (xEnd - xStart) / 2;
+            p_y += 3 << lv_analysis_level;
+        }
+        #endif
+
+        #if defined(FEATURE_HISTOGRAM) || defined(FEATURE_WAVEFORM) || defined(FEATURE_VECTORSCOPE)
+        if (y == h_y && y < h_end)
+        {
+            hist_scan_row(hist_buf, y, h_step);
+            h_y += h_step;
+        }
+        #endif
+    }
+
+    int elapsed_ms = (get_us_clock() - t0) / 1000;
+
+    #if defined(FEATURE_HISTOGRAM) || defined(FEATURE_WAVEFORM) || defined(FEATURE_VECTORSCOPE)
+    if (hist_requested)
+    {
+        old = cli();
+        hist_fused_state = HIST_FUSED_IDLE;
+        sei(old);
+    }
+    #endif
+
+    /* adjust the decimation for the next sweeps
+     * only from sweeps that included the decimated overlays (peaking, histogram)
+     * each level halves their cost, so there's enough hysteresis */
+    if (!lv_analysis_budget)
+    {
+        lv_analysis_level = 0;
+    }
+    else if (h_end || p_end)
+    {
+        if (elapsed_ms > lv_analysis_budget)
+        {
+            lv_analysis_level = MIN(lv_analysis_level + 1, 3);
+        }
+        else if (elapsed_ms < lv_analysis_budget / 2)
+        {
+            lv_analysis_level = MAX(lv_analysis_level - 1, 0);
+        }
+    }
+
+    #ifdef FEATURE_FOCUS_PEAK
+    if (vram)
+    {
+        return peak_update_threshold(n_over, n_total);
+    }
+    #endif
+
+    return 0;
+}
+
 // returns how the focus peaking threshold changed
 static int FAST
 draw_zebra_and_focus( int Z, int F )
@@ -1724,56 +1826,49 @@ draw_zebra_and_focus( int Z, int F )
     if (unlikely(!bvram_mirror)) return 0;
     
     #ifdef FEATURE_ZEBRA
-    draw_zebras(Z);
+    int zebras = zebra_begin(Z);
+    #else
+    int zebras = 0;
     #endif
     
     #ifdef FEATURE_FOCUS_PEAK
+    int peak = F && focus_peaking;
+
     if (focus_peaking && focus_peaking_disp && !EXT_MONITOR_CONNECTED)
     {
-        if (lv) 
-        {
-            return 0; // it's drawn from display filters routine
-        }
-        else  // display filters are not called in playback
-        {
-            if (F != 1) return 0; // problem: we need to update the threshold somehow
-            peak_disp_filter(); return 0; 
-        }
+        // in LiveView, it's drawn from display filters routine
+        // display filters are not called in playback
+        // problem: we need to update the threshold somehow
+        if (!lv && F == 1) peak_disp_filter();
+        peak = 0;
     }
+    #else
+    int peak = 0;
+    #endif
 
-    static int thr = 50;
-    static int thr_increment = 1;
-    static int prev_thr = 50;
-    static int thr_delta = 0;
+    if (lv) // fast, realtime
+    {
+        return lv_analysis_sweep(zebras, peak, bvram);
+    }
 
-    if (F && focus_peaking)
+    // playback - can be slower and more accurate
+    #ifdef FEATURE_ZEBRA
+    if (zebras)
     {
-        // clear previously written pixels
-        if (unlikely(!dirty_pixels)) dirty_pixels = malloc(MAX_DIRTY_PIXELS * sizeof(int));
-        if (unlikely(!dirty_pixels)) return -1;
-        if (unlikely(!dirty_pixel_values)) dirty_pixel_values = malloc(MAX_DIRTY_PIXELS * sizeof(int));
-        if (unlikely(!dirty_pixel_values)) return -1;
-        int i;
-        for (i = 0; i < dirty_pixels_num; i++)
+        int off = get_y_skip_offset_for_overlays();
+        for(int y = os.y0 + off; y < os.y_max - off; y += 2 )
         {
-            #define B1 *(uint16_t*)(bvram + dirty_pixels[i])
-            #define B2 *(uint16_t*)(bvram + dirty_pixels[i] + BMPPITCH)
-            #define M1 *(uint16_t*)(bvram_mirror + dirty_pixels[i])
-            #define M2 *(uint16_t*)(bvram_mirror + dirty_pixels[i] + BMPPITCH)
-
-            if (likely((B1 == 0 || B1 == M1)) && likely((B2 == 0 || B2 == M2)))
-            {
-                B1 = M1 = dirty_pixel_values[i] & 0xFFFF;
-                B2 = M2 = dirty_pixel_values[i] >> 16;
-            }
-            #undef B1
-            #undef B2
-            #undef M1
-            #undef M2
+            zebra_draw_row(y);
         }
-        dirty_pixels_num = 0;
-        
-        uint32_t vram = (uint32_t)CACHEABLE(YUV422_LV_BUFFER_DISPLAY_ADDR);
+    }
+    #endif
+
+    #ifdef FEATURE_FOCUS_PEAK
+    if (peak)
+    {
+        int r = peak_begin(bvram);
+        if (r < 0) return -1;
+        uint32_t vram = r;
         if (!vram) return 0;
         
         int off = get_y_skip_offset_for_overlays();
@@ -1788,97 +1883,14 @@ draw_zebra_and_focus( int Z, int F )
         yEnd   = anamorphic_squeeze_bmp_y(yEnd);
         #endif
 
-        const uint8_t* p8; // that's a moving pointer
-        
-        zebra_update_lut();
-
-        /** simple Laplacian filter
-         *     -1
-         *  -1  4 -1
-         *     -1
-         * 
-         * Big endian:
-         *  uyvy uyvy uyvy
-         *  uyvy uYvy uyvy
-         *  uyvy uyvy uyvy
-         */
-
-        int n_total = 0;
-        if (lv) // fast, realtime
+        int n_total = ((yEnd - yStart) * (xEnd - xStart));
+        for(int y = yStart; y < yEnd; y ++)
         {
-            n_total = ((yEnd - yStart) * (xEnd - xStart)) / 6;
-            for(int y = yStart; y < yEnd; y += 3)
-            {
-                uint32_t row = vram + BM2LV_R(y);
-                
-                for (int x = xStart; x < xEnd; x += 2)
-                {
-                    p8 = (uint8_t *)(row + bm_lv_x_cache[x - BMP_W_MINUS]);
-                     
-                    int e = peak_d2xy(p8);
-                    
-                    /* executed for 1% of pixels */
-                    if (unlikely(e >= thr))
-                    {
-                        n_over++;
-                        if (unlikely(dirty_pixels_num >= MAX_DIRTY_PIXELS)) break; // threshold too low, abort
-                        focus_found_pixel(x, y, e, thr, bvram);
-                    }
-                }
-            }
+            n_over += peak_scan_row(vram, bvram, y, xStart, xEnd, 1, F);
         }
-        else // playback - can be slower and more accurate
-        {
-            n_total = ((yEnd - yStart) * (xEnd - xStart));
-            for(int y = yStart; y < yEnd; y ++)
-            {
-                uint32_t row = vram + BM2LV_R(y);
-                
-                for (int x = xStart; x < xEnd; x ++)
-                {
-                    p8 = (uint8_t *)(row + bm_lv_x_cache[x - BMP_W_MINUS]);
-                    int e = peak_d2xy(p8);
-                    
-                    /* executed for 1% of pixels */
-                    if (unlikely(e >= thr))
-                    {
-                        n_over++;
 
-                        if (unlikely(dirty_pixels_num >= MAX_DIRTY_PIXELS)) // threshold too low, abort
-                            break;
-
-                        if (F==1) focus_found_pixel_playback(x, y, e, thr, bvram);
-                    }
-                }
-            }
-        }
-
-        //~ bmp_printf(FONT_LARGE, 10, 50, "%d ", thr);
-        
-        if (1000 * n_over / n_total > (int)focus_peaking_pthr)
-        {
-            if (thr_delta > 0) thr_increment++; else thr_increment = 1;
-            thr += thr_increment;
-        }
-        else
-        {
-            if (thr_delta < 0) thr_increment++; else thr_increment = 1;
-            thr -= thr_increment;
-        }
-
-        thr_increment = COERCE(thr_increment, -5, 5);
-        int thr_min = 15;
-        thr = COERCE(thr, thr_min, 255);
-
-
-        thr_delta = thr - prev_thr;
-        prev_thr = thr;
-
-        if (n_over > MAX_DIRTY_PIXELS)
-            return thr_delta;
+        return peak_update_threshold(n_over, n_total);
     }
-
-    return thr_delta;
     #endif
     
     return 0;
@@ -2051,6 +2063,14 @@ static MENU_UPDATE_FUNC(waveform_print)
 }
 #endif
 
+#ifdef FEATURE_FOCUS_PEAK
+static MENU_UPDATE_FUNC(lv_analysis_budget_display)
+{
+    if (!lv_analysis_budget)
+        MENU_SET_VALUE("OFF");
+}
+#endif
+
 #ifdef FEATURE_GLOBAL_DRAW
 static MENU_UPDATE_FUNC(global_draw_display)
 {
@@ -2847,6 +2867,15 @@ struct menu_entry zebra_menus[] = {
                 .max = 1,
                 .help = "Display LiveView image in grayscale.",
             },
+            {
+                .name = "Time budget",
+                .priv = &lv_analysis_budget,
+                .update = lv_analysis_budget_display,
+                .max = 50,
+                .unit = UNIT_TIME_MS,
+                .help  = "Time per LiveView frame for zebras, peaking and histogram.",
+                .help2 = "Over budget, peaking and histogram use fewer pixels.",
+            },
             MENU_EOL
         },
     },
@@ -3071,6 +3100,15 @@ struct menu_entry zebra_menus[] = {
                 .help = "Display warning dots when one color channel is clipped.",
                 .help2 = "Numbers represent the percentage of pixels clipped.",
             },
+            {
+                .name = "Sampling step",
+                .priv = &lv_analysis_stride,
+                .min = 1,
+                .max = 8,
+                .unit = UNIT_DEC,
+                .help  = "LiveView: use every Nth pixel for histogram/waveform/scope.",
+                .help2 = "Higher values are faster, but show less detail.",
+            },
             MENU_EOL
         },
     },
@@ -3752,7 +3790,7 @@ void draw_histogram_and_waveform(int allow_play)
 #endif
         )
     {
-        hist_build(); /* also updates waveform and vectorscope */
+        hist_update(); /* also updates waveform and vectorscope */
     }
 #endif
     
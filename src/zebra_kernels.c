@@ -0,0 +1,162 @@
+/**
+ * LiveView overlay kernels - frame loops (see zebra_kernels.h)
+ * No camera dependencies here; also built on the PC by contrib/zebra_bench.
+ **/
+
+#include "zebra_kernels.h"
+
+#ifndef FAST
+#define FAST __attribute__((optimize("-O3")))
+#endif
+
+int FAST peak_disp_filter_range(
+    const uint32_t * src_buf, uint32_t * dst_buf, int start, int end, int pitch,
+    int mode, int grayscale, int filter_edges, const int * peak_scaling)
+{
+    int n_over = 0;
+
+    #define PEAK_LOOP for (int i = start; i < end; i++)
+    // generic loop:
+    //~ PEAK_LOOP
+    //~ {
+        //~ int e = peak_compute((uint8_t*)&src_buf[i] + 1);
+        //~ dst_buf[i] = peak_blend(&src_buf[i], e, blend_thr);
+        //~ if (unlikely(e > FOCUSED_THR)) n_over++;
+    //~ }
+    #define PEAK_D2XY(i) peak_d2xy((const uint8_t*)&src_buf[i] + 1, pitch, filter_edges)
+    #define PEAK_SHARPEN(i) peak_d2xy_sharpen((const uint8_t*)&src_buf[i] + 1, pitch)
+
+    if (mode == PEAK_DISP_RAW)
+    {
+        PEAK_LOOP
+        {
+            int e = PEAK_D2XY(i);
+            e = MIN(e * 4, 255);
+            dst_buf[i] = (e << 8) | (e << 24);
+        }
+    }
+
+    else if (grayscale)
+    {
+        if (mode == PEAK_DISP_BLEND_SOLID)
+        {
+            PEAK_LOOP
+            {
+                int e = PEAK_D2XY(i);
+                e = peak_scaling[MIN(e, 255)];
+                if (likely(e < FOCUSED_THR)) dst_buf[i] = src_buf[i] & 0xFF00FF00;
+                else
+                {
+                    dst_buf[i] = 0x4C7F4CD5; // red
+                    n_over++;
+                }
+            }
+        }
+        else if (mode == PEAK_DISP_BLEND_ALPHA)
+        {
+            PEAK_LOOP
+            {
+                int e = PEAK_D2XY(i);
+                e = peak_scaling[MIN(e, 255)];
+                if (likely(e < 20)) dst_buf[i] = src_buf[i] & 0xFF00FF00;
+                else dst_buf[i] = peak_blend_alpha(&src_buf[i], e);
+                if (unlikely(e > FOCUSED_THR)) n_over++;
+            }
+        }
+        else if (mode == PEAK_DISP_SHARPEN)
+        {
+            PEAK_LOOP
+            {
+                int e = PEAK_SHARPEN(i);
+                dst_buf[i] = (src_buf[i] & 0xFF000000) | ((e & 0xFF) << 8);
+            }
+        }
+    }
+    else // color
+    {
+        if (mode == PEAK_DISP_BLEND_SOLID)
+        {
+            PEAK_LOOP
+            {
+                int e = PEAK_D2XY(i);
+                e = peak_scaling[MIN(e, 255)];
+                if (likely(e < FOCUSED_THR)) dst_buf[i] = src_buf[i];
+                else
+                {
+                    dst_buf[i] = 0x4C7F4CD5; // red
+                    n_over++;
+                }
+            }
+        }
+        else if (mode == PEAK_DISP_BLEND_ALPHA)
+        {
+            PEAK_LOOP
+            {
+                int e = PEAK_D2XY(i);
+                e = peak_scaling[MIN(e, 255)];
+                if (likely(e < 20)) dst_buf[i] = src_buf[i];
+                else dst_buf[i] = peak_blend_alpha(&src_buf[i], e);
+                if (unlikely(e > FOCUSED_THR)) n_over++;
+            }
+        }
+        else if (mode == PEAK_DISP_SHARPEN)
+        {
+            PEAK_LOOP
+            {
+                int e = PEAK_SHARPEN(i);
+                dst_buf[i] = (src_buf[i] & 0xFFFF00FF) | ((e & 0xFF) << 8);
+            }
+        }
+    }
+
+    #undef PEAK_LOOP
+    #undef PEAK_D2XY
+    #undef PEAK_SHARPEN
+
+    return n_over;
+}
+
+void FAST zebra_classify_line(const uint32_t * uyvy, int n, int rgb, int zlh, int zll, uint8_t * out)
+{
+    if (rgb)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            out[i] = zebra_classify_rgb(uyvy[i], zlh, zll);
+        }
+    }
+    else
+    {
+        for (int i = 0; i < n; i++)
+        {
+            out[i] = zebra_classify_luma(uyvy[i], zlh, zll);
+        }
+    }
+}
+
+void FAST hist_waveform_add_line(
+    struct Histogram * histogram,
+    uint8_t * waveform, int waveform_width, int waveform_height,
+    const uint32_t * uyvy, int n, int skip_mz)
+{
+    for (int i = 0; i < n; i++)
+    {
+        uint32_t pixel = uyvy[i];
+
+        // ignore magic zoom borders
+        if (skip_mz && (pixel == MZ_WHITE || pixel == MZ_BLACK || pixel == MZ_GREEN))
+            continue;
+
+        int Y = UYVY_GET_AVG_Y(pixel);
+
+        if (histogram)
+        {
+            hist_add_pixel(histogram, pixel, Y);
+        }
+
+        if (waveform)
+        {
+            waveform_add_pixel(waveform, waveform_width, waveform_height, i * waveform_width / n, Y);
+        }
+    }
+}
@@ -0,0 +1,213 @@
+/**
+ * LiveView overlay kernels: zebras, focus peaking, histogram and waveform.
+ *
+ * They work on plain YUV422 (UYVY) buffers and have no camera dependencies,
+ * so the same code can be built and benchmarked on the PC (contrib/zebra_bench).
+ *
+ * Per-pixel kernels are inline; the frame loops are in zebra_kernels.c.
+ **/
+
+#ifndef _zebra_kernels_h_
+#define _zebra_kernels_h_
+
+#include <stdint.h>
+#include "imath.h"
+#include "imgconv.h"
+
+#ifndef unlikely
+#define likely(x)       __builtin_expect(!!(x), 1)
+#define unlikely(x)     __builtin_expect(!!(x), 0)
+#endif
+
+// those colors will not be considered for histogram (so they should be very unlikely to appear in real situations)
+#define MZ_WHITE 0xFE12FE34
+#define MZ_BLACK 0x00120034
+#define MZ_GREEN 0xB68DB69E
+
+#define HIST_WIDTH          128
+
+struct Histogram
+{
+/** Store the histogram data for each of the "HIST_WIDTH" bins */
+    uint32_t hist[HIST_WIDTH];
+    uint32_t hist_r[HIST_WIDTH];
+    uint32_t hist_g[HIST_WIDTH];
+    uint32_t hist_b[HIST_WIDTH];
+
+    /** Maximum value in the histogram so that at least one entry fills
+     * the box */
+    uint32_t max;
+
+    /** total number of pixels analyzed by histogram */
+    uint32_t total_px;
+
+    int is_rgb;
+    int is_raw;
+};
+
+/** Zebras: what to show for one UYVY pixel pair */
+#define ZEBRA_UNDER     1
+#define ZEBRA_OVER      2   /* luma zebras */
+#define ZEBRA_CLIP_R    4   /* RGB zebras */
+#define ZEBRA_CLIP_G    8
+#define ZEBRA_CLIP_B    16
+
+/* luma zebras look at the first Y only */
+static inline int zebra_classify_luma(uint32_t uyvy, int zlh, int zll)
+{
+    int p0 = uyvy >> 8 & 0xFF;
+    if (unlikely(p0 > zlh)) return ZEBRA_OVER;
+    if (unlikely(p0 < zll)) return ZEBRA_UNDER;
+    return 0;
+}
+
+static inline int zebra_classify_rgb(uint32_t uyvy, int zlh, int zll)
+{
+    int Y, R, G, B;
+    COMPUTE_UYVY2YRGB(uyvy, Y, R, G, B);
+
+    if (unlikely(Y < zll))
+    {
+        return ZEBRA_UNDER;
+    }
+
+    return
+        (R > zlh ? ZEBRA_CLIP_R : 0) |
+        (G > zlh ? ZEBRA_CLIP_G : 0) |
+        (B > zlh ? ZEBRA_CLIP_B : 0) ;
+}
+
+/** Focus peaking: approximate second derivative with a Laplacian kernel:
+ *     -1
+ *  -1  4 -1
+ *     -1
+ *
+ * p8 points to a luma byte, pitch is in bytes.
+ * filter_edges > 0 filters out strong edges where first derivative is strong,
+ * as these are usually false positives
+ */
+static inline int peak_d2xy(const uint8_t* p8, const int pitch, const int filter_edges)
+{
+    const int p8_xmin1 = (int)(*(p8 - 2));
+    const int p8_xplus1 = (int)(*(p8 + 2));
+    const int p8_ymin1 = (int)(*(p8 - pitch));
+    const int p8_yplus1 = (int)(*(p8 + pitch));
+
+    int result = ((int)(*p8) * 4);
+    result -= p8_xplus1 + p8_xmin1 + p8_yplus1 + p8_ymin1;
+
+    int e = ABS(result);
+
+    if (filter_edges)
+    {
+        int d1x = ABS(p8_xplus1 - p8_xmin1);
+        int d1y = ABS(p8_yplus1 - p8_ymin1);
+        int d1 = MAX(d1x, d1y);
+        e = MAX(e - ((d1 << filter_edges) >> 2), 0) * 2;
+    }
+    return e;
+}
+
+static inline int peak_d2xy_sharpen(const uint8_t* p8, const int pitch)
+{
+    int orig = (int)(*p8);
+    int diff = orig * 4 - (int)(*(p8 + 2));
+    diff -= (int)(*(p8 - 2));
+    diff -= (int)(*(p8 + pitch));
+    diff -= (int)(*(p8 - pitch));
+    int v = orig + (diff << 2);
+    return COERCE(v, 0, 255);
+}
+
+static inline uint32_t peak_blend_alpha(const uint32_t* s, int e)
+{
+    // e=0 => cold (original color)
+    // e=255 => hot (red)
+
+    const uint8_t* s8u = (const uint8_t*)s;
+    const int8_t*  s8s = (const int8_t*)s;
+
+    int y_cold = *(s8u+1);
+    int u_cold = *(s8s);
+    int v_cold = *(s8s+2);
+
+    // red (255,0,0)
+    const int y_hot = 76;
+    const int u_hot = -43;
+    const int v_hot = 127;
+
+    int er = 255-e;
+    int y = (y_cold * er + y_hot * e) >> 8;
+    int u = (u_cold * er + u_hot * e) >> 8;
+    int v = (v_cold * er + v_hot * e) >> 8;
+
+    return UYVY_PACK(u,y,v,y);
+}
+
+/** Histogram: add one UYVY pixel pair, with Y = UYVY_GET_AVG_Y */
+static inline void hist_add_pixel(struct Histogram * histogram, uint32_t pixel, int Y)
+{
+    if (histogram->is_rgb)
+    {
+        int R, G, B;
+        COMPUTE_UYVY2YRGB(pixel, Y, R, G, B);
+        // YRGB range: 0-255
+        uint32_t R_level = (R * HIST_WIDTH) >> 8;
+        uint32_t G_level = (G * HIST_WIDTH) >> 8;
+        uint32_t B_level = (B * HIST_WIDTH) >> 8;
+
+        histogram->hist_r[R_level & (HIST_WIDTH-1)]++;
+        histogram->hist_g[G_level & (HIST_WIDTH-1)]++;
+        histogram->hist_b[B_level & (HIST_WIDTH-1)]++;
+    }
+
+    /* luma component is always computed, since we need histogram->max */
+    /* and it's much less expensive than RGB anyway */
+    histogram->total_px++;
+    uint32_t hist_level = (Y * HIST_WIDTH) >> 8;
+
+    // Ignore the 0 bin.  It generates too much noise
+    unsigned count = ++ (histogram->hist[ hist_level & (HIST_WIDTH-1)]);
+    if( hist_level && count > histogram->max )
+        histogram->max = count;
+}
+
+/** Waveform: width x height bins with 128 levels; bin_x is the column */
+static inline void waveform_add_pixel(uint8_t * waveform, int width, int height, int bin_x, int Y)
+{
+    int bin_y = (Y * height) >> 8;
+    uint8_t* w = &waveform[COERCE(bin_x, 0, width-1) + COERCE(bin_y, 0, height-1) * width];
+    if ((*w) < 250) (*w)++;
+}
+
+/** Frame loops (zebra_kernels.c) **/
+
+/* focus peaking display filter modes */
+#define PEAK_DISP_BLEND_SOLID   1
+#define PEAK_DISP_BLEND_ALPHA   2
+#define PEAK_DISP_SHARPEN       3
+#define PEAK_DISP_RAW           4
+
+/* pixels with peak_scaling[e] above this are considered in focus */
+#define FOCUSED_THR 64
+
+/* Focus peaking as a display filter, from src to dst, on UYVY pairs [start, end).
+ * pitch is in bytes; peak_scaling maps edge values to 0-255.
+ * Returns the number of pixel pairs considered in focus. */
+int peak_disp_filter_range(
+    const uint32_t * src_buf, uint32_t * dst_buf, int start, int end, int pitch,
+    int mode, int grayscale, int filter_edges, const int * peak_scaling
+);
+
+/* Zebras on one line of n UYVY pairs: writes the ZEBRA_* flags for each pair. */
+void zebra_classify_line(const uint32_t * uyvy, int n, int rgb, int zlh, int zll, uint8_t * out);
+
+/* Histogram and/or waveform from one line of n UYVY pairs (either pointer may be NULL).
+ * Magic zoom borders are skipped when skip_mz is set, as in hist_build. */
+void hist_waveform_add_line(
+    struct Histogram * histogram,
+    uint8_t * waveform, int waveform_width, int waveform_height,
+    const uint32_t * uyvy, int n, int skip_mz
+);
+
+#endif
@@ -73,6 +73,12 @@ LIBTCCAPI int tcc_add_library(TCCState *s, const char *libraryname);
 /* add a symbol to the compiled program */
 LIBTCCAPI int tcc_add_symbol(TCCState *s, const char *name, const void *val);
 
+/* add a whole symbol table prepared at build time (ELF symbols, string table
+   and hash table in the .hashtab layout). syms[0] is the null symbol. */
+LIBTCCAPI int tcc_add_symbol_table(TCCState *s, const void *syms, int nb_syms,
+                                   const char *strtab, unsigned long strtab_size,
+                                   const int *hash);
+
 /* output an executable, library or object file. DO NOT call
    tcc_relocate() before. */
 LIBTCCAPI int tcc_output_file(TCCState *s, const char *filename);
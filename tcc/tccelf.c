@@ -178,6 +178,51 @@ LIBTCCAPI void *tcc_get_symbol(TCCState *s, const char *name)
     return (void*)(uintptr_t)get_elf_sym_addr(s, name, 0);
 }
 
+/* add a prebuilt symbol table in one go, instead of one tcc_add_symbol per symbol.
+   if our symbol table is still empty, the symbols and the hash table are copied
+   as they are, otherwise they are added one by one with the usual checks. */
+LIBTCCAPI int tcc_add_symbol_table(TCCState *s, const void *syms, int nb_syms,
+                                   const char *strtab, unsigned long strtab_size,
+                                   const int *hash)
+{
+    Section *symtab = s->symtab;
+    Section *hs = symtab->hash;
+    const ElfW(Sym) *src = (const ElfW(Sym) *)syms;
+    ElfW(Sym) *dst;
+    unsigned long str_base;
+    int i;
+
+    if (nb_syms < 1 || (strtab_size && strtab[strtab_size - 1]))
+        return -1;
+
+    if (!hash || hash[0] <= 0 || hash[1] != nb_syms ||
+        symtab->data_offset != sizeof(ElfW(Sym)) || hs->nb_hashed_syms) {
+        for(i = 1; i < nb_syms; i++) {
+            if (src[i].st_name >= strtab_size)
+                return -1;
+            add_elf_sym(symtab, src[i].st_value, src[i].st_size,
+                        src[i].st_info, src[i].st_other, src[i].st_shndx,
+                        strtab + src[i].st_name);
+        }
+        return 0;
+    }
+
+    str_base = symtab->link->data_offset;
+    memcpy(section_ptr_add(symtab->link, strtab_size), strtab, strtab_size);
+
+    dst = section_ptr_add(symtab, (nb_syms - 1) * sizeof(ElfW(Sym)));
+    memcpy(dst, src + 1, (nb_syms - 1) * sizeof(ElfW(Sym)));
+    for(i = 0; i < nb_syms - 1; i++)
+        dst[i].st_name += str_base;
+
+    /* same layout as rebuild_hash(): nbuckets, nsyms, buckets, chains */
+    hs->data_offset = 0;
+    memcpy(section_ptr_add(hs, (2 + hash[0] + nb_syms) * sizeof(int)),
+           hash, (2 + hash[0] + nb_syms) * sizeof(int));
+    hs->nb_hashed_syms = nb_syms - 1;
+    return 0;
+}
+
 #ifdef TCC_IS_NATIVE
 /* return elf symbol value or error */
 ST_FUNC void* tcc_get_symbol_err(TCCState *s, const char *name)